@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <errno.h>
 #include <unistd.h>
@@ -39,6 +40,9 @@
 #include "chan_capi_supplementary.h"
 #include "chan_capi_chat.h"
 #include "chan_capi_command.h"
+#include "chan_capi_msn.h"
+#include "chan_capi_admission.h"
+#include "chan_capi_timeline.h"
 #ifdef CC_AST_HAS_VERSION_1_8
 #include <asterisk/callerid.h>
 #endif
@@ -58,6 +62,8 @@ struct _diva_streaming_vector* vind;
 #include "chan_capi_cli.h"
 #include "chan_capi_ami.h"
 #include "chan_capi_devstate.h"
+#include "chan_capi_faxio.h"
+#include "chan_capi_announce.h"
 #include "divaverbose.h"
 
 /* #define CC_VERSION "x.y.z" */
@@ -181,6 +187,12 @@ struct capi_pvt *capi_iflist = NULL;
 
 static struct cc_capi_controller *capi_controllers[CAPI_MAX_CONTROLLERS + 1];
 static int capi_num_controllers = 0;
+/*
+	Controllers with interface (ifc) or hardware (hw) in error state,
+	updated on state change and read without locks by call routing
+	*/
+static unsigned long long capi_controllers_ifc_unavailable;
+static unsigned long long capi_controllers_hw_unavailable;
 static unsigned int capi_counter = 0;
 
 static struct ast_channel *chan_for_task;
@@ -219,10 +231,21 @@ static struct ast_jb_conf global_jbconf;
 static char global_mohinterpret[MAX_MUSICCLASS] = "default";
 #endif
 
+/*
+ * Interface pools. The free lists are changed without iflock
+ * on interface cleanup, poollock is not held while taking other locks.
+ */
+AST_MUTEX_DEFINE_STATIC(poollock);
+#define CC_POOL_NAME_HASH_SIZE 64
+static struct capi_pvt_pool *capi_pools_by_name[CC_POOL_NAME_HASH_SIZE];
+static unsigned int capi_pools;
+/* controllers with interfaces in call group */
+static unsigned long long capi_group_controllers[sizeof(ast_group_t) * 8];
+#define CC_POOL_PVT(__x__) ((struct capi_pvt *)((char *)(__x__) - offsetof(struct capi_pvt, pool_link)))
+
 /* local prototypes */
-#define CC_B_INTERFACE_NOT_FREE(__x__) (((__x__)->used) || ((__x__)->reserved) || \
-	((__x__)->channeltype != CAPI_CHANNELTYPE_B) || \
-	(capi_controllers[(__x__)->controller]->nfreebchannels < capi_controllers[(__x__)->controller]->nfreebchannelsHardThr))
+#define CC_CONTROLLER_BUSY(__x__) \
+	(capi_controllers[(__x__)]->nfreebchannels < capi_controllers[(__x__)]->nfreebchannelsHardThr)
 
 /*!
  * \brief Acquire lock in correct order. Called if locking from non
@@ -246,6 +269,7 @@ static void pbx_capi_add_diva_protocol_independent_extension(
 #ifdef DIVA_STATUS
 static void pbx_capi_interface_status_changed(int controller, diva_status_interface_state_t newInterfaceState);
 static void pbx_capi_hw_status_changed(int controller, diva_status_hardware_state_t newHwState);
+static void pbx_capi_update_controller_bit(unsigned long long *mask, int controller, int set);
 #endif
 static int pbx_capi_check_controller_status(int controller);
 
@@ -1118,6 +1142,7 @@ static int pbx_capi_alert(struct ast_channel *c)
 		) != 0) {
 		return -1;
 	}
+	pbx_capi_timeline_event(i, CC_TIMELINE_ALERT);
 
 	i->state = CAPI_STATE_ALERTING;
 	ast_setstate(c, AST_STATE_RING);
@@ -1165,6 +1190,183 @@ static int pbx_capi_signal_proceeding(struct ast_channel *c, char *param)
 	return 0;
 }
 
+/*
+ * hash of interface name
+ */
+static unsigned int pbx_capi_pool_hash(const char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*name != 0) {
+		hash = ((hash << 5) + hash) + (unsigned char)*name++;
+	}
+
+	return (hash % CC_POOL_NAME_HASH_SIZE);
+}
+
+/*
+ * return interface to free list of pool
+ */
+static void pbx_capi_pool_put(struct capi_pvt *i)
+{
+	if ((i->pool == NULL) || (i->channeltype != CAPI_CHANNELTYPE_B))
+		return;
+
+	cc_mutex_lock(&poollock);
+	if (!i->in_pool) {
+		diva_q_add_tail(&i->pool->free, &i->pool_link);
+		i->in_pool = 1;
+		i->pool->nfree++;
+	}
+	cc_mutex_unlock(&poollock);
+}
+
+/*
+ * get free interface of pool without removing it from free list,
+ * called with iflock held
+ */
+static struct capi_pvt *pbx_capi_pool_get(struct capi_pvt_pool *pool)
+{
+	diva_entity_link_t *link;
+	struct capi_pvt *i = NULL;
+
+	cc_mutex_lock(&poollock);
+	while ((link = diva_q_get_head(&pool->free)) != NULL) {
+		i = CC_POOL_PVT(link);
+		if ((!i->used) && (!i->reserved))
+			break;
+		/* interface reused without cleanup */
+		diva_q_remove(&pool->free, link);
+		i->in_pool = 0;
+		pool->nfree--;
+		i = NULL;
+	}
+	cc_mutex_unlock(&poollock);
+
+	return i;
+}
+
+/*
+ * mark interface reserved and remove it from free list,
+ * called with iflock held
+ */
+static void pbx_capi_pool_reserve(struct capi_pvt *i)
+{
+	cc_mutex_lock(&poollock);
+	if (i->in_pool) {
+		diva_q_remove(&i->pool->free, &i->pool_link);
+		i->in_pool = 0;
+		i->pool->nfree--;
+	}
+	i->reserved = 1;
+	cc_mutex_unlock(&poollock);
+}
+
+/*
+ * create pool for interfaces of configuration section
+ */
+static struct capi_pvt_pool *pbx_capi_pool_create(struct cc_capi_conf *conf, int controller)
+{
+	struct capi_pvt_pool *pool;
+	unsigned int hash, bit;
+
+	pool = ast_malloc(sizeof(*pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+	memset(pool, 0, sizeof(*pool));
+	cc_copy_string(pool->name, conf->name, sizeof(pool->name));
+	pool->controller = controller;
+	pool->group = conf->group;
+	pool->priority = ++capi_pools;
+	diva_q_init(&pool->free);
+
+	if (capi_controllers[controller]->msnIndex == NULL) {
+		capi_controllers[controller]->msnIndex = pbx_capi_msn_index_create();
+	}
+	if ((capi_controllers[controller]->msnIndex == NULL) ||
+	    (pbx_capi_msn_index_add(capi_controllers[controller]->msnIndex, conf->incomingmsn,
+			(conf->isdnmode == CAPI_ISDNMODE_DID), pool->priority, pool) != 0)) {
+		cc_log(LOG_ERROR, "Unable to add incomingmsn of '%s'\n", conf->name);
+		ast_free(pool);
+		return NULL;
+	}
+
+	/* same order as capi_iflist, the last configured first */
+	diva_q_insert_before(&capi_controllers[controller]->pools,
+		diva_q_get_head(&capi_controllers[controller]->pools), &pool->link);
+	hash = pbx_capi_pool_hash(pool->name);
+	pool->next_name = capi_pools_by_name[hash];
+	capi_pools_by_name[hash] = pool;
+
+	for (bit = 0; bit < sizeof(ast_group_t) * 8; bit++) {
+		if ((conf->group & ((ast_group_t)1 << bit)) != 0) {
+			capi_group_controllers[bit] |= CC_CONTROLLER_BIT(controller);
+		}
+	}
+
+	return pool;
+}
+
+static void pbx_capi_pool_cleanup(void)
+{
+	int controller;
+	diva_entity_link_t *link;
+
+	for (controller = 1; controller <= CAPI_MAX_CONTROLLERS; controller++) {
+		if (capi_controllers[controller] == NULL)
+			continue;
+		while ((link = diva_q_get_head(&capi_controllers[controller]->pools)) != NULL) {
+			diva_q_remove(&capi_controllers[controller]->pools, link);
+			ast_free(link);
+		}
+		pbx_capi_msn_index_destroy(capi_controllers[controller]->msnIndex);
+		capi_controllers[controller]->msnIndex = NULL;
+	}
+	capi_pools = 0;
+	memset(capi_pools_by_name, 0, sizeof(capi_pools_by_name));
+	memset(capi_group_controllers, 0, sizeof(capi_group_controllers));
+}
+
+static void *pbx_capi_pool_accept_b(void *data)
+{
+	return pbx_capi_pool_get((struct capi_pvt_pool *)data);
+}
+
+static void *pbx_capi_pool_accept_d(void *data)
+{
+	struct capi_pvt *i = ((struct capi_pvt_pool *)data)->dchannel;
+
+	return (((i == NULL) || (i->used) || (i->reserved)) ? NULL : i);
+}
+
+/*
+ * free interface for incoming call to 'dnid' on controller, the
+ * incomingmsn of the interface matches exactly, is '*' or in DID mode
+ * is a prefix of 'dnid'. Called with iflock held.
+ */
+static struct capi_pvt *pbx_capi_find_incoming_interface(int controller, const char *dnid, int bchannel)
+{
+	if ((controller <= 0) || (controller > capi_num_controllers) ||
+	    (capi_controllers[controller] == NULL) || (capi_controllers[controller]->msnIndex == NULL)) {
+		return NULL;
+	}
+
+	return pbx_capi_msn_index_find(capi_controllers[controller]->msnIndex, dnid,
+		(bchannel != 0) ? pbx_capi_pool_accept_b : pbx_capi_pool_accept_d);
+}
+
+/*
+ * incoming call no longer waits for the PBX
+ */
+static void pbx_capi_admission_done(struct capi_pvt *i)
+{
+	if (i->admissionPending) {
+		i->admissionPending = 0;
+		pbx_capi_admission_pending(-1);
+	}
+}
+
 /*
  * cleanup the interface
  */
@@ -1214,14 +1416,7 @@ static void interface_cleanup(struct capi_pvt *i)
 	i->cid_ton = 0;
 
 	i->rtpcodec = 0;
-	if (i->rtp) {
-#ifdef CC_AST_HAS_RTP_ENGINE_H
-		ast_rtp_instance_destroy(i->rtp);
-#else
-		ast_rtp_destroy(i->rtp);
-#endif
-		i->rtp = NULL;
-	}
+	i->rtp = 0;
 
 	interface_cleanup_qsig(i);
 
@@ -1232,9 +1427,13 @@ static void interface_cleanup(struct capi_pvt *i)
 #endif
 	i->used = NULL;
 	i->reserved = 0;
+	pbx_capi_admission_done(i);
+	pbx_capi_timeline_reset(i);
 
 	if (i->channeltype == CAPI_CHANNELTYPE_NULL) {
 		capi_interface_task(i, CAPI_INTERFACE_TASK_NULLIFREMOVE);
+	} else {
+		pbx_capi_pool_put(i);
 	}
 
 	return;
@@ -1418,6 +1617,8 @@ static int pbx_capi_hangup(struct ast_channel *c)
 		return -1;
 	}
 
+	pbx_capi_timeline_set_vars(c, i);
+
 	cc_mutex_lock(&i->lock);
 
 	state = i->state;
@@ -1579,6 +1780,8 @@ static int pbx_capi_call(struct ast_channel *c, void *idest, int timeout)
 	
 	MESSAGE_EXCHANGE_ERROR  error;
 
+	pbx_capi_timeline_start(i, CC_TIMELINE_CALL, pbx_capi_timeline_now());
+
 	cc_copy_string(buffer, idest, sizeof(buffer));
 	capi_parse_dialstring(buffer, &interface, &dest, &param, &ocid);
 
@@ -2008,6 +2211,7 @@ static int capi_send_answer(struct ast_channel *c, _cstruct b3conf)
 		) != 0) {
 		return -1;	
 	}
+	pbx_capi_timeline_event(i, CC_TIMELINE_ANSWER);
     
 	i->state = CAPI_STATE_ANSWERING;
 	i->doB3 = CAPI_B3_DONT;
@@ -2517,8 +2721,8 @@ static struct ast_channel *capi_new(struct capi_pvt *i, int state, const char *l
 	i->outgoing = 0;
 	i->onholdPLCI = 0;
 	i->doholdtype = i->holdtype;
-	i->B3q = 0;
-	i->B3count = 0;
+	cc_atomic_store(&i->B3q, 0);
+	cc_atomic_store(&i->B3count, 0);
 	memset(i->txavg, 0, ECHO_TX_COUNT);
 
 	i->divaAudioFlags            = 0;
@@ -2693,6 +2897,122 @@ static struct ast_channel *capi_new(struct capi_pvt *i, int state, const char *l
 	return tmp;
 }
 
+/*
+ * first free interface of controller in pool with matching name or group,
+ * called with iflock held
+ */
+static struct capi_pvt *pbx_capi_find_free_controller_interface(int controller,
+	const char *name, ast_group_t capigroup)
+{
+	diva_entity_link_t *link;
+	struct capi_pvt *i;
+
+	if ((controller <= 0) || (controller > capi_num_controllers) ||
+	    (capi_controllers[controller] == NULL) || (CC_CONTROLLER_BUSY(controller))) {
+		return NULL;
+	}
+
+	for (link = diva_q_get_head(&capi_controllers[controller]->pools); link != NULL; link = diva_q_get_next(link)) {
+		struct capi_pvt_pool *pool = (struct capi_pvt_pool *)link;
+
+		if ((name != NULL) && (strcmp(pool->name, name) != 0))
+			continue;
+		if ((capigroup != 0) && ((pool->group & capigroup) == 0))
+			continue;
+		if ((i = pbx_capi_pool_get(pool)) != NULL)
+			return i;
+	}
+
+	return NULL;
+}
+
+/*
+ * select free interface for DIAL(CAPI/contrX/...), DIAL(CAPI/gX/...)
+ * or DIAL(CAPI/<interface-name>/...), called with iflock held
+ */
+static struct capi_pvt *pbx_capi_find_free_interface(const char *interface,
+	unsigned int controller, ast_group_t capigroup, unsigned long long *skipped)
+{
+	struct capi_pvt *i, *bestChannel = NULL;
+	struct capi_pvt *candidate[CAPI_MAX_CONTROLLERS];
+	struct capi_pvt_pool *pool;
+	unsigned long long controllers = 0;
+	unsigned int bit, n, ncandidates = 0;
+
+	if (controller) {
+		/* DIAL(CAPI/contrX/...) */
+		i = pbx_capi_find_free_controller_interface(controller, NULL, 0);
+		if ((i != NULL) && (pbx_capi_check_controller_status(controller) < 0)) {
+			*skipped |= CC_CONTROLLER_BIT(controller);
+			i = NULL;
+		}
+		return i;
+	}
+
+	if (interface[0] != 'g') {
+		/* DIAL(CAPI/<interface-name>/...) */
+		for (pool = capi_pools_by_name[pbx_capi_pool_hash(interface)]; pool != NULL; pool = pool->next_name) {
+			if ((strcmp(pool->name, interface) != 0) || (CC_CONTROLLER_BUSY(pool->controller)))
+				continue;
+			if ((i = pbx_capi_pool_get(pool)) == NULL)
+				continue;
+			if (pbx_capi_check_controller_status(i->controller) < 0) {
+				*skipped |= CC_CONTROLLER_BIT(i->controller);
+				i = NULL;
+			}
+			return i;
+		}
+		return NULL;
+	}
+
+	/* DIAL(CAPI/gX/...) */
+	for (bit = 0; bit < sizeof(ast_group_t) * 8; bit++) {
+		if ((capigroup & ((ast_group_t)1 << bit)) != 0) {
+			controllers |= capi_group_controllers[bit];
+		}
+	}
+
+	/*
+	 * One candidate per controller, the first free interface in capi_iflist
+	 * order. Candidates are hunted in capi_iflist order too, so the
+	 * configuration section order selects the controller as before.
+	 */
+	for (controller = 1; (controllers != 0) && (controller <= capi_num_controllers); controller++, controllers >>= 1) {
+		if ((controllers & 1) == 0)
+			continue;
+		if ((i = pbx_capi_find_free_controller_interface(controller, NULL, capigroup)) == NULL)
+			continue;
+		for (n = ncandidates; (n > 0) && (candidate[n - 1]->pool->priority < i->pool->priority); n--) {
+			candidate[n] = candidate[n - 1];
+		}
+		candidate[n] = i;
+		ncandidates++;
+	}
+
+	for (n = 0; n < ncandidates; n++) {
+		i = candidate[n];
+		if (pbx_capi_check_controller_status(i->controller) < 0) {
+			*skipped |= CC_CONTROLLER_BIT(i->controller);
+			continue; /* not active, keep on running! */
+		}
+		if (capi_controllers[i->controller]->nfreebchannelsSoftThr == 0)
+			return i;
+		if (bestChannel == NULL) {
+			bestChannel = i;
+		} else {
+			int idiff = capi_controllers[i->controller]->nfreebchannels - capi_controllers[i->controller]->nfreebchannelsSoftThr;
+			int bdiff = capi_controllers[bestChannel->controller]->nfreebchannels - capi_controllers[bestChannel->controller]->nfreebchannelsSoftThr;
+			int c = (i->controller < bestChannel->controller);
+
+			if ((c && (idiff >= 0)) || ((bdiff < 0) && (idiff >= 0)) || ((bdiff < 0) && (idiff > bdiff))) {
+				bestChannel = i;
+			}
+		}
+	}
+
+	return bestChannel;
+}
+
 /*
  * PBX wants us to dial ...
  */
@@ -2717,13 +3037,14 @@ static struct ast_channel *
 pbx_capi_request(const char *type, int format, void *data, int *cause)
 #endif /* } */
 {
-	struct capi_pvt *i, *bestChannel;
+	struct capi_pvt *i;
 	struct ast_channel *tmp = NULL;
 	char *dest, *interface, *param, *ocid;
 	char buffer[CAPI_MAX_STRING];
 	ast_group_t capigroup = 0;
 	unsigned int controller = 0;
 	unsigned int ccbsnrhandle = 0;
+	unsigned long long skipped = 0;
 
 	cc_verbose(1, 1, VERBOSE_PREFIX_4 "data = %s format=%s\n",
 							(char *)data, 
@@ -2762,55 +3083,12 @@ pbx_capi_request(const char *type, int format, void *data, int *cause)
  	}
 
 	cc_mutex_lock(&iflock);
-	
-	for (i = capi_iflist, bestChannel = 0; i; i = i->next) {
-		if (CC_B_INTERFACE_NOT_FREE(i)) {
-			/* if already in use or no real channel */
-			continue;
-		}
-		/* unused channel */
-		if (controller) {
-			/* DIAL(CAPI/contrX/...) */
-			if (i->controller != controller) {
-				/* keep on running! */
-				continue;
-			} else if (pbx_capi_check_controller_status(i->controller) < 0) {
-				break;
-			}
-		} else {
-			/* DIAL(CAPI/gX/...) */
-			if (interface[0] == 'g') {
-				if ((i->group & capigroup) == 0)
-					continue; /* not in group, keep on running! */
-				if (pbx_capi_check_controller_status(i->controller) < 0)
-					continue; /* not active or better interface found, keep on running! */
-				if (capi_controllers[i->controller]->nfreebchannelsSoftThr != 0) {
-					if (bestChannel == 0) {
-						bestChannel = i;
-					} else if (i->controller != bestChannel->controller) {
-						int idiff = capi_controllers[i->controller]->nfreebchannels - capi_controllers[i->controller]->nfreebchannelsSoftThr;
-						int bdiff = capi_controllers[bestChannel->controller]->nfreebchannels - capi_controllers[bestChannel->controller]->nfreebchannelsSoftThr;
-						int c = (i->controller < bestChannel->controller);
-
-						if ((c && (idiff >= 0)) || ((bdiff < 0) && (idiff >= 0)) || ((bdiff < 0) && (idiff > bdiff))) {
-							bestChannel = i;
-						}
-					}
-					continue; /* Continue search for best channel */
-				}
-			} else if (strcmp(interface, i->name) != 0) {
-			/* DIAL(CAPI/<interface-name>/...) */
-				/* keep on running! */
-				continue;
-			} else if (pbx_capi_check_controller_status(i->controller) < 0) {
-				break;
-			}
-		}
 
-found_best_channel:
+	i = pbx_capi_find_free_interface(interface, controller, capigroup, &skipped);
+	if (i != NULL) {
 		/* when we come here, we found a free controller match */
 		cc_copy_string(i->dnid, dest, sizeof(i->dnid));
-		i->reserved = 1;
+		pbx_capi_pool_reserve(i);
 		cc_mutex_unlock(&iflock);
 		tmp = capi_new(i, AST_STATE_RESERVED,
 #ifdef CC_AST_HAS_REQUEST_REQUESTOR
@@ -2831,14 +3109,12 @@ found_best_channel:
 		i->outgoing = 1;	/* this is an outgoing line */
 		i->ccbsnrhandle = ccbsnrhandle;
 		cc_mutex_unlock(&iflock);
+		pbx_capi_count_skipped_controllers(skipped);
 		return tmp;
 	}
-	if (bestChannel != 0) {
-		i = bestChannel;
-		goto found_best_channel;
-	}
 
 	cc_mutex_unlock(&iflock);
+	pbx_capi_count_skipped_controllers(skipped);
 	cc_verbose(2, 0, VERBOSE_PREFIX_3 "didn't find " CC_MESSAGE_NAME
 		" device for interface '%s'\n", interface);
 	*cause = AST_CAUSE_REQUESTED_CHAN_UNAVAIL;
@@ -2927,6 +3203,8 @@ static int pbx_capi_receive_extended_fax(struct ast_channel *c, struct capi_pvt
 	char *filename, *stationid, *headline, *options;
 	B3_PROTO_FAXG3 b3conf;
 	char buffer[CAPI_MAX_STRING];
+	FILE *f;
+	cc_capi_fax_io_t *faxio;
 	unsigned short b3_protocol_options = 0x0001;
 	int extended_resolution = 0;
 
@@ -3016,11 +3294,16 @@ static int pbx_capi_receive_extended_fax(struct ast_channel *c, struct capi_pvt
 	capi_wait_for_answered(i);
 
 	i->FaxState &= ~CAPI_FAX_STATE_CONN;
-	if ((i->fFax = fopen(filename, "wb")) == NULL) {
+	if ((f = fopen(filename, "wb")) == NULL) {
 		cc_log(LOG_WARNING, "can't create fax output file (%s)\n", strerror(errno));
 		capi_remove_nullif(i);
 		return -1;
 	}
+	if ((i->faxio = pbx_capi_fax_io_open(f, 0, i->vname, i)) == NULL) {
+		fclose(f);
+		capi_remove_nullif(i);
+		return -1;
+	}
 
 	if (capi_controllers[i->controller]->divaExtendedFeaturesAvailable != 0 && extended_resolution != 0) {
 		/*
@@ -3053,7 +3336,13 @@ static int pbx_capi_receive_extended_fax(struct ast_channel *c, struct capi_pvt
 		capi_change_bchan_fax(i, &b3conf);
 		break;
 	default:
+		/* detach the transfer from the device thread before closing it */
+		cc_mutex_lock(&i->lock);
 		i->FaxState &= ~CAPI_FAX_STATE_ACTIVE;
+		faxio = i->faxio;
+		i->faxio = NULL;
+		cc_mutex_unlock(&i->lock);
+		pbx_capi_fax_io_close(faxio);
 		cc_log(LOG_WARNING, CC_MESSAGE_NAME " receive fax in wrong state (%d)\n",
 			i->state);
 		capi_remove_nullif(i);
@@ -3077,17 +3366,16 @@ static int pbx_capi_receive_extended_fax(struct ast_channel *c, struct capi_pvt
 
 	res = (i->FaxState & CAPI_FAX_STATE_ERROR) ? 1 : 0;
 	i->FaxState &= ~(CAPI_FAX_STATE_ACTIVE | CAPI_FAX_STATE_ERROR);
+	faxio = i->faxio;
+	i->faxio = NULL;
+
+	cc_mutex_unlock(&i->lock);
 
-	/* if the file has zero length */
-	if (ftell(i->fFax) == 0L) {
+	cc_verbose(2, 1, VERBOSE_PREFIX_3 "Closing fax file...\n");
+	/* flush buffered data, fail if the file has zero length */
+	if (pbx_capi_fax_io_close(faxio) == 0L) {
 		res = 1;
 	}
-			
-	cc_verbose(2, 1, VERBOSE_PREFIX_3 "Closing fax file...\n");
-	fclose(i->fFax);
-	i->fFax = NULL;
-
-	cc_mutex_unlock(&i->lock);
 
 	if (res != 0) {
 		cc_verbose(2, 0,
@@ -3121,6 +3409,8 @@ static int pbx_capi_receive_basic_fax(struct ast_channel *c, struct capi_pvt *i,
 	char *filename, *stationid, *headline, *options;
 	B3_PROTO_FAXG3 b3conf;
 	char buffer[CAPI_MAX_STRING];
+	FILE *f;
+	cc_capi_fax_io_t *faxio;
 
 	filename = strsep(&data, COMMANDSEPARATOR);
 	stationid = strsep(&data, COMMANDSEPARATOR);
@@ -3174,10 +3464,14 @@ static int pbx_capi_receive_basic_fax(struct ast_channel *c, struct capi_pvt *i,
 	capi_wait_for_answered(i);
 
 	i->FaxState &= ~CAPI_FAX_STATE_CONN;
-	if ((i->fFax = fopen(filename, "wb")) == NULL) {
+	if ((f = fopen(filename, "wb")) == NULL) {
 		cc_log(LOG_WARNING, "can't create fax output file (%s)\n", strerror(errno));
 		return -1;
 	}
+	if ((i->faxio = pbx_capi_fax_io_open(f, 0, i->vname, i)) == NULL) {
+		fclose(f);
+		return -1;
+	}
 
 	i->FaxState |= CAPI_FAX_STATE_ACTIVE;
 	setup_b3_basic_fax_config(&b3conf, FAX_SFF_FORMAT, stationid, headline);
@@ -3198,7 +3492,13 @@ static int pbx_capi_receive_basic_fax(struct ast_channel *c, struct capi_pvt *i,
 		capi_change_bchan_fax(i, &b3conf);
 		break;
 	default:
+		/* detach the transfer from the device thread before closing it */
+		cc_mutex_lock(&i->lock);
 		i->FaxState &= ~CAPI_FAX_STATE_ACTIVE;
+		faxio = i->faxio;
+		i->faxio = NULL;
+		cc_mutex_unlock(&i->lock);
+		pbx_capi_fax_io_close(faxio);
 		cc_log(LOG_WARNING, CC_MESSAGE_NAME " receive fax in wrong state (%d)\n",
 			i->state);
 		return -1;
@@ -3217,17 +3517,16 @@ static int pbx_capi_receive_basic_fax(struct ast_channel *c, struct capi_pvt *i,
 
 	res = (i->FaxState & CAPI_FAX_STATE_ERROR) ? 1 : 0;
 	i->FaxState &= ~(CAPI_FAX_STATE_ACTIVE | CAPI_FAX_STATE_ERROR);
+	faxio = i->faxio;
+	i->faxio = NULL;
 
-	/* if the file has zero length */
-	if (ftell(i->fFax) == 0L) {
+	cc_mutex_unlock(&i->lock);
+
+	cc_verbose(2, 1, VERBOSE_PREFIX_3 "Closing fax file...\n");
+	/* flush buffered data, fail if the file has zero length */
+	if (pbx_capi_fax_io_close(faxio) == 0L) {
 		res = 1;
 	}
-			
-	cc_verbose(2, 1, VERBOSE_PREFIX_3 "Closing fax file...\n");
-	fclose(i->fFax);
-	i->fFax = NULL;
-
-	cc_mutex_unlock(&i->lock);
 
 	if (res != 0) {
 		cc_verbose(2, 0,
@@ -3398,6 +3697,8 @@ static int pbx_capi_send_extended_fax(struct ast_channel *c, struct capi_pvt *i,
 	char *filename, *stationid, *headline, *options;
 	B3_PROTO_FAXG3 b3conf;
 	char buffer[CAPI_MAX_STRING];
+	FILE *f;
+	cc_capi_fax_io_t *faxio;
 	int file_format;
 	unsigned short b3_protocol_options = 0;
 	int extended_resolution = 0;
@@ -3419,7 +3720,7 @@ static int pbx_capi_send_extended_fax(struct ast_channel *c, struct capi_pvt *i,
 
 	capi_wait_for_answered(i);
 
-	if ((i->fFax = fopen(filename, "rb")) == NULL) {
+	if ((f = fopen(filename, "rb")) == NULL) {
 		cc_log(LOG_WARNING, "can't open fax file (%s)\n", strerror(errno));
 		capi_remove_nullif(i);
 		return -1;
@@ -3431,10 +3732,9 @@ static int pbx_capi_send_extended_fax(struct ast_channel *c, struct capi_pvt *i,
 	{
 		unsigned char tmp[2] = { 0, 0 };
 
-		if (fread(tmp, 1, 2, i->fFax) != 2) {
+		if (fread(tmp, 1, 2, f) != 2) {
 			cc_log(LOG_WARNING, "can't read fax file (%s)\n", strerror(errno));
-			fclose(i->fFax);
-			i->fFax = 0;
+			fclose(f);
 			capi_remove_nullif(i);
 			return -1;
 		}
@@ -3452,7 +3752,12 @@ static int pbx_capi_send_extended_fax(struct ast_channel *c, struct capi_pvt *i,
 		}
 	}
 
-	rewind(i->fFax);
+	rewind(f);
+	if ((i->faxio = pbx_capi_fax_io_open(f, 1, i->vname, i)) == NULL) {
+		fclose(f);
+		capi_remove_nullif(i);
+		return -1;
+	}
 
 	/* parse the options */
 	while ((options) && (*options)) {
@@ -3535,7 +3840,13 @@ static int pbx_capi_send_extended_fax(struct ast_channel *c, struct capi_pvt *i,
 		capi_change_bchan_fax(i, &b3conf);
 		break;
 	default:
+		/* detach the transfer from the device thread before closing it */
+		cc_mutex_lock(&i->lock);
 		i->FaxState &= ~CAPI_FAX_STATE_ACTIVE;
+		faxio = i->faxio;
+		i->faxio = NULL;
+		cc_mutex_unlock(&i->lock);
+		pbx_capi_fax_io_close(faxio);
 		cc_log(LOG_WARNING, CC_MESSAGE_NAME " send fax in wrong state (%d)\n",
 			i->state);
 		capi_remove_nullif(i);
@@ -3559,13 +3870,14 @@ static int pbx_capi_send_extended_fax(struct ast_channel *c, struct capi_pvt *i,
 
 	res = (i->FaxState & CAPI_FAX_STATE_ERROR) ? 1 : 0;
 	i->FaxState &= ~(CAPI_FAX_STATE_ACTIVE | CAPI_FAX_STATE_ERROR);
-
-	cc_verbose(2, 1, VERBOSE_PREFIX_3 "Closing fax file...\n");
-	fclose(i->fFax);
-	i->fFax = NULL;
+	faxio = i->faxio;
+	i->faxio = NULL;
 
 	cc_mutex_unlock(&i->lock);
 
+	cc_verbose(2, 1, VERBOSE_PREFIX_3 "Closing fax file...\n");
+	pbx_capi_fax_io_close(faxio);
+
 	if (res != 0) {
 		cc_verbose(2, 0,
 			VERBOSE_PREFIX_1 CC_MESSAGE_NAME
@@ -3610,6 +3922,8 @@ static int pbx_capi_send_basic_fax(struct ast_channel *c, struct capi_pvt *i, ch
 	char *filename, *stationid, *headline, *options;
 	B3_PROTO_FAXG3 b3conf;
 	char buffer[CAPI_MAX_STRING];
+	FILE *f;
+	cc_capi_fax_io_t *faxio;
 
 	filename = strsep(&data, COMMANDSEPARATOR);
 	stationid = strsep(&data, COMMANDSEPARATOR);
@@ -3651,10 +3965,14 @@ static int pbx_capi_send_basic_fax(struct ast_channel *c, struct capi_pvt *i, ch
 
 	capi_wait_for_answered(i);
 
-	if ((i->fFax = fopen(filename, "rb")) == NULL) {
+	if ((f = fopen(filename, "rb")) == NULL) {
 		cc_log(LOG_WARNING, "can't open fax file (%s)\n", strerror(errno));
 		return -1;
 	}
+	if ((i->faxio = pbx_capi_fax_io_open(f, 1, i->vname, i)) == NULL) {
+		fclose(f);
+		return -1;
+	}
 
 	i->FaxState |= (CAPI_FAX_STATE_ACTIVE | CAPI_FAX_STATE_SENDMODE);
 	setup_b3_basic_fax_config(&b3conf, FAX_SFF_FORMAT, stationid, headline);
@@ -3675,7 +3993,13 @@ static int pbx_capi_send_basic_fax(struct ast_channel *c, struct capi_pvt *i, ch
 		capi_change_bchan_fax(i, &b3conf);
 		break;
 	default:
+		/* detach the transfer from the device thread before closing it */
+		cc_mutex_lock(&i->lock);
 		i->FaxState &= ~CAPI_FAX_STATE_ACTIVE;
+		faxio = i->faxio;
+		i->faxio = NULL;
+		cc_mutex_unlock(&i->lock);
+		pbx_capi_fax_io_close(faxio);
 		cc_log(LOG_WARNING, CC_MESSAGE_NAME " send fax in wrong state (%d)\n",
 			i->state);
 		return -1;
@@ -3693,13 +4017,14 @@ static int pbx_capi_send_basic_fax(struct ast_channel *c, struct capi_pvt *i, ch
 
 	res = (i->FaxState & CAPI_FAX_STATE_ERROR) ? 1 : 0;
 	i->FaxState &= ~(CAPI_FAX_STATE_ACTIVE | CAPI_FAX_STATE_ERROR);
-
-	cc_verbose(2, 1, VERBOSE_PREFIX_3 "Closing fax file...\n");
-	fclose(i->fFax);
-	i->fFax = NULL;
+	faxio = i->faxio;
+	i->faxio = NULL;
 
 	cc_mutex_unlock(&i->lock);
 
+	cc_verbose(2, 1, VERBOSE_PREFIX_3 "Closing fax file...\n");
+	pbx_capi_fax_io_close(faxio);
+
 	if (res != 0) {
 		cc_verbose(2, 0,
 			VERBOSE_PREFIX_1 CC_MESSAGE_NAME
@@ -3976,6 +4301,7 @@ static void handle_progress_indicator(_cmsg *CMSG, unsigned int PLCI, struct cap
 static void start_pbx_on_match(struct capi_pvt *i, unsigned int PLCI, _cword MessageNumber)
 {
 	struct ast_channel *c;
+	struct timespec setupStart = { 0, 0 };
 
 	c = i->owner;
 
@@ -4000,6 +4326,7 @@ static void start_pbx_on_match(struct capi_pvt *i, unsigned int PLCI, _cword Mes
 	/* check for internal pickup extension first */
 	if (!strcmp(i->dnid, ast_pickup_ext())) {
 		i->isdnstate |= CAPI_ISDN_STATE_PBX;
+		pbx_capi_admission_done(i);
 		cc_verbose(3, 1, VERBOSE_PREFIX_2 "%s: Pickup extension '%s' found.\n",
 			i->vname, i->dnid);
 #ifdef CC_AST_HAS_VERSION_11_0
@@ -4015,15 +4342,19 @@ static void start_pbx_on_match(struct capi_pvt *i, unsigned int PLCI, _cword Mes
 	switch(search_did(c)) {
 	case 0: /* match */
 		i->isdnstate |= CAPI_ISDN_STATE_PBX;
+		pbx_capi_admission_done(i);
 		ast_setstate(c, AST_STATE_RING);
+		pbx_capi_admission_setup_start(&setupStart);
 		if (ast_pbx_start(c)) {
 			cc_log(LOG_ERROR, "%s: Unable to start pbx on channel!\n",
 				i->vname);
 			capi_channel_task(c, CAPI_CHANNEL_TASK_HANGUP); 
 		} else {
+			pbx_capi_timeline_event(i, CC_TIMELINE_PBX_START);
 			cc_verbose(2, 1, VERBOSE_PREFIX_2 "Started pbx on channel %s\n",
 				cur_name);
 		}
+		pbx_capi_admission_setup_done(&setupStart);
 		break;
 	case 1:
 		/* would possibly match */
@@ -4034,6 +4365,7 @@ static void start_pbx_on_match(struct capi_pvt *i, unsigned int PLCI, _cword Mes
 	default:
 		/* doesn't match */
 		i->isdnstate |= CAPI_ISDN_STATE_PBX_DONT; /* don't try again */
+		pbx_capi_admission_done(i);
 		cc_log(LOG_NOTICE, "%s: did not find exten for '%s', ignoring call.\n",
 			i->vname, i->dnid);
 		capi_sendf(NULL, 0, CAPI_CONNECT_RESP, PLCI, MessageNumber,
@@ -4814,6 +5146,24 @@ static int pbx_capi_get_samples(struct capi_pvt *i, int length)
 	return (length);
 }
 
+/*
+ * copy received data to the frame buffer, every byte is translated
+ * using table if table is not NULL
+ */
+static inline void capidev_copy_b3_data(unsigned char *dst, const unsigned char *src,
+	int len, const unsigned char *table)
+{
+	int j;
+
+	if (table == NULL) {
+		memcpy(dst, src, len);
+		return;
+	}
+	for (j = 0; j < len; j++) {
+		dst[j] = table[src[j]];
+	}
+}
+
 /*
  * CAPI DATA_B3_IND
  */
@@ -4833,17 +5183,61 @@ static void capidev_handle_data_b3_indication(
 	int txavg = 0;
 	int rtpoffset = 0;
 
+	if ((CMSG != 0) && (i != NULL) && (i->virtualBridgePeer != 0)) {
+		/*
+			Forward directly from the CAPI receive buffer. The buffer
+			is released by DATA_B3_RESP after the request to the peer
+			was passed to CAPI, which copies the data.
+			*/
+		struct capi_pvt *peer = i->bridgePeer;
+
+		if ((peer != NULL) && (peer->NCCI != 0)
+#ifdef DIVA_STREAMING
+				&& (i->diva_stream_entry == 0)
+				&& (peer->diva_stream_entry == 0)
+#endif
+				) {
+			peer->send_buffer_handle++;
+			capi_sendf(NULL, 0, CAPI_DATA_B3_REQ, peer->NCCI, get_capi_MessageNumber(),
+				"dwww", (unsigned char *)DATA_B3_IND_DATA(CMSG), DATA_B3_IND_DATALENGTH(CMSG),
+				peer->send_buffer_handle, 0);
+		}
+		capi_sendf(NULL, 0, CAPI_DATA_B3_RESP, NCCI, HEADER_MSGNUM(CMSG),
+			"w", DATA_B3_IND_DATAHANDLE(CMSG));
+		return;
+	}
+
 	if (i != NULL) {
+		const unsigned char *table = NULL;
+
 		if ((i->isdnstate & CAPI_ISDN_STATE_RTP)) rtpoffset = RTP_HEADER_SIZE;
 		b3buf = &(i->rec_buffer[AST_FRIENDLY_OFFSET - rtpoffset]);
+
+		/*
+			Voice data is bit reversed and gain adjusted while copied
+			from the receive buffer or the stream to the frame buffer
+			*/
+		if ((i->faxio == NULL) && (!(i->isdnstate & CAPI_ISDN_STATE_RTP)) &&
+		    (i->bproto != CC_BPROTO_VOCODER)) {
+			if ((i->doES == 1) || (i->rxgain == 1.0) ||
+			    (capi_tcap_is_digital(i->transfercapability))) {
+				table = capi_reversebits;
+			} else {
+				table = i->g.rxgainsreversed;
+			}
+		}
+
 		if (CMSG != 0) {
 			b3len = DATA_B3_IND_DATALENGTH(CMSG);
-			memcpy(b3buf, (char *)DATA_B3_IND_DATA(CMSG), b3len);
+			capidev_copy_b3_data(b3buf, (unsigned char *)DATA_B3_IND_DATA(CMSG), b3len, table);
 		} else {
 #ifdef DIVA_STREAMING
-			dword i = 0, k = 0;
-			b3len = (int)diva_streaming_read_vector_data(vind,
-				vind_nr, &i, &k, b3buf, CAPI_MAX_B3_BLOCK_SIZE);
+			for (j = 0; (j < vind_nr) && (b3len < CAPI_MAX_B3_BLOCK_SIZE); j++) {
+				int len = MIN((int)vind[j].length, CAPI_MAX_B3_BLOCK_SIZE - b3len);
+
+				capidev_copy_b3_data(&b3buf[b3len], vind[j].data, len, table);
+				b3len += len;
+			}
 #endif
 		}
 	}
@@ -4857,30 +5251,19 @@ static void capidev_handle_data_b3_indication(
 	return_on_no_interface("DATA_B3_IND");
 
 	if (i->virtualBridgePeer != 0) {
-		if ((i->bridgePeer != NULL)
-#ifdef DIVA_STREAMING
-				&& (i->diva_stream_entry == 0)
-				&& (i->bridgePeer->diva_stream_entry == 0)
-#endif
-				) {
-			if (i->bridgePeer->NCCI != 0) {
-				i->bridgePeer->send_buffer_handle++;
-				capi_sendf(NULL, 0, CAPI_DATA_B3_REQ, i->bridgePeer->NCCI, get_capi_MessageNumber(),
-					"dwww", b3buf, b3len, i->bridgePeer->send_buffer_handle, 0);
-			}
-		}
+		/* bridge data received by stream is forwarded by the stream */
 		return;
 	}
 
-	if (i->fFax) {
+	if (i->faxio) {
 		/* we are in fax mode and have a file open */
 		cc_verbose(6, 1, VERBOSE_PREFIX_3 "%s: DATA_B3_IND (len=%d) Fax\n",
 			i->vname, b3len);
 		if ((!(i->FaxState & CAPI_FAX_STATE_SENDMODE)) &&
 			(i->FaxState & CAPI_FAX_STATE_CONN)) {
-			if (fwrite(b3buf, 1, b3len, i->fFax) != b3len)
-				cc_log(LOG_WARNING, "%s : error writing output file (%s)\n",
-					i->vname, strerror(errno));
+			if (pbx_capi_fax_io_write(i->faxio, b3buf, b3len) != b3len)
+				cc_log(LOG_WARNING, "%s : fax buffer overrun, output file too slow\n",
+					i->vname);
 		}
 #ifndef CC_AST_HAS_VERSION_1_4
 		fr.frametype = AST_FRAME_CONTROL;
@@ -4898,20 +5281,17 @@ static void capidev_handle_data_b3_indication(
 	}
 
 	if ((i->isdnstate & CAPI_ISDN_STATE_RTP)) {
-		struct ast_frame *f = capi_read_rtp(i, b3buf, b3len);
-		if (f)
-			local_queue_frame(i, f);
+		if (capi_read_rtp(i, b3buf, b3len, &fr) == 0)
+			local_queue_frame(i, &fr);
 		return;
 	}
 
-	if (i->B3q < (((CAPI_MAX_B3_BLOCKS - 1) * CAPI_MAX_B3_BLOCK_SIZE) + 1)) {
-		i->B3q += b3len;
-	}
+	capi_b3q_credit(i, b3len);
 
 	if (i->bproto != CC_BPROTO_VOCODER) {
+		/* data was bit reversed by capidev_copy_b3_data() */
 		if ((i->doES == 1) && (!capi_tcap_is_digital(i->transfercapability))) {
 			for (j = 0; j < b3len; j++) {
-				*(b3buf + j) = capi_reversebits[*(b3buf + j)]; 
 				if (capi_capability == CC_FORMAT_ULAW) {
 					rxavg += abs(capiULAW2INT[ capi_reversebits[*(b3buf + j)]]);
 				} else {
@@ -4933,16 +5313,9 @@ static void capidev_handle_data_b3_indication(
 				cc_verbose(6, 1, VERBOSE_PREFIX_3 "%s: SUPPRESSING ECHO rx=%d, tx=%d\n",
 						i->vname, rxavg, txavg);
 			}
-		} else {
-			if ((i->rxgain == 1.0) || (capi_tcap_is_digital(i->transfercapability))) {
-				for (j = 0; j < b3len; j++) {
-					*(b3buf + j) = capi_reversebits[*(b3buf + j)];
-				}
-			} else {
-				for (j = 0; j < b3len; j++) {
-					*(b3buf + j) = capi_reversebits[i->g.rxgains[*(b3buf + j)]];
-				}
-			}
+		}
+		if (i->rx_level_enabled) {
+			capi_level_update(&i->rx_level, b3buf, b3len);
 		}
 		SET_FRAME_SUBCLASS_CODEC(fr.subclass, capi_capability);
 	} else {
@@ -4996,7 +5369,7 @@ static void capidev_send_faxdata(struct capi_pvt *i)
 	struct ast_frame fr = { AST_FRAME_CONTROL, AST_CONTROL_PROGRESS, };
 #endif
 	unsigned char faxdata[CAPI_MAX_B3_BLOCK_SIZE];
-	size_t len;
+	int len;
 
 	if (i->NCCI == 0) {
 		cc_verbose(3, 0, VERBOSE_PREFIX_3 "%s: send_faxdata on NCCI = 0.\n",
@@ -5010,8 +5383,14 @@ static void capidev_send_faxdata(struct capi_pvt *i)
 		return;
 	}
 
-	if ((i->fFax) && (!(feof(i->fFax)))) {
-		len = fread(faxdata, 1, CAPI_MAX_B3_BLOCK_SIZE, i->fFax);
+	if (i->faxio) {
+		len = pbx_capi_fax_io_read(i->faxio, faxdata, CAPI_MAX_B3_BLOCK_SIZE);
+		if (len < 0) {
+			/* read ahead not ready, resumed from the device loop */
+			cc_verbose(5, 1, VERBOSE_PREFIX_3 "%s: fax data not yet available.\n",
+				i->vname);
+			return;
+		}
 		if (len > 0) {
 			i->send_buffer_handle++;
 			capi_sendf(NULL, 0, CAPI_DATA_B3_REQ, i->NCCI, get_capi_MessageNumber(),
@@ -5255,6 +5634,7 @@ static void capidev_handle_connect_active_indication(_cmsg *CMSG, unsigned int P
 		return;
 	}
 
+	pbx_capi_timeline_event(i, CC_TIMELINE_CONNECT_ACTIVE);
 	i->state = CAPI_STATE_CONNECTED;
 
 	if ((i->FaxState & CAPI_FAX_STATE_SENDMODE)) {
@@ -5318,6 +5698,7 @@ static void capidev_handle_connect_b3_active_indication(_cmsg *CMSG, unsigned in
 		return;
 	}
 
+	pbx_capi_timeline_event(i, CC_TIMELINE_B3_ACTIVE);
 	i->isdnstate |= CAPI_ISDN_STATE_B3_UP;
 	i->isdnstate &= ~CAPI_ISDN_STATE_B3_PEND;
 
@@ -5327,7 +5708,7 @@ static void capidev_handle_connect_b3_active_indication(_cmsg *CMSG, unsigned in
 		i->isdnstate &= ~CAPI_ISDN_STATE_RTP;
 	}
 
-	i->B3q = (CAPI_MAX_B3_BLOCK_SIZE * 3);
+	cc_atomic_store(&i->B3q, (CAPI_MAX_B3_BLOCK_SIZE * 3));
 
 	if ((i->FaxState & CAPI_FAX_STATE_SENDMODE)) {
 		cc_verbose(3, 1, VERBOSE_PREFIX_3 "%s: Start sending fax.\n",
@@ -5463,7 +5844,7 @@ static void capidev_handle_connect_b3_indication(_cmsg *CMSG, unsigned int PLCI,
 	return_on_no_interface("CONNECT_B3_IND");
 
 	i->NCCI = NCCI;
-	i->B3count = 0;
+	cc_atomic_store(&i->B3count, 0);
 
 	if (i->channeltype != CAPI_CHANNELTYPE_NULL) {
 		capi_controllers[i->controller]->nfreebchannels--;
@@ -5523,6 +5904,7 @@ static void capidev_handle_disconnect_indication(_cmsg *CMSG, unsigned int PLCI,
 		/* the real reason could be != 0x34xx, so provide this value in variable */
 		sprintf(buffer, "%d", i->reason);
 		pbx_builtin_setvar_helper(i->owner, "DISCONNECT_IND_REASON", buffer);
+		pbx_capi_timeline_set_vars(i->owner, i);
 	}
 
 	if (i->FaxState & CAPI_FAX_STATE_ACTIVE) {
@@ -5580,14 +5962,13 @@ static void capidev_handle_connect_indication(
 	char *KEYPAD = NULL;
 	int callernplan = 0, callednplan = 0;
 	int controller = 0;
-	char *msn;
 	char buffer[CAPI_MAX_STRING];
-	char buffer_r[CAPI_MAX_STRING];
-	char *buffer_rp = buffer_r;
-	char *magicmsn = "*\0";
 	char *emptydnid = "\0";
 	int callpres = 0;
 	char bchannelinfo[2] = { '0', 0 };
+	struct timespec setupStart = { 0, 0 };
+	unsigned long long received = pbx_capi_timeline_now();
+	int reject;
 
 	if (*interface) {
 	    /* chan_capi does not support 
@@ -5640,191 +6021,178 @@ static void capidev_handle_connect_indication(
 
 	/* well...somebody is calling us. let's set up a channel */
 	cc_mutex_lock(&iflock);
-	for (i = capi_iflist; i; i = i->next) {
-		if (i->used || i->reserved) {
-			/* is already used */
-			continue;
-		}
-		if (i->controller != controller) {
-			continue;
-		}
-		if (i->channeltype == CAPI_CHANNELTYPE_B) {
-			if (bchannelinfo[0] != '0')
-				continue;
-		} else {
-			if (bchannelinfo[0] == '0')
-				continue;
+	i = pbx_capi_find_incoming_interface(controller, DNID, (bchannelinfo[0] == '0'));
+	if (i == NULL) {
+		cc_mutex_unlock(&iflock);
+
+		/* obviously we are not called...so tell capi to ignore this call */
+
+		if (capidebug) {
+			cc_log(LOG_WARNING, "did not find device for msn = %s\n", DNID);
 		}
-		cc_copy_string(buffer, i->incomingmsn, sizeof(buffer));
-		for (msn = strtok_r(buffer, ",", &buffer_rp); msn; msn = strtok_r(NULL, ",", &buffer_rp)) {
-			if (!strlen(DNID)) {
-				/* if no DNID, only accept if '*' was specified */
-				if (strncasecmp(msn, magicmsn, strlen(msn))) {
-					continue;
-				}
-				cc_copy_string(i->dnid, emptydnid, sizeof(i->dnid));
-			} else {
-				/* make sure the number match exactly or may match on ptp mode */
-				cc_verbose(4, 1, VERBOSE_PREFIX_4 "%s: msn='%s' DNID='%s' %s\n",
-					i->vname, msn, DNID,
-					(i->isdnmode == CAPI_ISDNMODE_MSN)?"MSN":"DID");
-				if ((strcasecmp(msn, DNID)) &&
-				   ((i->isdnmode == CAPI_ISDNMODE_MSN) ||
-				    (strlen(msn) >= strlen(DNID)) ||
-				    (strncasecmp(msn, DNID, strlen(msn)))) &&
-				   (strncasecmp(msn, magicmsn, strlen(msn)))) {
-					continue;
-				}
-				cc_copy_string(i->dnid, DNID, sizeof(i->dnid));
-			}
-			if (CID != NULL) {
-				if ((callernplan & 0x70) == CAPI_ETSI_NPLAN_NATIONAL)
-					snprintf(i->cid, (sizeof(i->cid)-1), "%s%s%s",
-						i->prefix, capi_national_prefix, CID);
-				else if ((callernplan & 0x70) == CAPI_ETSI_NPLAN_INTERNAT)
-					snprintf(i->cid, (sizeof(i->cid)-1), "%s%s%s",
-						i->prefix, capi_international_prefix, CID);
-				else if ((callernplan & 0x70) == CAPI_ETSI_NPLAN_SUBSCRIBER)
-					snprintf(i->cid, (sizeof(i->cid)-1), "%s%s%s",
-						i->prefix, capi_subscriber_prefix, CID);
-				else
-					snprintf(i->cid, (sizeof(i->cid)-1), "%s%s",
-						i->prefix, CID);
-			} else {
-				cc_copy_string(i->cid, emptyid, sizeof(i->cid));
-			}
-			i->cip = CONNECT_IND_CIPVALUE(CMSG);
-			i->PLCI = PLCI;
-			i->MessageNumber = HEADER_MSGNUM(CMSG);
-			i->cid_ton = callernplan;
-
-			i->reserved = 1;
-			cc_mutex_unlock(&iflock);
-			capi_new(i, AST_STATE_DOWN, NULL);
-			if (i->isdnmode == CAPI_ISDNMODE_DID) {
-				i->state = CAPI_STATE_DID;
-			} else {
-				i->state = CAPI_STATE_INCALL;
-			}
 
-			if (!i->owner) {
-				interface_cleanup(i);
-				break;
-			}
-			i->transfercapability = cip2tcap(i->cip);
+		capi_sendf(NULL, 0, CAPI_CONNECT_RESP, CONNECT_IND_PLCI(CMSG), HEADER_MSGNUM(CMSG),
+				"w()()()()()", 1 /* ignore */);
+		return;
+	}
+
+	cc_verbose(4, 1, VERBOSE_PREFIX_4 "%s: msn='%s' DNID='%s' %s\n",
+		i->vname, i->incomingmsn, DNID,
+		(i->isdnmode == CAPI_ISDNMODE_MSN)?"MSN":"DID");
+
+	if ((reject = pbx_capi_admission_check()) != 0) {
+		cc_mutex_unlock(&iflock);
+		cc_verbose(3, 0, VERBOSE_PREFIX_2 "contr%d: overload, %s incoming call '%s' -> '%s'\n",
+			controller, (reject == 1) ? "ignoring" : "rejecting", (CID != NULL) ? CID : "", DNID);
+		capi_sendf(NULL, 0, CAPI_CONNECT_RESP, CONNECT_IND_PLCI(CMSG), HEADER_MSGNUM(CMSG),
+				"w()()()()()", reject);
+		return;
+	}
+
+	cc_copy_string(i->dnid, DNID, sizeof(i->dnid));
+	if (CID != NULL) {
+		if ((callernplan & 0x70) == CAPI_ETSI_NPLAN_NATIONAL)
+			snprintf(i->cid, (sizeof(i->cid)-1), "%s%s%s",
+				i->prefix, capi_national_prefix, CID);
+		else if ((callernplan & 0x70) == CAPI_ETSI_NPLAN_INTERNAT)
+			snprintf(i->cid, (sizeof(i->cid)-1), "%s%s%s",
+				i->prefix, capi_international_prefix, CID);
+		else if ((callernplan & 0x70) == CAPI_ETSI_NPLAN_SUBSCRIBER)
+			snprintf(i->cid, (sizeof(i->cid)-1), "%s%s%s",
+				i->prefix, capi_subscriber_prefix, CID);
+		else
+			snprintf(i->cid, (sizeof(i->cid)-1), "%s%s",
+				i->prefix, CID);
+	} else {
+		cc_copy_string(i->cid, emptyid, sizeof(i->cid));
+	}
+	i->cip = CONNECT_IND_CIPVALUE(CMSG);
+	i->PLCI = PLCI;
+	i->MessageNumber = HEADER_MSGNUM(CMSG);
+	i->cid_ton = callernplan;
+
+	pbx_capi_pool_reserve(i);
+	cc_mutex_unlock(&iflock);
+	pbx_capi_timeline_start(i, CC_TIMELINE_CONNECT_IND, received);
+	pbx_capi_admission_setup_start(&setupStart);
+	capi_new(i, AST_STATE_DOWN, NULL);
+	pbx_capi_admission_setup_done(&setupStart);
+	if (i->isdnmode == CAPI_ISDNMODE_DID) {
+		i->state = CAPI_STATE_DID;
+	} else {
+		i->state = CAPI_STATE_INCALL;
+	}
+
+	if (!i->owner) {
+		interface_cleanup(i);
+		capi_sendf(NULL, 0, CAPI_CONNECT_RESP, CONNECT_IND_PLCI(CMSG), HEADER_MSGNUM(CMSG),
+			"w()()()()()", 1 /* ignore */);
+		return;
+	}
+	i->admissionPending = 1;
+	pbx_capi_admission_pending(1);
+	pbx_capi_timeline_event(i, CC_TIMELINE_CHANNEL);
+	i->transfercapability = cip2tcap(i->cip);
 #ifdef CC_AST_HAS_VERSION_11_0
-			ast_channel_transfercapability_set(i->owner, i->transfercapability);
+	ast_channel_transfercapability_set(i->owner, i->transfercapability);
 #else /* !defined(CC_AST_HAS_VERSION_11_0) */
- 			i->owner->transfercapability = i->transfercapability;
+	i->owner->transfercapability = i->transfercapability;
 #endif /* defined(CC_AST_HAS_VERSION_11_0) */
-			if (capi_tcap_is_digital(i->transfercapability)) {
-				i->bproto = CC_BPROTO_TRANSPARENT;
-			}
+	if (capi_tcap_is_digital(i->transfercapability)) {
+		i->bproto = CC_BPROTO_TRANSPARENT;
+	}
 #ifdef CC_AST_HAS_VERSION_1_8
-			if (CID != NULL) {
-				const char* effective_cid = i->cid;
+	if (CID != NULL) {
+		const char* effective_cid = i->cid;
 
-				/*
-					Preserve original plan if translation is not required or done in dial plan
-					*/
-				if (capi_national_prefix[0]      == 0 &&
-						capi_international_prefix[0] == 0 &&
-						capi_subscriber_prefix[0]    == 0) {
+		/*
+			Preserve original plan if translation is not required or done in dial plan
+			*/
+		if (capi_national_prefix[0]      == 0 &&
+				capi_international_prefix[0] == 0 &&
+				capi_subscriber_prefix[0]    == 0) {
 #ifdef CC_AST_HAS_VERSION_11_0
-					ast_channel_caller(i->owner)->id.number.plan = callernplan;
+			ast_channel_caller(i->owner)->id.number.plan = callernplan;
 #else /* !defined(CC_AST_HAS_VERSION_11_0) */
-					i->owner->caller.id.number.plan = callernplan;
+			i->owner->caller.id.number.plan = callernplan;
 #endif /* defined(CC_AST_HAS_VERSION_11_0) */
-					effective_cid = CID;
-				}
+			effective_cid = CID;
+		}
 #ifdef CC_AST_HAS_VERSION_11_0
-				ast_channel_caller(i->owner)->id.number.presentation = callpres;
+		ast_channel_caller(i->owner)->id.number.presentation = callpres;
 #else /* !defined(CC_AST_HAS_VERSION_11_0) */
-				i->owner->caller.id.number.presentation = callpres;
+		i->owner->caller.id.number.presentation = callpres;
 #endif /* defined(CC_AST_HAS_VERSION_11_0) */
 
-				/* Don't use ast_set_callerid() here because it will
-					 generate a needless NewCallerID event
-					 ast_set_callerid(i->owner, effective_cid, NULL, effective_cid);
-					*/
+		/* Don't use ast_set_callerid() here because it will
+			 generate a needless NewCallerID event
+			 ast_set_callerid(i->owner, effective_cid, NULL, effective_cid);
+			*/
 #ifdef CC_AST_HAS_VERSION_11_0
-				ast_channel_caller(i->owner)->id.number.valid = 1;
-				ast_free(ast_channel_caller(i->owner)->id.number.str);
-				ast_channel_caller(i->owner)->id.number.str = ast_strdup(effective_cid);
+		ast_channel_caller(i->owner)->id.number.valid = 1;
+		ast_free(ast_channel_caller(i->owner)->id.number.str);
+		ast_channel_caller(i->owner)->id.number.str = ast_strdup(effective_cid);
 
-				ast_channel_caller(i->owner)->ani.number.valid = 1;
-				ast_free(ast_channel_caller(i->owner)->ani.number.str);
-				ast_channel_caller(i->owner)->ani.number.str = ast_strdup(effective_cid);
+		ast_channel_caller(i->owner)->ani.number.valid = 1;
+		ast_free(ast_channel_caller(i->owner)->ani.number.str);
+		ast_channel_caller(i->owner)->ani.number.str = ast_strdup(effective_cid);
 #else /* !defined(CC_AST_HAS_VERSION_11_0) */
-				i->owner->caller.id.number.valid = 1;
-				ast_free(i->owner->caller.id.number.str);
-				i->owner->caller.id.number.str = ast_strdup(effective_cid);
+		i->owner->caller.id.number.valid = 1;
+		ast_free(i->owner->caller.id.number.str);
+		i->owner->caller.id.number.str = ast_strdup(effective_cid);
 
-				i->owner->caller.ani.number.valid = 1;
-				ast_free(i->owner->caller.ani.number.str);
-				i->owner->caller.ani.number.str = ast_strdup(effective_cid);
+		i->owner->caller.ani.number.valid = 1;
+		ast_free(i->owner->caller.ani.number.str);
+		i->owner->caller.ani.number.str = ast_strdup(effective_cid);
 #endif /* defined(CC_AST_HAS_VERSION_11_0) */
-			}
+	}
 #else
-			i->owner->cid.cid_pres = callpres;
+	i->owner->cid.cid_pres = callpres;
 #endif
-			cc_verbose(3, 0, VERBOSE_PREFIX_2 "%s: Incoming call '%s' -> '%s'\n",
-				i->vname, i->cid, i->dnid);
+	cc_verbose(3, 0, VERBOSE_PREFIX_2 "%s: Incoming call '%s' -> '%s'\n",
+		i->vname, i->cid, i->dnid);
 
-			*interface = i;
-			cc_mutex_unlock(&iflock);
-			*interface_owner = capidev_acquire_locks_from_thread_context (i);
-		
-			pbx_builtin_setvar_helper(i->owner, "TRANSFERCAPABILITY", transfercapability2str(i->transfercapability));
-			pbx_builtin_setvar_helper(i->owner, "BCHANNELINFO", bchannelinfo);
-			sprintf(buffer, "%d", callednplan);
-			pbx_builtin_setvar_helper(i->owner, "CALLEDTON", buffer);
-			sprintf(buffer, "%d", i->cip);
-			pbx_builtin_setvar_helper(i->owner, "CAPI_CIP", buffer);
-			/*
-			pbx_builtin_setvar_helper(i->owner, "CALLINGSUBADDRESS",
-				CONNECT_IND_CALLINGPARTYSUBADDRESS(CMSG));
-			pbx_builtin_setvar_helper(i->owner, "CALLEDSUBADDRESS",
-				CONNECT_IND_CALLEDPARTYSUBADDRESS(CMSG));
-			pbx_builtin_setvar_helper(i->owner, "USERUSERINFO",
-				CONNECT_IND_USERUSERDATA(CMSG));
-			*/
-			/* TODO : set some more variables on incoming call */
-			/*
-			pbx_builtin_setvar_helper(i->owner, "ANI2", buffer);
-			pbx_builtin_setvar_helper(i->owner, "SECONDCALLERID", buffer);
-			*/
+	*interface = i;
+	cc_mutex_unlock(&iflock);
+	*interface_owner = capidev_acquire_locks_from_thread_context (i);
+
+	pbx_builtin_setvar_helper(i->owner, "TRANSFERCAPABILITY", transfercapability2str(i->transfercapability));
+	pbx_builtin_setvar_helper(i->owner, "BCHANNELINFO", bchannelinfo);
+	sprintf(buffer, "%d", callednplan);
+	pbx_builtin_setvar_helper(i->owner, "CALLEDTON", buffer);
+	sprintf(buffer, "%d", i->cip);
+	pbx_builtin_setvar_helper(i->owner, "CAPI_CIP", buffer);
+	/*
+	pbx_builtin_setvar_helper(i->owner, "CALLINGSUBADDRESS",
+		CONNECT_IND_CALLINGPARTYSUBADDRESS(CMSG));
+	pbx_builtin_setvar_helper(i->owner, "CALLEDSUBADDRESS",
+		CONNECT_IND_CALLEDPARTYSUBADDRESS(CMSG));
+	pbx_builtin_setvar_helper(i->owner, "USERUSERINFO",
+		CONNECT_IND_USERUSERDATA(CMSG));
+	*/
+	/* TODO : set some more variables on incoming call */
+	/*
+	pbx_builtin_setvar_helper(i->owner, "ANI2", buffer);
+	pbx_builtin_setvar_helper(i->owner, "SECONDCALLERID", buffer);
+	*/
 
-			/* Handle QSIG informations, if any */
-			cc_qsig_handle_capiind(CONNECT_IND_FACILITYDATAARRAY(CMSG), i);
+	/* Handle QSIG informations, if any */
+	cc_qsig_handle_capiind(CONNECT_IND_FACILITYDATAARRAY(CMSG), i);
 
 #ifdef DIVA_STREAMING
-			i->diva_stream_entry = 0;
-			if (pbx_capi_streaming_supported (i) != 0) {
-				capi_DivaStreamingOn(i, 0, 0);
-			}
-#endif
-		
-			if (i->immediate) {	
-				if ((i->isdnmode == CAPI_ISDNMODE_MSN) || (!(strlen(i->dnid)))) {
-					/* if we don't want to wait for SETUP/SENDING-COMPLETE in MSN mode */
-					/* or if no DNID in DID mode is provided (e.g. Austrian line) */
-					start_pbx_on_match(i, PLCI, HEADER_MSGNUM(CMSG));
-				}
-			}
-			return;
-		}
+	i->diva_stream_entry = 0;
+	if (pbx_capi_streaming_supported (i) != 0) {
+		capi_DivaStreamingOn(i, 0, 0);
 	}
-	cc_mutex_unlock(&iflock);
-
-	/* obviously we are not called...so tell capi to ignore this call */
+#endif
 
-	if (capidebug) {
-		cc_log(LOG_WARNING, "did not find device for msn = %s\n", DNID);
+	if (i->immediate) {	
+		if ((i->isdnmode == CAPI_ISDNMODE_MSN) || (!(strlen(i->dnid)))) {
+			/* if we don't want to wait for SETUP/SENDING-COMPLETE in MSN mode */
+			/* or if no DNID in DID mode is provided (e.g. Austrian line) */
+			start_pbx_on_match(i, PLCI, HEADER_MSGNUM(CMSG));
+		}
 	}
-	
-	capi_sendf(NULL, 0, CAPI_CONNECT_RESP, CONNECT_IND_PLCI(CMSG), HEADER_MSGNUM(CMSG),
-			"w()()()()()", 1 /* ignore */);
 	return;
 }
 
@@ -6021,6 +6389,7 @@ void capidev_handle_connection_conf(struct capi_pvt **i, unsigned int PLCI,
 
 	if (wInfo == 0) {
 		ii->PLCI = PLCI;
+		pbx_capi_timeline_event(ii, CC_TIMELINE_CONNECT_CONF);
 	} else {
 		/* error in connect, so set correct state and signal busy */
 		ii->state = CAPI_STATE_DISCONNECTED;
@@ -6209,8 +6578,8 @@ static void capidev_handle_msg(_cmsg *CMSG)
 		break;
 	case CAPI_P_CONF(DATA_B3):
 		wInfo = DATA_B3_CONF_INFO(CMSG);
-		if ((i) && (i->B3count > 0)) {
-			i->B3count--;
+		if (i) {
+			capi_b3count_release(i);
 		}
 		if ((i) && (i->FaxState & CAPI_FAX_STATE_SENDMODE)) {
 			capidev_send_faxdata(i);
@@ -7804,6 +8173,7 @@ static struct capicommands_s {
 	{ "chat_mute",    pbx_capi_chat_mute,       0, 0, 0 },
 	{ "chat_play",    pbx_capi_chat_play,       0, 0, 0 },
 	{ "chat_connect", pbx_capi_chat_connect,    0, 0, 1 },
+	{ "chat_broadcast", pbx_capi_chat_broadcast, 0, 0, 1 },
 	{ "resource",         pbx_capi_chat_associate_resource_plci, 0, 0, 0 },
 	{ "mwi",          pbx_capi_mwi,             1, 0, 0 },
 	{ "hangup",       pbx_capi_realhangup,      0, 0, 0 },
@@ -8263,6 +8633,20 @@ static void capidev_run_secondly(time_t now)
 	cc_mutex_unlock(&iflock);
 }
 
+/*
+ * restart a fax send which was waiting for file data
+ */
+static void capidev_resume_faxdata(void *owner)
+{
+	struct capi_pvt *i = (struct capi_pvt *)owner;
+
+	cc_mutex_lock(&i->lock);
+	if ((i->faxio) && (i->FaxState & CAPI_FAX_STATE_SENDMODE)) {
+		capidev_send_faxdata(i);
+	}
+	cc_mutex_unlock(&i->lock);
+}
+
 /*
  * Main loop to read the capi_device.
  */
@@ -8276,7 +8660,10 @@ static void *capidev_loop(void *data)
 	cc_log(LOG_NOTICE, "Started CAPI device thread for CAPI Appl-ID %d.\n", capi_ApplID);
 
 	for (/* for ever */;;) {
-		switch(Info = capidev_check_wait_get_cmsg(&monCMSG)) {
+		pbx_capi_admission_wait_start();
+		Info = capidev_check_wait_get_cmsg(&monCMSG);
+		pbx_capi_admission_wait_done(Info != 0x0000);
+		switch(Info) {
 		case 0x0000:
 			capidev_handle_msg(&monCMSG);
 			capi_do_channel_task();
@@ -8296,10 +8683,12 @@ static void *capidev_loop(void *data)
 			/* something is wrong! */
 			break;
 		} /* switch */
+		pbx_capi_fax_io_resume(capidev_resume_faxdata);
 		newtime = time(NULL);
 		if (lastcall != newtime) {
 			lastcall = newtime;
 			capidev_run_secondly(newtime);
+			pbx_capi_admission_secondly();
 #ifdef DIVA_STATUS
 			diva_status_process_events();
 #endif
@@ -8337,6 +8726,7 @@ void capi_gains(struct cc_capi_gains *g, float rxgain, float txgain)
 			} else {
 				g->rxgains[i] = capi_int2alaw(x);
 			}
+			g->rxgainsreversed[i] = capi_reversebits[g->rxgains[i]];
 		}
 	}
 	
@@ -8369,6 +8759,7 @@ int mkif(struct cc_capi_conf *conf)
 	int i = 0;
 	u_int16_t unit;
 	struct cc_capi_controller *mwiController = 0;
+	struct capi_pvt_pool *pool = NULL;
 
 	for (i = 0; i <= conf->devices; i++) {
 		tmp = ast_malloc(sizeof(struct capi_pvt));
@@ -8429,6 +8820,14 @@ int mkif(struct cc_capi_conf *conf)
 			return 0;
 		}
 
+		if (pool == NULL) {
+			pool = pbx_capi_pool_create(conf, unit);
+			if (pool == NULL) {
+				ast_free(tmp);
+				return -1;
+			}
+		}
+
 		capi_controllers[unit]->used = 1;
 		capi_controllers[unit]->ecPath = conf->echocancelpath;
 		capi_controllers[unit]->ecOnTransit = conf->econtransitconn;
@@ -8475,6 +8874,13 @@ int mkif(struct cc_capi_conf *conf)
 		
 		tmp->next = capi_iflist; /* prepend */
 		capi_iflist = tmp;
+
+		tmp->pool = pool;
+		if (tmp->channeltype == CAPI_CHANNELTYPE_D) {
+			pool->dchannel = tmp;
+		} else {
+			pbx_capi_pool_put(tmp);
+		}
 		cc_verbose(2, 0, VERBOSE_PREFIX_3 CC_MESSAGE_NAME
 			" %c %s (%s:%s) contr=%d devs=%d EC=%d,opt=%d,tail=%d\n",
 			(tmp->channeltype == CAPI_CHANNELTYPE_B)? 'B' : 'D',
@@ -8784,6 +9190,7 @@ static int cc_init_capi(void)
 #endif
 
 		AST_LIST_HEAD_INIT_NOLOCK(&cp->mwiSubscribtions);
+		diva_q_init(&cp->pools);
 
 		capi_controllers[controller] = cp;
 	}
@@ -8839,6 +9246,10 @@ static int cc_post_init_capi(void)
 																																	pbx_capi_interface_status_changed,
 																																	pbx_capi_hw_status_changed);
 					capi_controllers[controller]->hwState = hwState;
+					pbx_capi_update_controller_bit(&capi_controllers_ifc_unavailable, controller,
+						capi_controllers[controller]->interfaceState == (int)DivaStatusInterfaceStateERROR);
+					pbx_capi_update_controller_bit(&capi_controllers_hw_unavailable, controller,
+						hwState == DivaStatusHardwareStateERROR);
 				}
 #endif
 				/*
@@ -8852,6 +9263,24 @@ static int cc_post_init_capi(void)
 		}
 	}
 
+#ifdef DIVA_STREAMING
+	{
+		unsigned int streams = 0;
+		int streaming = 0;
+
+		for (controller = 1; controller <= capi_num_controllers; controller++) {
+			if ((capi_controllers[controller]->used) &&
+			    (capi_controllers[controller]->divaStreaming != 0)) {
+				streams += capi_DivaStreamingGetPoolSize(capi_controllers[controller]->nbchannels);
+				streaming = 1;
+			}
+		}
+		if (streaming != 0) {
+			capi_DivaStreamingPoolInit(streams);
+		}
+	}
+#endif
+
 	return 0;
 }
 
@@ -9123,6 +9552,12 @@ static int capi_eval_config(struct ast_config *cfg)
 	/* Copy the default jb config over global_jbconf */
 	memcpy(&global_jbconf, &default_jbconf, sizeof(struct ast_jb_conf));
 #endif
+#ifdef CAPI20EXT_HAS_RECV_ARENA
+	capi20ext_set_recv_arena(0);
+#endif
+	pbx_capi_chat_set_speaker_interval(0);
+	pbx_capi_chat_set_workers(PBX_CHAT_DEFAULT_WORKERS);
+	pbx_capi_admission_init_module();
 
 	/* read the general section */
 	for (v = ast_variable_browse(cfg, "general"); v; v = v->next) {
@@ -9155,11 +9590,45 @@ static int capi_eval_config(struct ast_config *cfg)
 			if (ast_true(v->value)) {
 				capi_capability = CC_FORMAT_ULAW;
 			}
+		} else if (!strcasecmp(v->name, "chatspeakerevents")) {
+			unsigned int interval;
+
+			if (sscanf(v->value, "%u", &interval) != 1) {
+				cc_log(LOG_ERROR, "invalid chatspeakerevents\n");
+			} else {
+				pbx_capi_chat_set_speaker_interval(interval);
+			}
+		} else if (!strcasecmp(v->name, "chatworkers")) {
+			unsigned int workers;
+
+			if (sscanf(v->value, "%u", &workers) != 1) {
+				cc_log(LOG_ERROR, "invalid chatworkers\n");
+			} else {
+				pbx_capi_chat_set_workers(workers);
+			}
+		} else if (pbx_capi_admission_config(v->name, v->value) == 0) {
+			/* admission control */
+#ifdef CAPI20EXT_HAS_RECV_ARENA
+		} else if (!strcasecmp(v->name, "recvbufferarena")) {
+			if (!strcasecmp(v->value, "hugepages")) {
+				capi20ext_set_recv_arena(CAPI20EXT_RECV_ARENA | CAPI20EXT_RECV_ARENA_HUGEPAGES);
+			} else if (ast_true(v->value)) {
+				capi20ext_set_recv_arena(CAPI20EXT_RECV_ARENA);
+			}
+#endif
 #ifdef DIVA_STREAMING
 		} else if (!strcasecmp(v->name, "nodivastreaming")) {
 			if (ast_true(v->value)) {
 				capi_DivaStreamingDisable ();
 			}
+		} else if (!strcasecmp(v->name, "divastreamingpool")) {
+			int streams;
+
+			if ((sscanf(v->value, "%d", &streams) != 1) || (streams < 0)) {
+				cc_log(LOG_ERROR, "invalid divastreamingpool\n");
+			} else {
+				capi_DivaStreamingSetPoolSize(streams);
+			}
 #endif
 		}
 	}
@@ -9229,6 +9698,8 @@ int unload_module(void)
 	ast_module_user_hangup_all();
 #endif
 
+	pbx_capi_chat_cleanup_module();
+
 	if (capi_device_thread != (pthread_t)(0-1)) {
 		pthread_cancel(capi_device_thread);
 		pthread_kill(capi_device_thread, SIGURG);
@@ -9236,6 +9707,12 @@ int unload_module(void)
 		capi_device_thread = (pthread_t)(0-1);
 	}
 
+	pbx_capi_fax_io_cleanup_module();
+	pbx_capi_announce_cleanup_module();
+#ifdef DIVA_STREAMING
+	capi_DivaStreamingPoolCleanup();
+#endif
+
 	cc_mutex_lock(&iflock);
 
 	if (capi_ApplID != CAPI_APPLID_UNUSED) {
@@ -9243,6 +9720,8 @@ int unload_module(void)
 			cc_log(LOG_WARNING,"Unable to unregister from CAPI!\n");
 	}
 
+	pbx_capi_pool_cleanup();
+
 	for (controller = 1; controller <= CAPI_MAX_CONTROLLERS; controller++) {
 		if (capi_controllers[controller]) {
 			pbx_capi_cleanup_mwi(capi_controllers[controller]);
@@ -9388,6 +9867,9 @@ int load_module(void)
 	pbx_capi_ami_register(myself);
 	pbx_capi_register_device_state_providers();
 	pbx_capi_chat_init_module();
+	pbx_capi_fax_io_init_module();
+	pbx_capi_announce_init_module();
+	pbx_capi_timeline_init_module();
 	
 	ast_register_application(commandapp, pbx_capicommand_exec, commandsynopsis, commandtdesc);
 
@@ -9526,6 +10008,19 @@ int pbx_capi_get_num_controllers(void)
 }
 
 #ifdef DIVA_STATUS
+/*!
+	\brief Set or clear bit of controller in controller mask
+	*/
+static void pbx_capi_update_controller_bit(unsigned long long *mask, int controller, int set)
+{
+	unsigned long long current, value;
+
+	do {
+		current = cc_atomic_load(mask);
+		value = (set != 0) ? (current | CC_CONTROLLER_BIT(controller)) : (current & ~CC_CONTROLLER_BIT(controller));
+	} while (!cc_atomic_cas(mask, current, value));
+}
+
 /*!
 	\brief Notify about interface state change
 
@@ -9541,6 +10036,8 @@ static void pbx_capi_interface_status_changed(int controller, diva_status_interf
 	cc_mutex_lock(&iflock);
 	currentInterfaceState = capi_controllers[controller]->interfaceState;
 	capi_controllers[controller]->interfaceState = newInterfaceState;
+	pbx_capi_update_controller_bit(&capi_controllers_ifc_unavailable, controller,
+		newInterfaceState == DivaStatusInterfaceStateERROR);
 	cc_mutex_unlock(&iflock);
 
 	newControllerStatus = (pbx_capi_check_controller_status(controller) != -1);
@@ -9561,6 +10058,8 @@ static void pbx_capi_hw_status_changed(int controller, diva_status_hardware_stat
 	cc_mutex_lock(&iflock);
 	currentHwState = capi_controllers[controller]->hwState;
 	capi_controllers[controller]->hwState = newHwState;
+	pbx_capi_update_controller_bit(&capi_controllers_hw_unavailable, controller,
+		newHwState == DivaStatusHardwareStateERROR);
 	cc_mutex_unlock(&iflock);
 
 	cc_verbose(1, 0, VERBOSE_PREFIX_1 "CAPI%d: hardware state changed %s -> %s\n",
@@ -9570,29 +10069,31 @@ static void pbx_capi_hw_status_changed(int controller, diva_status_hardware_stat
 }
 #endif
 
-/*! \brief Check interface is operational. If the state of the interface
-					 is not known then check if one with known state is available.
+/*! \brief Check interface is operational.
 
-		\note Called with iflock taken
+		\return -1 if the interface is known to be not operational, zero otherwise
 
-		\note The core runs twice over the interface list, but this allows to preserve
-					the structure of the original code which uses this function.
+		\note Uses the mask of unavailable controllers, no locks are required
 	*/
 static int pbx_capi_check_controller_status(int capiController)
 {
-#ifdef DIVA_STATUS
-	if (capi_controllers[capiController]->interfaceState == (int)DivaStatusInterfaceStateOK) /* known, OK */
-		return 0;
+	return (((cc_atomic_load(&capi_controllers_ifc_unavailable) & CC_CONTROLLER_BIT(capiController)) != 0) ? -1 : 0);
+}
 
-	if (capi_controllers[capiController]->interfaceState == (int)DivaStatusInterfaceStateERROR) /* known, not OK */
-		return -1;
+unsigned long long pbx_capi_get_hw_unavailable_controllers(void)
+{
+	return (cc_atomic_load(&capi_controllers_hw_unavailable));
+}
 
-	/*
-		Unknown interface state
-		*/
-#endif
+void pbx_capi_count_skipped_controllers(unsigned long long mask)
+{
+	int controller;
 
-	return 1;
+	for (controller = 1; (mask != 0) && (controller <= capi_num_controllers); controller++, mask >>= 1) {
+		if ((mask & 1) != 0) {
+			cc_atomic_add(&capi_controllers[controller]->routingSkipped, 1);
+		}
+	}
 }
 
 const char* pbx_capi_get_module_description(void)
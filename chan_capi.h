@@ -54,6 +54,7 @@
 struct _diva_stream_scheduling_entry;
 #endif
 struct _pbx_capi_conference_bridge;
+struct _cc_capi_fax_io;
 
 #define CAPI_MAX_CONTROLLERS             64
 #define CAPI_MAX_B3_BLOCKS                7
@@ -286,6 +287,21 @@ typedef struct fax3proto3 B3_PROTO_FAXG3;
 
 #define CAPI_STATE_ONHOLD              10
 
+/*
+ * call signalling timeline events, incoming calls start with
+ * CONNECT_IND, outgoing calls with CALL
+ */
+#define CC_TIMELINE_CONNECT_IND         0  /* CONNECT_IND received */
+#define CC_TIMELINE_CHANNEL             1  /* capi_new() done */
+#define CC_TIMELINE_PBX_START           2  /* PBX started */
+#define CC_TIMELINE_ALERT               3  /* ALERT_REQ sent */
+#define CC_TIMELINE_ANSWER              4  /* CONNECT_RESP (accept) sent */
+#define CC_TIMELINE_CALL                5  /* pbx_capi_call() */
+#define CC_TIMELINE_CONNECT_CONF        6  /* CONNECT_CONF received */
+#define CC_TIMELINE_CONNECT_ACTIVE      7  /* CONNECT_ACTIVE_IND received */
+#define CC_TIMELINE_B3_ACTIVE           8  /* CONNECT_B3_ACTIVE_IND received */
+#define CC_TIMELINE_EVENTS              9
+
 #define CAPI_B3_DONT                    0
 #define CAPI_B3_ALWAYS                  1
 #define CAPI_B3_ON_SUCCESS              2
@@ -304,6 +320,7 @@ typedef struct fax3proto3 B3_PROTO_FAXG3;
 struct cc_capi_gains {
 	unsigned char txgains[256];
 	unsigned char rxgains[256];
+	unsigned char rxgainsreversed[256]; /* rxgains followed by bit reversal */
 };
 
 #define CAPI_ISDN_STATE_SETUP         0x00000001
@@ -494,8 +511,8 @@ struct capi_pvt {
 	/* Features and settings of current connection */
 	unsigned int fsetting;
 	
-	/* if not null, receiving a fax */
-	FILE *fFax;
+	/* if not null, sending or receiving a fax */
+	struct _cc_capi_fax_io *faxio;
 	/* Fax status */
 	unsigned int FaxState;
 	/* Window for fax detection */
@@ -522,6 +539,10 @@ struct capi_pvt {
 	float rxmin;
 	float txmin;
 
+	/* level of received voice, chat speaker tracking */
+	int rx_level_enabled;
+	unsigned int rx_level;
+
 	unsigned short divaAudioFlags;
 	unsigned short divaDataStubAudioFlags;
 	unsigned short divaDigitalRxGain;
@@ -558,15 +579,13 @@ struct capi_pvt {
 	time_t whentoretrieve;
 
 	/* RTP */
-#ifdef CC_AST_HAS_RTP_ENGINE_H
-	struct ast_rtp_instance *rtp;
-#else
-	struct ast_rtp *rtp;
-#endif
+	int rtp; /* B channel uses RTP framing, headers are built by chan_capi */
 	cc_format_t capability;
 	int rtpcodec;
 	int codec;
 	unsigned int timestamp;
+	unsigned short rtpseq;
+	unsigned int rtpssrc;
 
 	/* Q.SIG features */
 	int qsigfeat;
@@ -588,10 +607,44 @@ struct capi_pvt {
 	int virtualBridgePeer;
 	struct capi_pvt *bridgePeer;
 
+	/*! Incoming call waits for PBX start, counted by admission control */
+	int admissionPending;
+
+	/*! Monotonic time (us) of call signalling events, 0 if not reached */
+	unsigned long long timeline[CC_TIMELINE_EVENTS];
+
+	/*! Interfaces created from same configuration section */
+	struct capi_pvt_pool *pool;
+	/*! Link in list of free interfaces of pool */
+	diva_entity_link_t pool_link;
+	int in_pool;
+
 	/*! Next channel in list */
 	struct capi_pvt *next;
 };
 
+/*
+ * Interfaces created from one configuration section. Free B channel
+ * interfaces are kept in a list, so channel selection does not need
+ * to scan the interface list.
+ */
+struct capi_pvt_pool {
+	/* pools of controller, same order as capi_iflist */
+	diva_entity_link_t link;
+	/* next pool in name hash chain */
+	struct capi_pvt_pool *next_name;
+	char name[CAPI_MAX_STRING];
+	int controller;
+	ast_group_t group;
+	/* pseudo D channel interface */
+	struct capi_pvt *dchannel;
+	/* free B channel interfaces */
+	diva_entity_queue_t free;
+	int nfree;
+	/* position in capi_iflist, higher first */
+	unsigned int priority;
+};
+
 struct cc_capi_profile {
 	unsigned short ncontrollers;
 	unsigned short nbchannels;
@@ -740,8 +793,17 @@ struct cc_capi_controller {
 	int interfaceState;
 	int hwState;
 #endif
+	/* calls not routed to this controller due to interface or hardware state */
+	unsigned long long routingSkipped;
+	/* interface pools of this controller */
+	diva_entity_queue_t pools;
+	/* incoming MSN/DID to interface pool */
+	struct _cc_capi_msn_index *msnIndex;
 };
 
+/* bit of controller in controller masks */
+#define CC_CONTROLLER_BIT(__x__) (1ULL << ((__x__) - 1))
+
 /* ETSI 300 102-1 Numbering Plans */
 #define CAPI_ETSI_NPLAN_SUBSCRIBER              0x40
 #define CAPI_ETSI_NPLAN_NATIONAL                0x20
@@ -818,6 +880,14 @@ _cstruct diva_get_b1_conf(struct capi_pvt *i);
 	\brief &capi_controllers[controller]
 	*/
 const struct cc_capi_controller *pbx_capi_get_controller(int controller);
+/*!
+	\brief Mask of controllers with hardware in error state
+	*/
+unsigned long long pbx_capi_get_hw_unavailable_controllers(void);
+/*!
+	\brief Count outgoing calls not routed to controllers in mask due to controller state
+	*/
+void pbx_capi_count_skipped_controllers(unsigned long long mask);
 /*!
 	\brief capi_num_controllers
 	*/
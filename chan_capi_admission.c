@@ -0,0 +1,247 @@
+/*
+ * An implementation of Common ISDN API 2.0 for Asterisk
+ *
+ * Admission control for incoming calls
+ *
+ * If many calls arrive at once (e.g. after a line recovered) the
+ * device thread creates channels and starts the PBX as fast as it
+ * can, and all calls slow down together. Before an incoming call is
+ * accepted the admission control checks
+ *  - the amount of incoming calls waiting for the PBX to start,
+ *  - the time the device thread is busy without waiting for a CAPI
+ *    message (backlog of the device thread),
+ *  - the average time needed to create a channel and start the PBX.
+ * If a configured limit is exceeded the call is rejected with the
+ * configured cause or ignored. Established calls are not affected.
+ *
+ * All functions except pbx_capi_admission_pending() and
+ * pbx_capi_admission_show() are called by the device thread.
+ *
+ * This program is free software and may be modified and
+ * distributed under the terms of the GNU Public License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "chan_capi_platform.h"
+#include "chan_capi20.h"
+#include "chan_capi.h"
+#include "chan_capi_utils.h"
+#include "chan_capi_admission.h"
+
+/*
+ * configuration, zero disables the limit
+ */
+static unsigned int admission_max_pending;
+static unsigned int admission_max_backlog;  /* ms */
+static unsigned int admission_max_setup;    /* ms */
+static int admission_cause = CC_ADMISSION_DEFAULT_CAUSE;
+static int admission_ignore;
+
+/*
+ * state
+ */
+static int admission_pending;
+static struct timespec admission_wait_start;
+static struct timespec admission_last_idle;
+static unsigned int admission_setup_us;     /* moving average */
+static unsigned int admission_setup_samples;
+
+/*
+ * statistics
+ */
+static unsigned long long admission_accepted;
+static unsigned long long admission_rejected_pending;
+static unsigned long long admission_rejected_backlog;
+static unsigned long long admission_rejected_setup;
+
+static inline unsigned long long admission_elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+	return ((unsigned long long)(end->tv_sec - start->tv_sec) * 1000000ULL +
+		(end->tv_nsec - start->tv_nsec) / 1000);
+}
+
+void pbx_capi_admission_init_module(void)
+{
+	admission_max_pending = 0;
+	admission_max_backlog = 0;
+	admission_max_setup = 0;
+	admission_cause = CC_ADMISSION_DEFAULT_CAUSE;
+	admission_ignore = 0;
+
+	admission_pending = 0;
+	clock_gettime(CLOCK_MONOTONIC, &admission_last_idle);
+	admission_setup_us = 0;
+	admission_setup_samples = 0;
+
+	admission_accepted = 0;
+	admission_rejected_pending = 0;
+	admission_rejected_backlog = 0;
+	admission_rejected_setup = 0;
+}
+
+/*
+ * parse option of general section
+ *
+ * \return zero if option was handled
+ */
+int pbx_capi_admission_config(const char *name, const char *value)
+{
+	unsigned int *limit = NULL;
+	unsigned int v;
+
+	if (!strcasecmp(name, "admissionmaxpending")) {
+		limit = &admission_max_pending;
+	} else if (!strcasecmp(name, "admissionmaxbacklog")) {
+		limit = &admission_max_backlog;
+	} else if (!strcasecmp(name, "admissionmaxsetup")) {
+		limit = &admission_max_setup;
+	} else if (!strcasecmp(name, "admissioncause")) {
+		if ((sscanf(value, "%u", &v) != 1) || (v == 0) || (v > 127)) {
+			cc_log(LOG_ERROR, "invalid %s\n", name);
+		} else {
+			admission_cause = (int)v;
+		}
+		return 0;
+	} else if (!strcasecmp(name, "admissionaction")) {
+		if (!strcasecmp(value, "ignore")) {
+			admission_ignore = 1;
+		} else if (!strcasecmp(value, "reject")) {
+			admission_ignore = 0;
+		} else {
+			cc_log(LOG_ERROR, "invalid %s\n", name);
+		}
+		return 0;
+	} else {
+		return -1;
+	}
+
+	if (sscanf(value, "%u", &v) != 1) {
+		cc_log(LOG_ERROR, "invalid %s\n", name);
+	} else {
+		*limit = v;
+	}
+
+	return 0;
+}
+
+/*
+ * check if new incoming call can be accepted
+ *
+ * \return zero to accept the call, Reject value of CONNECT_RESP otherwise
+ */
+int pbx_capi_admission_check(void)
+{
+	unsigned long long *counter = NULL;
+	struct timespec now;
+
+	if ((admission_max_pending != 0) &&
+	    ((unsigned int)cc_atomic_load(&admission_pending) >= admission_max_pending)) {
+		counter = &admission_rejected_pending;
+	} else if (admission_max_backlog != 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (admission_elapsed_us(&admission_last_idle, &now) > admission_max_backlog * 1000ULL) {
+			counter = &admission_rejected_backlog;
+		}
+	}
+	if ((counter == NULL) && (admission_max_setup != 0) &&
+	    (admission_setup_us > admission_max_setup * 1000U)) {
+		counter = &admission_rejected_setup;
+	}
+
+	if (counter == NULL) {
+		admission_accepted++;
+		return 0;
+	}
+
+	(*counter)++;
+
+	return ((admission_ignore != 0) ? 1 : (0x3480 | admission_cause));
+}
+
+/*
+ * incoming calls waiting for the PBX to start
+ */
+void pbx_capi_admission_pending(int delta)
+{
+	cc_atomic_add(&admission_pending, delta);
+}
+
+/*
+ * track time the device thread waits for CAPI messages
+ */
+void pbx_capi_admission_wait_start(void)
+{
+	if (admission_max_backlog != 0) {
+		clock_gettime(CLOCK_MONOTONIC, &admission_wait_start);
+	}
+}
+
+void pbx_capi_admission_wait_done(int empty)
+{
+	struct timespec now;
+
+	if (admission_max_backlog != 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((empty) || (admission_elapsed_us(&admission_wait_start, &now) >= CC_ADMISSION_IDLE_US)) {
+			admission_last_idle = now;
+		}
+	}
+}
+
+/*
+ * track time needed to create a channel or to start the PBX
+ */
+void pbx_capi_admission_setup_start(struct timespec *start)
+{
+	if (admission_max_setup != 0) {
+		clock_gettime(CLOCK_MONOTONIC, start);
+	}
+}
+
+void pbx_capi_admission_setup_done(const struct timespec *start)
+{
+	struct timespec now;
+	unsigned long long us;
+
+	if (admission_max_setup == 0) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = admission_elapsed_us(start, &now);
+	if (us > 60000000ULL) {
+		us = 60000000ULL;
+	}
+	/* average of about the last 8 samples */
+	admission_setup_us = (unsigned int)((admission_setup_us * 7ULL + us) / 8);
+	admission_setup_samples++;
+}
+
+/*
+ * if no call was set up for one second the average decays, so calls
+ * are accepted again after all calls were rejected
+ */
+void pbx_capi_admission_secondly(void)
+{
+	if (admission_setup_samples == 0) {
+		admission_setup_us /= 2;
+	}
+	admission_setup_samples = 0;
+}
+
+/*
+ * CLI: show admission control state
+ */
+void pbx_capi_admission_show(int fd)
+{
+	ast_cli(fd, "Admission: %d pending, setup %u us, limits: pending %u, backlog %u ms, setup %u ms\n",
+		cc_atomic_load(&admission_pending), admission_setup_us,
+		admission_max_pending, admission_max_backlog, admission_max_setup);
+	ast_cli(fd, "Admission: %llu accepted, %llu rejected (pending %llu, backlog %llu, setup %llu)\n",
+		admission_accepted,
+		admission_rejected_pending + admission_rejected_backlog + admission_rejected_setup,
+		admission_rejected_pending, admission_rejected_backlog, admission_rejected_setup);
+}
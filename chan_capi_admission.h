@@ -0,0 +1,40 @@
+/*
+ * An implementation of Common ISDN API 2.0 for Asterisk
+ *
+ * Admission control for incoming calls
+ *
+ * This program is free software and may be modified and
+ * distributed under the terms of the GNU Public License.
+ */
+
+#ifndef _PBX_CAPI_ADMISSION_H
+#define _PBX_CAPI_ADMISSION_H
+
+/*
+ * Device thread is considered idle if it waited at least this time
+ * for a CAPI message
+ */
+#define CC_ADMISSION_IDLE_US        200
+
+/*
+ * Default cause used to reject calls (no circuit/channel available)
+ */
+#define CC_ADMISSION_DEFAULT_CAUSE  34
+
+struct timespec;
+
+/*
+ * prototypes
+ */
+extern void pbx_capi_admission_init_module(void);
+extern int pbx_capi_admission_config(const char *name, const char *value);
+extern int pbx_capi_admission_check(void);
+extern void pbx_capi_admission_pending(int delta);
+extern void pbx_capi_admission_wait_start(void);
+extern void pbx_capi_admission_wait_done(int empty);
+extern void pbx_capi_admission_setup_start(struct timespec *start);
+extern void pbx_capi_admission_setup_done(const struct timespec *start);
+extern void pbx_capi_admission_secondly(void);
+extern void pbx_capi_admission_show(int fd);
+
+#endif
@@ -31,6 +31,8 @@
 #include "chan_capi_utils.h"
 #include "chan_capi_chat.h"
 #include "chan_capi_management_common.h"
+#include "chan_capi_ami.h"
+#include "chan_capi_timeline.h"
 #include "asterisk/manager.h"
 
 #ifdef CC_AST_HAS_VERSION_1_6
@@ -39,7 +41,9 @@
 #define CC_AMI_ACTION_NAME_CHATMUTE    "CapichatMute"
 #define CC_AMI_ACTION_NAME_CHATUNMUTE  "CapichatUnmute"
 #define CC_AMI_ACTION_NAME_CHATREMOVE  "CapichatRemove"
+#define CC_AMI_ACTION_NAME_CHATBROADCAST "CapichatBroadcast"
 #define CC_AMI_ACTION_NAME_CAPICOMMAND "CapiCommand"
+#define CC_AMI_ACTION_NAME_TIMELINE    "CapiTimeline"
 
 /*
 	LOCALS
@@ -48,13 +52,17 @@ static int pbx_capi_ami_capichat_list(struct mansession *s, const struct message
 static int pbx_capi_ami_capichat_mute(struct mansession *s, const struct message *m);
 static int pbx_capi_ami_capichat_unmute(struct mansession *s, const struct message *m);
 static int pbx_capi_ami_capichat_remove(struct mansession *s, const struct message *m);
+static int pbx_capi_ami_capichat_broadcast(struct mansession *s, const struct message *m);
 static int pbx_capi_ami_capichat_control(struct mansession *s, const struct message *m, int chatMute);
 static int pbx_capi_ami_capicommand(struct mansession *s, const struct message *m);
+static int pbx_capi_ami_timeline(struct mansession *s, const struct message *m);
 static int capiChatListRegistered;
 static int capiChatMuteRegistered;
 static int capiChatUnmuteRegistered;
 static int capiChatRemoveRegistered;
+static int capiChatBroadcastRegistered;
 static int capiCommandRegistered;
+static int capiTimelineRegistered;
 
 static char mandescr_capichatlist[] =
 "Description: Lists all users in a particular CapiChat conference.\n"
@@ -87,6 +95,13 @@ static char mandescr_capichatremove[] =
 "    *Conference: <confname>\n"
 "    *Member: <membername>\n";
 
+static char mandescr_capichatbroadcast[] =
+"Description: Plays voice file to all CapiChat conferences matching the pattern.\n"
+"Variables:\n"
+"    *ActionId: <id>\n"
+"    *Conference: <pattern>\n"
+"    *File: <filename>\n";
+
 static char mandescr_capicommand[] =
 "Description: Exec capicommand.\n"
 "Variables:\n"
@@ -94,6 +109,14 @@ static char mandescr_capicommand[] =
 "    *Channel: <channame>\n"
 "    *Capicommand: <capicommand>\n";
 
+static char mandescr_capitimeline[] =
+"Description: Lists latency histograms of call signalling events.\n"
+"CapiTimeline will follow as separate events, followed by a final event called\n"
+"CapiTimelineComplete.\n"
+"Variables:\n"
+"    *ActionId: <id>\n"
+"    *Controller: <controller>\n";
+
 void pbx_capi_ami_register(struct ast_module *myself)
 {
 	capiChatListRegistered = ast_manager_register2(CC_AMI_ACTION_NAME_CHATLIST,
@@ -132,6 +155,15 @@ void pbx_capi_ami_register(struct ast_module *myself)
 																								"Remove a conference user",
 																								mandescr_capichatremove) == 0;
 
+	capiChatBroadcastRegistered = ast_manager_register2(CC_AMI_ACTION_NAME_CHATBROADCAST,
+																								EVENT_FLAG_CALL,
+																								pbx_capi_ami_capichat_broadcast,
+#ifdef CC_AST_HAS_VERSION_11_0
+																								myself,
+#endif /* defined(CC_AST_HAS_VERSION_11_0) */
+																								"Broadcast voice file to conferences",
+																								mandescr_capichatbroadcast) == 0;
+
 	capiCommandRegistered = ast_manager_register2(CC_AMI_ACTION_NAME_CAPICOMMAND,
 																								EVENT_FLAG_CALL,
 																								pbx_capi_ami_capicommand,
@@ -140,6 +172,15 @@ void pbx_capi_ami_register(struct ast_module *myself)
 #endif /* defined(CC_AST_HAS_VERSION_11_0) */
 																								"Exec capicommand",
 																								mandescr_capicommand) == 0;
+
+	capiTimelineRegistered = ast_manager_register2(CC_AMI_ACTION_NAME_TIMELINE,
+																								EVENT_FLAG_REPORTING,
+																								pbx_capi_ami_timeline,
+#ifdef CC_AST_HAS_VERSION_11_0
+																								myself,
+#endif /* defined(CC_AST_HAS_VERSION_11_0) */
+																								"List call signalling latency",
+																								mandescr_capitimeline) == 0;
 }
 
 void pbx_capi_ami_unregister(void)
@@ -156,8 +197,14 @@ void pbx_capi_ami_unregister(void)
 	if (capiChatRemoveRegistered != 0)
 		ast_manager_unregister(CC_AMI_ACTION_NAME_CHATREMOVE);
 
+	if (capiChatBroadcastRegistered != 0)
+		ast_manager_unregister(CC_AMI_ACTION_NAME_CHATBROADCAST);
+
 	if (capiCommandRegistered != 0)
 		ast_manager_unregister(CC_AMI_ACTION_NAME_CAPICOMMAND);
+
+	if (capiTimelineRegistered != 0)
+		ast_manager_unregister(CC_AMI_ACTION_NAME_TIMELINE);
 }
 
 static int pbx_capi_ami_capichat_list(struct mansession *s, const struct message *m) {
@@ -197,6 +244,9 @@ static int pbx_capi_ami_capichat_list(struct mansession *s, const struct message
 			int isCapiChatMemberMuted    = pbx_capi_chat_is_member_muted(capiChatRoom);
 			int isCapiChatMemberListener = pbx_capi_chat_is_member_listener(capiChatRoom);
 			int isCapiChatMostRecentMember = pbx_capi_chat_is_most_recent_user(capiChatRoom);
+			unsigned int roomBridges     = pbx_capi_chat_get_room_bridges(capiChatRoom);
+			int isCapiChatSpeaker        = pbx_capi_chat_is_member_speaker(capiChatRoom);
+			unsigned int memberLevel     = pbx_capi_chat_get_member_level(capiChatRoom);
 			const char* mutedVisualName = "No";
 			char* cidVisual;
 			char* callerNameVisual;
@@ -245,6 +295,8 @@ static int pbx_capi_ami_capichat_list(struct mansession *s, const struct message
 				"TxAGC: %s\r\n"
 				"RxGain: %.1f%s\r\n"
 				"TxGain: %.1f%s\r\n"
+				"Bridges: %u\r\n"
+				"Level: %u\r\n"
 				"\r\n",
 				idText,
 				roomName,
@@ -257,7 +309,7 @@ static int pbx_capi_ami_capichat_list(struct mansession *s, const struct message
 				(isCapiChatMemberListener != 0) ? "Listen only" : "Talk and listen" /* "Talk only" */,
 				(isCapiChatMostRecentMember != 0) ? "Yes" : "No",
 				mutedVisualName,
-				/* "Yes" "No" */ "Not monitored",
+				(isCapiChatSpeaker < 0) ? "Not monitored" : ((isCapiChatSpeaker != 0) ? "Yes" : "No"),
 				(i->channeltype == CAPI_CHANNELTYPE_B) ? "TDM" : "IP",
 				(i->isdnstate & CAPI_ISDN_STATE_DTMF) ? "Y" : "N",
 				(i->isdnstate & CAPI_ISDN_STATE_EC)   ? "Y" : "N",
@@ -265,7 +317,9 @@ static int pbx_capi_ami_capichat_list(struct mansession *s, const struct message
 				(i->divaAudioFlags & 0x0008) ? "Y" : "N", /* Rx AGC */
 				(i->divaAudioFlags & 0x0004) ? "Y" : "N", /* Tx AGC */
 				i->divaDigitalRxGainDB, "dB",
-				i->divaDigitalTxGainDB, "dB");
+				i->divaDigitalTxGainDB, "dB",
+				roomBridges,
+				memberLevel);
 
 				ast_free (cidVisual);
 				ast_free (callerNameVisual);
@@ -366,6 +420,29 @@ static int pbx_capi_ami_capichat_remove(struct mansession *s, const struct messa
 	return 0;
 }
 
+static int pbx_capi_ami_capichat_broadcast(struct mansession *s, const struct message *m)
+{
+	const char *pattern   = astman_get_header(m, "Conference");
+	const char *fileName  = astman_get_header(m, "File");
+	char ack[64];
+	int rooms;
+
+	if (ast_strlen_zero(fileName)) {
+		astman_send_error(s, m, "Voice file not specified");
+		return 0;
+	}
+
+	rooms = pbx_capi_chat_broadcast_start(pattern, fileName);
+	if (rooms >= 0) {
+		snprintf(ack, sizeof(ack), "Broadcast started to %d conferences", rooms);
+		astman_send_ack(s, m, ack);
+	} else {
+		astman_send_error(s, m, "Broadcast failed");
+	}
+
+	return 0;
+}
+
 static int pbx_capi_ami_capicommand(struct mansession *s, const struct message *m)
 {
 	const char *requiredChannelName  = astman_get_header(m, "Channel");
@@ -398,6 +475,79 @@ static int pbx_capi_ami_capicommand(struct mansession *s, const struct message *
 	return 0;
 }
 
+static int pbx_capi_ami_timeline(struct mansession *s, const struct message *m)
+{
+	const char *actionid = astman_get_header(m, "ActionID");
+	const char *controllerName = astman_get_header(m, "Controller");
+	char idText[80] = "";
+	char histogram[CC_TIMELINE_BUCKETS * 12];
+	cc_capi_timeline_stat_t stat;
+	int controller = 0, contr, outgoing, event, bucket, len, total = 0;
+
+	if (!ast_strlen_zero(actionid))
+		snprintf(idText, sizeof(idText), "ActionID: %s\r\n", actionid);
+
+	if (!ast_strlen_zero(controllerName)) {
+		controller = atoi(controllerName);
+		if ((controller < 1) || (controller > CAPI_MAX_CONTROLLERS)) {
+			astman_send_error(s, m, "Invalid controller");
+			return 0;
+		}
+	}
+
+	astman_send_listack(s, m, CC_AMI_ACTION_NAME_TIMELINE" histograms will follow", "start");
+
+	for (contr = 1; contr <= CAPI_MAX_CONTROLLERS; contr++) {
+		if ((controller != 0) && (contr != controller))
+			continue;
+		for (outgoing = 0; outgoing < 2; outgoing++) {
+			for (event = 0; event < CC_TIMELINE_EVENTS; event++) {
+				if (pbx_capi_timeline_get_stat(contr, outgoing, event, &stat) == 0)
+					continue;
+
+				for (bucket = 0, len = 0; bucket < CC_TIMELINE_BUCKETS; bucket++) {
+					len += snprintf(&histogram[len], sizeof(histogram) - len, "%s%u",
+						(bucket != 0) ? " " : "", stat.count[bucket]);
+				}
+
+				total++;
+				astman_append(s,
+					"Event: "CC_AMI_ACTION_NAME_TIMELINE"\r\n"
+					"%s"
+					"Controller: %d\r\n"
+					"Direction: %s\r\n"
+					"TimelineEvent: %s\r\n"
+					"Calls: %u\r\n"
+					"AvgMs: %llu\r\n"
+					"P50Ms: %u\r\n"
+					"P90Ms: %u\r\n"
+					"P99Ms: %u\r\n"
+					"Histogram: %s\r\n"
+					"\r\n",
+					idText,
+					contr,
+					(outgoing != 0) ? "Outgoing" : "Incoming",
+					pbx_capi_timeline_event_name(event),
+					stat.calls,
+					stat.sum_ms / stat.calls,
+					pbx_capi_timeline_percentile(&stat, 50),
+					pbx_capi_timeline_percentile(&stat, 90),
+					pbx_capi_timeline_percentile(&stat, 99),
+					histogram);
+			}
+		}
+	}
+
+	/* Send final confirmation */
+	astman_append(s,
+	"Event: "CC_AMI_ACTION_NAME_TIMELINE"Complete\r\n"
+	"EventList: Complete\r\n"
+	"ListItems: %d\r\n"
+	"%s"
+	"\r\n", total, idText);
+	return 0;
+}
+
 #else
 void pbx_capi_ami_register(struct ast_module *myself)
 {
@@ -474,4 +624,15 @@ void pbx_capi_chat_conference_end_event(const char* roomName)
 	manager_event(EVENT_FLAG_CALL, "CapichatEnd", "Conference: %s\r\n", roomName);
 }
 
+void pbx_capi_chat_speaker_event(const char* roomName, unsigned int roomNumber,
+				 const char* channelName, unsigned int level)
+{
+	manager_event(EVENT_FLAG_CALL, "CapichatSpeaker",
+		"Conference: %s\r\n"
+		"Conferencenum: %u\r\n"
+		"Channel: %s\r\n"
+		"Level: %u\r\n",
+		roomName, roomNumber, channelName, level);
+}
+
 
@@ -34,6 +34,8 @@ void pbx_capi_chat_leave_event(struct ast_channel* c,
 			       const struct capichat_s *room,
 			       long duration);
 void pbx_capi_chat_conference_end_event(const char* roomName);
+void pbx_capi_chat_speaker_event(const char* roomName, unsigned int roomNumber,
+				 const char* channelName, unsigned int level);
 
 
 #endif
@@ -0,0 +1,320 @@
+/*
+ * An implementation of Common ISDN API 2.0 for Asterisk
+ *
+ * Shared announcement cache
+ *
+ * Voice files played into chat rooms are read into memory once and
+ * shared by all concurrent plays. A cached file is reused as long as
+ * modification time, size and inode are unchanged, otherwise the file
+ * is read again. Plays still using the old copy keep it, it is
+ * released with the last reference. Copies are not affected if the
+ * file is rewritten or truncated in place.
+ *
+ * This program is free software and may be modified and
+ * distributed under the terms of the GNU Public License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "chan_capi_platform.h"
+#include "chan_capi20.h"
+#include "chan_capi.h"
+#include "chan_capi_utils.h"
+#include "chan_capi_announce.h"
+
+#define CC_ANNOUNCE_HASH_SIZE 64
+
+struct _cc_capi_announcement {
+	char *name;
+	unsigned char *data;
+	size_t size;
+	time_t mtime;
+	dev_t dev;
+	ino_t ino;
+	unsigned int refs;
+	int cached;             /* linked to announce_cache */
+	unsigned long long plays;
+	struct _cc_capi_announcement *next;
+};
+
+/*
+ * LOCALS
+ */
+AST_MUTEX_DEFINE_STATIC(announce_lock);
+static cc_capi_announcement_t *announce_cache[CC_ANNOUNCE_HASH_SIZE];
+static unsigned int announce_unused;
+static unsigned long long announce_hits;
+static unsigned long long announce_loads;
+
+static unsigned int announce_hash(const char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*name != 0) {
+		hash = ((hash << 5) + hash) + (unsigned char)*name++;
+	}
+
+	return (hash % CC_ANNOUNCE_HASH_SIZE);
+}
+
+static void announce_free(cc_capi_announcement_t *announcement)
+{
+	ast_free(announcement->data);
+	ast_free(announcement->name);
+	ast_free(announcement);
+}
+
+/*
+ * remove from cache, called with announce_lock held
+ */
+static void announce_uncache(cc_capi_announcement_t *announcement)
+{
+	cc_capi_announcement_t **link;
+
+	for (link = &announce_cache[announce_hash(announcement->name)]; *link != NULL; link = &(*link)->next) {
+		if (*link == announcement) {
+			*link = announcement->next;
+			break;
+		}
+	}
+	announcement->cached = 0;
+	if (announcement->refs == 0) {
+		announce_unused--;
+		announce_free(announcement);
+	}
+}
+
+/*
+ * drop cached announcements not in use if there are too many of them,
+ * called with announce_lock held
+ */
+static void announce_trim(void)
+{
+	unsigned int hash;
+
+	for (hash = 0; (hash < CC_ANNOUNCE_HASH_SIZE) && (announce_unused > CC_ANNOUNCE_CACHE_UNUSED_MAX); hash++) {
+		cc_capi_announcement_t *announcement = announce_cache[hash], *next;
+
+		for (; (announcement != NULL) && (announce_unused > CC_ANNOUNCE_CACHE_UNUSED_MAX); announcement = next) {
+			next = announcement->next;
+			if (announcement->refs == 0) {
+				announce_uncache(announcement);
+			}
+		}
+	}
+}
+
+/*
+ * read voice file
+ */
+static cc_capi_announcement_t *announce_load(const char *name)
+{
+	cc_capi_announcement_t *announcement;
+	struct stat st;
+	unsigned char *data;
+	size_t pos = 0;
+	ssize_t len;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		cc_log(LOG_WARNING, "can't open voice file (%s)\n", strerror(errno));
+		return NULL;
+	}
+	if ((fstat(fd, &st) != 0) || (st.st_size < 2)) {
+		cc_log(LOG_WARNING, "can't read voice file '%s'\n", name);
+		close(fd);
+		return NULL;
+	}
+	data = ast_malloc(st.st_size);
+	if (data == NULL) {
+		close(fd);
+		return NULL;
+	}
+	while (pos < (size_t)st.st_size) {
+		len = read(fd, &data[pos], st.st_size - pos);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (len == 0)
+			break;
+		pos += len;
+	}
+	close(fd);
+	if (pos != (size_t)st.st_size) {
+		cc_log(LOG_WARNING, "can't read voice file '%s'\n", name);
+		ast_free(data);
+		return NULL;
+	}
+
+	announcement = ast_malloc(sizeof(*announcement));
+	if (announcement == NULL) {
+		ast_free(data);
+		return NULL;
+	}
+	memset(announcement, 0, sizeof(*announcement));
+	announcement->name = ast_strdup(name);
+	if (announcement->name == NULL) {
+		ast_free(data);
+		ast_free(announcement);
+		return NULL;
+	}
+	announcement->data = data;
+	announcement->size = st.st_size;
+	announcement->mtime = st.st_mtime;
+	announcement->dev = st.st_dev;
+	announcement->ino = st.st_ino;
+
+	return announcement;
+}
+
+/*
+ * get announcement, load if not cached or changed on disk
+ */
+cc_capi_announcement_t *pbx_capi_announce_get(const char *name)
+{
+	cc_capi_announcement_t *announcement, *loaded;
+	struct stat st;
+	unsigned int hash = announce_hash(name);
+
+	if (stat(name, &st) != 0) {
+		cc_log(LOG_WARNING, "can't open voice file (%s)\n", strerror(errno));
+		return NULL;
+	}
+
+	cc_mutex_lock(&announce_lock);
+	for (announcement = announce_cache[hash]; announcement != NULL; announcement = announcement->next) {
+		if (strcmp(announcement->name, name) == 0)
+			break;
+	}
+	if (announcement != NULL) {
+		if ((announcement->mtime == st.st_mtime) && (announcement->size == st.st_size) &&
+		    (announcement->dev == st.st_dev) && (announcement->ino == st.st_ino)) {
+			if (announcement->refs++ == 0) {
+				announce_unused--;
+			}
+			announcement->plays++;
+			announce_hits++;
+			cc_mutex_unlock(&announce_lock);
+			return announcement;
+		}
+		/* file changed, current users keep the old copy */
+		announce_uncache(announcement);
+	}
+	cc_mutex_unlock(&announce_lock);
+
+	loaded = announce_load(name);
+	if (loaded == NULL) {
+		return NULL;
+	}
+
+	cc_mutex_lock(&announce_lock);
+	for (announcement = announce_cache[hash]; announcement != NULL; announcement = announcement->next) {
+		if (strcmp(announcement->name, name) == 0)
+			break;
+	}
+	if (announcement != NULL) {
+		/* loaded concurrently by other play */
+		announce_uncache(announcement);
+	}
+	loaded->refs = 1;
+	loaded->plays = 1;
+	loaded->cached = 1;
+	loaded->next = announce_cache[hash];
+	announce_cache[hash] = loaded;
+	announce_loads++;
+	cc_mutex_unlock(&announce_lock);
+
+	cc_verbose(3, 1, VERBOSE_PREFIX_3 CC_MESSAGE_NAME " announce: cached '%s' (%lu bytes)\n",
+		name, (unsigned long)loaded->size);
+
+	return loaded;
+}
+
+/*
+ * release announcement
+ */
+void pbx_capi_announce_put(cc_capi_announcement_t *announcement)
+{
+	cc_mutex_lock(&announce_lock);
+	if (--announcement->refs == 0) {
+		if (announcement->cached == 0) {
+			announce_free(announcement);
+		} else {
+			announce_unused++;
+			announce_trim();
+		}
+	}
+	cc_mutex_unlock(&announce_lock);
+}
+
+/*
+ * voice data of announcement
+ */
+const unsigned char *pbx_capi_announce_data(const cc_capi_announcement_t *announcement, size_t *len)
+{
+	*len = announcement->size;
+
+	return announcement->data;
+}
+
+/*
+ * CLI: show cached announcements
+ */
+void pbx_capi_announce_show(int fd)
+{
+	cc_capi_announcement_t *announcement;
+	unsigned int hash, count = 0;
+
+	ast_cli(fd, "%-48s %10s %5s %10s\n", "File", "Bytes", "Users", "Plays");
+
+	cc_mutex_lock(&announce_lock);
+	for (hash = 0; hash < CC_ANNOUNCE_HASH_SIZE; hash++) {
+		for (announcement = announce_cache[hash]; announcement != NULL; announcement = announcement->next) {
+			ast_cli(fd, "%-48s %10lu %5u %10llu\n", announcement->name,
+				(unsigned long)announcement->size, announcement->refs, announcement->plays);
+			count++;
+		}
+	}
+	ast_cli(fd, "%u cached announcements, %llu loads, %llu cache hits\n",
+		count, announce_loads, announce_hits);
+	cc_mutex_unlock(&announce_lock);
+}
+
+void pbx_capi_announce_init_module(void)
+{
+	memset(announce_cache, 0, sizeof(announce_cache));
+	announce_unused = 0;
+	announce_hits = 0;
+	announce_loads = 0;
+}
+
+void pbx_capi_announce_cleanup_module(void)
+{
+	unsigned int hash;
+
+	cc_mutex_lock(&announce_lock);
+	for (hash = 0; hash < CC_ANNOUNCE_HASH_SIZE; hash++) {
+		while (announce_cache[hash] != NULL) {
+			cc_capi_announcement_t *announcement = announce_cache[hash];
+
+			announce_cache[hash] = announcement->next;
+			if (announcement->refs != 0) {
+				cc_log(LOG_WARNING, "announcement '%s' still in use\n", announcement->name);
+				announcement->cached = 0;
+				continue;
+			}
+			announce_free(announcement);
+		}
+	}
+	announce_unused = 0;
+	cc_mutex_unlock(&announce_lock);
+}
@@ -0,0 +1,31 @@
+/*
+ * An implementation of Common ISDN API 2.0 for Asterisk
+ *
+ * Shared announcement cache
+ *
+ * This program is free software and may be modified and
+ * distributed under the terms of the GNU Public License.
+ */
+
+#ifndef _PBX_CAPI_ANNOUNCE_H
+#define _PBX_CAPI_ANNOUNCE_H
+
+/*
+ * Max. amount of cached announcements not in use
+ */
+#define CC_ANNOUNCE_CACHE_UNUSED_MAX  32
+
+struct _cc_capi_announcement;
+typedef struct _cc_capi_announcement cc_capi_announcement_t;
+
+/*
+ * prototypes
+ */
+extern void pbx_capi_announce_init_module(void);
+extern void pbx_capi_announce_cleanup_module(void);
+extern cc_capi_announcement_t *pbx_capi_announce_get(const char *name);
+extern void pbx_capi_announce_put(cc_capi_announcement_t *announcement);
+extern const unsigned char *pbx_capi_announce_data(const cc_capi_announcement_t *announcement, size_t *len);
+extern void pbx_capi_announce_show(int fd);
+
+#endif
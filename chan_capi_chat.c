@@ -17,6 +17,11 @@
 #include <sys/signal.h>
 #include <sys/time.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#ifdef CC_USE_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #include "chan_capi_platform.h"
 #include "chan_capi20.h"
@@ -26,6 +31,8 @@
 #include "chan_capi_command.h"
 #include "chan_capi_ami.h"
 #include "chan_capi_devstate.h"
+#include "chan_capi_mixer.h"
+#include "chan_capi_announce.h"
 
 #ifdef DIVA_STREAMING
 #include "platform.h"
@@ -34,11 +41,13 @@
 
 #define CHAT_FLAG_MOH      0x0001
 #define CHAT_FLAG_SAMEMSG  0x0002
+#define CHAT_FLAG_SWMIX    0x0004
 
 typedef enum {
 	RoomMemberDefault  = 0, /* Rx/Tx by default, muted by operator */
 	RoomMemberListener = 1, /* Rx only, always muted */
-	RoomMemberOperator = 2  /* Rx/Tx, newer muted */
+	RoomMemberOperator = 2, /* Rx/Tx, newer muted */
+	RoomMemberSpeaker  = 3  /* Tx only, does not listen to the room (broadcast source) */
 } room_member_type_t;
 
 typedef enum {
@@ -51,21 +60,141 @@ typedef enum {
 #define PBX_CHAT_MAX_GROUP_MEMBERS_PRI 31
 #define PBX_CHAT_MAX_GROUP_MEMBERS_BRI 2
 
+#define PBX_CHAT_ROOM_HASH_SIZE 64
+#define PBX_CHAT_BROADCAST_FRAME_SIZE 160 /* 20ms */
+#define PBX_CHAT_MAX_WORKERS 16
+#define PBX_CHAT_WORKER_EVENTS 64
+
+#define PBX_CHAT_SPEAKER_MIN_LEVEL  200 /* Min. mean amplitude of a speaker */
+#define PBX_CHAT_SPEAKER_HYSTERESIS 2   /* New speaker must be louder by this factor */
+
 #define PBX_CHAT_MEMBER_INFO_RECENT     0x00000001
 #define PBX_CHAT_MEMBER_INFO_REMOVE     0x00000002
-struct capichat_s {
+
+struct capichat_s;
+struct capichat_conference_s;
+struct capichat_room_s {
 	char name[16]; /* Name if group == 0 or Name.Ggroup] if group != 0 */
 	unsigned int number;
-	int active;
+	int active; /* Amount of members */
+	room_mode_t room_mode;
+	unsigned int group; /* Group of the member which created the room */
+	int controller; /* Controller of the group, -1 if unknown */
+	cc_capi_mixer_t *mixer; /* Software mixer, room does not use line interconnect */
+	struct capichat_s *members;
+	struct capichat_s *speaker; /* Dominant speaker, NULL if nobody talks */
+	struct timeval speaker_checked;
+	struct capichat_conference_s *conference; /* Conference the group belongs to */
+	struct capichat_room_s *next_group;  /* next group of the same conference */
+	struct capichat_room_s *next;        /* list of all rooms */
+	struct capichat_room_s *next_name;   /* room name hash chain */
+	struct capichat_room_s *next_number; /* room number hash chain */
+};
+
+/*
+ * Large conference split into groups, bridge and group modification
+ * is serialized per conference
+ */
+struct capichat_conference_s {
+	char name[16];
+	int modifying; /* Group/bridge modification in progress */
+	unsigned int refs; /* Group rooms and users of the modify state */
+	ast_cond_t modify_event;
+	unsigned int bridges_created; /* Group bridges created */
+	unsigned int bridges_peak;    /* Max. group bridges at the same time */
+	struct capichat_room_s *groups;
+	struct capichat_conference_s *next; /* conference name hash chain */
+};
+
+struct capichat_s {
+	struct capichat_room_s *chat_room;
 	room_member_type_t room_member_type;
-	room_mode_t        room_mode;
 	struct capi_pvt *i;
-	struct capichat_s *next;
+	struct capichat_s *next; /* next member of the same room */
 	unsigned int info;
 	time_t       time;
 	unsigned int group; /* Group inside of conference, 0 - groups are not used, 1 - group root, > 1 - group in conference */
 	unsigned int groupUsers; /* Amount of users using this group */
+	int li_listener; /* Listener state the programmed LI paths of this member are based on */
+	cc_capi_mixer_member_t *mixer_member; /* Member of software mixer */
+	int event_fd[2]; /* Wakes up the member thread on room events, -1 if unused */
+};
+
+/*
+ * Room joined by a broadcast
+ */
+struct capichat_broadcast_target_s {
+	char name[16]; /* Room name, conference name if group != 0 */
+	unsigned int group;
+	int controller;
+	struct capichat_s *member; /* Membership of the source of the controller */
+};
+
+/*
+ * Broadcast of a voice file, one source (NULL PLCI) per controller
+ */
+struct capichat_broadcast_s {
+	unsigned int number;
+	char pattern[32];
+	char file_name[128];
+	cc_capi_announcement_t *announcement;
+	int stop;
+	unsigned int rooms;   /* Rooms joined */
+	unsigned int sources; /* Sources in use */
+	unsigned int ntargets;
+	struct capichat_broadcast_target_s *targets;
+	struct capi_pvt *source[CAPI_MAX_CONTROLLERS + 1];
+	struct capichat_broadcast_s *next;
+};
+
+#ifdef CC_USE_EPOLL
+/*
+ * Descriptors of a member watched by a chat worker:
+ * the channel descriptors, the NULL PLCI reader pipe and the event pipe
+ */
+#define PBX_CHAT_WORKER_FD_NULLPLCI AST_MAX_FDS
+#define PBX_CHAT_WORKER_FD_EVENT    (AST_MAX_FDS + 1)
+#define PBX_CHAT_WORKER_FDS         (AST_MAX_FDS + 2)
+
+struct capichat_worker_member_s;
+
+struct capichat_worker_fd_s {
+	struct capichat_worker_member_s *member;
+	int index;
+};
+
+/*
+ * NULL PLCI member serviced by a chat worker, located on the stack
+ * of the dialplan thread of the member which sleeps until done is set
+ */
+struct capichat_worker_member_s {
+	diva_entity_link_t link; /* Members serviced by the worker */
+	struct capichat_worker_member_s *next; /* Joining or finished members */
+	struct capichat_s *room;
+	struct ast_channel *chan;
+	struct capi_pvt *i;
+	int event_fd;
+	unsigned int hangup_timeout;
+	time_t alone_since;
+	int fd[PBX_CHAT_WORKER_FDS];    /* Descriptors seen by the worker, -1 if none */
+	int added[PBX_CHAT_WORKER_FDS]; /* Descriptor is in the epoll set */
+	struct capichat_worker_fd_s tag[PBX_CHAT_WORKER_FDS];
+	int finished;
+	int detected_hangup;
+	int done; /* Protected by chat_lock */
+	ast_cond_t event;
+};
+
+struct capichat_worker_s {
+	pthread_t thread;
+	int epfd;
+	int wakeup_fd[2];
+	int stop;
+	unsigned int members; /* Members handed over, protected by chat_lock */
+	struct capichat_worker_member_s *joining; /* Protected by chat_lock */
+	diva_entity_queue_t serviced; /* Used by the worker thread only */
 };
+#endif
 
 struct _deffered_chat_capi_message;
 typedef struct _deffered_chat_capi_message {
@@ -75,11 +204,35 @@ typedef struct _deffered_chat_capi_message {
 	unsigned char p_list[254];
 } deffered_chat_capi_message_t;
 
-static struct capichat_s *chat_list = NULL;
+static struct capichat_room_s *chat_room_list = NULL;
+static struct capichat_room_s *chat_room_by_name[PBX_CHAT_ROOM_HASH_SIZE];
+static struct capichat_room_s *chat_room_by_number[PBX_CHAT_ROOM_HASH_SIZE];
+static unsigned int chat_room_last_number;
+static struct capichat_conference_s *chat_conference_by_name[PBX_CHAT_ROOM_HASH_SIZE];
 AST_MUTEX_DEFINE_STATIC(chat_lock);
-AST_MUTEX_DEFINE_STATIC(chat_bridge_lock);
-static volatile int pbx_capi_bridge_modify_state;
-static ast_cond_t   pbx_capi_bridge_modify_event;
+static unsigned long      chat_li_events;        /* membership events which updated LI */
+static unsigned long long chat_li_requests;      /* LI requests sent for these events */
+static unsigned int       chat_li_requests_last; /* LI requests sent for the last event */
+static struct capichat_broadcast_s *chat_broadcast_list;
+static unsigned int chat_broadcast_last_number;
+static ast_cond_t chat_broadcast_event;
+static unsigned int chat_speaker_interval; /* ms between speaker updates, 0 - disabled */
+static unsigned int chat_workers_max = PBX_CHAT_DEFAULT_WORKERS; /* 0 - thread per member */
+#ifdef CC_USE_EPOLL
+static struct capichat_worker_s chat_workers[PBX_CHAT_MAX_WORKERS];
+static unsigned int chat_workers_running;
+static int chat_workers_stop;
+#endif
+
+/*
+		\brief Max. members of a group on the controller
+	*/
+static unsigned int pbx_capi_chat_get_group_max_members(int groupController)
+{
+	const struct cc_capi_controller *c = (groupController > 0) ? pbx_capi_get_controller(groupController) : NULL;
+
+	return (((c != NULL) && (c->nbchannels == 2)) ? PBX_CHAT_MAX_GROUP_MEMBERS_BRI : PBX_CHAT_MAX_GROUP_MEMBERS_PRI);
+}
 
 /*
  * LOCALS
@@ -92,25 +245,308 @@ static unsigned int pbx_capi_find_group (const char* roomName,
 																				 int requiredController);
 static unsigned int pbx_capi_add_group_user(const char* roomName, unsigned int groupNumber);
 static unsigned int pbx_capi_remove_group_user(const char* roomName, unsigned int groupNumber);
-static unsigned int pbx_capi_chat_get_group_member_count(const char* roomName,
-																												 unsigned int group,
+static unsigned int pbx_capi_chat_get_group_member_count(const struct capichat_room_s *chat_room,
 																												 int* groupController);
-static void pbx_capi_chat_enter_bridge_modify_state(void);
-static void pbx_capi_chat_leave_bridge_modify_state(void);
+static unsigned int pbx_capi_chat_get_group_max_members(int groupController);
+static void pbx_capi_chat_enter_bridge_modify_state(const char* roomName);
+static void pbx_capi_chat_leave_bridge_modify_state(const char* roomName);
 static struct capichat_s* pbx_capi_get_room_bridge(const char* roomName);
-static struct capichat_s* pbx_capi_get_group_main_bridge(struct capi_pvt* mainPLCI);
+static struct capichat_s* pbx_capi_get_group_main_bridge(const char* roomName, struct capi_pvt* mainPLCI);
 static int pbx_capi_is_bridge_idle(const char* roomName);
 static void pbx_capi_cleanup_bridge(const char* roomName, unsigned int groupNumber);
 
+/*
+ * room table, called with chat_lock held
+ */
+static unsigned int chat_room_name_hash(const char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*name != 0) {
+		hash = (hash * 33) ^ (unsigned char)*name++;
+	}
+
+	return (hash % PBX_CHAT_ROOM_HASH_SIZE);
+}
+
+static struct capichat_room_s *chat_find_room(const char *name)
+{
+	struct capichat_room_s *chat_room;
+
+	for (chat_room = chat_room_by_name[chat_room_name_hash(name)];
+	     chat_room != NULL; chat_room = chat_room->next_name) {
+		if (strcmp(chat_room->name, name) == 0)
+			break;
+	}
+
+	return chat_room;
+}
+
+static struct capichat_room_s *chat_find_room_by_number(unsigned int number)
+{
+	struct capichat_room_s *chat_room;
+
+	for (chat_room = chat_room_by_number[number % PBX_CHAT_ROOM_HASH_SIZE];
+	     chat_room != NULL; chat_room = chat_room->next_number) {
+		if (chat_room->number == number)
+			break;
+	}
+
+	return chat_room;
+}
+
+static struct capichat_conference_s *chat_get_conference(const char *name, int create)
+{
+	struct capichat_conference_s *conference;
+	unsigned int hash = chat_room_name_hash(name);
+
+	for (conference = chat_conference_by_name[hash]; conference != NULL; conference = conference->next) {
+		if (strcmp(conference->name, name) == 0)
+			return conference;
+	}
+
+	if (create == 0)
+		return NULL;
+
+	conference = ast_malloc(sizeof(*conference));
+	if (conference == NULL)
+		return NULL;
+	memset(conference, 0, sizeof(*conference));
+
+	cc_copy_string(conference->name, name, sizeof(conference->name));
+	ast_cond_init(&conference->modify_event, NULL);
+
+	hash = chat_room_name_hash(conference->name);
+	conference->next = chat_conference_by_name[hash];
+	chat_conference_by_name[hash] = conference;
+
+	return conference;
+}
+
+static void chat_put_conference(struct capichat_conference_s *conference)
+{
+	struct capichat_conference_s **link;
+
+	if (--conference->refs != 0)
+		return;
+
+	for (link = &chat_conference_by_name[chat_room_name_hash(conference->name)];
+	     *link != NULL; link = &(*link)->next) {
+		if (*link == conference) {
+			*link = conference->next;
+			break;
+		}
+	}
+
+	ast_cond_destroy(&conference->modify_event);
+	ast_free(conference);
+}
+
+/*
+ * find group room of conference
+ */
+static struct capichat_room_s *chat_find_group_room(const char *roomName, unsigned int group)
+{
+	struct capichat_conference_s *conference = chat_get_conference(roomName, 0);
+	struct capichat_room_s *chat_room;
+
+	for (chat_room = (conference != NULL) ? conference->groups : NULL;
+	     chat_room != NULL; chat_room = chat_room->next_group) {
+		if (chat_room->group == group)
+			break;
+	}
+
+	return chat_room;
+}
+
+/*
+ * count bridges between root and groups of conference
+ */
+static unsigned int chat_conference_bridges(const struct capichat_conference_s *conference)
+{
+	const struct capichat_room_s *chat_room;
+	const struct capichat_s *member;
+	unsigned int bridges = 0;
+
+	for (chat_room = conference->groups; chat_room != NULL; chat_room = chat_room->next_group) {
+		if (chat_room->group <= 1)
+			continue;
+		for (member = chat_room->members; member != NULL; member = member->next) {
+			if ((member->i != NULL) && (member->i->used == NULL) && (member->i->bridgePeer != NULL)) {
+				bridges++;
+				break;
+			}
+		}
+	}
+
+	return bridges;
+}
+
+static struct capichat_room_s *chat_create_room(const char *name, const char *roomName, unsigned int group)
+{
+	struct capichat_room_s *chat_room;
+	unsigned int hash;
+
+	chat_room = ast_malloc(sizeof(*chat_room));
+	if (chat_room == NULL)
+		return NULL;
+	memset(chat_room, 0, sizeof(*chat_room));
+
+	cc_copy_string(chat_room->name, name, sizeof(chat_room->name));
+	chat_room->number = ++chat_room_last_number;
+	chat_room->room_mode = RoomModeDefault;
+	chat_room->group = group;
+	chat_room->controller = -1;
+
+	if (group != 0) {
+		chat_room->conference = chat_get_conference(roomName, 1);
+		if (chat_room->conference == NULL) {
+			ast_free(chat_room);
+			return NULL;
+		}
+		chat_room->conference->refs++;
+		chat_room->next_group = chat_room->conference->groups;
+		chat_room->conference->groups = chat_room;
+	}
+
+	hash = chat_room_name_hash(chat_room->name);
+	chat_room->next_name = chat_room_by_name[hash];
+	chat_room_by_name[hash] = chat_room;
+
+	hash = chat_room->number % PBX_CHAT_ROOM_HASH_SIZE;
+	chat_room->next_number = chat_room_by_number[hash];
+	chat_room_by_number[hash] = chat_room;
+
+	chat_room->next = chat_room_list;
+	chat_room_list = chat_room;
+
+	return chat_room;
+}
+
+static void chat_destroy_room(struct capichat_room_s *chat_room)
+{
+	struct capichat_room_s **link;
+
+	for (link = &chat_room_by_name[chat_room_name_hash(chat_room->name)];
+	     *link != NULL; link = &(*link)->next_name) {
+		if (*link == chat_room) {
+			*link = chat_room->next_name;
+			break;
+		}
+	}
+	for (link = &chat_room_by_number[chat_room->number % PBX_CHAT_ROOM_HASH_SIZE];
+	     *link != NULL; link = &(*link)->next_number) {
+		if (*link == chat_room) {
+			*link = chat_room->next_number;
+			break;
+		}
+	}
+	for (link = &chat_room_list; *link != NULL; link = &(*link)->next) {
+		if (*link == chat_room) {
+			*link = chat_room->next;
+			break;
+		}
+	}
+
+	if (chat_room_list == NULL) {
+		chat_room_last_number = 0;
+	}
+
+	if (chat_room->mixer != NULL) {
+		pbx_capi_mixer_destroy(chat_room->mixer);
+	}
+
+	if (chat_room->conference != NULL) {
+		for (link = &chat_room->conference->groups; *link != NULL; link = &(*link)->next_group) {
+			if (*link == chat_room) {
+				*link = chat_room->next_group;
+				break;
+			}
+		}
+		chat_put_conference(chat_room->conference);
+	}
+
+	ast_free(chat_room);
+}
+
+/*
+ * check if member belongs to channel
+ */
+static int chat_member_of_channel(const struct capichat_s *room, const struct ast_channel *c)
+{
+	return ((room->i != 0) && ((room->i->used == c) || (room->i->peer == c)));
+}
+
+/*
+ * check if member is connected receive only
+ */
+static int chat_member_is_listener(const struct capichat_s *room)
+{
+	return ((room->room_member_type == RoomMemberListener) ||
+		((room->chat_room->room_mode == RoomModeMuted) && (room->room_member_type == RoomMemberDefault)));
+}
+
+static int chat_member_is_speaker_only(const struct capichat_s *room)
+{
+	return (room->room_member_type == RoomMemberSpeaker);
+}
+
+/*
+ * LI transmission paths between main PLCI and member PLCI,
+ * a listener does not send, a speaker only member does not receive
+ */
+static _cdword chat_li_paths(int main_listener, int main_speaker_only,
+	int member_listener, int member_speaker_only)
+{
+	_cdword paths = 3;
+
+	if ((main_listener) || (member_speaker_only)) {
+		paths &= ~1U; /* Disable data transmission from main PLCI to member PLCI */
+	}
+	if ((member_listener) || (main_speaker_only)) {
+		paths &= ~2U; /* Disable data transmission from member PLCI to main PLCI */
+	}
+
+	return paths;
+}
+
+/*
+ * B channel members send the line data to the host too if the
+ * level of the member is measured
+ */
+static _cdword chat_li_meter_path(const struct capi_pvt *i)
+{
+	if ((i->rx_level_enabled) && (i->channeltype != CAPI_CHANNELTYPE_NULL) && (i->line_plci == 0)) {
+		return 0x00000004;
+	}
+
+	return 0;
+}
+
+/*
+ * account the LI requests sent for one membership event
+ */
+static void chat_li_event_done(unsigned int roomnumber, const char *event, unsigned int requests)
+{
+	cc_mutex_lock(&chat_lock);
+	chat_li_events++;
+	chat_li_requests += requests;
+	chat_li_requests_last = requests;
+	cc_mutex_unlock(&chat_lock);
+
+	cc_verbose(3, 1, VERBOSE_PREFIX_3 CC_MESSAGE_NAME
+		" mixer: room %u %s, %u LI requests\n", roomnumber, event, requests);
+}
+
 /*
  * partial update the capi mixer for the given char room
  */
 static struct capichat_s* update_capi_mixer_part(
+	struct capichat_room_s *chat_room,
 	struct capichat_s *chat_start,
 	int overall_found,
 	deffered_chat_capi_message_t* capi_msg,
 	int remove,
-	unsigned int roomnumber,
 	struct capi_pvt *i)
 {
 	struct capi_pvt *ii, *ii_last = NULL;
@@ -122,27 +558,22 @@ static struct capichat_s* update_capi_mixer_part(
 	unsigned int found = 0;
 	_cword j = 0;
 	struct capichat_s *new_chat_start = NULL;
-	room_member_type_t main_member_type = RoomMemberDefault;
-	room_mode_t room_mode = RoomModeDefault;
+	int main_listener = 0;
+	int main_speaker_only = 0;
 
-	room = chat_start;
+	room = chat_room->members;
 	while (room != 0) {
 		if (room->i == i) {
-			main_member_type = room->room_member_type;
-			room_mode        = room->room_mode;
+			main_listener = chat_member_is_listener(room);
+			main_speaker_only = chat_member_is_speaker_only(room);
 			break;
 		}
 		room = room->next;
 	}
 
-	if ((room_mode == RoomModeMuted) && (main_member_type == RoomMemberDefault)) {
-		main_member_type = RoomMemberListener;
-	}
-
 	room = chat_start;
 	while (room) {
-		if ((room->number == roomnumber) &&
-		    (room->i != i)) {
+		if (room->i != i) {
 			if ((found >= PLCI_PER_LX_REQUEST) || ((j + 9) > sizeof(capi_msg->p_list))) {
 				/* maybe we need to split capi messages here */
 				new_chat_start = room;
@@ -161,19 +592,9 @@ static struct capichat_s* update_capi_mixer_part(
 				dest |= 0x00000030;
 			}
 			if (remove == 0) {
-				room_member_type_t room_member_type = room->room_member_type;
-
-				if ((room_mode == RoomModeMuted) && (room_member_type == RoomMemberDefault)) {
-					room_member_type = RoomMemberListener;
-				}
-
-				if ((main_member_type == RoomMemberListener) && (room_member_type == RoomMemberListener)) {
-					dest &= ~3U; /* Disable data transmission between two listener */
-				} else if ((main_member_type == RoomMemberListener) && (room_member_type != RoomMemberListener)) {
-					dest &= ~1U; /* Disable data transmission from main PLCI to member PLCI */
-				} else if ((main_member_type != RoomMemberListener) && (room_member_type == RoomMemberListener)) {
-					dest &= ~2U; /* Disable data transmission from member PLCI to main PLCI */
-				}
+				dest &= ~3U;
+				dest |= chat_li_paths(main_listener, main_speaker_only,
+					chat_member_is_listener(room), chat_member_is_speaker_only(room));
 			}
 
 			p_list[j++] = (_cbyte)(dest);
@@ -217,6 +638,8 @@ static struct capichat_s* update_capi_mixer_part(
 			if (!remove) {
 				datapath |= 0x00000030;
 			}
+		} else if (!remove) {
+			datapath |= chat_li_meter_path(i);
 		}
 
 		capi_msg->busy = 1;
@@ -237,12 +660,13 @@ static void update_capi_mixer(
 	int remove,
 	unsigned int roomnumber,
 	struct capi_pvt *i,
-	deffered_chat_capi_message_t* update_segment,
 	int expect_plci_removal)
 {
+	struct capichat_room_s *chat_room;
 	struct capichat_s *room;
-	unsigned int overall_found;
+	unsigned int overall_found = 0;
 	unsigned int nr_segments;
+	unsigned int requests = 0;
 
 	if (i->PLCI == 0) {
 		cc_verbose(2, 0, VERBOSE_PREFIX_3 CC_MESSAGE_NAME
@@ -250,245 +674,987 @@ static void update_capi_mixer(
 		return;
 	}
 
-	if (update_segment == 0) {
-		cc_mutex_lock(&chat_lock);
-	}
+	cc_mutex_lock(&chat_lock);
 
 	/*
 		Get overall amount of parties
 	*/
-	for (room = chat_list, overall_found = 0; room != 0; room = room->next) {
-		overall_found += ((room->number == roomnumber) && (room->i != i));
-	}
-
-	room = chat_list;
-	while (room != 0) {
-		if (room->number == roomnumber) {
-			room->active = overall_found + ((remove != 0) ? 0 : 1);
+	chat_room = chat_find_room_by_number(roomnumber);
+	if ((chat_room != NULL) && (chat_room->mixer == NULL)) {
+		for (room = chat_room->members; room != 0; room = room->next) {
+			overall_found += (room->i != i);
 		}
-		room = room->next;
 	}
 
 	nr_segments = overall_found/PLCI_PER_LX_REQUEST + (overall_found%PLCI_PER_LX_REQUEST != 0);
 	if (nr_segments != 0) {
-		deffered_chat_capi_message_t __segments[nr_segments];
-		deffered_chat_capi_message_t* segments = update_segment == 0 ? __segments : update_segment;
+		deffered_chat_capi_message_t segments[nr_segments];
 		struct capichat_s *chat_start;
 		int segment_nr, nr;
 
-		for (segment_nr = 0, chat_start = chat_list; segment_nr < nr_segments && chat_start != 0; segment_nr++) {
+		for (segment_nr = 0, chat_start = chat_room->members; segment_nr < nr_segments && chat_start != 0; segment_nr++) {
 			segments[segment_nr].busy = 0;
-			chat_start = update_capi_mixer_part(chat_start, overall_found, &segments[segment_nr], remove, roomnumber, i);
+			chat_start = update_capi_mixer_part(chat_room, chat_start, overall_found, &segments[segment_nr], remove, i);
 		}
 
-		if (update_segment == 0) {
-			cc_mutex_unlock(&chat_lock);
-		}
+		cc_mutex_unlock(&chat_lock);
 
 		if (chat_start != 0) {
 			cc_log(LOG_ERROR, "%s:%s at %d.\n", __FILE__, __FUNCTION__, __LINE__);
 		}
 
-		if (update_segment == 0) {
-			for (nr = 0; nr < segment_nr; nr++) {
-				if (segments[nr].busy != 0) {
-					if (expect_plci_removal == 0) {
-						cc_verbose(3, 1, VERBOSE_PREFIX_3 CC_MESSAGE_NAME
-							" mixer: %s PLCI=0x%04x LI=0x%x\n", i->vname, i->PLCI, segments[nr].datapath);
+		for (nr = 0; nr < segment_nr; nr++) {
+			if (segments[nr].busy != 0) {
+				if (expect_plci_removal == 0) {
+					cc_verbose(3, 1, VERBOSE_PREFIX_3 CC_MESSAGE_NAME
+						" mixer: %s PLCI=0x%04x LI=0x%x\n", i->vname, i->PLCI, segments[nr].datapath);
 
-						capi_sendf(NULL, 0, CAPI_FACILITY_REQ, i->PLCI, get_capi_MessageNumber(),
-							"w(w(dc))",
-							FACILITYSELECTOR_LINE_INTERCONNECT,
-							0x0001, /* CONNECT */
-							segments[nr].datapath,
-							&segments[nr].p_struct);
-					}
+					capi_sendf(NULL, 0, CAPI_FACILITY_REQ, i->PLCI, get_capi_MessageNumber(),
+						"w(w(dc))",
+						FACILITYSELECTOR_LINE_INTERCONNECT,
+						0x0001, /* CONNECT */
+						segments[nr].datapath,
+						&segments[nr].p_struct);
+					requests++;
 				}
 			}
 		}
 
+		chat_li_event_done(roomnumber, (remove != 0) ? "leave" : "join", requests);
+
 		return;
 	}
 
-	if (update_segment == 0) {
+	cc_mutex_unlock(&chat_lock);
+
+	chat_li_event_done(roomnumber, (remove != 0) ? "leave" : "join", requests);
+}
+
+/*
+ * build the LI requests of one member for all pairs with members
+ * following it in the list whose transmission paths have changed.
+ * Returns the number of used segments.
+ */
+static unsigned int update_capi_mixer_delta(
+	struct capichat_s *main_member,
+	deffered_chat_capi_message_t *segments,
+	unsigned int max_segments)
+{
+	struct capi_pvt *ii;
+	struct capichat_s *room;
+	deffered_chat_capi_message_t *segment = NULL;
+	unsigned int nr_segments = 0, found = 0;
+	int main_listener = chat_member_is_listener(main_member);
+	int main_speaker_only = chat_member_is_speaker_only(main_member);
+	_cword j = 0;
+	_cdword dest;
+
+	for (room = main_member->next; room != 0; room = room->next) {
+		if ((room->i == 0) || (room->i->PLCI == 0)) {
+			continue;
+		}
+		dest = chat_li_paths(main_listener, main_speaker_only,
+			chat_member_is_listener(room), chat_member_is_speaker_only(room));
+		if (dest == chat_li_paths(main_member->li_listener, main_speaker_only,
+				room->li_listener, chat_member_is_speaker_only(room))) {
+			continue;
+		}
+
+		if ((segment == NULL) || (found >= PLCI_PER_LX_REQUEST)) {
+			if (nr_segments >= max_segments) {
+				cc_log(LOG_ERROR, "%s:%s at %d.\n", __FILE__, __FUNCTION__, __LINE__);
+				break;
+			}
+			segment = &segments[nr_segments++];
+			segment->busy = 1;
+			segment->datapath = 0x00000000; /* don't send DATA_B3 to me */
+			if ((main_member->i->channeltype == CAPI_CHANNELTYPE_NULL) && (main_member->i->line_plci == 0)) {
+				segment->datapath |= 0x00000030;
+			} else {
+				segment->datapath |= chat_li_meter_path(main_member->i);
+			}
+			segment->p_struct.info = segment->p_list;
+			segment->p_struct.wLen = 0;
+			found = 0;
+			j = 0;
+		}
+
+		ii = room->i;
+		if ((ii->channeltype == CAPI_CHANNELTYPE_NULL) && (ii->line_plci == 0)) {
+			dest |= 0x00000030;
+		}
+		segment->p_list[j++] = 8;
+		segment->p_list[j++] = (_cbyte)(ii->PLCI);
+		segment->p_list[j++] = (_cbyte)(ii->PLCI >> 8);
+		segment->p_list[j++] = (_cbyte)(ii->PLCI >> 16);
+		segment->p_list[j++] = (_cbyte)(ii->PLCI >> 24);
+		segment->p_list[j++] = (_cbyte)(dest);
+		segment->p_list[j++] = (_cbyte)(dest >> 8);
+		segment->p_list[j++] = (_cbyte)(dest >> 16);
+		segment->p_list[j++] = (_cbyte)(dest >> 24);
+		segment->p_struct.wLen = j;
+		found++;
+		cc_verbose(3, 1, VERBOSE_PREFIX_3 CC_MESSAGE_NAME
+			" mixer: listed %s PLCI=0x%04x LI=0x%x\n", ii->vname, ii->PLCI, dest);
+	}
+
+	return nr_segments;
+}
+
+/*
+ * apply a room wide change of the member transmission paths.
+ * Only pairs which changed are sent, each pair once.
+ * Called with chat_lock held, returns with chat_lock released.
+ */
+static void update_all_capi_mixers(struct capichat_room_s *chat_room)
+{
+	struct capichat_s *room;
+	unsigned int roomnumber = chat_room->number;
+	unsigned int overall_found = chat_room->active;
+	unsigned int nr_segments;
+	unsigned int requests = 0;
+
+	if (chat_room->mixer != NULL) {
+		/* software mixer applies the listener state with every frame */
 		cc_mutex_unlock(&chat_lock);
+		return;
 	}
+
+	nr_segments = overall_found/PLCI_PER_LX_REQUEST + (overall_found%PLCI_PER_LX_REQUEST != 0);
+
+	{
+		deffered_chat_capi_message_t *segments, *segment;
+		unsigned int PLCIS[overall_found];
+		unsigned int used[overall_found];
+		unsigned int nr;
+		int i, j;
+
+		segments = ast_malloc (sizeof(*segments)*overall_found*nr_segments);
+		if (segments == 0) {
+			cc_mutex_unlock(&chat_lock);
+			return;
+		}
+
+		for (room = chat_room->members, i = 0; room != 0; room = room->next) {
+			if (room->i && room->i->PLCI != 0) {
+				segment = segments + i*nr_segments;
+				used[i] = update_capi_mixer_delta(room, segment, nr_segments);
+				if (used[i] != 0) {
+					PLCIS[i++] = room->i->PLCI;
+				}
+			}
+		}
+
+		for (room = chat_room->members; room != 0; room = room->next) {
+			room->li_listener = chat_member_is_listener(room);
+		}
+
+		cc_mutex_unlock(&chat_lock);
+
+		for (j = 0; j < i; j++) {
+			segment = segments + j*nr_segments;
+			for (nr = 0; nr < used[j]; nr++) {
+				cc_verbose(3, 1, VERBOSE_PREFIX_3 CC_MESSAGE_NAME
+					" mixer: PLCI=0x%04x LI=0x%x\n", PLCIS[j], segment[nr].datapath);
+				capi_sendf(NULL, 0, CAPI_FACILITY_REQ, PLCIS[j], get_capi_MessageNumber(),
+					"w(w(dc))",
+					FACILITYSELECTOR_LINE_INTERCONNECT,
+					0x0001, /* CONNECT */
+					segment[nr].datapath,
+					&segment[nr].p_struct);
+				requests++;
+			}
+		}
+
+		ast_free(segments);
+	}
+
+	chat_li_event_done(roomnumber, "mode change", requests);
+}
+
+/*
+ * non blocking pipe used to wake up a thread
+ */
+static int chat_event_pipe_create(int fds[2])
+{
+	int flags;
+
+	if (pipe(fds) != 0) {
+		return -1;
+	}
+	flags = fcntl(fds[0], F_GETFL);
+	fcntl(fds[0], F_SETFL, flags | O_NONBLOCK);
+	flags = fcntl(fds[1], F_GETFL);
+	fcntl(fds[1], F_SETFL, flags | O_NONBLOCK);
+
+	return 0;
+}
+
+static void chat_event_pipe_signal(int fd)
+{
+	static const unsigned char event = 1;
+
+	if (write(fd, &event, 1) < 0) {
+		/* pipe full, thread is woken up anyway */
+	}
+}
+
+/*
+ * wake up the thread of a member to re-evaluate the member state,
+ * called with chat_lock held
+ */
+static void chat_member_signal(struct capichat_s *room)
+{
+	if (room->event_fd[1] >= 0) {
+		chat_event_pipe_signal(room->event_fd[1]);
+	}
+}
+
+/*
+ * wake up the threads of all members of the room,
+ * called with chat_lock held
+ */
+static void chat_room_signal(struct capichat_room_s *chat_room)
+{
+	struct capichat_s *room;
+
+	for (room = chat_room->members; room != NULL; room = room->next) {
+		chat_member_signal(room);
+	}
+}
+
+/*
+ * create/close the event pipe of the member
+ */
+static int chat_member_events_open(struct capichat_s *room)
+{
+	int fds[2];
+
+	if (chat_event_pipe_create(fds) != 0) {
+		cc_log(LOG_WARNING, "%s: unable to create chat event pipe.\n",
+			room->i->vname);
+		return -1;
+	}
+
+	cc_mutex_lock(&chat_lock);
+	room->event_fd[0] = fds[0];
+	room->event_fd[1] = fds[1];
+	cc_mutex_unlock(&chat_lock);
+
+	return fds[0];
+}
+
+static void chat_member_events_close(struct capichat_s *room)
+{
+	int fds[2];
+
+	cc_mutex_lock(&chat_lock);
+	fds[0] = room->event_fd[0];
+	fds[1] = room->event_fd[1];
+	room->event_fd[0] = -1;
+	room->event_fd[1] = -1;
+	cc_mutex_unlock(&chat_lock);
+
+	if (fds[0] >= 0) {
+		close(fds[0]);
+		close(fds[1]);
+	}
+}
+
+static void chat_member_events_drain(int fd)
+{
+	unsigned char events[32];
+
+	while (read(fd, events, sizeof(events)) > 0);
+}
+
+/*
+ * delete a chat member
+ */
+static void del_chat_member(struct capichat_s *room, int expect_plci_removal)
+{
+	struct capichat_room_s *chat_room;
+	struct capichat_s **link;
+	unsigned int roomnumber;
+	struct capi_pvt *i = room->i;
+
+	cc_mutex_lock(&chat_lock);
+	chat_room = room->chat_room;
+	roomnumber = chat_room->number;
+	for (link = &chat_room->members; *link != NULL; link = &(*link)->next) {
+		if (*link == room) {
+			*link = room->next;
+			chat_room->active--;
+			cc_verbose(3, 0, VERBOSE_PREFIX_3 "%s: removed chat member from room '%s' (%d)\n",
+				room->i->vname, chat_room->name, roomnumber);
+			if (room->mixer_member != NULL) {
+				pbx_capi_mixer_leave(chat_room->mixer, room->mixer_member);
+			}
+			if (chat_room->speaker == room) {
+				chat_room->speaker = NULL;
+			}
+			ast_free(room);
+			break;
+		}
+	}
+	if (chat_room->members == NULL) {
+		chat_destroy_room(chat_room);
+	} else {
+		chat_room_signal(chat_room);
+	}
+	if (i->channeltype != CAPI_CHANNELTYPE_NULL) {
+		i->rx_level_enabled = 0;
+	}
+	cc_mutex_unlock(&chat_lock);
+
+	update_capi_mixer(1, roomnumber, i, expect_plci_removal);
+}
+
+/*
+ * add a new chat member
+ */
+static struct capichat_s *add_chat_member(const char *roomname, struct capi_pvt *i, room_member_type_t room_member_type,
+	unsigned int groupNumber, int software_mixing)
+{
+	struct capichat_room_s *chat_room;
+	struct capichat_s *room = NULL;
+	struct capichat_s *tmproom;
+	char name[sizeof(chat_room->name)];
+	unsigned int roomnumber;
+
+	room = ast_malloc(sizeof(struct capichat_s));
+	if (room == NULL) {
+		cc_log(LOG_ERROR, "Unable to allocate chan_capi chat struct.\n");
+		return NULL;
+	}
+	memset(room, 0, sizeof(struct capichat_s));
+	
+	if (groupNumber == 0) {
+		strncpy(name, roomname, sizeof(name));
+	} else {
+		pbx_capi_create_full_room_name(roomname, groupNumber, name, sizeof(name));
+	}
+	name[sizeof(name) - 1] = 0;
+
+	room->i = i;
+	room->room_member_type = room_member_type;
+	room->group = groupNumber;
+	room->event_fd[0] = -1;
+	room->event_fd[1] = -1;
+
+	cc_mutex_lock(&chat_lock);
+
+	chat_room = chat_find_room(name);
+	if (chat_room == NULL) {
+		chat_room = chat_create_room(name, roomname, groupNumber);
+		if (chat_room == NULL) {
+			cc_mutex_unlock(&chat_lock);
+			ast_free(room);
+			cc_log(LOG_ERROR, "Unable to allocate chan_capi chat room struct.\n");
+			return NULL;
+		}
+		/*
+			Mix in software if requested or if the controller does not support
+			line interconnect. Groups of large conferences are connected by
+			line interconnect bridges and always use the controller.
+			*/
+		if ((groupNumber == 0) && ((software_mixing != 0) ||
+				((i != NULL) && (pbx_capi_get_controller(i->controller) != NULL) &&
+				 (pbx_capi_get_controller(i->controller)->lineinterconnect == 0)))) {
+			chat_room->mixer = pbx_capi_mixer_create();
+			if (chat_room->mixer == NULL) {
+				cc_log(LOG_WARNING, "Unable to create software mixer for chat room '%s'.\n", name);
+			} else {
+				cc_verbose(3, 0, VERBOSE_PREFIX_3 CC_MESSAGE_NAME
+					" chat room '%s' uses software mixing\n", name);
+			}
+		}
+	}
+	if (chat_room->mixer != NULL) {
+		room->mixer_member = pbx_capi_mixer_join(chat_room->mixer);
+		if (room->mixer_member == NULL) {
+			if (chat_room->members == NULL) {
+				chat_destroy_room(chat_room);
+			}
+			cc_mutex_unlock(&chat_lock);
+			ast_free(room);
+			cc_log(LOG_ERROR, "Unable to allocate chan_capi chat mixer member.\n");
+			return NULL;
+		}
+	}
+	roomnumber = chat_room->number;
+
+	room->chat_room = chat_room;
+	room->li_listener = chat_member_is_listener(room);
+	if ((chat_speaker_interval != 0) && (i != NULL) &&
+	    ((i->channeltype != CAPI_CHANNELTYPE_NULL) || (i->used != NULL))) {
+		/* measure level of members with channel, not of bridges and broadcasts */
+		i->rx_level = 0;
+		i->rx_level_enabled = 1;
+	}
+	if ((chat_room->controller < 0) && (i != NULL)) {
+		chat_room->controller = i->controller;
+	}
+
+	for (tmproom = chat_room->members; tmproom != NULL; tmproom = tmproom->next) {
+		tmproom->info &= ~PBX_CHAT_MEMBER_INFO_RECENT;
+	}
+	room->info |= PBX_CHAT_MEMBER_INFO_RECENT;
+	room->time = time(NULL);
+
+	room->next = chat_room->members;
+	chat_room->members = room;
+	chat_room->active++;
+
+	chat_room_signal(chat_room);
+
+	cc_mutex_unlock(&chat_lock);
+
+	cc_verbose(3, 0, VERBOSE_PREFIX_3 "%s: added new chat member to room '%s' %s(%d)\n",
+		i->vname, roomname, room_member_type_2_name(room_member_type), roomnumber);
+
+	update_capi_mixer(0, roomnumber, i, 0);
+
+	return room;
+}
+
+/*
+ * Select the dominant speaker of the room. The current speaker is
+ * replaced only by a member which is clearly louder, the selection
+ * runs at most once per configured interval and a changed speaker is
+ * reported with one event per interval.
+ */
+static void chat_speaker_update(struct capichat_room_s *chat_room)
+{
+	struct capichat_s *room, *candidate = NULL;
+	unsigned int level = 0, speaker_level = 0;
+	char room_name[sizeof(chat_room->name)];
+	char channel_name[AST_CHANNEL_NAME];
+	unsigned int room_number;
+	struct timeval now;
+
+	if (chat_speaker_interval == 0) {
+		return;
+	}
+	now = ast_tvnow();
+	if (ast_tvdiff_ms(now, chat_room->speaker_checked) < (long)chat_speaker_interval) {
+		return;
+	}
+
+	cc_mutex_lock(&chat_lock);
+	if (ast_tvdiff_ms(now, chat_room->speaker_checked) < (long)chat_speaker_interval) {
+		cc_mutex_unlock(&chat_lock);
+		return;
+	}
+	chat_room->speaker_checked = now;
+
+	for (room = chat_room->members; room != NULL; room = room->next) {
+		if ((room->i == NULL) || (room->i->rx_level_enabled == 0) || (chat_member_is_listener(room) != 0)) {
+			continue;
+		}
+		if (room->i->rx_level > level) {
+			level = room->i->rx_level;
+			candidate = room;
+		}
+	}
+	if (chat_room->speaker != NULL) {
+		speaker_level = chat_room->speaker->i->rx_level;
+	}
+
+	if (level < PBX_CHAT_SPEAKER_MIN_LEVEL) {
+		candidate = (speaker_level < PBX_CHAT_SPEAKER_MIN_LEVEL) ? NULL : chat_room->speaker;
+	} else if ((chat_room->speaker != NULL) && (level <= (speaker_level * PBX_CHAT_SPEAKER_HYSTERESIS))) {
+		candidate = chat_room->speaker;
+	}
+	if (candidate == chat_room->speaker) {
+		cc_mutex_unlock(&chat_lock);
+		return;
+	}
+
+	chat_room->speaker = candidate;
+	cc_copy_string(room_name, chat_room->name, sizeof(room_name));
+	room_number = chat_room->number;
+	channel_name[0] = 0;
+	if (candidate != NULL) {
+		struct ast_channel *c = (candidate->i->owner != NULL) ? candidate->i->owner : candidate->i->used;
+
+		level = candidate->i->rx_level;
+		if (c != NULL) {
+#ifdef CC_AST_HAS_VERSION_11_0
+			cc_copy_string(channel_name, ast_channel_name(c), sizeof(channel_name));
+#else
+			cc_copy_string(channel_name, c->name, sizeof(channel_name));
+#endif
+		}
+	} else {
+		level = 0;
+	}
+	cc_mutex_unlock(&chat_lock);
+
+	cc_verbose(4, 1, VERBOSE_PREFIX_3 CC_MESSAGE_NAME " chat room '%s': speaker '%s' level %u\n",
+		room_name, channel_name, level);
+
+	pbx_capi_chat_speaker_event(room_name, room_number, channel_name, level);
+}
+
+/*
+ * pass frame of member to software mixer and send the mix
+ * of the other members back to the member
+ */
+static void chat_software_mix(struct ast_channel *chan, struct capi_pvt *i,
+	struct capichat_s *room, struct ast_frame *f, int send)
+{
+	unsigned char mix[CC_MIXER_MAX_SAMPLES * 2];
+	struct ast_frame fr;
+
+	if ((GET_FRAME_SUBCLASS_CODEC(f->subclass) != capi_capability) ||
+	    (f->FRAME_DATA_PTR == NULL) || (f->datalen <= 0) || (f->datalen > (int)sizeof(mix))) {
+		return;
+	}
+
+	pbx_capi_mixer_mix(room->chat_room->mixer, room->mixer_member,
+		(chat_member_is_listener(room) == 0), f->FRAME_DATA_PTR, mix, f->datalen);
+
+	if (send == 0) {
+		return;
+	}
+
+	fr = *f;
+	fr.FRAME_DATA_PTR = mix;
+	fr.offset = 0;
+	fr.mallocd = 0;
+
+	if (i->channeltype == CAPI_CHANNELTYPE_NULL) {
+		ast_write(chan, &fr);
+	} else {
+		capi_write_frame(i, &fr);
+	}
+}
+
+#ifdef CC_USE_EPOLL
+#ifdef CC_AST_HAS_VERSION_11_0
+#define CHAT_CHANNEL_FD(c, n) ast_channel_fd(c, n)
+#define CHAT_CHANNEL_SET_FDNO(c, n, exception) do { \
+		ast_channel_fdno_set(c, n); \
+		ast_set2_flag(ast_channel_flags(c), exception, AST_FLAG_EXCEPTION); \
+	} while (0)
+#else
+#define CHAT_CHANNEL_FD(c, n) ((c)->fds[n])
+#define CHAT_CHANNEL_SET_FDNO(c, n, exception) do { \
+		(c)->fdno = (n); \
+		ast_set2_flag(c, exception, AST_FLAG_EXCEPTION); \
+	} while (0)
+#endif
+
+/*
+ * NULL PLCI chat members
+ *
+ * A NULL PLCI member only passes frames between the channel and the
+ * reader pipe of the NULL PLCI. Instead of one thread per member these
+ * members are serviced by a small pool of worker threads, each waiting
+ * for the descriptors of all its members in one epoll set. The dialplan
+ * thread of the member sleeps until the member leaves the room.
+ */
+static int chat_worker_eligible(struct capi_pvt *i, unsigned int flags,
+	cc_capi_announcement_t *voice_message)
+{
+	return ((chat_workers_max != 0) && (i->channeltype == CAPI_CHANNELTYPE_NULL) &&
+		(i->readerfd >= 0) && ((flags & CHAT_FLAG_MOH) == 0) && (voice_message == NULL) &&
+		(diva_q_get_head(&i->channel_command_q) == NULL));
+}
+
+static int chat_worker_fd(struct capichat_worker_member_s *member, int n)
+{
+	if (n < AST_MAX_FDS) {
+		return CHAT_CHANNEL_FD(member->chan, n);
+	}
+	if (n == PBX_CHAT_WORKER_FD_NULLPLCI) {
+		return member->i->readerfd;
+	}
+	return member->event_fd;
+}
+
+/*
+ * add new and remove changed descriptors of the member to/from the
+ * epoll set of the worker, remove all descriptors if remove is set
+ */
+static void chat_worker_sync_fds(struct capichat_worker_s *worker,
+	struct capichat_worker_member_s *member, int remove)
+{
+	struct epoll_event ev;
+	int n, fd;
+
+	for (n = 0; n < PBX_CHAT_WORKER_FDS; n++) {
+		fd = (remove == 0) ? chat_worker_fd(member, n) : -1;
+		if (fd == member->fd[n]) {
+			continue;
+		}
+		memset(&ev, 0, sizeof(ev));
+		if (member->added[n] != 0) {
+			epoll_ctl(worker->epfd, EPOLL_CTL_DEL, member->fd[n], &ev);
+			member->added[n] = 0;
+		}
+		member->fd[n] = fd;
+		if (fd < 0) {
+			continue;
+		}
+		ev.events = EPOLLIN | EPOLLPRI;
+		ev.data.ptr = &member->tag[n];
+		if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+			member->added[n] = 1;
+		}
+	}
+}
+
+/*
+ * check remove request and alone hangup timeout,
+ * returns nonzero if the member leaves the room
+ */
+static int chat_worker_check_member(struct capichat_worker_member_s *member, time_t now)
+{
+	if ((member->room->info & PBX_CHAT_MEMBER_INFO_REMOVE) != 0) {
+		return 1;
+	}
+	if (member->hangup_timeout == 0) {
+		return 0;
+	}
+	if (member->room->chat_room->active > 1) {
+		member->alone_since = 0;
+		return 0;
+	}
+	if (member->alone_since == 0) {
+		member->alone_since = now;
+	}
+	if ((member->alone_since + member->hangup_timeout) < now) {
+		cc_verbose(3, 1, VERBOSE_PREFIX_3 "%s: chat: reached (alone) hangup timeout.\n",
+			member->i->vname);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * process a ready descriptor of the member,
+ * returns nonzero if the member leaves the room
+ */
+static int chat_worker_member_event(struct capichat_worker_s *worker,
+	struct capichat_worker_member_s *member, int n, unsigned int events)
+{
+	struct ast_channel *chan = member->chan;
+	struct capi_pvt *i = member->i;
+	struct capichat_s *room = member->room;
+	struct ast_frame *f;
+
+	if (n == PBX_CHAT_WORKER_FD_EVENT) {
+		chat_member_events_drain(member->event_fd);
+		return chat_worker_check_member(member, time(NULL));
+	}
+
+	if (n == PBX_CHAT_WORKER_FD_NULLPLCI) {
+		if ((events & EPOLLIN) == 0) {
+			cc_verbose(1, 0, VERBOSE_PREFIX_3 "%s: chat: exception on readerfd\n",
+				i->vname);
+			return 1;
+		}
+		f = capi_read_pipeframe(i);
+		if (f == NULL) {
+			member->detected_hangup = 1;
+			return 1;
+		}
+		if ((f->frametype == AST_FRAME_VOICE) && (room->mixer_member == NULL)) {
+			ast_write(chan, f);
+		}
+		/* software mixer sends the mix on reception of the own frame,
+		   ignore other nullplci frames */
+		return 0;
+	}
+
+	CHAT_CHANNEL_SET_FDNO(chan, n, ((events & EPOLLPRI) != 0));
+	f = ast_read(chan);
+	if (f == NULL) {
+		cc_verbose(3, 1, VERBOSE_PREFIX_3 "%s: chat: no frame, hangup.\n",
+			i->vname);
+		member->detected_hangup = 1;
+		return 1;
+	}
+	if ((f->frametype == AST_FRAME_CONTROL) &&
+		(FRAME_SUBCLASS_INTEGER(f->subclass) == AST_CONTROL_HANGUP)) {
+		cc_verbose(3, 1, VERBOSE_PREFIX_3 "%s: chat: hangup frame.\n",
+			i->vname);
+		ast_frfree(f);
+		member->detected_hangup = 1;
+		return 1;
+	} else if (f->frametype == AST_FRAME_VOICE) {
+		if ((i->rx_level_enabled) && (GET_FRAME_SUBCLASS_CODEC(f->subclass) == capi_capability)) {
+			capi_level_update(&i->rx_level, f->FRAME_DATA_PTR, f->datalen);
+		}
+		chat_speaker_update(room->chat_room);
+		if (room->mixer_member != NULL) {
+			chat_software_mix(chan, i, room, f, 1);
+		} else {
+			capi_write_frame(i, f);
+		}
+#ifdef CC_AST_HAS_VERSION_1_4
+	} else if (f->frametype == AST_FRAME_DTMF_END) {
+#else
+	} else if (f->frametype == AST_FRAME_DTMF) {
+#endif
+		pbx_capi_voicecommand_process_digit(i, chan, FRAME_SUBCLASS_INTEGER(f->subclass));
+	} else if (f->frametype != AST_FRAME_NULL) {
+		cc_verbose(3, 1, VERBOSE_PREFIX_3 "%s: chat: unhandled frame %d/%d.\n",
+			i->vname, f->frametype, FRAME_SUBCLASS_INTEGER(f->subclass));
+	}
+	ast_frfree(f);
+
+	/* channel descriptors may change, e.g. on masquerade */
+	chat_worker_sync_fds(worker, member, 0);
+
+	return 0;
 }
 
-static void update_all_capi_mixers(unsigned int roomnumber)
+/*
+ * stop servicing the member, the dialplan thread of the member
+ * is woken up after all events of the current batch are processed
+ */
+static void chat_worker_finish_member(struct capichat_worker_s *worker,
+	struct capichat_worker_member_s *member, struct capichat_worker_member_s **finished)
 {
-	struct capichat_s *room;
-	unsigned int overall_found;
-	unsigned int nr_segments;
-
-	for (room = chat_list, overall_found = 0; room != 0; room = room->next) {
-		overall_found += (room->number == roomnumber);
-	}
+	member->finished = 1;
+	chat_worker_sync_fds(worker, member, 1);
+	diva_q_remove(&worker->serviced, &member->link);
+	member->next = *finished;
+	*finished = member;
+}
 
-	nr_segments = overall_found/PLCI_PER_LX_REQUEST + (overall_found%PLCI_PER_LX_REQUEST != 0);
+static void *chat_worker_thread(void *data)
+{
+	struct capichat_worker_s *worker = data;
+	struct epoll_event events[PBX_CHAT_WORKER_EVENTS];
+	struct capichat_worker_member_s *member, *joining, *finished;
+	struct capichat_worker_fd_s *tag;
+	diva_entity_link_t *link, *next;
+	time_t now, checked = 0;
+	int n, nevents, stop;
+
+	do {
+		nevents = epoll_wait(worker->epfd, events, PBX_CHAT_WORKER_EVENTS, 1000);
+		finished = NULL;
+
+		for (n = 0; n < nevents; n++) {
+			tag = events[n].data.ptr;
+			if (tag == NULL) {
+				chat_member_events_drain(worker->wakeup_fd[0]);
+				continue;
+			}
+			member = tag->member;
+			if ((member->finished == 0) &&
+			    (chat_worker_member_event(worker, member, tag->index, events[n].events) != 0)) {
+				chat_worker_finish_member(worker, member, &finished);
+			}
+		}
 
-	{
-		deffered_chat_capi_message_t *segments, *segment;
-		unsigned int PLCIS[overall_found];
-		int i, j, nr;
+		cc_mutex_lock(&chat_lock);
+		joining = worker->joining;
+		worker->joining = NULL;
+		stop = worker->stop;
+		cc_mutex_unlock(&chat_lock);
 
-		segments = ast_malloc (sizeof(*segments)*overall_found*nr_segments);
-		if (segments == 0) {
-			cc_mutex_unlock(&chat_lock);
-			return;
+		while (joining != NULL) {
+			member = joining;
+			joining = member->next;
+			diva_q_add_tail(&worker->serviced, &member->link);
+			chat_worker_sync_fds(worker, member, 0);
 		}
 
-		for (room = chat_list, i = 0; room != 0; room = room->next) {
-			if (room->number == roomnumber && room->i && room->i->PLCI != 0) {
-			  segment = segments + i*nr_segments;
-				for (nr = 0; nr < nr_segments; nr++) {
-					segment[nr].busy = 0;
+		now = time(NULL);
+		if ((now != checked) || (stop != 0)) {
+			checked = now;
+			for (link = diva_q_get_head(&worker->serviced); link != NULL; link = next) {
+				next = diva_q_get_next(link);
+				member = (struct capichat_worker_member_s *)link;
+				if (ast_check_hangup(member->chan)) {
+					member->detected_hangup = 1;
 				}
-				update_capi_mixer(0, roomnumber, room->i, segment, 0);
-				if (segment[0].busy != 0) {
-					PLCIS[i++] = room->i->PLCI;
+				if ((stop != 0) || (member->detected_hangup != 0) ||
+				    (chat_worker_check_member(member, now) != 0)) {
+					chat_worker_finish_member(worker, member, &finished);
 				}
 			}
 		}
 
-		cc_mutex_unlock(&chat_lock);
-
-		for (j = 0; j < i; j++) {
-			segment = segments + j*nr_segments;
-			for (nr = 0; nr < nr_segments; nr++) {
-				if (segment[nr].busy != 0) {
-					cc_verbose(3, 1, VERBOSE_PREFIX_3 CC_MESSAGE_NAME
-						" mixer: PLCI=0x%04x LI=0x%x\n", PLCIS[j], segment[nr].datapath);
-					capi_sendf(NULL, 0, CAPI_FACILITY_REQ, PLCIS[j], get_capi_MessageNumber(),
-						"w(w(dc))",
-						FACILITYSELECTOR_LINE_INTERCONNECT,
-						0x0001, /* CONNECT */
-						segment[nr].datapath,
-						&segment[nr].p_struct);
-				}
+		if (finished != NULL) {
+			cc_mutex_lock(&chat_lock);
+			while (finished != NULL) {
+				member = finished;
+				finished = member->next;
+				worker->members--;
+				member->done = 1;
+				ast_cond_signal(&member->event);
 			}
+			cc_mutex_unlock(&chat_lock);
 		}
+	} while (stop == 0);
 
-		ast_free(segments);
-	}
+	return NULL;
 }
 
-/*
- * delete a chat member
- */
-static void del_chat_member(struct capichat_s *room, int expect_plci_removal)
+static int chat_worker_start(struct capichat_worker_s *worker)
 {
-	struct capichat_s *tmproom;
-	struct capichat_s *tmproom2 = NULL;
-	unsigned int roomnumber = room->number;
-	struct capi_pvt *i = room->i;
+	struct epoll_event ev;
 
-	cc_mutex_lock(&chat_lock);
-	tmproom = chat_list;
-	while (tmproom) {
-		if (tmproom == room) {
-			if (!tmproom2) {
-				chat_list = tmproom->next;
-			} else {
-				tmproom2->next = tmproom->next;
-			}
-			cc_verbose(3, 0, VERBOSE_PREFIX_3 "%s: removed chat member from room '%s' (%d)\n",
-				room->i->vname, room->name, room->number);
-			ast_free(room);
-		}
-		tmproom2 = tmproom;
-		tmproom = tmproom->next;
+	memset(worker, 0, sizeof(*worker));
+	diva_q_init(&worker->serviced);
+
+	worker->epfd = epoll_create(PBX_CHAT_WORKER_EVENTS);
+	if (worker->epfd < 0) {
+		cc_log(LOG_WARNING, "Unable to create " CC_MESSAGE_NAME " chat worker epoll set.\n");
+		return -1;
+	}
+	if (chat_event_pipe_create(worker->wakeup_fd) != 0) {
+		close(worker->epfd);
+		cc_log(LOG_WARNING, "Unable to create " CC_MESSAGE_NAME " chat worker pipe.\n");
+		return -1;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if ((epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->wakeup_fd[0], &ev) != 0) ||
+	    (ast_pthread_create(&worker->thread, NULL, chat_worker_thread, worker) < 0)) {
+		close(worker->epfd);
+		close(worker->wakeup_fd[0]);
+		close(worker->wakeup_fd[1]);
+		cc_log(LOG_WARNING, "Unable to start " CC_MESSAGE_NAME " chat worker thread.\n");
+		return -1;
 	}
-	cc_mutex_unlock(&chat_lock);
 
-	update_capi_mixer(1, roomnumber, i, 0, expect_plci_removal);
+	return 0;
 }
 
 /*
- * add a new chat member
+ * select the worker with the least members, start a new worker
+ * if all workers are busy, called with chat_lock held
  */
-static struct capichat_s *add_chat_member(const char *roomname, struct capi_pvt *i, room_member_type_t room_member_type, unsigned int groupNumber)
+static struct capichat_worker_s *chat_worker_get(void)
 {
-	struct capichat_s *room = NULL;
-	struct capichat_s *tmproom;
-	unsigned int roomnumber = 1;
-	room_mode_t room_mode = RoomModeDefault;
+	struct capichat_worker_s *worker = NULL;
+	unsigned int n;
 
-	room = ast_malloc(sizeof(struct capichat_s));
-	if (room == NULL) {
-		cc_log(LOG_ERROR, "Unable to allocate chan_capi chat struct.\n");
+	if (chat_workers_stop != 0) {
 		return NULL;
 	}
-	memset(room, 0, sizeof(struct capichat_s));
-	
-	if (groupNumber == 0) {
-		strncpy(room->name, roomname, sizeof(room->name));
-	} else {
-		pbx_capi_create_full_room_name(roomname, groupNumber, room->name, sizeof(room->name));
+	for (n = 0; (n < chat_workers_running) && (n < chat_workers_max); n++) {
+		if ((worker == NULL) || (chat_workers[n].members < worker->members)) {
+			worker = &chat_workers[n];
+		}
+	}
+	if ((chat_workers_running < chat_workers_max) &&
+	    ((worker == NULL) || (worker->members != 0))) {
+		if (chat_worker_start(&chat_workers[chat_workers_running]) == 0) {
+			worker = &chat_workers[chat_workers_running++];
+		}
 	}
-	room->name[sizeof(room->name) - 1] = 0;
 
-	room->i = i;
-	room->room_member_type = room_member_type;
-	room->group = groupNumber;
+	return worker;
+}
 
-	cc_mutex_lock(&chat_lock);
+/*
+ * hand the member over to a worker and wait until the member
+ * leaves the room, returns -1 if no worker is available
+ */
+static int chat_worker_run(struct ast_channel *chan, struct capi_pvt *i,
+	struct capichat_s *room, int eventfd, unsigned int hangup_timeout, int *detected_hangup)
+{
+	struct capichat_worker_member_s member;
+	struct capichat_worker_s *worker;
+	int n;
+
+	memset(&member, 0, sizeof(member));
+	member.room = room;
+	member.chan = chan;
+	member.i = i;
+	member.event_fd = eventfd;
+	member.hangup_timeout = hangup_timeout;
+	member.alone_since = time(NULL);
+	for (n = 0; n < PBX_CHAT_WORKER_FDS; n++) {
+		member.fd[n] = -1;
+		member.tag[n].member = &member;
+		member.tag[n].index = n;
+	}
+	ast_cond_init(&member.event, NULL);
 
-	tmproom = chat_list;
-	while (tmproom) {
-		if (!strcmp(tmproom->name, room->name)) {
-			roomnumber = tmproom->number;
-			room_mode  = tmproom->room_mode;
-			break;
-		} else {
-			if (tmproom->number >= roomnumber) {
-				roomnumber = tmproom->number + 1;
-			}
-		}
-		tmproom = tmproom->next;
+	cc_mutex_lock(&chat_lock);
+	worker = chat_worker_get();
+	if (worker == NULL) {
+		cc_mutex_unlock(&chat_lock);
+		ast_cond_destroy(&member.event);
+		return -1;
 	}
+	worker->members++;
+	member.next = worker->joining;
+	worker->joining = &member;
+	chat_event_pipe_signal(worker->wakeup_fd[1]);
 
-	room->number = roomnumber;
-	room->room_mode = room_mode;
+	cc_verbose(4, 1, VERBOSE_PREFIX_3 "%s: chat: serviced by worker %d.\n",
+		i->vname, (int)(worker - chat_workers));
 
-	for (tmproom = chat_list; tmproom != NULL; tmproom = tmproom->next) {
-		if (tmproom->number == roomnumber) {
-			tmproom->info &= ~PBX_CHAT_MEMBER_INFO_RECENT;
-		}
+	while (member.done == 0) {
+		ast_cond_wait(&member.event, &chat_lock);
 	}
-	room->info |= PBX_CHAT_MEMBER_INFO_RECENT;
-	room->time = time(NULL);
+	cc_mutex_unlock(&chat_lock);
+	ast_cond_destroy(&member.event);
 
-	room->next = chat_list;
-	chat_list = room;
+	*detected_hangup = member.detected_hangup;
 
-	cc_mutex_unlock(&chat_lock);
+	return 0;
+}
 
-	cc_verbose(3, 0, VERBOSE_PREFIX_3 "%s: added new chat member to room '%s' %s(%d)\n",
-		i->vname, roomname, room_member_type_2_name(room_member_type), roomnumber);
+/*
+ * stop the chat workers, the members are woken up to leave the room
+ */
+static void chat_workers_cleanup(void)
+{
+	unsigned int n, running;
 
-	update_capi_mixer(0, roomnumber, i, 0, 0);
+	cc_mutex_lock(&chat_lock);
+	chat_workers_stop = 1;
+	running = chat_workers_running;
+	for (n = 0; n < running; n++) {
+		chat_workers[n].stop = 1;
+		chat_event_pipe_signal(chat_workers[n].wakeup_fd[1]);
+	}
+	cc_mutex_unlock(&chat_lock);
 
-	return room;
+	for (n = 0; n < running; n++) {
+		pthread_join(chat_workers[n].thread, NULL);
+		close(chat_workers[n].epfd);
+		close(chat_workers[n].wakeup_fd[0]);
+		close(chat_workers[n].wakeup_fd[1]);
+	}
+	chat_workers_running = 0;
 }
+#endif
 
 /*
  * loop during chat
  */
 static void chat_handle_events(struct ast_channel *c, struct capi_pvt *i,
 	struct capichat_s *room, unsigned int flags, struct capi_pvt* iline,
-	FILE* voice_message, unsigned int hangup_timeout, int* pbx_detected_hangup)
+	cc_capi_announcement_t* voice_message, unsigned int hangup_timeout, int* pbx_detected_hangup)
 {
 	struct ast_frame *f;
 	int ms;
 	int exception;
 	int ready_fd;
-	int waitfd;
+	int waitfd[2];
+	int eventfd;
 	int nfds = 0;
 	struct ast_channel *rchan;
 	struct ast_channel *chan = c;
 	int moh_active = 0, voice_message_moh_active = 0;
 	int write_block_nr = 2;
+	const unsigned char *voice_data = NULL;
+	size_t voice_len = 0, voice_pos = 0;
 	time_t alone_since = time(NULL);
 	int local_detected_hangup;
 	int* detected_hangup = (pbx_detected_hangup != NULL) ? pbx_detected_hangup : &local_detected_hangup;
@@ -497,17 +1663,36 @@ static void chat_handle_events(struct ast_channel *c, struct capi_pvt *i,
 
 	if (voice_message == NULL) {
 		ast_indicate(chan, -1);
+	} else {
+		voice_data = pbx_capi_announce_data(voice_message, &voice_len);
 	}
 
-	waitfd = i->readerfd;
 	if (i->channeltype == CAPI_CHANNELTYPE_NULL) {
 		int fmt = (i->line_plci != 0 && i->line_plci->bproto == CC_BPROTO_VOCODER) ? i->line_plci->codec : capi_capability;
-		nfds = 1;
+		waitfd[nfds++] = i->readerfd;
 		cc_set_read_format(chan, fmt);
 		cc_set_write_format(chan, fmt);
 	}
 
-	if ((flags & CHAT_FLAG_MOH) && ((room->active < 2) || (voice_message != NULL))) {
+	/*
+		Room events (members joining or leaving, remove requests) wake up
+		the thread, so it sleeps until a frame or event arrives and polls only
+		if the event pipe is not available
+		*/
+	eventfd = chat_member_events_open(room);
+	if (eventfd >= 0) {
+		waitfd[nfds++] = eventfd;
+	}
+
+#ifdef CC_USE_EPOLL
+	if ((eventfd >= 0) && (chat_worker_eligible(i, flags, voice_message) != 0) &&
+	    (chat_worker_run(chan, i, room, eventfd, hangup_timeout, detected_hangup) == 0)) {
+		chat_member_events_close(room);
+		return;
+	}
+#endif
+
+	if ((flags & CHAT_FLAG_MOH) && ((room->chat_room->active < 2) || (voice_message != NULL))) {
 #if defined(CC_AST_HAS_VERSION_1_6) || defined(CC_AST_HAS_VERSION_1_4)
 		ast_moh_start(chan, NULL, NULL);
 #else
@@ -522,7 +1707,7 @@ static void chat_handle_events(struct ast_channel *c, struct capi_pvt *i,
 
 	while (1) {
 		ready_fd = 0;
-		ms = 100;
+		ms = (eventfd >= 0) ? -1 : 100;
 		errno = 0;
 		exception = 0;
 
@@ -530,7 +1715,16 @@ static void chat_handle_events(struct ast_channel *c, struct capi_pvt *i,
 			break;
 		}
 
-		rchan = ast_waitfor_nandfds(&chan, 1, &waitfd, nfds, &exception, &ready_fd, &ms);
+		if ((hangup_timeout > 0) && (room->chat_room->active < 2)) {
+			time_t now = time(NULL);
+			time_t hangup_time = ((alone_since != 0) ? alone_since : now) + hangup_timeout + 1;
+
+			if ((ms < 0) || (((hangup_time - now) * 1000) < ms)) {
+				ms = (hangup_time > now) ? (int)((hangup_time - now) * 1000) : 0;
+			}
+		}
+
+		rchan = ast_waitfor_nandfds(&chan, 1, waitfd, nfds, &exception, &ready_fd, &ms);
 
 		if (rchan) {
 			f = ast_read(chan);
@@ -552,7 +1746,15 @@ static void chat_handle_events(struct ast_channel *c, struct capi_pvt *i,
 			} else if (f->frametype == AST_FRAME_VOICE) {
 				cc_verbose(8, 1, VERBOSE_PREFIX_3 "%s: chat: voice frame.\n",
 					i->vname);
-				if ((voice_message == NULL) && (i->channeltype == CAPI_CHANNELTYPE_NULL)) {
+				if ((i->rx_level_enabled) && (i->channeltype == CAPI_CHANNELTYPE_NULL) &&
+				    (GET_FRAME_SUBCLASS_CODEC(f->subclass) == capi_capability)) {
+					/* voice of the channel is passed to the NULL PLCI by this thread */
+					capi_level_update(&i->rx_level, f->FRAME_DATA_PTR, f->datalen);
+				}
+				chat_speaker_update(room->chat_room);
+				if ((voice_message == NULL) && (room->mixer_member != NULL)) {
+					chat_software_mix(chan, i, room, f, 1);
+				} else if ((voice_message == NULL) && (i->channeltype == CAPI_CHANNELTYPE_NULL)) {
 					capi_write_frame(i, f);
 				} else if ((iline != NULL) && (!(flags & CHAT_FLAG_SAMEMSG))) {
 					capi_write_frame(iline, f);
@@ -572,7 +1774,9 @@ static void chat_handle_events(struct ast_channel *c, struct capi_pvt *i,
 					i->vname, f->frametype, FRAME_SUBCLASS_INTEGER(f->subclass));
 			}
 			ast_frfree(f);
-		} else if (ready_fd == i->readerfd) {
+		} else if ((eventfd >= 0) && (ready_fd == eventfd)) {
+			chat_member_events_drain(eventfd);
+		} else if ((i->channeltype == CAPI_CHANNELTYPE_NULL) && (ready_fd == i->readerfd)) {
 			if (exception) {
 				cc_verbose(1, 0, VERBOSE_PREFIX_3 "%s: chat: exception on readerfd\n",
 					i->vname);
@@ -581,14 +1785,20 @@ static void chat_handle_events(struct ast_channel *c, struct capi_pvt *i,
 			f = capi_read_pipeframe(i);
 			if (f->frametype == AST_FRAME_VOICE) {
 				if (voice_message == NULL) {
-					ast_write(chan, f);
+					if (room->mixer_member == NULL) {
+						ast_write(chan, f);
+					}
+					/* software mixer sends the mix on reception of the own frame */
 				} else {
 					struct ast_frame *fr2;
 					char* p = f->FRAME_DATA_PTR;
 					int len;
 
 					do {
-						if ((len = fread(p, 1, f->datalen, voice_message)) > 0) {
+						len = ((voice_len - voice_pos) < (size_t)f->datalen) ? (int)(voice_len - voice_pos) : f->datalen;
+						if (len > 0) {
+							memcpy(p, &voice_data[voice_pos], len);
+							voice_pos += len;
 							if (len < f->datalen) {
 								memset (&p[len], 0x00, f->datalen-len);
 								len = 0;
@@ -602,7 +1812,11 @@ static void chat_handle_events(struct ast_channel *c, struct capi_pvt *i,
 								}
 								ast_frfree(fr2);
 							}
-							capi_write_frame(i, f);
+							if (room->mixer_member != NULL) {
+								chat_software_mix(chan, i, room, f, 0);
+							} else {
+								capi_write_frame(i, f);
+							}
 						}
 					} while ((write_block_nr-- != 0) && (len > 0));
 
@@ -628,14 +1842,17 @@ static void chat_handle_events(struct ast_channel *c, struct capi_pvt *i,
 				break;
 			}
 		}
-		if ((moh_active) && (room->active > 1)) {
+		if ((moh_active) && (room->chat_room->active > 1)) {
 			ast_moh_stop(chan);
 			moh_active = 0;
 		}
 		if (hangup_timeout > 0) {
-			if (room->active > 1) {
-				alone_since = time(NULL);
+			if (room->chat_room->active > 1) {
+				alone_since = 0;
 			} else {
+				if (alone_since == 0) {
+					alone_since = time(NULL);
+				}
 				if ((alone_since + hangup_timeout) < time(NULL)) {
 					cc_verbose(3, 1, VERBOSE_PREFIX_3 "%s: chat: reached (alone) hangup timeout.\n",
 						i->vname);
@@ -647,6 +1864,8 @@ static void chat_handle_events(struct ast_channel *c, struct capi_pvt *i,
 	if (voice_message_moh_active != 0) {
 		ast_moh_stop(chan);
 	}
+
+	chat_member_events_close(room);
 }
 
 /*
@@ -708,6 +1927,9 @@ int pbx_capi_chat(struct ast_channel *c, char *param)
 		case 'g':
 			largeConferenceMode = 1;
 			break;
+		case 's':
+			flags |= CHAT_FLAG_SWMIX;
+			break;
 
 		default:
 			cc_log(LOG_WARNING, "Unknown chat option '%c'.\n",
@@ -736,10 +1958,10 @@ int pbx_capi_chat(struct ast_channel *c, char *param)
 
 	if (largeConferenceMode != 0) {
 		int c;
-		pbx_capi_chat_enter_bridge_modify_state();
+		pbx_capi_chat_enter_bridge_modify_state(roomname);
 		selectedGroup = pbx_capi_find_group (roomname, contr, (i != NULL) ? i->controller : -1);
 		if (selectedGroup == 0) {
-			pbx_capi_chat_leave_bridge_modify_state();
+			pbx_capi_chat_leave_bridge_modify_state(roomname);
 			if (i != NULL) {
 				capi_remove_nullif(i);
 			}
@@ -750,7 +1972,7 @@ int pbx_capi_chat(struct ast_channel *c, char *param)
 			contr = (1LU << (c - 1));
 		}
 		bridgeUsers = pbx_capi_add_group_user(roomname, selectedGroup);
-		pbx_capi_chat_leave_bridge_modify_state();
+		pbx_capi_chat_leave_bridge_modify_state(roomname);
 	}
 
 	cc_verbose(3, 1, VERBOSE_PREFIX_3 CC_MESSAGE_NAME " chat: %s: roomname=%s group=%u group users=%u"
@@ -777,7 +1999,7 @@ int pbx_capi_chat(struct ast_channel *c, char *param)
 		goto out;
 	}
 
-	room = add_chat_member(roomname, i, room_member_type, selectedGroup);
+	room = add_chat_member(roomname, i, room_member_type, selectedGroup, ((flags & CHAT_FLAG_SWMIX) != 0));
 	if (!room) {
 		cc_log(LOG_WARNING, "Unable to open " CC_MESSAGE_NAME " chat room.\n");
 		capi_remove_nullif(i);
@@ -786,8 +2008,8 @@ int pbx_capi_chat(struct ast_channel *c, char *param)
 	}
 
 	pbx_capi_chat_join_event(c, room);
-	if (room->active == 1) {
-		pbx_capi_chat_room_state_event(room->name, 1);
+	if (room->chat_room->active == 1) {
+		pbx_capi_chat_room_state_event(room->chat_room->name, 1);
 	}
 	conferenceConnectTime = time(NULL);
 
@@ -795,9 +2017,9 @@ int pbx_capi_chat(struct ast_channel *c, char *param)
 	chat_handle_events(c, i, room, flags, 0, 0, hangup_timeout, &expect_plci_removal);
 
 	pbx_capi_chat_leave_event(c, room, time(NULL)-conferenceConnectTime);
-	if (room->active == 1) {
-		pbx_capi_chat_conference_end_event (room->name);
-		pbx_capi_chat_room_state_event(room->name, 0);
+	if (room->chat_room->active == 1) {
+		pbx_capi_chat_conference_end_event (room->chat_room->name);
+		pbx_capi_chat_room_state_event(room->chat_room->name, 0);
 	}
 
 	expect_plci_removal |= (i->channeltype == CAPI_CHANNELTYPE_NULL); /* NULL PLCI is removed, no need to update CAPI LI state */
@@ -821,7 +2043,7 @@ int pbx_capi_chat_play(struct ast_channel *c, char *param)
 	unsigned long long contr = 0;
 	unsigned int flags = 0;
 	room_member_type_t room_member_type = RoomMemberOperator;
-	FILE* f;
+	cc_capi_announcement_t *f;
 
 	if (param == 0 || *param == 0) {
 		cc_log(LOG_WARNING, CC_MESSAGE_NAME " chat_play requires parameters.\n");
@@ -846,9 +2068,7 @@ int pbx_capi_chat_play(struct ast_channel *c, char *param)
 		int chat_members;
 
 		cc_mutex_lock(&chat_lock);
-		for (room = chat_list, chat_members = 0; room != 0 && chat_members == 0; room = room->next) {
-			chat_members += (strcmp(room->name, roomname) == 0);
-		}
+		chat_members = (chat_find_room(roomname) != NULL);
 		cc_mutex_unlock(&chat_lock);
 
 		if (chat_members == 0) {
@@ -877,24 +2097,11 @@ int pbx_capi_chat_play(struct ast_channel *c, char *param)
 		flags &= ~CHAT_FLAG_MOH;
 	}
 
-	f = fopen(file_name, "rb");
+	f = pbx_capi_announce_get(file_name);
 	if (f == NULL) {
-		cc_log(LOG_WARNING, "can't open voice file (%s)\n", strerror(errno));
 		return -1;
 	}
 
-	{
-		unsigned char tmp[2] = { 0, 0 };
-
-		if (fread(tmp, 1, 2, f) != 2) {
-			cc_log(LOG_WARNING, "can't read voice file (%s)\n", strerror(errno));
-			fclose(f);
-			return -1;
-		}
-	}
-
-	rewind(f);
-
 	if (controller) {
 		for (p = controller; p && *p; p++) {
 			if (*p == '|') *p = ',';
@@ -917,44 +2124,394 @@ int pbx_capi_chat_play(struct ast_channel *c, char *param)
 		"message=%s controller=%s (0x%llx)\n",
 		cur_name, roomname, file_name, controller, contr);
 
-	i = capi_mknullif(c, contr);
-	if (i == NULL) {
-		fclose (f);
-		cc_log(LOG_WARNING, "Unable to play %s to chat room %s", file_name, roomname);
-		return (-1);
+	i = capi_mknullif(c, contr);
+	if (i == NULL) {
+		pbx_capi_announce_put(f);
+		cc_log(LOG_WARNING, "Unable to play %s to chat room %s", file_name, roomname);
+		return (-1);
+	}
+
+	if (cur_state != AST_STATE_UP) {
+		ast_answer(c);
+	}
+
+	capi_wait_for_answered(i);
+	if (!(capi_wait_for_b3_up(i))) {
+		goto out;
+	}
+
+	room = add_chat_member(roomname, i, room_member_type, 0, 0);
+	if (!room) {
+		capi_remove_nullif(i);
+		pbx_capi_announce_put(f);
+		cc_log(LOG_WARNING, "Unable to open " CC_MESSAGE_NAME " chat room.\n");
+		return -1;
+	}
+
+	/* main loop */
+	chat_handle_events(c, i, room, flags, (cur_tech == &capi_tech) ? (CC_CHANNEL_PVT(c)) : 0, f, 0, NULL);
+
+	del_chat_member(room, 1);
+
+out:
+	pbx_capi_announce_put(f);
+	capi_remove_nullif(i);
+
+	return 0;
+}
+
+/*
+ * Broadcast of a voice file into many rooms. One NULL PLCI per
+ * controller plays the file and joins all matching rooms of the
+ * controller, line interconnect copies the data to the members of
+ * the rooms, so the file is sent once per controller.
+ */
+static int chat_broadcast_match(const struct capichat_broadcast_s *broadcast,
+	const struct capichat_room_s *chat_room)
+{
+	const char *name;
+
+	if ((chat_room->group > 1) || (chat_room->members == NULL) ||
+	    (chat_room->controller < 1) || (chat_room->controller > CAPI_MAX_CONTROLLERS)) {
+		return 0;
+	}
+	if (chat_room->group != 0) {
+		if (chat_room->conference == NULL) {
+			return 0;
+		}
+		name = chat_room->conference->name;
+	} else {
+		name = chat_room->name;
+	}
+
+	return (fnmatch(broadcast->pattern, name, 0) == 0);
+}
+
+static void chat_broadcast_credit(struct capi_pvt *i, int len)
+{
+	/*
+		The source does not receive voice which could credit the
+		B3 queue, the broadcast clock does it instead
+		*/
+	capi_b3q_credit(i, len);
+}
+
+static void chat_broadcast_done(struct capichat_broadcast_s *broadcast)
+{
+	struct capichat_broadcast_s **link;
+
+	cc_mutex_lock(&chat_lock);
+	for (link = &chat_broadcast_list; *link != NULL; link = &(*link)->next) {
+		if (*link == broadcast) {
+			*link = broadcast->next;
+			break;
+		}
+	}
+	ast_cond_broadcast(&chat_broadcast_event);
+	cc_mutex_unlock(&chat_lock);
+
+	pbx_capi_announce_put(broadcast->announcement);
+	ast_free(broadcast->targets);
+	ast_free(broadcast);
+}
+
+/*
+ * group of the target has no place for the source
+ */
+static int chat_broadcast_group_full(const struct capichat_broadcast_target_s *target)
+{
+	struct capichat_room_s *chat_room;
+	int controller, full = 1;
+
+	cc_mutex_lock(&chat_lock);
+	chat_room = chat_find_group_room(target->name, target->group);
+	if (chat_room != NULL) {
+		full = (pbx_capi_chat_get_group_member_count(chat_room, &controller) >=
+			pbx_capi_chat_get_group_max_members(controller));
+	}
+	cc_mutex_unlock(&chat_lock);
+
+	return full;
+}
+
+static void *chat_broadcast_thread(void *data)
+{
+	struct capichat_broadcast_s *broadcast = data;
+	struct capichat_broadcast_target_s *target;
+	struct capi_pvt *i;
+	unsigned char frame_data[PBX_CHAT_BROADCAST_FRAME_SIZE];
+	unsigned char mix[PBX_CHAT_BROADCAST_FRAME_SIZE];
+	const unsigned char *voice_data;
+	size_t voice_len, voice_pos = 0;
+	unsigned long long tried = 0;
+	unsigned int nr, rooms = 0, sources = 0;
+	struct timeval next;
+	struct ast_frame fr;
+	int controller;
+
+	/* one source per controller */
+	for (nr = 0; nr < broadcast->ntargets; nr++) {
+		controller = broadcast->targets[nr].controller;
+		if ((tried & (1ULL << (controller - 1))) != 0) {
+			continue;
+		}
+		tried |= (1ULL << (controller - 1));
+		i = capi_mknullif(NULL, 1ULL << (controller - 1));
+		if (i == NULL) {
+			continue;
+		}
+		if (i->controller != controller) {
+			cc_log(LOG_WARNING, CC_MESSAGE_NAME " chat broadcast %u: controller %d not available.\n",
+				broadcast->number, controller);
+			capi_remove_nullif(i);
+			continue;
+		}
+		snprintf(i->vname, sizeof(i->vname) - 1, "BROADCAST%u-NULLPLCI", broadcast->number);
+		broadcast->source[controller] = i;
+	}
+	for (controller = 1; controller <= CAPI_MAX_CONTROLLERS; controller++) {
+		i = broadcast->source[controller];
+		if (i == NULL) {
+			continue;
+		}
+		capi_wait_for_answered(i);
+		if (!(capi_wait_for_b3_up(i))) {
+			capi_remove_nullif(i);
+			broadcast->source[controller] = NULL;
+			continue;
+		}
+		sources++;
+	}
+
+	for (nr = 0; (nr < broadcast->ntargets) && (broadcast->stop == 0); nr++) {
+		target = &broadcast->targets[nr];
+		i = broadcast->source[target->controller];
+		if (i == NULL) {
+			continue;
+		}
+		if (target->group != 0) {
+			/* the source takes a place in the root group like any other member */
+			pbx_capi_chat_enter_bridge_modify_state(target->name);
+			if (chat_broadcast_group_full(target) != 0) {
+				pbx_capi_chat_leave_bridge_modify_state(target->name);
+				cc_log(LOG_WARNING, CC_MESSAGE_NAME " chat broadcast %u: conference '%s' is full.\n",
+					broadcast->number, target->name);
+				continue;
+			}
+		}
+		target->member = add_chat_member(target->name, i, RoomMemberSpeaker, target->group, 0);
+		if (target->group != 0) {
+			pbx_capi_chat_leave_bridge_modify_state(target->name);
+		}
+		if (target->member != NULL) {
+			rooms++;
+		}
+	}
+
+	cc_mutex_lock(&chat_lock);
+	broadcast->sources = sources;
+	broadcast->rooms = rooms;
+	cc_mutex_unlock(&chat_lock);
+
+	cc_verbose(3, 0, VERBOSE_PREFIX_3 CC_MESSAGE_NAME " chat broadcast %u: '%s' to %u rooms using %u sources\n",
+		broadcast->number, broadcast->file_name, rooms, sources);
+
+	memset(&fr, 0, sizeof(fr));
+	fr.frametype = AST_FRAME_VOICE;
+	SET_FRAME_SUBCLASS_CODEC(fr.subclass, capi_capability);
+	fr.FRAME_DATA_PTR = frame_data;
+	fr.datalen = sizeof(frame_data);
+	fr.samples = sizeof(frame_data);
+	fr.offset = 0;
+	fr.mallocd = 0;
+	fr.delivery = ast_tv(0, 0);
+	fr.src = NULL;
+
+	voice_data = pbx_capi_announce_data(broadcast->announcement, &voice_len);
+	next = ast_tvnow();
+
+	while ((broadcast->stop == 0) && (voice_pos < voice_len) && (rooms != 0)) {
+		size_t len = ((voice_len - voice_pos) < sizeof(frame_data)) ? (voice_len - voice_pos) : sizeof(frame_data);
+		long ms;
+
+		memcpy(frame_data, &voice_data[voice_pos], len);
+		if (len < sizeof(frame_data)) {
+			memset(&frame_data[len], (capi_capability == CC_FORMAT_ULAW) ? 255 : 85, sizeof(frame_data) - len);
+		}
+		voice_pos += len;
+
+		for (controller = 1; controller <= CAPI_MAX_CONTROLLERS; controller++) {
+			i = broadcast->source[controller];
+			if (i != NULL) {
+				chat_broadcast_credit(i, sizeof(frame_data));
+				capi_write_frame(i, &fr);
+			}
+		}
+
+		for (nr = 0; nr < broadcast->ntargets; nr++) {
+			cc_capi_mixer_t *mixer;
+			cc_capi_mixer_member_t *mixer_member;
+			int active;
+
+			target = &broadcast->targets[nr];
+			if (target->member == NULL) {
+				continue;
+			}
+			cc_mutex_lock(&chat_lock);
+			active = target->member->chat_room->active;
+			mixer = target->member->chat_room->mixer;
+			mixer_member = target->member->mixer_member;
+			cc_mutex_unlock(&chat_lock);
+
+			if (active < 2) {
+				/* all other members left the room */
+				del_chat_member(target->member, 0);
+				target->member = NULL;
+				rooms--;
+				continue;
+			}
+			if ((mixer != NULL) && (mixer_member != NULL)) {
+				/* the room and its mixer exist as long as the source is a member */
+				pbx_capi_mixer_mix(mixer, mixer_member, 1, frame_data, mix, sizeof(frame_data));
+			}
+		}
+
+		next = ast_tvadd(next, ast_tv(0, PBX_CHAT_BROADCAST_FRAME_SIZE * 125));
+		ms = ast_tvdiff_ms(next, ast_tvnow());
+		if (ms > 0) {
+			usleep(ms * 1000);
+		}
+	}
+
+	for (nr = 0; nr < broadcast->ntargets; nr++) {
+		if (broadcast->targets[nr].member != NULL) {
+			del_chat_member(broadcast->targets[nr].member, 1);
+		}
+	}
+	for (controller = 1; controller <= CAPI_MAX_CONTROLLERS; controller++) {
+		if (broadcast->source[controller] != NULL) {
+			capi_remove_nullif(broadcast->source[controller]);
+		}
+	}
+
+	cc_verbose(3, 0, VERBOSE_PREFIX_3 CC_MESSAGE_NAME " chat broadcast %u: finished\n",
+		broadcast->number);
+
+	chat_broadcast_done(broadcast);
+
+	return NULL;
+}
+
+/*
+ * start broadcast of voice file to all rooms matching the pattern,
+ * returns the number of matching rooms or -1 on error
+ */
+int pbx_capi_chat_broadcast_start(const char *pattern, const char *file_name)
+{
+	struct capichat_broadcast_s *broadcast;
+	struct capichat_room_s *chat_room;
+	unsigned int ntargets = 0;
+	pthread_t thread;
+
+	broadcast = ast_malloc(sizeof(*broadcast));
+	if (broadcast == NULL) {
+		return -1;
 	}
+	memset(broadcast, 0, sizeof(*broadcast));
+	cc_copy_string(broadcast->pattern, (ast_strlen_zero(pattern)) ? "*" : pattern, sizeof(broadcast->pattern));
+	cc_copy_string(broadcast->file_name, file_name, sizeof(broadcast->file_name));
 
-	if (cur_state != AST_STATE_UP) {
-		ast_answer(c);
+	broadcast->announcement = pbx_capi_announce_get(file_name);
+	if (broadcast->announcement == NULL) {
+		ast_free(broadcast);
+		return -1;
 	}
 
-	capi_wait_for_answered(i);
-	if (!(capi_wait_for_b3_up(i))) {
-		goto out;
+	cc_mutex_lock(&chat_lock);
+	/*
+		Groups of large conferences are connected by bridges to the root
+		group, so it is sufficient to join the root group
+		*/
+	for (chat_room = chat_room_list; chat_room != NULL; chat_room = chat_room->next) {
+		if (chat_broadcast_match(broadcast, chat_room) != 0) {
+			ntargets++;
+		}
+	}
+	if (ntargets != 0) {
+		broadcast->targets = ast_malloc(sizeof(*broadcast->targets) * ntargets);
 	}
+	if (broadcast->targets == NULL) {
+		cc_mutex_unlock(&chat_lock);
+		pbx_capi_announce_put(broadcast->announcement);
+		ast_free(broadcast);
+		return (ntargets == 0) ? 0 : -1;
+	}
+	memset(broadcast->targets, 0, sizeof(*broadcast->targets) * ntargets);
+	for (chat_room = chat_room_list; (chat_room != NULL) && (broadcast->ntargets < ntargets); chat_room = chat_room->next) {
+		if (chat_broadcast_match(broadcast, chat_room) != 0) {
+			struct capichat_broadcast_target_s *target = &broadcast->targets[broadcast->ntargets++];
+
+			cc_copy_string(target->name, (chat_room->group != 0) ? chat_room->conference->name : chat_room->name,
+				sizeof(target->name));
+			target->group = chat_room->group;
+			target->controller = chat_room->controller;
+		}
+	}
+	broadcast->number = ++chat_broadcast_last_number;
+	broadcast->next = chat_broadcast_list;
+	chat_broadcast_list = broadcast;
 
-	room = add_chat_member(roomname, i, room_member_type, 0);
-	if (!room) {
-		capi_remove_nullif(i);
-		fclose (f);
-		cc_log(LOG_WARNING, "Unable to open " CC_MESSAGE_NAME " chat room.\n");
+	if (ast_pthread_create(&thread, NULL, chat_broadcast_thread, broadcast) < 0) {
+		chat_broadcast_list = broadcast->next;
+		cc_mutex_unlock(&chat_lock);
+		cc_log(LOG_ERROR, "Unable to start " CC_MESSAGE_NAME " chat broadcast thread.\n");
+		pbx_capi_announce_put(broadcast->announcement);
+		ast_free(broadcast->targets);
+		ast_free(broadcast);
 		return -1;
 	}
+	pthread_detach(thread);
+	cc_mutex_unlock(&chat_lock);
 
-	/* main loop */
-	chat_handle_events(c, i, room, flags, (cur_tech == &capi_tech) ? (CC_CHANNEL_PVT(c)) : 0, f, 0, NULL);
+	cc_verbose(3, 1, VERBOSE_PREFIX_3 CC_MESSAGE_NAME " chat broadcast %u: pattern=%s message=%s rooms=%u\n",
+		broadcast->number, broadcast->pattern, file_name, ntargets);
 
-	del_chat_member(room, 1);
+	return (int)ntargets;
+}
 
-out:
-	fclose (f);
-	capi_remove_nullif(i);
+/*
+ * broadcast voice file to rooms
+ */
+int pbx_capi_chat_broadcast(struct ast_channel *c, char *param)
+{
+	char *pattern, *file_name;
+	int rooms;
+
+	if (param == 0 || *param == 0) {
+		cc_log(LOG_WARNING, CC_MESSAGE_NAME " chat_broadcast requires parameters.\n");
+		return (-1);
+	}
+
+	pattern = strsep(&param, COMMANDSEPARATOR);
+	file_name = param;
+
+	if (!file_name || !*file_name) {
+		cc_log(LOG_WARNING, CC_MESSAGE_NAME " chat_broadcast requires file name.\n");
+		return -1;
+	}
+
+	rooms = pbx_capi_chat_broadcast_start(pattern, file_name);
+	if (rooms < 0) {
+		cc_log(LOG_WARNING, "Unable to broadcast %s to chat rooms %s\n", file_name, pattern);
+		return -1;
+	}
 
 	return 0;
 }
 
 int pbx_capi_chat_command(struct ast_channel *c, char *param)
 {
+	struct capichat_room_s *chat_room;
 	struct capichat_s *room, *tmproom;
 	struct capi_pvt *i;
 	unsigned int roomnumber, ret = 0;
@@ -998,41 +2555,52 @@ int pbx_capi_chat_command(struct ast_channel *c, char *param)
 
 		cc_mutex_lock(&chat_lock);
 
-		for (room = chat_list; room != 0; room = room->next) {
-			if (((roomname != 0 && strcmp(room->name, roomname) == 0) || (i != 0 && room->i == i)) &&
-					(room->i != 0 && (room->i->used == c || room->i->peer == c))) {
-				if (room->room_member_type == RoomMemberOperator) {
-					struct capichat_s *recent = 0;
-					time_t t = 0;
-
-					roomnumber = room->number;
-					cc_verbose(3, 0, VERBOSE_PREFIX_3 "%s: command %08x (%d)\n",
-											room->name, disconnect_command, roomnumber);
-					for (tmproom = chat_list; tmproom != 0; tmproom = tmproom->next) {
-						if (tmproom->number == roomnumber && tmproom != room) {
-							if ((disconnect_command & 8U) != 0) {
-								tmproom->info |= PBX_CHAT_MEMBER_INFO_REMOVE;
-							} else if ((disconnect_command & 2U) != 0 && room->room_member_type == RoomMemberListener) {
-								tmproom->info |= PBX_CHAT_MEMBER_INFO_REMOVE;
-							} else if ((disconnect_command & 4U) != 0 &&  room->room_member_type == RoomMemberOperator) {
-								tmproom->info |= PBX_CHAT_MEMBER_INFO_REMOVE;
-							} else if ((disconnect_command & 1U) != 0) {
-								if (t < tmproom->time) {
-									t      = tmproom->time;
-									recent = tmproom;
-								}
+		room = NULL;
+		if ((roomname != 0) && ((chat_room = chat_find_room(roomname)) != NULL)) {
+			for (room = chat_room->members; room != 0; room = room->next) {
+				if (chat_member_of_channel(room, c))
+					break;
+			}
+		}
+		for (chat_room = chat_room_list; (room == 0) && (i != 0) && (chat_room != 0); chat_room = chat_room->next) {
+			for (room = chat_room->members; room != 0; room = room->next) {
+				if ((room->i == i) && chat_member_of_channel(room, c))
+					break;
+			}
+		}
+
+		if (room != 0) {
+			if (room->room_member_type == RoomMemberOperator) {
+				struct capichat_s *recent = 0;
+				time_t t = 0;
+
+				roomnumber = room->chat_room->number;
+				cc_verbose(3, 0, VERBOSE_PREFIX_3 "%s: command %08x (%d)\n",
+										room->chat_room->name, disconnect_command, roomnumber);
+				for (tmproom = room->chat_room->members; tmproom != 0; tmproom = tmproom->next) {
+					if (tmproom != room) {
+						if ((disconnect_command & 8U) != 0) {
+							tmproom->info |= PBX_CHAT_MEMBER_INFO_REMOVE;
+						} else if ((disconnect_command & 2U) != 0 && room->room_member_type == RoomMemberListener) {
+							tmproom->info |= PBX_CHAT_MEMBER_INFO_REMOVE;
+						} else if ((disconnect_command & 4U) != 0 &&  room->room_member_type == RoomMemberOperator) {
+							tmproom->info |= PBX_CHAT_MEMBER_INFO_REMOVE;
+						} else if ((disconnect_command & 1U) != 0) {
+							if (t < tmproom->time) {
+								t      = tmproom->time;
+								recent = tmproom;
 							}
 						}
 					}
-					if (recent != 0) {
-						recent->info |= PBX_CHAT_MEMBER_INFO_REMOVE;
-					}
-				} else {
-					cc_verbose(3, 0, VERBOSE_PREFIX_3 "%s: no permissions for command command %08x\n",
-											room->name, disconnect_command);
-					ret = -1;
 				}
-				break;
+				if (recent != 0) {
+					recent->info |= PBX_CHAT_MEMBER_INFO_REMOVE;
+				}
+				chat_room_signal(room->chat_room);
+			} else {
+				cc_verbose(3, 0, VERBOSE_PREFIX_3 "%s: no permissions for command command %08x\n",
+										room->chat_room->name, disconnect_command);
+				ret = -1;
 			}
 		}
 
@@ -1132,6 +2700,8 @@ char *pbxcli_capi_chatinfo(struct ast_cli_entry *e, int cmd, struct ast_cli_args
 int pbxcli_capi_chatinfo(int fd, int argc, char *argv[])
 #endif
 {
+	struct capichat_room_s *chat_room;
+	struct capichat_broadcast_s *broadcast;
 	struct capichat_s *room = NULL;
 	struct ast_channel *c;
 #ifdef CC_AST_HAS_VERSION_1_6
@@ -1151,7 +2721,7 @@ int pbxcli_capi_chatinfo(int fd, int argc, char *argv[])
 		return RESULT_SHOWUSAGE;
 #endif
 
-	if (chat_list == NULL) {
+	if (chat_room_list == NULL) {
 		ast_cli(fd, "There are no members in " CC_MESSAGE_NAME " chat.\n");
 		return RESULT_SUCCESS;
 	}
@@ -1160,15 +2730,15 @@ int pbxcli_capi_chatinfo(int fd, int argc, char *argv[])
 	ast_cli(fd, "%-6s%-17s%-40s%-17s\n", "Room#", "Roomname", "Member", "Caller");
 
 	cc_mutex_lock(&chat_lock);
-	room = chat_list;
-	while (room) {
+	for (room = (struct capichat_s *)pbx_capi_chat_get_room_c(NULL); room != 0;
+	     room = (struct capichat_s *)pbx_capi_chat_get_room_c(room)) {
 		c = room->i->owner;
 		if (!c) {
 			c = room->i->used;
 		}
 		if (!c) {
 			ast_cli(fd, "%5d %-17s%-40s\"%s\" <%s>\n",
-				room->number, room->name, room->i->vname,
+				room->chat_room->number, room->chat_room->name, room->i->vname,
 				"?", "?");
 		} else {
 #ifdef CC_AST_HAS_VERSION_11_0
@@ -1177,10 +2747,38 @@ int pbxcli_capi_chatinfo(int fd, int argc, char *argv[])
 			const char *cur_name = c->name;
 #endif /* defined(CC_AST_HAS_VERSION_11_0) */
 			ast_cli(fd, "%5d %-17s%-40s\"%s\" <%s>\n",
-				room->number, room->name, cur_name,
+				room->chat_room->number, room->chat_room->name, cur_name,
 				pbx_capi_get_callername (c, ""), pbx_capi_get_cid (c, ""));
 		}
-		room = room->next;
+	}
+	ast_cli(fd, "Line interconnect: %llu requests for %lu membership events (last event %u)\n",
+		chat_li_requests, chat_li_events, chat_li_requests_last);
+	for (chat_room = chat_room_list; chat_room != NULL; chat_room = chat_room->next) {
+		unsigned int members;
+		unsigned long long frames, ns_per_frame;
+
+		if (chat_room->mixer == NULL)
+			continue;
+
+		pbx_capi_mixer_get_stats(chat_room->mixer, &members, &frames, &ns_per_frame);
+		ast_cli(fd, "Software mixer '%s': %u members, %llu frames, %llu ns per member frame\n",
+			chat_room->name, members, frames, ns_per_frame);
+	}
+#ifdef CC_USE_EPOLL
+	if (chat_workers_running != 0) {
+		unsigned int n, members = 0;
+
+		for (n = 0; n < chat_workers_running; n++) {
+			members += chat_workers[n].members;
+		}
+		ast_cli(fd, "Workers: %u threads servicing %u NULL PLCI members\n",
+			chat_workers_running, members);
+	}
+#endif
+	for (broadcast = chat_broadcast_list; broadcast != NULL; broadcast = broadcast->next) {
+		ast_cli(fd, "Broadcast %u '%s' to '%s': %u rooms, %u sources\n",
+			broadcast->number, broadcast->file_name, broadcast->pattern,
+			broadcast->rooms, broadcast->sources);
 	}
 	cc_mutex_unlock(&chat_lock);
 
@@ -1198,6 +2796,8 @@ static const char* room_member_type_2_name(room_member_type_t room_member_type)
 		return "in listener mode ";
 	case RoomMemberOperator:
 		return "in operator mode ";
+	case RoomMemberSpeaker:
+		return "in speaker mode ";
 
 	default:
 		return "";
@@ -1206,8 +2806,8 @@ static const char* room_member_type_2_name(room_member_type_t room_member_type)
 
 int pbx_capi_chat_mute(struct ast_channel *c, char *param)
 {
+	struct capichat_room_s *chat_room = NULL;
 	struct capichat_s *room;
-	unsigned int roomnumber;
 	room_mode_t room_mode;
 	const char* roommode = strsep(&param, COMMANDSEPARATOR);
 	const char* roomname  = param;
@@ -1236,21 +2836,26 @@ int pbx_capi_chat_mute(struct ast_channel *c, char *param)
 
 	cc_mutex_lock(&chat_lock);
 
-	for (room = chat_list; room != 0; room = room->next) {
-		if ((roomname != 0 && strcmp(room->name, roomname) == 0) ||
-				(i != 0 && room->i == i) ||
-				(room->i != 0 && (room->i->used == c || room->i->peer == c))) {
-			roomnumber = room->number;
-			cc_verbose(3, 0, VERBOSE_PREFIX_3 "%s: change mode to %s (%d)\n",
-									room->name, room_mode == RoomModeDefault ? "full duplex" : "half duplex", roomnumber);
-			for (room = chat_list; room != 0; room = room->next) {
-				if (room->number == roomnumber) {
-					room->room_mode = room_mode;
-				}
+	if (roomname != 0) {
+		chat_room = chat_find_room(roomname);
+	}
+	if (chat_room == NULL) {
+		room = NULL;
+		for (chat_room = chat_room_list; (room == NULL) && (chat_room != 0); chat_room = chat_room->next) {
+			for (room = chat_room->members; room != 0; room = room->next) {
+				if ((i != 0 && room->i == i) || chat_member_of_channel(room, c))
+					break;
 			}
-			update_all_capi_mixers(roomnumber);
-			return 0;
 		}
+		chat_room = (room != NULL) ? room->chat_room : NULL;
+	}
+
+	if (chat_room != NULL) {
+		cc_verbose(3, 0, VERBOSE_PREFIX_3 "%s: change mode to %s (%d)\n",
+								chat_room->name, room_mode == RoomModeDefault ? "full duplex" : "half duplex", chat_room->number);
+		chat_room->room_mode = room_mode;
+		update_all_capi_mixers(chat_room);
+		return 0;
 	}
 
 	cc_mutex_unlock(&chat_lock);
@@ -1263,21 +2868,16 @@ int pbx_capi_chat_mute(struct ast_channel *c, char *param)
 	*/
 int pbx_capi_chat_remove_user(const char* roomName, const char* memberName)
 {
+	struct capichat_room_s *chat_room;
 	struct capichat_s *room;
-	unsigned int roomnumber;
 	int ret = -1;
 
 	cc_mutex_lock(&chat_lock);
 
-	for (room = chat_list; room != 0; room = room->next) {
-		if (strcmp(room->name, roomName) == 0) {
-			roomnumber = room->number;
-			break;
-		}
-	}
-	if (room != 0) {
-		for (room = chat_list; room != 0; room = room->next) {
-			if ((roomnumber == room->number) && (room->i != 0)) {
+	chat_room = chat_find_room(roomName);
+	if (chat_room != 0) {
+		for (room = chat_room->members; room != 0; room = room->next) {
+			if (room->i != 0) {
 				struct ast_channel *c = room->i->owner;
 				if (c == 0) {
 					c = room->i->used;
@@ -1290,6 +2890,7 @@ int pbx_capi_chat_remove_user(const char* roomName, const char* memberName)
 #endif /* defined(CC_AST_HAS_VERSION_11_0) */
 					if (strcmp (memberName, cur_name) == 0) {
 						room->info |= PBX_CHAT_MEMBER_INFO_REMOVE;
+						chat_member_signal(room);
 						ret = 0;
 					}
 				}
@@ -1309,10 +2910,31 @@ int pbx_capi_chat_remove_user(const char* roomName, const char* memberName)
  */
 const struct capichat_s *pbx_capi_chat_get_room_c(const struct capichat_s * room)
 {
-	if (room == 0)
-		return chat_list;
+	const struct capichat_room_s *chat_room;
+
+	if (room != 0) {
+		if (room->next != 0)
+			return room->next;
+		chat_room = room->chat_room->next;
+	} else {
+		chat_room = chat_room_list;
+	}
+
+	return (chat_room != 0) ? chat_room->members : 0;
+}
+
+/*!
+ * \brief Check if room has members
+ */
+int pbx_capi_chat_room_in_use(const char *roomName)
+{
+	int inUse;
+
+	cc_mutex_lock(&chat_lock);
+	inUse = (chat_find_room(roomName) != NULL);
+	cc_mutex_unlock(&chat_lock);
 
-	return room->next;
+	return inUse;
 }
 
 /*!
@@ -1322,7 +2944,7 @@ const struct capichat_s *pbx_capi_chat_get_room_c(const struct capichat_s * room
  */
 const char* pbx_capi_chat_get_room_name(const struct capichat_s * room)
 {
-	return room->name;
+	return room->chat_room->name;
 }
 
 /*!
@@ -1332,7 +2954,7 @@ const char* pbx_capi_chat_get_room_name(const struct capichat_s * room)
  */
 unsigned int pbx_capi_chat_get_room_number(const struct capichat_s * room)
 {
-	return room->number;
+	return room->chat_room->number;
 }
 
 /*!
@@ -1342,7 +2964,7 @@ unsigned int pbx_capi_chat_get_room_number(const struct capichat_s * room)
  */
 unsigned int pbx_capi_chat_get_room_members(const struct capichat_s * room)
 {
-	return room->active;
+	return room->chat_room->active;
 }
 
 /*!
@@ -1352,7 +2974,7 @@ unsigned int pbx_capi_chat_get_room_members(const struct capichat_s * room)
  */
 int pbx_capi_chat_is_room_muted(const struct capichat_s * room)
 {
-	return (room->room_mode == RoomModeMuted);
+	return (room->chat_room->room_mode == RoomModeMuted);
 }
 
 /*!
@@ -1449,6 +3071,79 @@ unsigned int pbx_capi_chat_get_room_group_members (const struct capichat_s * roo
 	return room->groupUsers;
 }
 
+/*!
+ * \brief Level of the voice of the member, 0 if not measured
+ */
+unsigned int pbx_capi_chat_get_member_level(const struct capichat_s * room)
+{
+	return ((room->i != NULL) && (room->i->rx_level_enabled != 0)) ? room->i->rx_level : 0;
+}
+
+/*!
+ * \brief Returns 1 if member is the speaker of the room, 0 if not,
+ *        -1 if speakers are not tracked
+ */
+int pbx_capi_chat_is_member_speaker(const struct capichat_s * room)
+{
+	if (chat_speaker_interval == 0) {
+		return -1;
+	}
+
+	return (room->chat_room->speaker == room);
+}
+
+/*!
+ * \brief Set interval of speaker updates in ms, 0 disables speaker tracking
+ */
+void pbx_capi_chat_set_speaker_interval(unsigned int interval)
+{
+	chat_speaker_interval = interval;
+}
+
+/*!
+ * \brief Set amount of threads servicing NULL PLCI members,
+ *        0 - one thread per member
+ */
+void pbx_capi_chat_set_workers(unsigned int workers)
+{
+	chat_workers_max = (workers < PBX_CHAT_MAX_WORKERS) ? workers : PBX_CHAT_MAX_WORKERS;
+}
+
+/*!
+ * \brief Get amount of bridges between the groups of the room
+ *
+ * \note called unter protection of chat_lock
+ */
+unsigned int pbx_capi_chat_get_room_bridges (const struct capichat_s * room) {
+	return ((room->chat_room->conference != NULL) ? chat_conference_bridges(room->chat_room->conference) : 0);
+}
+
+/*!
+ * \brief Show bridge usage of large conferences
+ */
+void pbx_capi_chat_show_conference_bridges(int fd)
+{
+	const struct capichat_conference_s *conference;
+	const struct capichat_room_s *chat_room;
+	unsigned int hash;
+
+	ast_cli(fd, "%-17s %6s %7s %7s %7s\n", "Conference", "Groups", "Bridges", "Peak", "Created");
+
+	cc_mutex_lock(&chat_lock);
+	for (hash = 0; hash < PBX_CHAT_ROOM_HASH_SIZE; hash++) {
+		for (conference = chat_conference_by_name[hash]; conference != NULL; conference = conference->next) {
+			unsigned int groups = 0;
+
+			for (chat_room = conference->groups; chat_room != NULL; chat_room = chat_room->next_group) {
+				groups++;
+			}
+			ast_cli(fd, "%-17s %6u %7u %7u %7u\n", conference->name, groups,
+				chat_conference_bridges(conference), conference->bridges_peak, conference->bridges_created);
+		}
+	}
+	cc_mutex_unlock(&chat_lock);
+}
+
 /*!
  * \brief Lock chat list
  */
@@ -1502,7 +3197,7 @@ pbx_capi_create_conference_bridge(const char* mainName,
 	}
 
 	for (i = 0; (error == 0) && (i < sizeof(name)/sizeof(name[0])); i++) {
-		room[i] = add_chat_member(name[i], capi_ifc[i], RoomMemberOperator, roomNumber[i]);
+		room[i] = add_chat_member(name[i], capi_ifc[i], RoomMemberOperator, roomNumber[i], 0);
 		error |= (room[i] == NULL);
 	}
 
@@ -1591,48 +3286,25 @@ static size_t pbx_capi_create_full_room_name(const char* roomName, unsigned int
 
 /*!
 	\brief Calculate amount of members in group
+
+	\note called with chat_lock held
 	*/
-static unsigned int pbx_capi_chat_get_group_member_count(const char* roomName,
-																												 unsigned int group,
+static unsigned int pbx_capi_chat_get_group_member_count(const struct capichat_room_s *chat_room,
 																												 int* groupController)
 {
-	size_t fullRoomNameLength = pbx_capi_create_full_room_name(roomName, group, NULL, 0);
-	char* fullRoomName = alloca(fullRoomNameLength);
-	struct capichat_s *currentRoom;
-	int numberOfMembers;
-
-	pbx_capi_create_full_room_name(roomName, group, fullRoomName, fullRoomNameLength);
-
-	cc_mutex_lock(&chat_lock);
-	for (currentRoom = chat_list, numberOfMembers = 0; ((group != 0) && (currentRoom != 0)); currentRoom = currentRoom->next) {
-		if ((currentRoom->group == group) && (strcmp(currentRoom->name, fullRoomName) == 0)) {
-			if (currentRoom->i != NULL) {
-				*groupController = currentRoom->i->controller;
-			}
-			numberOfMembers++;
-		}
-	}
-	cc_mutex_unlock(&chat_lock);
+	*groupController = chat_room->controller;
 
-	return numberOfMembers;
+	return ((chat_room->active > 0) ? chat_room->active : 0);
 }
 
 static int pbx_capi_chat_get_group_controller(const char* roomName, unsigned int group)
 {
-	size_t fullRoomNameLength = pbx_capi_create_full_room_name(roomName, group, NULL, 0);
-	char* fullRoomName = alloca(fullRoomNameLength);
-	struct capichat_s *currentRoom;
+	struct capichat_room_s *chat_room;
 	int controller;
 
-	pbx_capi_create_full_room_name(roomName, group, fullRoomName, fullRoomNameLength);
-
 	cc_mutex_lock(&chat_lock);
-	for (currentRoom = chat_list, controller = -1;
-				((controller < 0) && (group != 0) && (currentRoom != 0));
-				currentRoom = currentRoom->next) {
-		if ((currentRoom->group == group) && (strcmp(currentRoom->name, fullRoomName) == 0) && currentRoom->i != NULL)
-			controller = currentRoom->i->controller;
-	}
+	chat_room = (group != 0) ? chat_find_group_room(roomName, group) : NULL;
+	controller = (chat_room != NULL) ? chat_room->controller : -1;
 	cc_mutex_unlock(&chat_lock);
 
 	return controller;
@@ -1640,88 +3312,123 @@ static int pbx_capi_chat_get_group_controller(const char* roomName, unsigned int
 
 /*!
 		\brief Find froup with max free number
+
+		\note called with chat_lock held
 	*/
-static unsigned int pbx_capi_chat_find_free_group (const char* roomName) {
-	struct capichat_s *currentRoom;
-	char* roomNameTemplate = alloca(strlen(roomName) + strlen(PBX_CHAT_GROUP_PREFIX) + 1);
+static unsigned int pbx_capi_chat_find_free_group (const struct capichat_conference_s *conference) {
+	struct capichat_room_s *chat_room;
 	unsigned int selectedGroup = 1;
 
-	strcpy(roomNameTemplate, roomName);
-	strcat(roomNameTemplate, PBX_CHAT_GROUP_PREFIX);
-
-	cc_mutex_lock(&chat_lock);
-	for (currentRoom = chat_list, selectedGroup = 1; currentRoom != 0; currentRoom = currentRoom->next) {
-		if ((currentRoom->group >= selectedGroup) &&
-				(strlen(roomNameTemplate) < strlen(currentRoom->name)) &&
-				(memcmp(currentRoom->name, roomNameTemplate, strlen(roomNameTemplate)) == 0) &&
-				((unsigned int)atoi(&currentRoom->name[strlen(roomNameTemplate)]) == currentRoom->group)) {
-			selectedGroup = currentRoom->group;
+	for (chat_room = conference->groups; chat_room != 0; chat_room = chat_room->next_group) {
+		if (chat_room->group >= selectedGroup) {
+			selectedGroup = chat_room->group;
 		}
 	}
-	cc_mutex_unlock(&chat_lock);
 
 	return (selectedGroup+1);
 }
 
-static void pbx_capi_chat_enter_bridge_modify_state(void)
+/*!
+		\brief Serialize group and bridge modifications of one conference,
+		modifications of different conferences run in parallel
+	*/
+static void pbx_capi_chat_enter_bridge_modify_state(const char* roomName)
 {
-	cc_mutex_lock(&chat_bridge_lock);
-	while (pbx_capi_bridge_modify_state != 0) {
-		ast_cond_wait(&pbx_capi_bridge_modify_event, &chat_bridge_lock);
+	struct capichat_conference_s *conference;
+
+	cc_mutex_lock(&chat_lock);
+	conference = chat_get_conference(roomName, 1);
+	if (conference != NULL) {
+		conference->refs++;
+		while (conference->modifying != 0) {
+			ast_cond_wait(&conference->modify_event, &chat_lock);
+		}
+		conference->modifying = 1;
 	}
-	pbx_capi_bridge_modify_state = 1;
-	cc_mutex_unlock(&chat_bridge_lock);
+	cc_mutex_unlock(&chat_lock);
 }
 
-static void pbx_capi_chat_leave_bridge_modify_state(void)
+static void pbx_capi_chat_leave_bridge_modify_state(const char* roomName)
 {
-	cc_mutex_lock(&chat_bridge_lock);
-	pbx_capi_bridge_modify_state = 0;
-	ast_cond_signal(&pbx_capi_bridge_modify_event);
-	cc_mutex_unlock(&chat_bridge_lock);
+	struct capichat_conference_s *conference;
+
+	cc_mutex_lock(&chat_lock);
+	conference = chat_get_conference(roomName, 0);
+	if (conference != NULL) {
+		conference->modifying = 0;
+		ast_cond_signal(&conference->modify_event);
+		chat_put_conference(conference);
+	}
+	cc_mutex_unlock(&chat_lock);
 }
 
 /*
 		\brief Find the group where the new member can be attached to, create group if not found
 
-		\note groups are not sparse, group 1 is the root
+		Every group is connected to the root by one bridge using two NULL PLCIs.
+		To keep the amount of bridges low the member is placed to the fullest
+		group with free capacity, groups on controllers with less NULL PLCIs
+		in use are preferred if the fill level is equal.
+
+		\note group 1 is the root
 	*/
 static unsigned int pbx_capi_find_group (const char* roomName,
 																				 unsigned long long controllers,
 																				 int requiredController) {
-	char* roomNameTemplate = alloca(strlen(roomName) + strlen(PBX_CHAT_GROUP_PREFIX) + 1);
-	unsigned int selectedGroup = 0, i;
+	struct capichat_conference_s *conference;
+	struct capichat_room_s *chat_room;
+	unsigned int selectedGroup = 0, selectedFree = 0;
+	int selectedLoad = 0;
 
-	strcpy(roomNameTemplate, roomName);
-	strcat(roomNameTemplate, PBX_CHAT_GROUP_PREFIX);
-
-	for (i = 2;;i++) {
-		unsigned int maxChannels = PBX_CHAT_MAX_GROUP_MEMBERS_PRI;
+	cc_mutex_lock(&chat_lock);
+	conference = chat_get_conference(roomName, 0);
+	for (chat_room = (conference != NULL) ? conference->groups : NULL; chat_room != 0; chat_room = chat_room->next_group) {
+		unsigned int maxChannels;
 		int groupController = -1;
-		unsigned int v = pbx_capi_chat_get_group_member_count(roomName, i, &groupController);
+		unsigned int v, groupFree;
+		int groupLoad;
 
+		if (chat_room->group < 2)
+			continue;
+		v = pbx_capi_chat_get_group_member_count(chat_room, &groupController);
 		if (v == 0)
-			break;
-		if ((requiredController > 0) && (groupController != requiredController))
 			continue;
-		if (groupController > 0) {
-			const struct cc_capi_controller *c = pbx_capi_get_controller(groupController);
-			if (c != 0 && c->nbchannels == 2) {
-				maxChannels = PBX_CHAT_MAX_GROUP_MEMBERS_BRI;
-			}
+		if (requiredController > 0) {
+			if (groupController != requiredController)
+				continue;
+		} else if ((groupController > 0) && (controllers != 0) &&
+				((groupController > (int)(sizeof(controllers)*8)) ||
+				 ((controllers & (1ULL << (groupController - 1))) == 0))) {
+			continue;
 		}
-		if (v < maxChannels) {
-			selectedGroup = i;
-			break;
+		maxChannels = pbx_capi_chat_get_group_max_members(groupController);
+		if (v >= maxChannels)
+			continue;
+
+		groupFree = maxChannels - v;
+		groupLoad = pbx_capi_get_controller_nullplcis(groupController);
+
+		if ((selectedGroup == 0) ||
+				(groupFree < selectedFree) ||
+				((groupFree == selectedFree) && (groupLoad < selectedLoad)) ||
+				((groupFree == selectedFree) && (groupLoad == selectedLoad) && (chat_room->group < selectedGroup))) {
+			selectedGroup = chat_room->group;
+			selectedFree  = groupFree;
+			selectedLoad  = groupLoad;
 		}
 	}
+	cc_mutex_unlock(&chat_lock);
+
 	if (selectedGroup == 0) {
-		/* Create new group */
+		/* Create new group, capi_mknullif selects the least loaded controller of the mask */
 		int controller = pbx_capi_chat_get_group_controller(roomName, 1);
 		unsigned long long mainController = controllers;
 
-		selectedGroup = pbx_capi_chat_find_free_group (roomName);
-		
+		cc_mutex_lock(&chat_lock);
+		conference = chat_get_conference(roomName, 0);
+		selectedGroup = (conference != NULL) ? pbx_capi_chat_find_free_group (conference) : 2;
+		cc_mutex_unlock(&chat_lock);
+
 		if (controller > 0) {
 			mainController = (1LU << (controller - 1));
 		}
@@ -1731,6 +3438,18 @@ static unsigned int pbx_capi_find_group (const char* roomName,
 
 		if (pbx_capi_create_conference_bridge(roomName, mainController, 1, roomName, controllers, selectedGroup) == NULL)
 			return 0;
+
+		cc_mutex_lock(&chat_lock);
+		conference = chat_get_conference(roomName, 0);
+		if (conference != NULL) {
+			unsigned int bridges = chat_conference_bridges(conference);
+
+			conference->bridges_created++;
+			if (bridges > conference->bridges_peak) {
+				conference->bridges_peak = bridges;
+			}
+		}
+		cc_mutex_unlock(&chat_lock);
 	}
 
 	return selectedGroup;
@@ -1741,19 +3460,12 @@ static unsigned int pbx_capi_find_group (const char* roomName,
 	*/
 static struct capichat_s* pbx_capi_get_group_bridge(const char* roomName, unsigned int groupNumber)
 {
+	struct capichat_room_s *chat_room;
 	struct capichat_s *currentRoom;
-	char* roomNameTemplate = alloca(strlen(roomName) + strlen(PBX_CHAT_GROUP_PREFIX) + 1);
-	size_t roomNameTemplateLen;
 
-	strcpy(roomNameTemplate, roomName);
-	strcat(roomNameTemplate, PBX_CHAT_GROUP_PREFIX);
-	roomNameTemplateLen = strlen(roomNameTemplate);
-
-	for (currentRoom = chat_list; currentRoom != 0; currentRoom = currentRoom->next) {
+	chat_room = chat_find_group_room(roomName, groupNumber);
+	for (currentRoom = (chat_room != NULL) ? chat_room->members : NULL; currentRoom != 0; currentRoom = currentRoom->next) {
 		if ((currentRoom->group == groupNumber) && (currentRoom->i != NULL) &&
-				(roomNameTemplateLen < strlen(currentRoom->name)) &&
-				(memcmp(currentRoom->name, roomNameTemplate, roomNameTemplateLen) == 0) &&
-				((unsigned int)atoi(&currentRoom->name[roomNameTemplateLen]) == currentRoom->group) &&
 				 (currentRoom->i->used == NULL) && (currentRoom->i->bridgePeer != NULL)) {
 			return currentRoom;
 		}
@@ -1762,32 +3474,40 @@ static struct capichat_s* pbx_capi_get_group_bridge(const char* roomName, unsign
 	return NULL;
 }
 
+/*
+		\brief Find bridge member of group > 1 of the conference
+	*/
+static struct capichat_s* pbx_capi_find_group_bridge(const char* roomName, int inUse)
+{
+	struct capichat_conference_s *conference = chat_get_conference(roomName, 0);
+	struct capichat_room_s *chat_room;
+	struct capichat_s *currentRoom;
+
+	for (chat_room = (conference != NULL) ? conference->groups : NULL; chat_room != 0; chat_room = chat_room->next_group) {
+		if (chat_room->group <= 1) {
+			continue;
+		}
+		for (currentRoom = chat_room->members; currentRoom != 0; currentRoom = currentRoom->next) {
+			if ((currentRoom->group == chat_room->group) && (currentRoom->i != NULL) &&
+					((inUse == 0) || (currentRoom->groupUsers != 0)) &&
+					(currentRoom->i->used == NULL) && (currentRoom->i->bridgePeer != NULL)) {
+				return currentRoom;
+			}
+		}
+	}
+
+	return NULL;
+}
+
 /*!
 		\brief Returns true if bridge is idle
 	*/
 static int pbx_capi_is_bridge_idle(const char* roomName)
 {
-	struct capichat_s *currentRoom;
-	char* roomNameTemplate = alloca(strlen(roomName) + strlen(PBX_CHAT_GROUP_PREFIX) + 1);
-	size_t roomNameTemplateLen;
 	int bridgeIdle;
 
-	strcpy(roomNameTemplate, roomName);
-	strcat(roomNameTemplate, PBX_CHAT_GROUP_PREFIX);
-	roomNameTemplateLen = strlen(roomNameTemplate);
-
 	cc_mutex_lock(&chat_lock);
-	for (currentRoom = chat_list, bridgeIdle = 1;
-			((bridgeIdle != 0) && (currentRoom != 0));
-			currentRoom = currentRoom->next) {
-		if ((currentRoom->group > 1) && (currentRoom->groupUsers != 0) && (currentRoom->i != NULL) &&
-				(roomNameTemplateLen < strlen(currentRoom->name)) &&
-				(memcmp(currentRoom->name, roomNameTemplate, roomNameTemplateLen) == 0) &&
-				((unsigned int)atoi(&currentRoom->name[roomNameTemplateLen]) == currentRoom->group) &&
-				 (currentRoom->i->used == NULL) && (currentRoom->i->bridgePeer != NULL)) {
-			bridgeIdle = 0;
-		}
-	}
+	bridgeIdle = (pbx_capi_find_group_bridge(roomName, 1) == NULL);
 	cc_mutex_unlock(&chat_lock);
 
 	return bridgeIdle;
@@ -1796,34 +3516,22 @@ static int pbx_capi_is_bridge_idle(const char* roomName)
 static struct capichat_s* pbx_capi_get_room_bridge(const char* roomName)
 {
 	struct capichat_s *currentRoom;
-	char* roomNameTemplate = alloca(strlen(roomName) + strlen(PBX_CHAT_GROUP_PREFIX) + 1);
-	size_t roomNameTemplateLen;
-
-	strcpy(roomNameTemplate, roomName);
-	strcat(roomNameTemplate, PBX_CHAT_GROUP_PREFIX);
-	roomNameTemplateLen = strlen(roomNameTemplate);
 
 	cc_mutex_lock(&chat_lock);
-	for (currentRoom = chat_list; currentRoom != 0; currentRoom = currentRoom->next) {
-		if ((currentRoom->group > 1) && (currentRoom->i != NULL) &&
-				(roomNameTemplateLen < strlen(currentRoom->name)) &&
-				(memcmp(currentRoom->name, roomNameTemplate, roomNameTemplateLen) == 0) &&
-				((unsigned int)atoi(&currentRoom->name[roomNameTemplateLen]) == currentRoom->group) &&
-				 (currentRoom->i->used == NULL) && (currentRoom->i->bridgePeer != NULL)) {
-			break;
-		}
-	}
+	currentRoom = pbx_capi_find_group_bridge(roomName, 0);
 	cc_mutex_unlock(&chat_lock);
 
 	return currentRoom;
 }
 
-static struct capichat_s* pbx_capi_get_group_main_bridge(struct capi_pvt* mainPLCI)
+static struct capichat_s* pbx_capi_get_group_main_bridge(const char* roomName, struct capi_pvt* mainPLCI)
 {
+	struct capichat_room_s *chat_room;
 	struct capichat_s *currentRoom = NULL;
 
 	cc_mutex_lock(&chat_lock);
-	for (currentRoom = chat_list; currentRoom != 0; currentRoom = currentRoom->next) {
+	chat_room = chat_find_group_room(roomName, 1);
+	for (currentRoom = (chat_room != NULL) ? chat_room->members : NULL; currentRoom != 0; currentRoom = currentRoom->next) {
 		if (currentRoom->i == mainPLCI) {
 			break;
 		}
@@ -1880,6 +3588,69 @@ static unsigned int pbx_capi_remove_group_user(const char* roomName, unsigned in
 	return ret;
 }
 
+/*!
+		\brief Remove bridge between group and root of the conference
+	*/
+static void pbx_capi_delete_group_bridge(const char* roomName, struct capichat_s* additionalGroup)
+{
+	struct capichat_s* mainGroup = pbx_capi_get_group_main_bridge(roomName, additionalGroup->i->bridgePeer);
+	struct capi_pvt *mainPLCI = mainGroup->i, *additionalPLCI = additionalGroup->i;
+	size_t mainFullNameLength       = pbx_capi_create_full_room_name(roomName, 1, NULL, 0);
+	size_t additionalFullNameLength = pbx_capi_create_full_room_name(roomName, additionalGroup->group, NULL, 0);
+	char* mainFullName       = alloca(mainFullNameLength);
+	char* additionalFullName = alloca(additionalFullNameLength);
+
+	pbx_capi_create_full_room_name(roomName, 1, mainFullName, mainFullNameLength);
+	pbx_capi_create_full_room_name(roomName, additionalGroup->group, additionalFullName, additionalFullNameLength);
+	cc_verbose(2, 0, VERBOSE_PREFIX_2 CC_MESSAGE_NAME
+		" Delete bridge '%s' <-> '%s'\n", mainFullName, additionalFullName);
+
+	del_chat_member(additionalGroup, 1);
+	del_chat_member(mainGroup, 1);
+#ifdef DIVA_STREAMING
+	capi_DivaStreamLock();
+#endif
+	cc_mutex_lock(&mainPLCI->lock);
+	cc_mutex_lock(&additionalPLCI->lock);
+	mainPLCI->bridgePeer = NULL;
+	additionalPLCI->bridgePeer = NULL;
+	cc_mutex_unlock(&additionalPLCI->lock);
+	cc_mutex_unlock(&mainPLCI->lock);
+#ifdef DIVA_STREAMING
+	capi_DivaStreamUnLock();
+#endif
+	capi_remove_nullif(mainPLCI);
+	capi_remove_nullif(additionalPLCI);
+}
+
+/*!
+		\brief Count idle group bridges of the conference
+
+		\note called with chat_lock held
+	*/
+static unsigned int pbx_capi_count_idle_bridges(const char* roomName)
+{
+	struct capichat_conference_s *conference = chat_get_conference(roomName, 0);
+	struct capichat_room_s *chat_room;
+	struct capichat_s *currentRoom;
+	unsigned int idleBridges = 0;
+
+	for (chat_room = (conference != NULL) ? conference->groups : NULL; chat_room != 0; chat_room = chat_room->next_group) {
+		if (chat_room->group <= 1) {
+			continue;
+		}
+		for (currentRoom = chat_room->members; currentRoom != 0; currentRoom = currentRoom->next) {
+			if ((currentRoom->i != NULL) && (currentRoom->groupUsers == 0) &&
+					(currentRoom->i->used == NULL) && (currentRoom->i->bridgePeer != NULL)) {
+				idleBridges++;
+				break;
+			}
+		}
+	}
+
+	return idleBridges;
+}
+
 /*!
 		\brief Clean up bridge if no members are left in the group
 	*/
@@ -1896,7 +3667,7 @@ static void pbx_capi_cleanup_bridge(const char* roomName, unsigned int groupNumb
 		pbx_capi_create_full_room_name(roomName, 1, mainFullName, mainFullNameLength);
 		pbx_capi_create_full_room_name(roomName, groupNumber, additionalFullName, additionalFullNameLength);
 
-		pbx_capi_chat_enter_bridge_modify_state();
+		pbx_capi_chat_enter_bridge_modify_state(roomName);
 		bridgeUsers = pbx_capi_remove_group_user(roomName, groupNumber);
 
 		cc_verbose(2, 0, VERBOSE_PREFIX_2 CC_MESSAGE_NAME
@@ -1906,45 +3677,67 @@ static void pbx_capi_cleanup_bridge(const char* roomName, unsigned int groupNumb
 			/*
 				Delecte bridge between conference room groups.
 				To reduce the load at the central bridge while the conference running
-				the bridge is remoced only if all bridges are in idle state
+				the bridge is remoced only if all bridges are in idle state.
+				Not more than one idle bridge is kept in reserve, additional idle
+				bridges are removed to release the NULL PLCIs.
 				*/
 			if (pbx_capi_is_bridge_idle(roomName) != 0) {
 				struct capichat_s* additionalGroup;
 
 				while ((additionalGroup = pbx_capi_get_room_bridge(roomName)) != 0) {
-					struct capichat_s* mainGroup = pbx_capi_get_group_main_bridge(additionalGroup->i->bridgePeer);
-					struct capi_pvt *mainPLCI = mainGroup->i, *additionalPLCI = additionalGroup->i;
+					pbx_capi_delete_group_bridge(roomName, additionalGroup);
+				}
+			} else {
+				struct capichat_s* additionalGroup = NULL;
 
-					pbx_capi_create_full_room_name(roomName, additionalGroup->group, additionalFullName, additionalFullNameLength);
-					cc_verbose(2, 0, VERBOSE_PREFIX_2 CC_MESSAGE_NAME
-						" Delete bridge '%s' <-> '%s'\n", mainFullName, additionalFullName);
+				cc_mutex_lock(&chat_lock);
+				if (pbx_capi_count_idle_bridges(roomName) > 1) {
+					additionalGroup = pbx_capi_get_group_bridge(roomName, groupNumber);
+				}
+				cc_mutex_unlock(&chat_lock);
 
-					del_chat_member(additionalGroup, 1);
-					del_chat_member(mainGroup, 1);
-#ifdef DIVA_STREAMING
-					capi_DivaStreamLock();
-#endif
-					cc_mutex_lock(&mainPLCI->lock);
-					cc_mutex_lock(&additionalPLCI->lock);
-					mainPLCI->bridgePeer = NULL;
-					additionalPLCI->bridgePeer = NULL;
-					cc_mutex_unlock(&additionalPLCI->lock);
-					cc_mutex_unlock(&mainPLCI->lock);
-#ifdef DIVA_STREAMING
-					capi_DivaStreamUnLock();
-#endif
-					capi_remove_nullif(mainPLCI);
-					capi_remove_nullif(additionalPLCI);
+				if (additionalGroup != NULL) {
+					pbx_capi_delete_group_bridge(roomName, additionalGroup);
 				}
 			}
 		}
 
-		pbx_capi_chat_leave_bridge_modify_state();
+		pbx_capi_chat_leave_bridge_modify_state(roomName);
 	}
 }
 
 void pbx_capi_chat_init_module(void)
 {
-	ast_cond_init(&pbx_capi_bridge_modify_event, NULL);
+	memset(chat_conference_by_name, 0, sizeof(chat_conference_by_name));
+	chat_broadcast_list = NULL;
+	ast_cond_init(&chat_broadcast_event, NULL);
+#ifdef CC_USE_EPOLL
+	chat_workers_running = 0;
+	chat_workers_stop = 0;
+#endif
+}
+
+/*
+ * stop running broadcasts and chat workers, must be called before the
+ * CAPI device thread is stopped
+ */
+void pbx_capi_chat_cleanup_module(void)
+{
+	struct capichat_broadcast_s *broadcast;
+
+	cc_mutex_lock(&chat_lock);
+	for (broadcast = chat_broadcast_list; broadcast != NULL; broadcast = broadcast->next) {
+		broadcast->stop = 1;
+	}
+	while (chat_broadcast_list != NULL) {
+		ast_cond_wait(&chat_broadcast_event, &chat_lock);
+	}
+	cc_mutex_unlock(&chat_lock);
+
+	ast_cond_destroy(&chat_broadcast_event);
+
+#ifdef CC_USE_EPOLL
+	chat_workers_cleanup();
+#endif
 }
 
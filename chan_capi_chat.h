@@ -12,10 +12,13 @@
 #ifndef _PBX_CAPI_CHAT_H
 #define _PBX_CAPI_CHAT_H
 
+#define PBX_CHAT_DEFAULT_WORKERS 4 /* Threads servicing NULL PLCI chat members */
+
 /*
  * prototypes
  */
 extern void pbx_capi_chat_init_module(void);
+extern void pbx_capi_chat_cleanup_module(void);
 extern int pbx_capi_chat(struct ast_channel *c, char *param);
 extern int pbx_capi_chat_associate_resource_plci(struct ast_channel *c, char *param);
 extern struct capi_pvt* pbx_check_resource_plci(struct ast_channel *c);
@@ -28,10 +31,13 @@ extern int pbx_capi_chat_command (struct ast_channel *c, char *param);
 extern int pbx_capi_chat_mute(struct ast_channel *c, char *param);
 extern int pbx_capi_chat_play(struct ast_channel *c, char *param);
 extern int pbx_capi_chat_connect(struct ast_channel *c, char *param);
+extern int pbx_capi_chat_broadcast(struct ast_channel *c, char *param);
+extern int pbx_capi_chat_broadcast_start(const char *pattern, const char *file_name);
 int pbx_capi_chat_remove_user(const char* room, const char* name);
 
 struct capichat_s;
 const struct capichat_s *pbx_capi_chat_get_room_c(const struct capichat_s * room);
+int pbx_capi_chat_room_in_use(const char *roomName);
 const char* pbx_capi_chat_get_room_name(const struct capichat_s * room);
 unsigned int pbx_capi_chat_get_room_number(const struct capichat_s * room);
 unsigned int pbx_capi_chat_get_room_members(const struct capichat_s * room);
@@ -44,6 +50,12 @@ int pbx_capi_chat_is_member_listener(const struct capichat_s * room);
 int pbx_capi_chat_is_most_recent_user(const struct capichat_s * room);
 unsigned int pbx_capi_chat_get_room_group (const struct capichat_s * room);
 unsigned int pbx_capi_chat_get_room_group_members (const struct capichat_s * room);
+unsigned int pbx_capi_chat_get_room_bridges (const struct capichat_s * room);
+unsigned int pbx_capi_chat_get_member_level(const struct capichat_s * room);
+int pbx_capi_chat_is_member_speaker(const struct capichat_s * room);
+void pbx_capi_chat_set_speaker_interval(unsigned int interval);
+void pbx_capi_chat_set_workers(unsigned int workers);
+void pbx_capi_chat_show_conference_bridges(int fd);
 
 void pbx_capi_lock_chat_rooms(void);
 void pbx_capi_unlock_chat_rooms(void);
@@ -22,6 +22,10 @@
 #include "chan_capi_chat.h"
 #include "chan_capi_cli.h"
 #include "chan_capi_management_common.h"
+#include "chan_capi_faxio.h"
+#include "chan_capi_announce.h"
+#include "chan_capi_admission.h"
+#include "chan_capi_timeline.h"
 #ifdef DIVA_STREAMING
 #include "platform.h"
 #include "chan_capi_divastreaming_utils.h"
@@ -50,7 +54,21 @@ static char show_resources_usage[] =
 
 static char show_bridges_usage[] =
 "Usage: " CC_MESSAGE_NAME " show bridges\n"
-"       Show info about used conference bridges.\n";
+"       Show info about used conference bridges and the amount\n"
+"       of bridges per large conference.\n";
+
+static char show_faxes_usage[] =
+"Usage: " CC_MESSAGE_NAME " show faxes\n"
+"       Show throughput and buffer backlog of active fax transfers.\n";
+
+static char show_announcements_usage[] =
+"Usage: " CC_MESSAGE_NAME " show announcements\n"
+"       Show voice files cached for chat_play.\n";
+
+static char show_timeline_usage[] =
+"Usage: " CC_MESSAGE_NAME " show timeline [controller]\n"
+"       Show latency of call signalling events to the start of the call.\n"
+"       Shows the histograms if a controller is selected.\n";
 
 static char debug_usage[] =
 "Usage: " CC_MESSAGE_NAME " debug\n"
@@ -76,6 +94,18 @@ static char show_chat_manage_usage[] =
 "Usage: " CC_MESSAGE_NAME " chat manage\n"
 "       Manage chat conference (chat manage room member command parameters).\n";
 
+static char show_chat_broadcast_usage[] =
+"Usage: " CC_MESSAGE_NAME " chat broadcast <pattern> <file>\n"
+"       Play voice file to all chat rooms matching the pattern ('*' for all rooms).\n"
+"       The file is sent once per controller.\n";
+
+#ifdef DIVA_STREAMING
+static char streaming_loopback_usage[] =
+"Usage: " CC_MESSAGE_NAME " streaming loopback <streams> <frames>\n"
+"       Load test of the streaming engine: send <frames> voice frames on each of\n"
+"       <streams> streams to a software loopback of the adapter side.\n";
+#endif
+
 #ifndef CC_AST_HAS_VERSION_1_6
 static
 #endif
@@ -92,8 +122,13 @@ char chatinfo_usage[] =
 #define CC_CLI_TEXT_CHATINFO "Show " CC_MESSAGE_BIGNAME " chat info"
 #define CC_CLI_TEXT_SHOW_RESOURCES "Show used resources"
 #define CC_CLI_TEXT_SHOW_BRIDGES "Show used conference bridges"
+#define CC_CLI_TEXT_SHOW_FAXES "Show active fax transfers"
+#define CC_CLI_TEXT_SHOW_ANNOUNCEMENTS "Show cached chat announcements"
+#define CC_CLI_TEXT_SHOW_TIMELINE "Show call signalling latency"
 #define CC_CLI_TEXT_EXEC_CAPICOMMAND "Exec command"
 #define CC_CLI_TEXT_CHAT_MANAGE "Manager chat conference"
+#define CC_CLI_TEXT_CHAT_BROADCAST "Broadcast voice file to chat rooms"
+#define CC_CLI_TEXT_STREAMING_LOOPBACK "Load test streaming using software loopback"
 
 /*
  * helper functions to convert conf value to string
@@ -426,6 +461,114 @@ static int pbxcli_capi_show_bridges(int fd, int argc, char *argv[])
 	}
 	pbx_capi_unlock_chat_rooms();
 
+	ast_cli(fd, "\n");
+	pbx_capi_chat_show_conference_bridges(fd);
+
+#ifdef CC_AST_HAS_VERSION_1_6
+	return CLI_SUCCESS;
+#else
+	return RESULT_SUCCESS;
+#endif
+}
+
+/*
+ * do command capi show faxes
+ */
+#ifdef CC_AST_HAS_VERSION_1_6
+static char *pbxcli_capi_show_faxes(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+#else
+static int pbxcli_capi_show_faxes(int fd, int argc, char *argv[])
+#endif
+{
+#ifdef CC_AST_HAS_VERSION_1_6
+	int fd = a->fd;
+
+	if (cmd == CLI_INIT) {
+		e->command = CC_MESSAGE_NAME " show faxes";
+		e->usage = show_faxes_usage;
+		return NULL;
+	} else if (cmd == CLI_GENERATE)
+		return NULL;
+#endif
+
+	pbx_capi_fax_io_show(fd);
+
+#ifdef CC_AST_HAS_VERSION_1_6
+	return CLI_SUCCESS;
+#else
+	return RESULT_SUCCESS;
+#endif
+}
+
+/*
+ * do command capi show announcements
+ */
+#ifdef CC_AST_HAS_VERSION_1_6
+static char *pbxcli_capi_show_announcements(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+#else
+static int pbxcli_capi_show_announcements(int fd, int argc, char *argv[])
+#endif
+{
+#ifdef CC_AST_HAS_VERSION_1_6
+	int fd = a->fd;
+
+	if (cmd == CLI_INIT) {
+		e->command = CC_MESSAGE_NAME " show announcements";
+		e->usage = show_announcements_usage;
+		return NULL;
+	} else if (cmd == CLI_GENERATE)
+		return NULL;
+#endif
+
+	pbx_capi_announce_show(fd);
+
+#ifdef CC_AST_HAS_VERSION_1_6
+	return CLI_SUCCESS;
+#else
+	return RESULT_SUCCESS;
+#endif
+}
+
+/*
+ * do command capi show timeline
+ */
+#ifdef CC_AST_HAS_VERSION_1_6
+static char *pbxcli_capi_show_timeline(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+#else
+static int pbxcli_capi_show_timeline(int fd, int argc, char *argv[])
+#endif
+{
+	int controller = 0;
+#ifdef CC_AST_HAS_VERSION_1_6
+	int fd = a->fd;
+
+	if (cmd == CLI_INIT) {
+		e->command = CC_MESSAGE_NAME " show timeline";
+		e->usage = show_timeline_usage;
+		return NULL;
+	} else if (cmd == CLI_GENERATE)
+		return NULL;
+	if (a->argc > 4)
+		return CLI_SHOWUSAGE;
+	if (a->argc == 4)
+		controller = atoi(a->argv[3]);
+#else
+	if (argc > 4)
+		return RESULT_SHOWUSAGE;
+	if (argc == 4)
+		controller = atoi(argv[3]);
+#endif
+
+	if ((controller < 0) || (controller > CAPI_MAX_CONTROLLERS)) {
+#ifdef CC_AST_HAS_VERSION_1_6
+		return CLI_SHOWUSAGE;
+#else
+		return RESULT_SHOWUSAGE;
+#endif
+	}
+
+	pbx_capi_timeline_show(fd, controller);
+
 #ifdef CC_AST_HAS_VERSION_1_6
 	return CLI_SUCCESS;
 #else
@@ -469,8 +612,13 @@ static int pbxcli_capi_info(int fd, int argc, char *argv[])
 				i, capiController->nbchannels,
 				capiController->nfreebchannels,
 				(capiController->used) ? "":" (unused)");
+			if (capiController->routingSkipped != 0) {
+				ast_cli(fd, "Contr%d: %llu calls not routed due to controller state\n",
+					i, capiController->routingSkipped);
+			}
 		}
 	}
+	pbx_capi_admission_show(fd);
 #ifdef CC_AST_HAS_VERSION_1_6
 	return CLI_SUCCESS;
 #else
@@ -727,6 +875,100 @@ static int pbxcli_capi_chat_manage_capicommand(int fd, int argc, char *argv[])
 #endif
 }
 
+/*
+ * do command capi chat broadcast
+ */
+#ifdef CC_AST_HAS_VERSION_1_6
+static char *pbxcli_capi_chat_broadcast(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+#else
+static int pbxcli_capi_chat_broadcast(int fd, int argc, char *argv[])
+#endif
+{
+	int rooms;
+#ifdef CC_AST_HAS_VERSION_1_6
+	int fd = a->fd;
+
+	if (cmd == CLI_INIT) {
+		e->command = CC_MESSAGE_NAME " chat broadcast";
+		e->usage = show_chat_broadcast_usage;
+		return NULL;
+	} else if (cmd == CLI_GENERATE) {
+		return NULL;
+	}
+	if (a->argc != 5) {
+		return CLI_SHOWUSAGE;
+	}
+	rooms = pbx_capi_chat_broadcast_start(a->argv[3], a->argv[4]);
+#else
+	if (argc != 5) {
+		return RESULT_SHOWUSAGE;
+	}
+	rooms = pbx_capi_chat_broadcast_start(argv[3], argv[4]);
+#endif
+
+	if (rooms >= 0) {
+		ast_cli(fd, "Broadcast started to %d rooms.\n", rooms);
+	}
+
+#ifdef CC_AST_HAS_VERSION_1_6
+	return ((rooms >= 0) ? CLI_SUCCESS : CLI_FAILURE);
+#else
+	return ((rooms >= 0) ? RESULT_SUCCESS : RESULT_FAILURE);
+#endif
+}
+
+#ifdef DIVA_STREAMING
+/*
+ * do command capi streaming loopback
+ */
+#ifdef CC_AST_HAS_VERSION_1_6
+static char *pbxcli_capi_streaming_loopback(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+#else
+static int pbxcli_capi_streaming_loopback(int fd, int argc, char *argv[])
+#endif
+{
+	int streams, frames;
+#ifdef CC_AST_HAS_VERSION_1_6
+	int fd = a->fd;
+
+	if (cmd == CLI_INIT) {
+		e->command = CC_MESSAGE_NAME " streaming loopback";
+		e->usage = streaming_loopback_usage;
+		return NULL;
+	} else if (cmd == CLI_GENERATE) {
+		return NULL;
+	}
+	if (a->argc != 5) {
+		return CLI_SHOWUSAGE;
+	}
+	streams = atoi(a->argv[3]);
+	frames = atoi(a->argv[4]);
+#else
+	if (argc != 5) {
+		return RESULT_SHOWUSAGE;
+	}
+	streams = atoi(argv[3]);
+	frames = atoi(argv[4]);
+#endif
+
+	if ((streams <= 0) || (streams > 1024) || (frames <= 0)) {
+#ifdef CC_AST_HAS_VERSION_1_6
+		return CLI_SHOWUSAGE;
+#else
+		return RESULT_SHOWUSAGE;
+#endif
+	}
+
+	capi_DivaStreamingLoopbackTest(fd, streams, frames);
+
+#ifdef CC_AST_HAS_VERSION_1_6
+	return CLI_SUCCESS;
+#else
+	return RESULT_SUCCESS;
+#endif
+}
+#endif
+
 /*
  * define commands
  */
@@ -749,7 +991,14 @@ static struct ast_cli_entry cc_cli_cmd[] = {
 	AST_CLI_DEFINE(pbxcli_capi_show_resources, CC_CLI_TEXT_SHOW_RESOURCES),
 	AST_CLI_DEFINE(pbxcli_capi_exec_capicommand, CC_CLI_TEXT_EXEC_CAPICOMMAND),
 	AST_CLI_DEFINE(pbxcli_capi_chat_manage_capicommand, CC_CLI_TEXT_CHAT_MANAGE),
+	AST_CLI_DEFINE(pbxcli_capi_chat_broadcast, CC_CLI_TEXT_CHAT_BROADCAST),
 	AST_CLI_DEFINE(pbxcli_capi_show_bridges, CC_CLI_TEXT_SHOW_BRIDGES),
+	AST_CLI_DEFINE(pbxcli_capi_show_faxes, CC_CLI_TEXT_SHOW_FAXES),
+	AST_CLI_DEFINE(pbxcli_capi_show_announcements, CC_CLI_TEXT_SHOW_ANNOUNCEMENTS),
+	AST_CLI_DEFINE(pbxcli_capi_show_timeline, CC_CLI_TEXT_SHOW_TIMELINE),
+#ifdef DIVA_STREAMING
+	AST_CLI_DEFINE(pbxcli_capi_streaming_loopback, CC_CLI_TEXT_STREAMING_LOOPBACK),
+#endif
 };
 #else
 static struct ast_cli_entry  cli_info =
@@ -782,8 +1031,20 @@ static struct ast_cli_entry  cli_exec_capicommand =
 	{ { CC_MESSAGE_NAME, "exec", NULL }, pbxcli_capi_exec_capicommand, CC_CLI_TEXT_CHAT_MANAGE, show_exec_usage };
 static struct ast_cli_entry  cli_chat_manage =
 	{ { CC_MESSAGE_NAME, "chat", "manage", NULL }, pbxcli_capi_chat_manage_capicommand, CC_CLI_TEXT_EXEC_CAPICOMMAND, show_chat_manage_usage };
+static struct ast_cli_entry  cli_chat_broadcast =
+	{ { CC_MESSAGE_NAME, "chat", "broadcast", NULL }, pbxcli_capi_chat_broadcast, CC_CLI_TEXT_CHAT_BROADCAST, show_chat_broadcast_usage };
 static struct ast_cli_entry  cli_show_bridges =
 	{ { CC_MESSAGE_NAME, "show", "bridges", NULL }, pbxcli_capi_show_bridges, CC_CLI_TEXT_SHOW_BRIDGES, show_bridges_usage };
+static struct ast_cli_entry  cli_show_faxes =
+	{ { CC_MESSAGE_NAME, "show", "faxes", NULL }, pbxcli_capi_show_faxes, CC_CLI_TEXT_SHOW_FAXES, show_faxes_usage };
+static struct ast_cli_entry  cli_show_announcements =
+	{ { CC_MESSAGE_NAME, "show", "announcements", NULL }, pbxcli_capi_show_announcements, CC_CLI_TEXT_SHOW_ANNOUNCEMENTS, show_announcements_usage };
+static struct ast_cli_entry  cli_show_timeline =
+	{ { CC_MESSAGE_NAME, "show", "timeline", NULL }, pbxcli_capi_show_timeline, CC_CLI_TEXT_SHOW_TIMELINE, show_timeline_usage };
+#ifdef DIVA_STREAMING
+static struct ast_cli_entry  cli_streaming_loopback =
+	{ { CC_MESSAGE_NAME, "streaming", "loopback", NULL }, pbxcli_capi_streaming_loopback, CC_CLI_TEXT_STREAMING_LOOPBACK, streaming_loopback_usage };
+#endif
 #endif
 
 
@@ -810,7 +1071,14 @@ void pbx_capi_cli_register(void)
 	ast_cli_register(&cli_show_resources);
 	ast_cli_register(&cli_exec_capicommand);
 	ast_cli_register(&cli_chat_manage);
+	ast_cli_register(&cli_chat_broadcast);
 	ast_cli_register(&cli_show_bridges);
+	ast_cli_register(&cli_show_faxes);
+	ast_cli_register(&cli_show_announcements);
+	ast_cli_register(&cli_show_timeline);
+#ifdef DIVA_STREAMING
+	ast_cli_register(&cli_streaming_loopback);
+#endif
 #endif
 }
 
@@ -836,7 +1104,14 @@ void pbx_capi_cli_unregister(void)
 	ast_cli_unregister(&cli_show_resources);
 	ast_cli_unregister(&cli_exec_capicommand);
 	ast_cli_unregister(&cli_chat_manage);
+	ast_cli_unregister(&cli_chat_broadcast);
 	ast_cli_unregister(&cli_show_bridges);
+	ast_cli_unregister(&cli_show_faxes);
+	ast_cli_unregister(&cli_show_announcements);
+	ast_cli_unregister(&cli_show_timeline);
+#ifdef DIVA_STREAMING
+	ast_cli_unregister(&cli_streaming_loopback);
+#endif
 #endif
 }
 
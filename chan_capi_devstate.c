@@ -82,7 +82,6 @@ int
 #endif
 pbx_capi_chat_room_state(const char *data)
 {
-	const struct capichat_s *room;
 #ifdef CC_AST_HAS_VERSION_1_6
 	enum ast_device_state ret = AST_DEVICE_NOT_INUSE;
 #else
@@ -92,16 +91,9 @@ pbx_capi_chat_room_state(const char *data)
 	if (data == 0)
 		return AST_DEVICE_INVALID;
 
-	pbx_capi_lock_chat_rooms();
-	for (room = pbx_capi_chat_get_room_c(NULL);
-			 room != 0;
-			 room = pbx_capi_chat_get_room_c(room)) {
-		if (strcmp(data, pbx_capi_chat_get_room_name(room)) == 0) {
-			ret = AST_DEVICE_INUSE;
-			break;
-		}
+	if (pbx_capi_chat_room_in_use(data) != 0) {
+		ret = AST_DEVICE_INUSE;
 	}
-	pbx_capi_unlock_chat_rooms();
 
 	return ret;
 }
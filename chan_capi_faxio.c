@@ -0,0 +1,465 @@
+/*
+ * An implementation of Common ISDN API 2.0 for Asterisk
+ *
+ * Buffered fax file I/O
+ *
+ * Fax data is exchanged with the file system by a background worker
+ * thread. The CAPI device thread only copies the DATA_B3 payload
+ * into (receive) or out of (send) a per fax ring buffer and never
+ * blocks on disk or network file system latency.
+ *
+ * This program is free software and may be modified and
+ * distributed under the terms of the GNU Public License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "chan_capi_platform.h"
+#include "chan_capi20.h"
+#include "chan_capi.h"
+#include "chan_capi_utils.h"
+#include "chan_capi_faxio.h"
+#include "dlist.h"
+
+struct _cc_capi_fax_io {
+	diva_entity_link_t link;
+	FILE *f;
+	int sendmode;
+	char name[80];
+	void *owner;
+
+	unsigned char *buffer;
+	unsigned int head;      /* next byte written by the producer */
+	unsigned int tail;      /* next byte read by the consumer */
+	unsigned int fill;
+
+	int busy;               /* worker accesses the file */
+	int eof;                /* send: file completely read */
+	int error;              /* file I/O failed */
+	int closing;
+	int starved;            /* send: device thread waits for data */
+	int resuming;           /* owner is resumed, close waits for it */
+
+	unsigned long long bytes;     /* bytes passed to/from the line */
+	unsigned long long filebytes; /* bytes passed to/from the file */
+	unsigned int underruns;
+	unsigned int overruns;
+	unsigned int maxfill;
+	time_t start;
+};
+
+/*
+ * LOCALS
+ */
+AST_MUTEX_DEFINE_STATIC(faxio_lock);
+static ast_cond_t faxio_work;
+static ast_cond_t faxio_done;
+static diva_entity_queue_t faxio_list;
+static pthread_t faxio_thread = (pthread_t)(0-1);
+static int faxio_stop;
+static int faxio_starved;
+
+/*
+ * check if the worker has something to do for this transfer,
+ * called with faxio_lock held
+ */
+static int faxio_pending(cc_capi_fax_io_t *io)
+{
+	if ((io->busy) || (io->error))
+		return 0;
+
+	if (io->sendmode) {
+		return ((!io->eof) && (!io->closing) &&
+			((CC_FAXIO_BUFFER_SIZE - io->fill) >= CC_FAXIO_CHUNK_SIZE));
+	}
+
+	return ((io->fill >= CC_FAXIO_CHUNK_SIZE) ||
+		((io->fill != 0) && (io->closing)));
+}
+
+/*
+ * move one chunk between ring buffer and file,
+ * called with faxio_lock held, the lock is dropped during the file access
+ */
+static void faxio_transfer(cc_capi_fax_io_t *io)
+{
+	unsigned int pos, len;
+	size_t done;
+
+	if (io->sendmode) {
+		pos = io->head;
+		len = CC_FAXIO_BUFFER_SIZE - io->fill;
+		if (len > (CC_FAXIO_BUFFER_SIZE - pos))
+			len = CC_FAXIO_BUFFER_SIZE - pos;
+	} else {
+		pos = io->tail;
+		len = io->fill;
+		if (len > (CC_FAXIO_BUFFER_SIZE - pos))
+			len = CC_FAXIO_BUFFER_SIZE - pos;
+	}
+	if (len > CC_FAXIO_CHUNK_SIZE)
+		len = CC_FAXIO_CHUNK_SIZE;
+
+	io->busy = 1;
+	cc_mutex_unlock(&faxio_lock);
+
+	if (io->sendmode) {
+		done = fread(io->buffer + pos, 1, len, io->f);
+	} else {
+		done = fwrite(io->buffer + pos, 1, len, io->f);
+	}
+
+	cc_mutex_lock(&faxio_lock);
+	io->busy = 0;
+
+	if (io->sendmode) {
+		io->head = (io->head + done) % CC_FAXIO_BUFFER_SIZE;
+		io->fill += done;
+		if (done < len) {
+			if (ferror(io->f)) {
+				cc_log(LOG_WARNING, "%s: error reading fax file.\n",
+					io->name);
+				io->error = 1;
+			}
+			io->eof = 1;
+		}
+		if ((io->starved) && ((io->fill != 0) || (io->eof))) {
+			/* device thread will pick up the transfer again */
+			faxio_starved = 1;
+		}
+	} else {
+		io->tail = (io->tail + done) % CC_FAXIO_BUFFER_SIZE;
+		io->fill -= done;
+		if (done < len) {
+			cc_log(LOG_WARNING, "%s: error writing fax file.\n",
+				io->name);
+			io->error = 1;
+		}
+	}
+	io->filebytes += done;
+}
+
+/*
+ * worker thread
+ */
+static void *faxio_loop(void *data)
+{
+	diva_entity_link_t *link;
+	cc_capi_fax_io_t *io;
+	struct timespec abstime;
+	int worked;
+
+	cc_mutex_lock(&faxio_lock);
+
+	while (!faxio_stop) {
+		worked = 0;
+		for (link = diva_q_get_head(&faxio_list); link != NULL;
+		     link = diva_q_get_next(link)) {
+			io = (cc_capi_fax_io_t *)link;
+			if (faxio_pending(io)) {
+				faxio_transfer(io);
+				worked = 1;
+				/* list may have changed while unlocked */
+				break;
+			}
+		}
+		if (worked) {
+			ast_cond_broadcast(&faxio_done);
+			continue;
+		}
+		abstime.tv_sec = time(NULL) + 1;
+		abstime.tv_nsec = 0;
+		ast_cond_timedwait(&faxio_work, &faxio_lock, &abstime);
+
+		/* flush received data which did not fill a complete chunk */
+		for (link = diva_q_get_head(&faxio_list); link != NULL;
+		     link = diva_q_get_next(link)) {
+			io = (cc_capi_fax_io_t *)link;
+			if ((!io->sendmode) && (io->fill != 0) && (!io->busy) && (!io->error)) {
+				faxio_transfer(io);
+				ast_cond_broadcast(&faxio_done);
+				break;
+			}
+		}
+	}
+
+	cc_mutex_unlock(&faxio_lock);
+
+	return NULL;
+}
+
+/*
+ * start the fax I/O buffer for an open file
+ */
+cc_capi_fax_io_t *pbx_capi_fax_io_open(FILE *f, int sendmode, const char *name, void *owner)
+{
+	cc_capi_fax_io_t *io;
+
+	io = ast_calloc(1, sizeof(*io));
+	if (io == NULL)
+		return NULL;
+	io->buffer = ast_malloc(CC_FAXIO_BUFFER_SIZE);
+	if (io->buffer == NULL) {
+		ast_free(io);
+		return NULL;
+	}
+
+	io->f = f;
+	io->sendmode = sendmode;
+	io->owner = owner;
+	io->start = time(NULL);
+	cc_copy_string(io->name, name, sizeof(io->name));
+
+	if (sendmode) {
+		/* prefetch the start of the document before the connection is up */
+		io->fill = fread(io->buffer, 1, CC_FAXIO_BUFFER_SIZE, f);
+		io->head = io->fill % CC_FAXIO_BUFFER_SIZE;
+		io->filebytes = io->fill;
+		if (io->fill < CC_FAXIO_BUFFER_SIZE)
+			io->eof = 1;
+	}
+
+	cc_mutex_lock(&faxio_lock);
+	if (faxio_thread == (pthread_t)(0-1)) {
+		faxio_stop = 0;
+		if (ast_pthread_create(&faxio_thread, NULL, faxio_loop, NULL) < 0) {
+			faxio_thread = (pthread_t)(0-1);
+			cc_mutex_unlock(&faxio_lock);
+			cc_log(LOG_ERROR, "%s: unable to start fax I/O thread.\n", name);
+			ast_free(io->buffer);
+			ast_free(io);
+			return NULL;
+		}
+	}
+	diva_q_add_tail(&faxio_list, &io->link);
+	cc_mutex_unlock(&faxio_lock);
+
+	cc_verbose(3, 1, VERBOSE_PREFIX_3 "%s: fax I/O started (%s, %u bytes prefetched)\n",
+		io->name, (sendmode) ? "send" : "receive", io->fill);
+
+	return io;
+}
+
+/*
+ * flush outstanding data, close the file and release the buffer.
+ * May block, must not be called from the device thread or with the
+ * lock of the owner held. The owner must stay valid until this returns.
+ * Returns the number of bytes read from/written to the file.
+ */
+long pbx_capi_fax_io_close(cc_capi_fax_io_t *io)
+{
+	long size;
+
+	if (io == NULL)
+		return 0;
+
+	cc_mutex_lock(&faxio_lock);
+	io->closing = 1;
+	ast_cond_signal(&faxio_work);
+	while ((io->busy) || (io->resuming) ||
+	       ((!io->sendmode) && (io->fill != 0) && (!io->error))) {
+		ast_cond_wait(&faxio_done, &faxio_lock);
+	}
+	diva_q_remove(&faxio_list, &io->link);
+	cc_mutex_unlock(&faxio_lock);
+
+	size = (long)io->filebytes;
+
+	cc_verbose(3, 1, VERBOSE_PREFIX_3 "%s: fax I/O finished (%llu bytes, "
+		"%u underruns, %u overruns, max backlog %u)\n",
+		io->name, io->bytes, io->underruns, io->overruns, io->maxfill);
+
+	fclose(io->f);
+	ast_free(io->buffer);
+	ast_free(io);
+
+	return size;
+}
+
+/*
+ * store received fax data, called by the device thread.
+ * Never blocks on the file system.
+ */
+int pbx_capi_fax_io_write(cc_capi_fax_io_t *io, const unsigned char *data, int len)
+{
+	unsigned int part;
+
+	if (len <= 0)
+		return 0;
+
+	cc_mutex_lock(&faxio_lock);
+
+	if ((io->error) || ((CC_FAXIO_BUFFER_SIZE - io->fill) < (unsigned int)len)) {
+		io->overruns++;
+		cc_mutex_unlock(&faxio_lock);
+		return -1;
+	}
+
+	part = CC_FAXIO_BUFFER_SIZE - io->head;
+	if (part > (unsigned int)len)
+		part = len;
+	memcpy(io->buffer + io->head, data, part);
+	if (part < (unsigned int)len)
+		memcpy(io->buffer, data + part, len - part);
+
+	io->head = (io->head + len) % CC_FAXIO_BUFFER_SIZE;
+	io->fill += len;
+	io->bytes += len;
+	if (io->fill > io->maxfill)
+		io->maxfill = io->fill;
+
+	if ((io->fill >= CC_FAXIO_CHUNK_SIZE) && (!io->busy))
+		ast_cond_signal(&faxio_work);
+
+	cc_mutex_unlock(&faxio_lock);
+
+	return len;
+}
+
+/*
+ * fetch fax data to send, called by the device thread.
+ * Returns the number of bytes, 0 at end of file or -1 if
+ * the worker has not yet read ahead far enough. In this case
+ * the transfer is resumed by pbx_capi_fax_io_resume().
+ */
+int pbx_capi_fax_io_read(cc_capi_fax_io_t *io, unsigned char *data, int len)
+{
+	unsigned int part;
+
+	cc_mutex_lock(&faxio_lock);
+
+	if ((unsigned int)len > io->fill)
+		len = io->fill;
+
+	if (len == 0) {
+		if (io->eof) {
+			cc_mutex_unlock(&faxio_lock);
+			return 0;
+		}
+		io->starved = 1;
+		io->underruns++;
+		ast_cond_signal(&faxio_work);
+		cc_mutex_unlock(&faxio_lock);
+		return -1;
+	}
+
+	part = CC_FAXIO_BUFFER_SIZE - io->tail;
+	if (part > (unsigned int)len)
+		part = len;
+	memcpy(data, io->buffer + io->tail, part);
+	if (part < (unsigned int)len)
+		memcpy(data + part, io->buffer, len - part);
+
+	io->tail = (io->tail + len) % CC_FAXIO_BUFFER_SIZE;
+	io->fill -= len;
+	io->bytes += len;
+
+	if ((!io->eof) && (!io->busy) &&
+	    ((CC_FAXIO_BUFFER_SIZE - io->fill) >= CC_FAXIO_CHUNK_SIZE))
+		ast_cond_signal(&faxio_work);
+
+	cc_mutex_unlock(&faxio_lock);
+
+	return len;
+}
+
+/*
+ * restart send transfers which ran out of data,
+ * called by the device thread. The owner is resumed without faxio_lock,
+ * pbx_capi_fax_io_close() waits until this is done, so the owner
+ * can not be released meanwhile.
+ */
+void pbx_capi_fax_io_resume(cc_capi_fax_io_resume_fn_t resume)
+{
+	diva_entity_link_t *link;
+	cc_capi_fax_io_t *io;
+	cc_capi_fax_io_t *resumed[16];
+	int count = 0, n;
+
+	if (!faxio_starved)
+		return;
+
+	cc_mutex_lock(&faxio_lock);
+	faxio_starved = 0;
+	for (link = diva_q_get_head(&faxio_list); link != NULL;
+	     link = diva_q_get_next(link)) {
+		io = (cc_capi_fax_io_t *)link;
+		if ((io->starved) && (!io->closing) &&
+		    ((io->fill != 0) || (io->eof))) {
+			if (count == (sizeof(resumed) / sizeof(resumed[0]))) {
+				faxio_starved = 1;
+				break;
+			}
+			io->starved = 0;
+			io->resuming = 1;
+			resumed[count++] = io;
+		}
+	}
+	cc_mutex_unlock(&faxio_lock);
+
+	for (n = 0; n < count; n++) {
+		resume(resumed[n]->owner);
+	}
+
+	if (count != 0) {
+		cc_mutex_lock(&faxio_lock);
+		for (n = 0; n < count; n++) {
+			resumed[n]->resuming = 0;
+		}
+		ast_cond_broadcast(&faxio_done);
+		cc_mutex_unlock(&faxio_lock);
+	}
+}
+
+/*
+ * show active fax transfers
+ */
+void pbx_capi_fax_io_show(int fd)
+{
+	diva_entity_link_t *link;
+	cc_capi_fax_io_t *io;
+	time_t now = time(NULL);
+	long duration;
+
+	ast_cli(fd, CC_MESSAGE_BIGNAME " fax transfers:\n");
+	ast_cli(fd, "Line-Name       dir  bytes     bytes/s backlog maxbacklog underrun overrun\n");
+	ast_cli(fd, "---------------------------------------------------------------------------\n");
+
+	cc_mutex_lock(&faxio_lock);
+	for (link = diva_q_get_head(&faxio_list); link != NULL;
+	     link = diva_q_get_next(link)) {
+		io = (cc_capi_fax_io_t *)link;
+		duration = (long)(now - io->start);
+		if (duration <= 0)
+			duration = 1;
+		ast_cli(fd, "%-16s%-5s%-10llu%-8llu%-8u%-11u%-9u%u\n",
+			io->name, (io->sendmode) ? "send" : "recv",
+			io->bytes, io->bytes / duration,
+			io->fill, io->maxfill, io->underruns, io->overruns);
+	}
+	cc_mutex_unlock(&faxio_lock);
+}
+
+void pbx_capi_fax_io_init_module(void)
+{
+	diva_q_init(&faxio_list);
+	ast_cond_init(&faxio_work, NULL);
+	ast_cond_init(&faxio_done, NULL);
+}
+
+void pbx_capi_fax_io_cleanup_module(void)
+{
+	cc_mutex_lock(&faxio_lock);
+	if (faxio_thread == (pthread_t)(0-1)) {
+		cc_mutex_unlock(&faxio_lock);
+		return;
+	}
+	faxio_stop = 1;
+	ast_cond_signal(&faxio_work);
+	cc_mutex_unlock(&faxio_lock);
+
+	pthread_join(faxio_thread, NULL);
+	faxio_thread = (pthread_t)(0-1);
+}
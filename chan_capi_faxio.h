@@ -0,0 +1,41 @@
+/*
+ * An implementation of Common ISDN API 2.0 for Asterisk
+ *
+ * Buffered fax file I/O
+ *
+ * This program is free software and may be modified and
+ * distributed under the terms of the GNU Public License.
+ */
+
+#ifndef _PBX_CAPI_FAXIO_H
+#define _PBX_CAPI_FAXIO_H
+
+/*
+ * Size of the per fax ring buffer. Allows the file system to stall
+ * for several seconds without losing data.
+ */
+#define CC_FAXIO_BUFFER_SIZE  (64 * 1024)
+
+/*
+ * File system transfers are done in chunks of this size
+ */
+#define CC_FAXIO_CHUNK_SIZE   (8 * 1024)
+
+struct _cc_capi_fax_io;
+typedef struct _cc_capi_fax_io cc_capi_fax_io_t;
+
+typedef void (*cc_capi_fax_io_resume_fn_t)(void *owner);
+
+/*
+ * prototypes
+ */
+extern void pbx_capi_fax_io_init_module(void);
+extern void pbx_capi_fax_io_cleanup_module(void);
+extern cc_capi_fax_io_t *pbx_capi_fax_io_open(FILE *f, int sendmode, const char *name, void *owner);
+extern long pbx_capi_fax_io_close(cc_capi_fax_io_t *io);
+extern int pbx_capi_fax_io_write(cc_capi_fax_io_t *io, const unsigned char *data, int len);
+extern int pbx_capi_fax_io_read(cc_capi_fax_io_t *io, unsigned char *data, int len);
+extern void pbx_capi_fax_io_resume(cc_capi_fax_io_resume_fn_t resume);
+extern void pbx_capi_fax_io_show(int fd);
+
+#endif
@@ -0,0 +1,332 @@
+/*
+ * An implementation of Common ISDN API 2.0 for Asterisk
+ *
+ * Software conference mixer
+ *
+ * Used by chat rooms if the controller can not mix the conference
+ * using line interconnect. Every member contributes one frame to the
+ * mixer, the mixer maintains the sum of all contributions. Each
+ * member receives the sum without its own contribution (N-1 mix),
+ * so the work per frame does not depend on the amount of members.
+ * Frames arriving before the current contribution of the member was
+ * played for its duration wait in a small per-member FIFO, so a
+ * burst of frames is mixed in order instead of only its last frame.
+ *
+ * This program is free software and may be modified and
+ * distributed under the terms of the GNU Public License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "chan_capi_platform.h"
+#include "chan_capi20.h"
+#include "chan_capi.h"
+#include "chan_capi_utils.h"
+#include "chan_capi_mixer.h"
+#include "xlaw.h"
+#include "dlist.h"
+
+struct _cc_capi_mixer_member {
+	diva_entity_link_t link;
+	short samples[CC_MIXER_MAX_SAMPLES]; /* current contribution, zero above len */
+	int len;                /* samples of the current contribution */
+	int in_sum;             /* samples are part of the mixer sum */
+	struct timeval played;  /* time the current contribution entered the sum */
+	struct timeval last;    /* time of the last frame */
+	unsigned char fifo[CC_MIXER_FIFO_FRAMES][CC_MIXER_MAX_SAMPLES];
+	int fifo_len[CC_MIXER_FIFO_FRAMES];
+	int fifo_head;
+	int fifo_count;
+};
+
+struct _cc_capi_mixer {
+	ast_mutex_t lock;
+	int sum[CC_MIXER_MAX_SAMPLES];
+	diva_entity_queue_t members;
+	unsigned int nmembers;
+	unsigned long long frames;
+	unsigned long long ns;  /* time spent mixing */
+};
+
+/*
+ * convert from/to the line law used by capi_capability
+ */
+static inline void mixer_decode(short *dst, const unsigned char *src, int len)
+{
+	const short *table = (capi_capability == CC_FORMAT_ULAW) ? capiULAW2INT : capiALAW2INT;
+	int n;
+
+	for (n = 0; n < len; n++) {
+		dst[n] = table[src[n]];
+	}
+}
+
+static inline void mixer_encode(unsigned char *dst, const short *src, int len)
+{
+	int n;
+
+	if (capi_capability == CC_FORMAT_ULAW) {
+		for (n = 0; n < len; n++) {
+			dst[n] = capi_int2ulaw(src[n]);
+		}
+	} else {
+		for (n = 0; n < len; n++) {
+			dst[n] = capi_int2alaw(src[n]);
+		}
+	}
+}
+
+/*
+ * add/remove member contribution, plain loops over fixed arrays
+ * can be vectorized by the compiler
+ */
+static inline void mixer_sum_add(int *sum, const short *samples, int len)
+{
+	int n;
+
+	for (n = 0; n < len; n++) {
+		sum[n] += samples[n];
+	}
+}
+
+static inline void mixer_sum_sub(int *sum, const short *samples, int len)
+{
+	int n;
+
+	for (n = 0; n < len; n++) {
+		sum[n] -= samples[n];
+	}
+}
+
+/*
+ * sum of all other members with saturation
+ */
+static inline void mixer_sum_others(short *dst, const int *sum, const short *own, int len)
+{
+	int n;
+
+	for (n = 0; n < len; n++) {
+		int v = sum[n] - own[n];
+
+		v = (v > 32767) ? 32767 : v;
+		v = (v < -32768) ? -32768 : v;
+		dst[n] = (short)v;
+	}
+}
+
+static void mixer_remove_contribution(cc_capi_mixer_t *mixer, cc_capi_mixer_member_t *member)
+{
+	if (member->in_sum) {
+		mixer_sum_sub(mixer->sum, member->samples, member->len);
+		memset(member->samples, 0, member->len * sizeof(member->samples[0]));
+		member->len = 0;
+		member->in_sum = 0;
+	}
+}
+
+/*
+ * make frame the current contribution of the member
+ */
+static void mixer_set_contribution(cc_capi_mixer_t *mixer, cc_capi_mixer_member_t *member,
+	const unsigned char *frame, int len, struct timeval now)
+{
+	struct timeval next = now;
+
+	if (member->in_sum) {
+		/* keep the frame clock of the member unless it fell behind */
+		next = ast_tvadd(member->played, ast_tv(0, member->len * 125));
+		if (ast_tvdiff_ms(now, next) > CC_MIXER_STALE_MS) {
+			next = now;
+		}
+	}
+	mixer_remove_contribution(mixer, member);
+	mixer_decode(member->samples, frame, len);
+	member->len = len;
+	member->in_sum = 1;
+	member->played = next;
+	mixer_sum_add(mixer->sum, member->samples, len);
+}
+
+/*
+ * move queued frames of the member to the mix once the current
+ * contribution was played for its duration (8 samples per ms),
+ * frames up to half of the duration early are accepted
+ */
+static void mixer_advance(cc_capi_mixer_t *mixer, cc_capi_mixer_member_t *member, struct timeval now)
+{
+	while ((member->fifo_count != 0) &&
+	       ((!member->in_sum) || (ast_tvdiff_ms(now, member->played) >= (member->len / 16)))) {
+		int head = member->fifo_head;
+
+		mixer_set_contribution(mixer, member, member->fifo[head], member->fifo_len[head], now);
+		member->fifo_head = (head + 1) % CC_MIXER_FIFO_FRAMES;
+		member->fifo_count--;
+	}
+}
+
+/*
+ * queue frame of the member, the oldest frame is dropped if the FIFO is full
+ */
+static void mixer_queue(cc_capi_mixer_member_t *member, const unsigned char *frame, int len)
+{
+	int tail;
+
+	if (member->fifo_count == CC_MIXER_FIFO_FRAMES) {
+		member->fifo_head = (member->fifo_head + 1) % CC_MIXER_FIFO_FRAMES;
+		member->fifo_count--;
+	}
+	tail = (member->fifo_head + member->fifo_count) % CC_MIXER_FIFO_FRAMES;
+	memcpy(member->fifo[tail], frame, len);
+	member->fifo_len[tail] = len;
+	member->fifo_count++;
+}
+
+/*
+ * create mixer
+ */
+cc_capi_mixer_t *pbx_capi_mixer_create(void)
+{
+	cc_capi_mixer_t *mixer;
+
+	mixer = ast_malloc(sizeof(*mixer));
+	if (mixer == NULL) {
+		return NULL;
+	}
+	memset(mixer, 0, sizeof(*mixer));
+	cc_mutex_init(&mixer->lock);
+	diva_q_init(&mixer->members);
+
+	return mixer;
+}
+
+/*
+ * destroy mixer, all members have to be removed
+ */
+void pbx_capi_mixer_destroy(cc_capi_mixer_t *mixer)
+{
+	diva_entity_link_t *link;
+
+	while ((link = diva_q_get_head(&mixer->members)) != NULL) {
+		diva_q_remove(&mixer->members, link);
+		ast_free(link);
+	}
+	cc_mutex_destroy(&mixer->lock);
+	ast_free(mixer);
+}
+
+/*
+ * add member to mixer
+ */
+cc_capi_mixer_member_t *pbx_capi_mixer_join(cc_capi_mixer_t *mixer)
+{
+	cc_capi_mixer_member_t *member;
+
+	member = ast_malloc(sizeof(*member));
+	if (member == NULL) {
+		return NULL;
+	}
+	memset(member, 0, sizeof(*member));
+
+	cc_mutex_lock(&mixer->lock);
+	diva_q_add_tail(&mixer->members, &member->link);
+	mixer->nmembers++;
+	cc_mutex_unlock(&mixer->lock);
+
+	return member;
+}
+
+/*
+ * remove member from mixer
+ */
+void pbx_capi_mixer_leave(cc_capi_mixer_t *mixer, cc_capi_mixer_member_t *member)
+{
+	cc_mutex_lock(&mixer->lock);
+	mixer_remove_contribution(mixer, member);
+	diva_q_remove(&mixer->members, &member->link);
+	mixer->nmembers--;
+	cc_mutex_unlock(&mixer->lock);
+
+	ast_free(member);
+}
+
+/*
+ * Queue 'in' as contribution of the member (if member talks)
+ * and return the mix of all other members in 'out'.
+ * 'in' and 'out' use the law of capi_capability.
+ */
+int pbx_capi_mixer_mix(cc_capi_mixer_t *mixer, cc_capi_mixer_member_t *member,
+	int talk, const unsigned char *in, unsigned char *out, int len)
+{
+	short mix[CC_MIXER_MAX_SAMPLES];
+	struct timespec start, end;
+	struct timeval now = ast_tvnow();
+	diva_entity_link_t *link;
+	int mixlen = (len > CC_MIXER_MAX_SAMPLES) ? CC_MIXER_MAX_SAMPLES : len;
+
+	if (len <= 0) {
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	cc_mutex_lock(&mixer->lock);
+
+	/*
+	 * play queued frames of the other members, drop contributions
+	 * of members which stopped to send frames
+	 */
+	for (link = diva_q_get_head(&mixer->members); link != NULL; link = diva_q_get_next(link)) {
+		cc_capi_mixer_member_t *other = (cc_capi_mixer_member_t *)link;
+
+		if (other == member) {
+			continue;
+		}
+		mixer_advance(mixer, other, now);
+		if ((other->in_sum) && (other->fifo_count == 0) &&
+		    (ast_tvdiff_ms(now, other->last) > CC_MIXER_STALE_MS)) {
+			mixer_remove_contribution(mixer, other);
+		}
+	}
+
+	if (talk) {
+		mixer_queue(member, in, mixlen);
+		mixer_advance(mixer, member, now);
+	} else {
+		member->fifo_count = 0;
+		mixer_remove_contribution(mixer, member);
+	}
+	mixer_sum_others(mix, mixer->sum, member->samples, mixlen);
+	member->last = now;
+
+	cc_mutex_unlock(&mixer->lock);
+
+	mixer_encode(out, mix, mixlen);
+	if (mixlen < len) {
+		memset(&out[mixlen], (capi_capability == CC_FORMAT_ULAW) ? 255 : 85, len - mixlen);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	cc_mutex_lock(&mixer->lock);
+	mixer->frames++;
+	mixer->ns += (unsigned long long)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+		end.tv_nsec - start.tv_nsec;
+	cc_mutex_unlock(&mixer->lock);
+
+	return len;
+}
+
+/*
+ * get mixer statistics
+ */
+void pbx_capi_mixer_get_stats(cc_capi_mixer_t *mixer, unsigned int *members,
+	unsigned long long *frames, unsigned long long *ns_per_frame)
+{
+	cc_mutex_lock(&mixer->lock);
+	*members = mixer->nmembers;
+	*frames = mixer->frames;
+	*ns_per_frame = (mixer->frames != 0) ? (mixer->ns / mixer->frames) : 0;
+	cc_mutex_unlock(&mixer->lock);
+}
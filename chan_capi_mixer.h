@@ -0,0 +1,48 @@
+/*
+ * An implementation of Common ISDN API 2.0 for Asterisk
+ *
+ * Software conference mixer
+ *
+ * This program is free software and may be modified and
+ * distributed under the terms of the GNU Public License.
+ */
+
+#ifndef _PBX_CAPI_MIXER_H
+#define _PBX_CAPI_MIXER_H
+
+/*
+ * Max. samples mixed per frame (60ms), remaining samples of
+ * longer frames are sent as silence
+ */
+#define CC_MIXER_MAX_SAMPLES  480
+
+/*
+ * Contribution of member is removed from the mix if no frame
+ * was received for this time
+ */
+#define CC_MIXER_STALE_MS     60
+
+/*
+ * Frames of a member waiting for the mix, absorbs the jitter of
+ * members delivering frames in bursts
+ */
+#define CC_MIXER_FIFO_FRAMES  3
+
+struct _cc_capi_mixer;
+typedef struct _cc_capi_mixer cc_capi_mixer_t;
+struct _cc_capi_mixer_member;
+typedef struct _cc_capi_mixer_member cc_capi_mixer_member_t;
+
+/*
+ * prototypes
+ */
+extern cc_capi_mixer_t *pbx_capi_mixer_create(void);
+extern void pbx_capi_mixer_destroy(cc_capi_mixer_t *mixer);
+extern cc_capi_mixer_member_t *pbx_capi_mixer_join(cc_capi_mixer_t *mixer);
+extern void pbx_capi_mixer_leave(cc_capi_mixer_t *mixer, cc_capi_mixer_member_t *member);
+extern int pbx_capi_mixer_mix(cc_capi_mixer_t *mixer, cc_capi_mixer_member_t *member,
+	int talk, const unsigned char *in, unsigned char *out, int len);
+extern void pbx_capi_mixer_get_stats(cc_capi_mixer_t *mixer, unsigned int *members,
+	unsigned long long *frames, unsigned long long *ns_per_frame);
+
+#endif
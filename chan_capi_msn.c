@@ -0,0 +1,226 @@
+/*
+ * An implementation of Common ISDN API 2.0 for Asterisk
+ *
+ * MSN/DID index for incoming calls
+ *
+ * The incomingmsn lists of all interfaces of a controller are parsed
+ * once into a digit tree. Every node holds the entries with an MSN
+ * ending at this node and the entries in DID mode, which match also
+ * longer numbers. The lookup follows the called number through the
+ * tree and collects the candidates on the way, so the cost depends on
+ * the length of the number only. Candidates are offered in order of
+ * descending priority, every data has its own priority.
+ *
+ * This program is free software and may be modified and
+ * distributed under the terms of the GNU Public License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "chan_capi_platform.h"
+#include "chan_capi20.h"
+#include "chan_capi.h"
+#include "chan_capi_utils.h"
+#include "chan_capi_msn.h"
+
+typedef struct _cc_capi_msn_entry {
+	void *data;
+	unsigned int priority;
+	struct _cc_capi_msn_entry *next;
+} cc_capi_msn_entry_t;
+
+typedef struct _cc_capi_msn_node {
+	char digit;
+	struct _cc_capi_msn_node *child;
+	struct _cc_capi_msn_node *sibling;
+	cc_capi_msn_entry_t *exact;   /* MSN ends at this node */
+	cc_capi_msn_entry_t *prefix;  /* DID ends at this node, matches longer numbers */
+} cc_capi_msn_node_t;
+
+struct _cc_capi_msn_index {
+	cc_capi_msn_node_t root;
+	cc_capi_msn_entry_t *any;     /* '*' */
+};
+
+static void msn_free_entries(cc_capi_msn_entry_t *entry)
+{
+	cc_capi_msn_entry_t *next;
+
+	for (; entry != NULL; entry = next) {
+		next = entry->next;
+		ast_free(entry);
+	}
+}
+
+static void msn_free_node(cc_capi_msn_node_t *node)
+{
+	cc_capi_msn_node_t *child, *next;
+
+	for (child = node->child; child != NULL; child = next) {
+		next = child->sibling;
+		msn_free_node(child);
+		ast_free(child);
+	}
+	msn_free_entries(node->exact);
+	msn_free_entries(node->prefix);
+}
+
+/*
+ * add entry to list sorted by descending priority
+ */
+static int msn_add_entry(cc_capi_msn_entry_t **list, unsigned int priority, void *data)
+{
+	cc_capi_msn_entry_t *entry;
+
+	for (; (*list != NULL) && ((*list)->priority >= priority); list = &(*list)->next) {
+		if ((*list)->data == data) {
+			/* same MSN listed twice */
+			return 0;
+		}
+	}
+
+	entry = ast_malloc(sizeof(*entry));
+	if (entry == NULL) {
+		return -1;
+	}
+	entry->data = data;
+	entry->priority = priority;
+	entry->next = *list;
+	*list = entry;
+
+	return 0;
+}
+
+static cc_capi_msn_node_t *msn_get_child(cc_capi_msn_node_t *node, char digit, int create)
+{
+	cc_capi_msn_node_t *child;
+
+	for (child = node->child; child != NULL; child = child->sibling) {
+		if (child->digit == digit)
+			return child;
+	}
+	if (!create) {
+		return NULL;
+	}
+
+	child = ast_malloc(sizeof(*child));
+	if (child == NULL) {
+		return NULL;
+	}
+	memset(child, 0, sizeof(*child));
+	child->digit = digit;
+	child->sibling = node->child;
+	node->child = child;
+
+	return child;
+}
+
+cc_capi_msn_index_t *pbx_capi_msn_index_create(void)
+{
+	cc_capi_msn_index_t *index;
+
+	index = ast_malloc(sizeof(*index));
+	if (index == NULL) {
+		return NULL;
+	}
+	memset(index, 0, sizeof(*index));
+
+	return index;
+}
+
+void pbx_capi_msn_index_destroy(cc_capi_msn_index_t *index)
+{
+	if (index == NULL) {
+		return;
+	}
+	msn_free_node(&index->root);
+	msn_free_entries(index->any);
+	ast_free(index);
+}
+
+/*
+ * add comma separated list of MSNs, 'did' selects DID mode
+ */
+int pbx_capi_msn_index_add(cc_capi_msn_index_t *index, const char *msnlist,
+	int did, unsigned int priority, void *data)
+{
+	char buffer[CAPI_MAX_STRING];
+	char *msn, *rp, *p;
+	cc_capi_msn_node_t *node;
+
+	cc_copy_string(buffer, msnlist, sizeof(buffer));
+
+	for (msn = strtok_r(buffer, ",", &rp); msn != NULL; msn = strtok_r(NULL, ",", &rp)) {
+		if (strcmp(msn, "*") == 0) {
+			if (msn_add_entry(&index->any, priority, data) != 0)
+				return -1;
+			continue;
+		}
+		for (node = &index->root, p = msn; (*p != 0) && (node != NULL); p++) {
+			node = msn_get_child(node, tolower((unsigned char)*p), 1);
+		}
+		if ((node == NULL) || (node == &index->root)) {
+			return -1;
+		}
+		if (msn_add_entry(&node->exact, priority, data) != 0)
+			return -1;
+		if ((did) && (msn_add_entry(&node->prefix, priority, data) != 0))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * offer all entries matching 'dnid' to 'accept' until accepted.
+ * An empty number matches '*' only.
+ */
+void *pbx_capi_msn_index_find(const cc_capi_msn_index_t *index, const char *dnid,
+	pbx_capi_msn_accept_proc_t accept)
+{
+	const cc_capi_msn_entry_t *lists[CC_MSN_MAX_DIGITS + 2];
+	const cc_capi_msn_node_t *node = &index->root;
+	unsigned int nlists = 0, n;
+	const char *p;
+	void *data;
+
+	if (index->any != NULL) {
+		lists[nlists++] = index->any;
+	}
+	for (p = dnid; (*p != 0) && (p - dnid < CC_MSN_MAX_DIGITS); p++) {
+		node = msn_get_child((cc_capi_msn_node_t *)node, tolower((unsigned char)*p), 0);
+		if (node == NULL)
+			break;
+		if (p[1] == 0) {
+			if (node->exact != NULL)
+				lists[nlists++] = node->exact;
+		} else if (node->prefix != NULL) {
+			lists[nlists++] = node->prefix;
+		}
+	}
+
+	/* merge candidate lists by priority */
+	for (;;) {
+		const cc_capi_msn_entry_t *best = NULL;
+
+		for (n = 0; n < nlists; n++) {
+			if ((lists[n] != NULL) && ((best == NULL) || (lists[n]->priority > best->priority))) {
+				best = lists[n];
+			}
+		}
+		if (best == NULL) {
+			return NULL;
+		}
+		/* candidate listed with different MSNs is offered once */
+		for (n = 0; n < nlists; n++) {
+			if ((lists[n] != NULL) && (lists[n]->priority == best->priority)) {
+				lists[n] = lists[n]->next;
+			}
+		}
+		if ((data = accept(best->data)) != NULL) {
+			return data;
+		}
+	}
+}
@@ -0,0 +1,36 @@
+/*
+ * An implementation of Common ISDN API 2.0 for Asterisk
+ *
+ * MSN/DID index for incoming calls
+ *
+ * This program is free software and may be modified and
+ * distributed under the terms of the GNU Public License.
+ */
+
+#ifndef _PBX_CAPI_MSN_H
+#define _PBX_CAPI_MSN_H
+
+/*
+ * Max. digits of called number used for lookup
+ */
+#define CC_MSN_MAX_DIGITS  64
+
+struct _cc_capi_msn_index;
+typedef struct _cc_capi_msn_index cc_capi_msn_index_t;
+
+/*
+ * Called for each candidate, lookup stops if non NULL value is returned
+ */
+typedef void *(*pbx_capi_msn_accept_proc_t)(void *data);
+
+/*
+ * prototypes
+ */
+extern cc_capi_msn_index_t *pbx_capi_msn_index_create(void);
+extern void pbx_capi_msn_index_destroy(cc_capi_msn_index_t *index);
+extern int pbx_capi_msn_index_add(cc_capi_msn_index_t *index, const char *msnlist,
+	int did, unsigned int priority, void *data);
+extern void *pbx_capi_msn_index_find(const cc_capi_msn_index_t *index, const char *dnid,
+	pbx_capi_msn_accept_proc_t accept);
+
+#endif
@@ -41,5 +41,22 @@
 
 #endif /* } */
 
+/*
+	Atomic access to values shared by the write path and the CAPI
+	device thread without taking the interface lock
+	*/
+#if defined(__ATOMIC_ACQUIRE) /* { */
+#define cc_atomic_load(__p__)             __atomic_load_n((__p__), __ATOMIC_ACQUIRE)
+#define cc_atomic_store(__p__, __v__)     __atomic_store_n((__p__), (__v__), __ATOMIC_RELEASE)
+#define cc_atomic_add(__p__, __v__)       __atomic_add_fetch((__p__), (__v__), __ATOMIC_ACQ_REL)
+#define cc_atomic_cas(__p__, __o__, __n__) \
+	__atomic_compare_exchange_n((__p__), &(__o__), (__n__), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#else /* } { */
+#define cc_atomic_load(__p__)             __sync_fetch_and_add((__p__), 0)
+#define cc_atomic_store(__p__, __v__)     do { __sync_synchronize(); *(__p__) = (__v__); __sync_synchronize(); } while (0)
+#define cc_atomic_add(__p__, __v__)       __sync_add_and_fetch((__p__), (__v__))
+#define cc_atomic_cas(__p__, __o__, __n__) __sync_bool_compare_and_swap((__p__), (__o__), (__n__))
+#endif /* } */
+
 #endif
 
@@ -151,65 +151,17 @@ _cstruct capi_rtp_ncpi(struct capi_pvt *i)
 }
 
 /*
- * create rtp for capi interface
+ * enable RTP for capi interface, the RTP headers are built and parsed
+ * by capi_write_rtp()/capi_read_rtp(), no RTP instance is needed
  */
-int capi_alloc_rtp(struct capi_pvt *i)
+int capi_enable_rtp(struct capi_pvt *i)
 {
 #ifndef CC_AST_HAS_VERSION_10_0 /* Use vocoder without RTP framing */
-#ifdef CC_AST_HAS_AST_SOCKADDR
-	struct ast_sockaddr addr;
-	struct ast_sockaddr us;
-#else
-	struct ast_hostent ahp;
-	struct hostent *hp;
-	struct in_addr addr;
-	struct sockaddr_in us;
-#endif
-#ifndef CC_AST_HAS_VERSION_1_4
-	char temp[MAXHOSTNAMELEN];
-#endif
-
-#ifdef CC_AST_HAS_AST_SOCKADDR
-	ast_sockaddr_parse(&addr, "localhost:0", 0);
-#else
-	hp = ast_gethostbyname("localhost", &ahp);
-	memcpy(&addr, hp->h_addr, sizeof(addr));
-#endif
-
-#ifdef CC_AST_HAS_RTP_ENGINE_H
-#ifdef CC_AST_HAS_AST_SOCKADDR
-	i->rtp = ast_rtp_instance_new(NULL, NULL, &addr, NULL);
-#else
-	i->rtp = ast_rtp_instance_new(NULL, NULL, (struct sockaddr_in *)&addr, NULL);
-#endif
-#else
-	i->rtp = ast_rtp_new_with_bindaddr(NULL, NULL, 0, 0, addr);
-#endif
-
-	if (!(i->rtp)) {
-		cc_log(LOG_ERROR, "%s: unable to alloc rtp.\n", i->vname);
-		return 1;
-	}
-#ifdef CC_AST_HAS_RTP_ENGINE_H
-	ast_rtp_instance_get_local_address(i->rtp, &us);
-	ast_rtp_instance_set_remote_address(i->rtp, &us);
-#else
-	ast_rtp_get_us(i->rtp, &us);
-	ast_rtp_set_peer(i->rtp, &us);
-#endif
-	cc_verbose(2, 1, VERBOSE_PREFIX_4 "%s: alloc rtp socket on %s:%d\n",
-		i->vname,
-#ifdef CC_AST_HAS_AST_SOCKADDR
-		ast_sockaddr_stringify(&us), ntohs(ast_sockaddr_port(&us)));
-#else
-#ifdef CC_AST_HAS_VERSION_1_4
-		ast_inet_ntoa(us.sin_addr),
-#else
-		ast_inet_ntoa(temp, sizeof(temp), us.sin_addr),
-#endif
-		ntohs(us.sin_port));
-#endif
+	i->rtp = 1;
 	i->timestamp = 0;
+	i->rtpseq = (unsigned short)ast_random();
+	i->rtpssrc = (unsigned int)ast_random();
+	cc_verbose(2, 1, VERBOSE_PREFIX_4 "%s: rtp enabled\n", i->vname);
 	return 0;
 #else
 	i->rtp = 0;
@@ -219,162 +171,173 @@ int capi_alloc_rtp(struct capi_pvt *i)
 }
 
 /*
- * write rtp for a channel
+ * RTP payload types as announced in the NCPI above
  */
-int capi_write_rtp(struct capi_pvt *i, struct ast_frame *f)
+static const struct {
+	unsigned char pt;
+	cc_format_t codec;
+} capi_rtp_payload_types[] = {
+	{ 0,  CC_FORMAT_ULAW },
+	{ 2,  CC_FORMAT_G726 },
+	{ 3,  CC_FORMAT_GSM },
+	{ 4,  CC_FORMAT_G723_1 },
+	{ 8,  CC_FORMAT_ALAW },
+	{ 18, CC_FORMAT_G729A },
+};
+
+#define CAPI_RTP_PT_COUNT (sizeof(capi_rtp_payload_types)/sizeof(capi_rtp_payload_types[0]))
+
+static int capi_rtp_codec2pt(cc_format_t codec)
 {
-#ifndef CC_AST_HAS_VERSION_10_0 /* Use vocoder */
-#ifdef CC_AST_HAS_AST_SOCKADDR
-	struct ast_sockaddr us;
-#else
-	struct sockaddr_in us;
-	socklen_t uslen = sizeof(us);
-#endif
-	int len;
-	unsigned int *rtpheader;
-	unsigned char buf[256];
+	int n;
 
-	if (!(i->rtp)) {
-		cc_log(LOG_ERROR, "rtp struct is NULL\n");
-		return -1;
+	for (n = 0; n < CAPI_RTP_PT_COUNT; n++) {
+		if (capi_rtp_payload_types[n].codec == codec)
+			return capi_rtp_payload_types[n].pt;
 	}
+	return -1;
+}
 
-#ifdef CC_AST_HAS_RTP_ENGINE_H
-	ast_rtp_instance_get_local_address(i->rtp, &us);
-	ast_rtp_instance_set_remote_address(i->rtp, &us);
-	if (ast_rtp_instance_write(i->rtp, f) != 0) {
-#else
-	ast_rtp_get_us(i->rtp, &us);
-	ast_rtp_set_peer(i->rtp, &us);
-	if (ast_rtp_write(i->rtp, f) != 0) {
-#endif
-		cc_verbose(3, 0, VERBOSE_PREFIX_2 "%s: rtp_write error, dropping packet.\n",
-			i->vname);
-		return 0;
-	}
+static cc_format_t capi_rtp_pt2codec(unsigned char pt)
+{
+	int n;
 
-	while(1) {
-#ifdef CC_AST_HAS_AST_SOCKADDR
-		len = ast_recvfrom(ast_rtp_instance_fd(i->rtp, 0), buf, sizeof(buf), 0, &us);
-#else
-#ifdef CC_AST_HAS_RTP_ENGINE_H
-		len = recvfrom(ast_rtp_instance_fd(i->rtp, 0),
-			buf, sizeof(buf), 0, (struct sockaddr *)&us, &uslen);
-#else
-		len = recvfrom(ast_rtp_fd(i->rtp),
-			buf, sizeof(buf), 0, (struct sockaddr *)&us, &uslen);
-#endif
-#endif
-		if (len <= 0)
-			break;
+	for (n = 0; n < CAPI_RTP_PT_COUNT; n++) {
+		if (capi_rtp_payload_types[n].pt == pt)
+			return capi_rtp_payload_types[n].codec;
+	}
+	return 0;
+}
 
-		rtpheader = (unsigned int *)buf;
-		
-		rtpheader[1] = htonl(i->timestamp);
-		i->timestamp += CAPI_MAX_B3_BLOCK_SIZE;
-			
-		if (len > (CAPI_MAX_B3_BLOCK_SIZE + RTP_HEADER_SIZE)) {
-			cc_verbose(4, 0, VERBOSE_PREFIX_4 "%s: rtp write data: frame too big (len = %d).\n",
-				i->vname, len);
-			continue;
-		}
-		if (i->B3count >= CAPI_MAX_B3_BLOCKS) {
-			cc_verbose(3, 1, VERBOSE_PREFIX_4 "%s: B3count is full, dropping packet.\n",
-				i->vname);
-			continue;
-		}
-		cc_mutex_lock(&i->lock);
-		i->B3count++;
-		cc_mutex_unlock(&i->lock);
-
-		i->send_buffer_handle++;
-
-		cc_verbose(6, 1, VERBOSE_PREFIX_4 "%s: RTP write for NCCI=%#x len=%d(%d) %s ts=%x\n",
-			i->vname, i->NCCI, len, f->datalen, cc_getformatname(GET_FRAME_SUBCLASS_CODEC(f->subclass)),
-			i->timestamp);
-
-		capi_sendf(NULL, 0, CAPI_DATA_B3_REQ, i->NCCI, get_capi_MessageNumber(),
-			"dwww",
-			buf,
-			len,
-			i->send_buffer_handle,
-			0
-		);
+/*
+ * write rtp for a channel, the RTP header is built here and the
+ * packet is sent as DATA_B3_REQ without going through a RTP socket
+ */
+int capi_write_rtp(struct capi_pvt *i, struct ast_frame *f)
+{
+#ifndef CC_AST_HAS_VERSION_10_0 /* Use vocoder */
+	unsigned char buf[CAPI_MAX_B3_BLOCK_SIZE + RTP_HEADER_SIZE];
+	int len = RTP_HEADER_SIZE + f->datalen;
+	int pt;
+
+	pt = capi_rtp_codec2pt(GET_FRAME_SUBCLASS_CODEC(f->subclass));
+	if (pt < 0) {
+		cc_verbose(3, 0, VERBOSE_PREFIX_2 "%s: no RTP payload type for %s, dropping packet.\n",
+			i->vname, cc_getformatname(GET_FRAME_SUBCLASS_CODEC(f->subclass)));
+		return 0;
+	}
+	if (len > sizeof(buf)) {
+		cc_verbose(4, 0, VERBOSE_PREFIX_4 "%s: rtp write data: frame too big (len = %d).\n",
+			i->vname, len);
+		return 0;
+	}
+	if (cc_atomic_load(&i->B3count) >= CAPI_MAX_B3_BLOCKS) {
+		cc_verbose(3, 1, VERBOSE_PREFIX_4 "%s: B3count is full, dropping packet.\n",
+			i->vname);
+		return 0;
 	}
 
+	buf[0] = 0x80; /* V=2, no padding, no extension, no CSRC */
+	buf[1] = (unsigned char)pt;
+	buf[2] = (i->rtpseq >> 8) & 0xff;
+	buf[3] = i->rtpseq & 0xff;
+	buf[4] = (i->timestamp >> 24) & 0xff;
+	buf[5] = (i->timestamp >> 16) & 0xff;
+	buf[6] = (i->timestamp >> 8) & 0xff;
+	buf[7] = i->timestamp & 0xff;
+	buf[8] = (i->rtpssrc >> 24) & 0xff;
+	buf[9] = (i->rtpssrc >> 16) & 0xff;
+	buf[10] = (i->rtpssrc >> 8) & 0xff;
+	buf[11] = i->rtpssrc & 0xff;
+	memcpy(&buf[RTP_HEADER_SIZE], f->FRAME_DATA_PTR, f->datalen);
+
+	i->rtpseq++;
+	i->timestamp += (f->samples) ? f->samples : CAPI_MAX_B3_BLOCK_SIZE;
+
+	cc_atomic_add(&i->B3count, 1);
+
+	i->send_buffer_handle++;
+
+	cc_verbose(6, 1, VERBOSE_PREFIX_4 "%s: RTP write for NCCI=%#x len=%d(%d) %s ts=%x\n",
+		i->vname, i->NCCI, len, f->datalen, cc_getformatname(GET_FRAME_SUBCLASS_CODEC(f->subclass)),
+		i->timestamp);
+
+	capi_sendf(NULL, 0, CAPI_DATA_B3_REQ, i->NCCI, get_capi_MessageNumber(),
+		"dwww",
+		buf,
+		len,
+		i->send_buffer_handle,
+		0
+	);
 #endif
 
 	return 0;
 }
 
 /*
- * read data b3 in RTP mode
+ * read data b3 in RTP mode, the RTP header is parsed here and
+ * f is set up to point to the payload in buf.
+ * returns 0 if f contains a voice frame.
  */
-struct ast_frame *capi_read_rtp(struct capi_pvt *i, unsigned char *buf, int len)
+int capi_read_rtp(struct capi_pvt *i, unsigned char *buf, int len, struct ast_frame *f)
 {
 #ifndef CC_AST_HAS_VERSION_10_0 /* Use vocoder */
-	struct ast_frame *f;
-#ifdef CC_AST_HAS_AST_SOCKADDR
-	struct ast_sockaddr us;
-#else
-	struct sockaddr_in us;
-#endif
+	int hdrlen;
+	cc_format_t codec;
 
 	if (!(i->owner))
-		return NULL;
+		return -1;
 
-	if (!(i->rtp)) {
-		cc_log(LOG_ERROR, "rtp struct is NULL\n");
-		return NULL;
+	if ((len < RTP_HEADER_SIZE) || ((buf[0] & 0xc0) != 0x80)) {
+		cc_verbose(4, 1, VERBOSE_PREFIX_3 "%s: DATA_B3_IND RTP (len=%d) invalid header\n",
+			i->vname, len);
+		return -1;
 	}
 
-#ifdef CC_AST_HAS_RTP_ENGINE_H
-	ast_rtp_instance_get_local_address(i->rtp, &us);
-	ast_rtp_instance_set_remote_address(i->rtp, &us);
-#else
-	ast_rtp_get_us(i->rtp, &us);
-	ast_rtp_set_peer(i->rtp, &us);
-#endif
+	hdrlen = RTP_HEADER_SIZE + 4 * (buf[0] & 0x0f);
+	if ((buf[0] & 0x10)) {
+		/* header extension */
+		if ((hdrlen + 4) > len)
+			return -1;
+		hdrlen += 4 + 4 * ((buf[hdrlen + 2] << 8) | buf[hdrlen + 3]);
+	}
+	if ((buf[0] & 0x20)) {
+		/* padding */
+		len -= buf[len - 1];
+	}
+	if (hdrlen >= len) {
+		return -1;
+	}
 
-#ifdef CC_AST_HAS_AST_SOCKADDR
-	if (len != ast_sendto(ast_rtp_instance_fd(i->rtp, 0), buf, len, 0, &us))
-#else
-#ifdef CC_AST_HAS_RTP_ENGINE_H
-	if (len != sendto(ast_rtp_instance_fd(i->rtp, 0), buf, len, 0, (struct sockaddr *)&us, sizeof(us)))
-#else
-	if (len != sendto(ast_rtp_fd(i->rtp), buf, len, 0, (struct sockaddr *)&us, sizeof(us)))
-#endif
-#endif
-	{
-		cc_verbose(4, 1, VERBOSE_PREFIX_3 "%s: RTP sendto error\n",
-			i->vname);
-		return NULL;
+	if (!(codec = capi_rtp_pt2codec(buf[1] & 0x7f))) {
+		cc_verbose(3, 1, VERBOSE_PREFIX_3 "%s: DATA_B3_IND RTP (len=%d) non voice payload type=%d\n",
+			i->vname, len, buf[1] & 0x7f);
+		return -1;
 	}
 
-#ifdef CC_AST_HAS_RTP_ENGINE_H
-	if ((f = ast_rtp_instance_read(i->rtp, 0))) {
-#else
-	if ((f = ast_rtp_read(i->rtp))) {
-#endif
-		if (f->frametype != AST_FRAME_VOICE) {
-			cc_verbose(3, 1, VERBOSE_PREFIX_3 "%s: DATA_B3_IND RTP (len=%d) non voice type=%d\n",
-				i->vname, len, f->frametype);
-			return NULL;
-		}
-		cc_verbose(6, 1, VERBOSE_PREFIX_4 "%s: DATA_B3_IND RTP NCCI=%#x len=%d %s (read/write=%d/%d)\n",
-			i->vname, i->NCCI, len, cc_getformatname(GET_FRAME_SUBCLASS_CODEC(f->subclass)),
-			i->owner->readformat, i->owner->writeformat);
-		if (i->owner->nativeformats != GET_FRAME_SUBCLASS_CODEC(f->subclass)) {
-			cc_verbose(3, 1, VERBOSE_PREFIX_3 "%s: DATA_B3_IND RTP nativeformats=%d, but subclass=%ld\n",
-				i->vname, i->owner->nativeformats, GET_FRAME_SUBCLASS_CODEC(f->subclass));
-			i->owner->nativeformats = GET_FRAME_SUBCLASS_CODEC(f->subclass);
-			ast_set_read_format(i->owner, i->owner->readformat);
-			ast_set_write_format(i->owner, i->owner->writeformat);
-		}
+	f->frametype = AST_FRAME_VOICE;
+	SET_FRAME_SUBCLASS_CODEC(f->subclass, codec);
+	f->FRAME_DATA_PTR = buf + hdrlen;
+	f->datalen = len - hdrlen;
+	f->samples = ast_codec_get_samples(f);
+	f->offset = AST_FRIENDLY_OFFSET;
+	f->mallocd = 0;
+	f->delivery = ast_tv(0,0);
+	f->src = NULL;
+
+	cc_verbose(6, 1, VERBOSE_PREFIX_4 "%s: DATA_B3_IND RTP NCCI=%#x len=%d %s (read/write=%d/%d)\n",
+		i->vname, i->NCCI, len, cc_getformatname(codec),
+		i->owner->readformat, i->owner->writeformat);
+	if (i->owner->nativeformats != codec) {
+		cc_verbose(3, 1, VERBOSE_PREFIX_3 "%s: DATA_B3_IND RTP nativeformats=%d, but subclass=%ld\n",
+			i->vname, i->owner->nativeformats, (long)codec);
+		i->owner->nativeformats = codec;
+		ast_set_read_format(i->owner, i->owner->readformat);
+		ast_set_write_format(i->owner, i->owner->writeformat);
 	}
-	return f;
+	return 0;
 #else
-	return NULL;
+	return -1;
 #endif
 }
 
@@ -0,0 +1,284 @@
+/*
+ * An implementation of Common ISDN API 2.0 for Asterisk
+ *
+ * Call signalling timeline
+ *
+ * Every interface records the monotonic time of the signalling events
+ * of the current call (CONNECT_IND, channel created, PBX started,
+ * ALERT_REQ, CONNECT_RESP for incoming calls, call request and
+ * CONNECT_CONF for outgoing calls, CONNECT_ACTIVE_IND and
+ * CONNECT_B3_ACTIVE_IND for both). The latency of every event to the
+ * start of the call is counted in per controller log2 histograms.
+ * At hangup a summary of the call is provided in channel variables.
+ *
+ * Events are recorded by the device thread and by PBX threads, the
+ * histograms are updated using atomic operations only.
+ *
+ * This program is free software and may be modified and
+ * distributed under the terms of the GNU Public License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "chan_capi_platform.h"
+#include "chan_capi20.h"
+#include "chan_capi.h"
+#include "chan_capi_utils.h"
+#include "chan_capi_timeline.h"
+
+static const char *timeline_event_names[CC_TIMELINE_EVENTS] = {
+	"connect_ind",
+	"channel",
+	"pbx_start",
+	"alert",
+	"answer",
+	"call",
+	"connect_conf",
+	"connect_active",
+	"b3_active",
+};
+
+/*
+ * LOCALS
+ */
+static cc_capi_timeline_stat_t timeline_stat[CAPI_MAX_CONTROLLERS + 1][2][CC_TIMELINE_EVENTS];
+
+static int timeline_bucket(unsigned long long ms)
+{
+	int bucket = 0;
+
+	while ((bucket < (CC_TIMELINE_BUCKETS - 1)) && (ms >= (1ULL << bucket))) {
+		bucket++;
+	}
+
+	return bucket;
+}
+
+/*
+ * start of current call, 0 if no call is recorded
+ */
+static unsigned long long timeline_call_start(const struct capi_pvt *i, int *outgoing)
+{
+	if (i->timeline[CC_TIMELINE_CALL] != 0) {
+		*outgoing = 1;
+		return i->timeline[CC_TIMELINE_CALL];
+	}
+	*outgoing = 0;
+
+	return i->timeline[CC_TIMELINE_CONNECT_IND];
+}
+
+static const char *timeline_format_limit(char *buffer, size_t length, unsigned int limit)
+{
+	if (limit != 0) {
+		snprintf(buffer, length, "<%u", limit);
+	} else {
+		snprintf(buffer, length, ">=%u", 1U << (CC_TIMELINE_BUCKETS - 1));
+	}
+
+	return buffer;
+}
+
+void pbx_capi_timeline_init_module(void)
+{
+	memset(timeline_stat, 0, sizeof(timeline_stat));
+}
+
+/*
+ * monotonic time in us
+ */
+unsigned long long pbx_capi_timeline_now(void)
+{
+	struct timespec now;
+	unsigned long long us;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+
+	return ((us != 0) ? us : 1);
+}
+
+/*
+ * start timeline of a new call with event CONNECT_IND or CALL
+ */
+void pbx_capi_timeline_start(struct capi_pvt *i, int event, unsigned long long now)
+{
+	memset(i->timeline, 0, sizeof(i->timeline));
+	i->timeline[event] = now;
+}
+
+/*
+ * record event, only the first occurrence of an event is recorded
+ */
+void pbx_capi_timeline_event(struct capi_pvt *i, int event)
+{
+	cc_capi_timeline_stat_t *stat;
+	unsigned long long start, now, ms;
+	int outgoing, bucket;
+
+	if (i->timeline[event] != 0) {
+		return;
+	}
+	start = timeline_call_start(i, &outgoing);
+	if (start == 0) {
+		return;
+	}
+	now = pbx_capi_timeline_now();
+	i->timeline[event] = now;
+
+	if ((i->controller < 1) || (i->controller > CAPI_MAX_CONTROLLERS)) {
+		return;
+	}
+	ms = (now - start) / 1000;
+	bucket = timeline_bucket(ms);
+	stat = &timeline_stat[i->controller][outgoing][event];
+	cc_atomic_add(&stat->count[bucket], 1);
+	cc_atomic_add(&stat->sum_ms, ms);
+	cc_atomic_add(&stat->calls, 1);
+}
+
+void pbx_capi_timeline_reset(struct capi_pvt *i)
+{
+	memset(i->timeline, 0, sizeof(i->timeline));
+}
+
+/*
+ * provide summary of the call in channel variables
+ */
+void pbx_capi_timeline_set_vars(struct ast_channel *c, struct capi_pvt *i)
+{
+	char buffer[CC_TIMELINE_EVENTS * 32];
+	unsigned long long start;
+	int event, outgoing, len = 0;
+
+	start = timeline_call_start(i, &outgoing);
+	if (start == 0) {
+		return;
+	}
+
+	buffer[0] = 0;
+	for (event = 0; event < CC_TIMELINE_EVENTS; event++) {
+		if ((i->timeline[event] == 0) || (len >= (int)sizeof(buffer))) {
+			continue;
+		}
+		len += snprintf(&buffer[len], sizeof(buffer) - len, "%s%s:%llu",
+			(len != 0) ? " " : "", timeline_event_names[event],
+			(i->timeline[event] - start) / 1000);
+	}
+	pbx_builtin_setvar_helper(c, "CAPI_TIMELINE", buffer);
+
+	if (i->timeline[CC_TIMELINE_CONNECT_ACTIVE] != 0) {
+		snprintf(buffer, sizeof(buffer), "%llu",
+			(i->timeline[CC_TIMELINE_CONNECT_ACTIVE] - start) / 1000);
+		pbx_builtin_setvar_helper(c, "CAPI_SETUPTIME", buffer);
+	}
+}
+
+const char *pbx_capi_timeline_event_name(int event)
+{
+	return timeline_event_names[event];
+}
+
+/*
+ * upper limit (ms) of histogram bucket, 0 for the last bucket
+ */
+unsigned int pbx_capi_timeline_bucket_limit(int bucket)
+{
+	return ((bucket < (CC_TIMELINE_BUCKETS - 1)) ? (1U << bucket) : 0);
+}
+
+/*
+ * get latency histogram of event, returns amount of calls
+ */
+int pbx_capi_timeline_get_stat(int controller, int outgoing, int event, cc_capi_timeline_stat_t *stat)
+{
+	cc_capi_timeline_stat_t *src;
+	int bucket;
+
+	if ((controller < 1) || (controller > CAPI_MAX_CONTROLLERS)) {
+		memset(stat, 0, sizeof(*stat));
+		return 0;
+	}
+	src = &timeline_stat[controller][(outgoing != 0)][event];
+
+	for (bucket = 0; bucket < CC_TIMELINE_BUCKETS; bucket++) {
+		stat->count[bucket] = cc_atomic_load(&src->count[bucket]);
+	}
+	stat->sum_ms = cc_atomic_load(&src->sum_ms);
+	stat->calls = cc_atomic_load(&src->calls);
+
+	return stat->calls;
+}
+
+/*
+ * upper limit of bucket containing the percentile
+ */
+unsigned int pbx_capi_timeline_percentile(const cc_capi_timeline_stat_t *stat, unsigned int percent)
+{
+	unsigned long long total = 0, target;
+	int bucket;
+
+	for (bucket = 0; bucket < CC_TIMELINE_BUCKETS; bucket++) {
+		total += stat->count[bucket];
+	}
+	target = (total * percent + 99) / 100;
+
+	for (bucket = 0, total = 0; bucket < (CC_TIMELINE_BUCKETS - 1); bucket++) {
+		total += stat->count[bucket];
+		if ((total != 0) && (total >= target)) {
+			break;
+		}
+	}
+
+	return pbx_capi_timeline_bucket_limit(bucket);
+}
+
+/*
+ * CLI: show latency of events, histograms if a controller is selected
+ */
+void pbx_capi_timeline_show(int fd, int controller)
+{
+	cc_capi_timeline_stat_t stat;
+	char p50[16], p90[16], p99[16];
+	int contr, outgoing, event, bucket, found = 0;
+
+	ast_cli(fd, "%-5s %-3s %-15s %8s %8s %8s %8s %8s\n",
+		"Contr", "Dir", "Event", "Calls", "Avg(ms)", "P50", "P90", "P99");
+
+	for (contr = 1; contr <= CAPI_MAX_CONTROLLERS; contr++) {
+		if ((controller != 0) && (contr != controller)) {
+			continue;
+		}
+		for (outgoing = 0; outgoing < 2; outgoing++) {
+			for (event = 0; event < CC_TIMELINE_EVENTS; event++) {
+				if (pbx_capi_timeline_get_stat(contr, outgoing, event, &stat) == 0) {
+					continue;
+				}
+				found++;
+				ast_cli(fd, "%5d %-3s %-15s %8u %8llu %8s %8s %8s\n",
+					contr, (outgoing != 0) ? "out" : "in",
+					timeline_event_names[event], stat.calls,
+					stat.sum_ms / stat.calls,
+					timeline_format_limit(p50, sizeof(p50), pbx_capi_timeline_percentile(&stat, 50)),
+					timeline_format_limit(p90, sizeof(p90), pbx_capi_timeline_percentile(&stat, 90)),
+					timeline_format_limit(p99, sizeof(p99), pbx_capi_timeline_percentile(&stat, 99)));
+				if (controller == 0) {
+					continue;
+				}
+				for (bucket = 0; bucket < CC_TIMELINE_BUCKETS; bucket++) {
+					if (stat.count[bucket] != 0) {
+						ast_cli(fd, "%40s ms %8u\n",
+							timeline_format_limit(p50, sizeof(p50), pbx_capi_timeline_bucket_limit(bucket)),
+							stat.count[bucket]);
+					}
+				}
+			}
+		}
+	}
+
+	if (found == 0) {
+		ast_cli(fd, "no calls recorded\n");
+	}
+}
@@ -0,0 +1,42 @@
+/*
+ * An implementation of Common ISDN API 2.0 for Asterisk
+ *
+ * Call signalling timeline
+ *
+ * This program is free software and may be modified and
+ * distributed under the terms of the GNU Public License.
+ */
+
+#ifndef _PBX_CAPI_TIMELINE_H
+#define _PBX_CAPI_TIMELINE_H
+
+/*
+ * Latency histogram buckets, bucket n counts latencies below 2^n ms,
+ * the last bucket all latencies above
+ */
+#define CC_TIMELINE_BUCKETS  16
+
+typedef struct _cc_capi_timeline_stat {
+	unsigned int count[CC_TIMELINE_BUCKETS];
+	unsigned int calls;
+	unsigned long long sum_ms;
+} cc_capi_timeline_stat_t;
+
+struct capi_pvt;
+
+/*
+ * prototypes
+ */
+extern void pbx_capi_timeline_init_module(void);
+extern unsigned long long pbx_capi_timeline_now(void);
+extern void pbx_capi_timeline_start(struct capi_pvt *i, int event, unsigned long long now);
+extern void pbx_capi_timeline_event(struct capi_pvt *i, int event);
+extern void pbx_capi_timeline_reset(struct capi_pvt *i);
+extern void pbx_capi_timeline_set_vars(struct ast_channel *c, struct capi_pvt *i);
+extern const char *pbx_capi_timeline_event_name(int event);
+extern unsigned int pbx_capi_timeline_bucket_limit(int bucket);
+extern int pbx_capi_timeline_get_stat(int controller, int outgoing, int event, cc_capi_timeline_stat_t *stat);
+extern unsigned int pbx_capi_timeline_percentile(const cc_capi_timeline_stat_t *stat, unsigned int percent);
+extern void pbx_capi_timeline_show(int fd, int controller);
+
+#endif
@@ -37,10 +37,6 @@
 #endif
 #ifdef DIVA_STATUS
 #include "divastatus_ifc.h"
-#define CC_HW_STATE_OK(__x__) ((pbx_capi_get_controller((__x__)) == NULL) || \
-																(pbx_capi_get_controller((__x__))->hwState != (int)DivaStatusHardwareStateERROR))
-#else
-#define CC_HW_STATE_OK(__x__) (1)
 #endif
 
 int capidebug = 0;
@@ -107,7 +103,7 @@ void capi_remove_nullif(struct capi_pvt *i)
 	cc_mutex_lock(&i->lock);
 	if (i->line_plci != 0) {
 		ii = i->line_plci;
-		i->line_plci = 0;
+		cc_atomic_store(&i->line_plci, NULL);
 		capi_remove_nullif(ii);
 	}
 	cc_mutex_unlock(&i->lock);
@@ -172,13 +168,16 @@ struct capi_pvt *capi_mknullif(struct ast_channel *c, unsigned long long control
 	int channelcount = 0xffff;
 	int maxcontr = (CAPI_MAX_CONTROLLERS > (sizeof(controllermask)*8)) ?
 		(sizeof(controllermask)*8) : CAPI_MAX_CONTROLLERS;
+	unsigned long long unavailable;
 	char *cur_chan_name;
 
 	cc_verbose(3, 1, VERBOSE_PREFIX_4 "capi_mknullif: find controller for mask 0x%lx\n",
 		controllermask);
+	unavailable = controllermask & pbx_capi_get_hw_unavailable_controllers();
+	controllermask &= ~unavailable;
 	/* find the next controller of mask with least plcis used */	
 	for (contrcount = 0; contrcount < maxcontr; contrcount++) {
-		if (((controllermask & (1ULL << contrcount)) != 0) && CC_HW_STATE_OK(contrcount + 1)) {
+		if ((controllermask & (1ULL << contrcount)) != 0) {
 			if (controller_nullplcis[contrcount] < channelcount) {
 				channelcount = controller_nullplcis[contrcount];
 				controller = contrcount + 1;
@@ -297,13 +296,17 @@ struct capi_pvt *capi_mkresourceif(
 		int channelcount = 0xffff;
 		int maxcontr = (CAPI_MAX_CONTROLLERS > (sizeof(controllermask)*8)) ?
 			(sizeof(controllermask)*8) : CAPI_MAX_CONTROLLERS;
+		unsigned long long unavailable;
 
 		cc_verbose(3, 1, VERBOSE_PREFIX_4 "capi_mkresourceif: find controller for mask 0x%lx\n",
 			controllermask);
 
+		unavailable = controllermask & pbx_capi_get_hw_unavailable_controllers();
+		controllermask &= ~unavailable;
+
 		/* find the next controller of mask with least plcis used */	
 		for (contrcount = 0; contrcount < maxcontr; contrcount++) {
-			if (((controllermask & (1ULL << contrcount)) != 0) && CC_HW_STATE_OK(contrcount + 1)) {
+			if ((controllermask & (1ULL << contrcount)) != 0) {
 				if (controller_nullplcis[contrcount] < channelcount) {
 					channelcount = controller_nullplcis[contrcount];
 					controller = contrcount + 1;
@@ -423,7 +426,7 @@ struct capi_pvt *capi_mkresourceif(
 			data_ifc = 0;
 		} else {
 			cc_mutex_lock(&data_plci_ifc->lock);
-			data_plci_ifc->line_plci = data_ifc;
+			cc_atomic_store(&data_plci_ifc->line_plci, data_ifc);
 			capi_sendf(data_plci_ifc, 1, CAPI_FACILITY_REQ, data_plci_ifc->PLCI, get_capi_MessageNumber(),
 				"w(w(d()))",
 				FACILITYSELECTOR_LINE_INTERCONNECT,
@@ -1429,6 +1432,76 @@ struct ast_frame *capi_read_pipeframe(struct capi_pvt *i)
 	return f;
 }
 
+/*
+ * Update the smoothed voice level (mean amplitude) with the data of one
+ * frame in the law of capi_capability. Independent partial sums let the
+ * compiler pipeline the table lookups. The level is written by one thread
+ * only and read without lock.
+ */
+void capi_level_update(unsigned int *level, const unsigned char *data, int len)
+{
+	const short *table = (capi_capability == CC_FORMAT_ULAW) ? capiULAW2INT : capiALAW2INT;
+	unsigned int sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+	int j;
+
+	if (len <= 0) {
+		return;
+	}
+
+	for (j = 0; j + 4 <= len; j += 4) {
+		sum0 += abs(table[data[j]]);
+		sum1 += abs(table[data[j + 1]]);
+		sum2 += abs(table[data[j + 2]]);
+		sum3 += abs(table[data[j + 3]]);
+	}
+	for (; j < len; j++) {
+		sum0 += abs(table[data[j]]);
+	}
+
+	*level = ((*level * 3) + ((sum0 + sum1 + sum2 + sum3) / len)) / 4;
+}
+
+/*
+ * credit B3 queue by received data, lock-free
+ */
+void capi_b3q_credit(struct capi_pvt *i, int len)
+{
+	int q = cc_atomic_load(&i->B3q);
+
+	while (q < (((CAPI_MAX_B3_BLOCKS - 1) * CAPI_MAX_B3_BLOCK_SIZE) + 1)) {
+		if (cc_atomic_cas(&i->B3q, q, q + len))
+			break;
+		q = cc_atomic_load(&i->B3q);
+	}
+}
+
+/*
+ * account sent data, the B3 queue does not go below zero
+ */
+static void capi_b3q_debit(struct capi_pvt *i, int len)
+{
+	int q, n;
+
+	do {
+		q = cc_atomic_load(&i->B3q);
+		n = (q > len) ? (q - len) : 0;
+	} while (!cc_atomic_cas(&i->B3q, q, n));
+}
+
+/*
+ * DATA_B3_CONF received, release one block
+ */
+void capi_b3count_release(struct capi_pvt *i)
+{
+	int count = cc_atomic_load(&i->B3count);
+
+	while (count > 0) {
+		if (cc_atomic_cas(&i->B3count, count, count - 1))
+			break;
+		count = cc_atomic_load(&i->B3count);
+	}
+}
+
 /*
  * write for a channel
  */
@@ -1448,16 +1521,13 @@ int capi_write_frame(struct capi_pvt *i, struct ast_frame *f)
 	}
 
 	{
-		struct capi_pvt *ii = i;
-
-		cc_mutex_lock(&ii->lock);
+		/* published with release semantics by capi_mkresourceif() */
+		struct capi_pvt *line_plci = cc_atomic_load(&i->line_plci);
 
-		if (i->line_plci != 0)
-			i = i->line_plci;
-
-		cc_mutex_unlock(&ii->lock);
+		if (line_plci != 0)
+			i = line_plci;
 	}
-	 
+
 	if (unlikely((!(i->isdnstate & CAPI_ISDN_STATE_B3_UP)) || (!i->NCCI) ||
 	    ((i->isdnstate & (CAPI_ISDN_STATE_B3_CHANGE | CAPI_ISDN_STATE_LI))))) {
 		return 0;
@@ -1498,7 +1568,7 @@ int capi_write_frame(struct capi_pvt *i, struct ast_frame *f)
 		return capi_write_rtp(i, f);
 	}
 
-	if (unlikely(i->B3count >= CAPI_MAX_B3_BLOCKS)) {
+	if (unlikely(cc_atomic_load(&i->B3count) >= CAPI_MAX_B3_BLOCKS)) {
 		cc_verbose(3, 1, VERBOSE_PREFIX_4 "%s: B3count is full, dropping packet.\n",
 			i->vname);
 		return 0;
@@ -1506,18 +1576,11 @@ int capi_write_frame(struct capi_pvt *i, struct ast_frame *f)
 
 	if (i->bproto == CC_BPROTO_VOCODER || (i->line_plci != 0 && i->line_plci->bproto == CC_BPROTO_VOCODER)) {
 #ifdef DIVA_STREAMING
-		capi_DivaStreamLock();
-		if (i->diva_stream_entry != 0) {
-			int written = 0, ready = 0;
+		int ready = 0;
+		int written = capi_DivaStreamingWrite(i, f->FRAME_DATA_PTR, f->datalen, &ready);
 
+		if (written >= 0) {
 			B3Blocks = 0;
-			if ((ready = (i->diva_stream_entry->diva_stream_state == DivaStreamActive)) &&
-					(i->diva_stream_entry->diva_stream->get_tx_free (i->diva_stream_entry->diva_stream) > 2*CAPI_MAX_B3_BLOCK_SIZE+128)) {
-				written = i->diva_stream_entry->diva_stream->write (i->diva_stream_entry->diva_stream, 8U << 8 | DIVA_STREAM_MESSAGE_TX_IDI_REQUEST, f->FRAME_DATA_PTR, f->datalen);
-				i->diva_stream_entry->diva_stream->flush_stream(i->diva_stream_entry->diva_stream);
-			}
-			capi_DivaStreamUnLock ();
-
 			error = written != f->datalen;
 			if (unlikely(error != 0)) {
 				cc_verbose(3, 1, VERBOSE_PREFIX_4 "%s: stream is %s, dropping packet.\n", i->vname, (ready != 0) ? "full" : "not ready");
@@ -1525,9 +1588,6 @@ int capi_write_frame(struct capi_pvt *i, struct ast_frame *f)
 		} else
 #endif
 		{
-#ifdef DIVA_STREAMING
-			capi_DivaStreamUnLock ();
-#endif
 			buf = &(i->send_buffer[(i->send_buffer_handle % CAPI_MAX_B3_BLOCKS) *
 				(CAPI_MAX_B3_BLOCK_SIZE + AST_FRIENDLY_OFFSET)]);
 			i->send_buffer_handle++;
@@ -1538,12 +1598,9 @@ int capi_write_frame(struct capi_pvt *i, struct ast_frame *f)
 				"dwww", buf, f->datalen, i->send_buffer_handle, 0);
 		}
 		if (likely(error == 0)) {
-			cc_mutex_lock(&i->lock);
-			i->B3count += B3Blocks;
-			i->B3q -= f->datalen;
-			if (i->B3q < 0)
-				i->B3q = 0;
-			cc_mutex_unlock(&i->lock);
+			if (B3Blocks != 0)
+				cc_atomic_add(&i->B3count, B3Blocks);
+			capi_b3q_debit(i, f->datalen);
 		}
 
 		return 0;
@@ -1588,20 +1645,13 @@ int capi_write_frame(struct capi_pvt *i, struct ast_frame *f)
 		}
    
 		error = 1; 
-		if (i->B3q > 0) {
+		if (cc_atomic_load(&i->B3q) > 0) {
 #if defined(DIVA_STREAMING)
-			if (i->diva_stream_entry != 0) {
-				int written = 0, ready = 0;
+			int ready = 0;
+			int written = capi_DivaStreamingWrite(i, buf, fsmooth->datalen, &ready);
 
+			if (written >= 0) {
 				B3Blocks = 0;
-				capi_DivaStreamLock();
-				if ((ready = (i->diva_stream_entry->diva_stream_state == DivaStreamActive)) &&
-						(i->diva_stream_entry->diva_stream->get_tx_free (i->diva_stream_entry->diva_stream) > 2*CAPI_MAX_B3_BLOCK_SIZE+128)) {
-					written = i->diva_stream_entry->diva_stream->write (i->diva_stream_entry->diva_stream, 8U << 8 | DIVA_STREAM_MESSAGE_TX_IDI_REQUEST, buf, fsmooth->datalen);
-					i->diva_stream_entry->diva_stream->flush_stream(i->diva_stream_entry->diva_stream);
-				}
-				capi_DivaStreamUnLock ();
-
 				error = written != fsmooth->datalen;
 				if (unlikely(error != 0)) {
 					cc_verbose(3, 1, VERBOSE_PREFIX_4 "%s: stream is %s, dropping packet.\n", i->vname, (ready != 0) ? "full" : "not ready");
@@ -1618,12 +1668,9 @@ int capi_write_frame(struct capi_pvt *i, struct ast_frame *f)
 		}
 
 		if (likely(!error)) {
-			cc_mutex_lock(&i->lock);
-			i->B3count += B3Blocks;
-			i->B3q -= fsmooth->datalen;
-			if (i->B3q < 0)
-				i->B3q = 0;
-			cc_mutex_unlock(&i->lock);
+			if (B3Blocks != 0)
+				cc_atomic_add(&i->B3count, B3Blocks);
+			capi_b3q_debit(i, fsmooth->datalen);
 		}
 	}
 	return ret;
@@ -1701,6 +1748,23 @@ void pbx_capi_nulliflist_unlock(void)
 	cc_mutex_unlock(&nullif_lock);
 }
 
+/*!
+		\brief Amount of NULL PLCIs allocated on controller
+	*/
+int pbx_capi_get_controller_nullplcis(int controller)
+{
+	int nullplcis;
+
+	if ((controller <= 0) || (controller > CAPI_MAX_CONTROLLERS))
+		return 0;
+
+	cc_mutex_lock(&nullif_lock);
+	nullplcis = controller_nullplcis[controller - 1];
+	cc_mutex_unlock(&nullif_lock);
+
+	return nullplcis;
+}
+
 /*!
 		\brief get list of controllers. Stop parsing
 						after non digit detected after separator
@@ -58,6 +58,9 @@ struct capi_pvt *capi_mkresourceif(struct ast_channel *c, unsigned long long con
 extern int capi_create_reader_writer_pipe(struct capi_pvt *i);
 extern struct ast_frame *capi_read_pipeframe(struct capi_pvt *i);
 extern int capi_write_frame(struct capi_pvt *i, struct ast_frame *f);
+extern void capi_b3q_credit(struct capi_pvt *i, int len);
+extern void capi_b3count_release(struct capi_pvt *i);
+extern void capi_level_update(unsigned int *level, const unsigned char *data, int len);
 extern int capi_verify_resource_plci(const struct capi_pvt *i);
 extern const char* pbx_capi_get_cid (struct ast_channel* c, const char *notAvailableVisual);
 extern const char* pbx_capi_get_callername (struct ast_channel* c, const char *notAvailableVisual);
@@ -93,5 +96,9 @@ void pbx_capi_nulliflist_lock(void);
 		\brief cc_mutex_unlock(&nullif_lock)
 	*/
 void pbx_capi_nulliflist_unlock(void);
+/*!
+		\brief Amount of NULL PLCIs allocated on controller
+	*/
+int pbx_capi_get_controller_nullplcis(int controller);
 
 #endif
@@ -52,28 +52,56 @@ typedef const char* pcchar;
 static pcchar DIVA_STATUS_PATH       = "/usr/lib/eicon/divas/registry/ifc";
 static pcchar DIVA_STATUS_FILE       = "ifcstate";
 static pcchar DIVA_INFO_FILE         = "info";
-static pcchar DIVA_CONFIG_FILE       = "info/Config";
-static pcchar DIVA_SERIAL_FILE       = "serial";
-static pcchar DIVA_READ_ALARM_FILE   = "info/Red Alarm";
-static pcchar DIVA_YELLOW_ALARM_FILE = "info/Yellow Alarm";
-static pcchar DIVA_BLUE_ALARM_FILE   = "info/Blue Alarm";
+
+/*
+	Status files read for every controller, kept open
+	*/
+typedef enum _diva_status_file {
+	DivaStatusFileConfig = 0,
+	DivaStatusFileIfcState,
+	DivaStatusFileRedAlarm,
+	DivaStatusFileYellowAlarm,
+	DivaStatusFileBlueAlarm,
+	DivaStatusFileSerial,
+	DivaStatusFile_Max
+} diva_status_file_t;
+
+static const pcchar diva_status_files[DivaStatusFile_Max] = {
+	"info/Config",
+	"ifcstate",
+	"info/Red Alarm",
+	"info/Yellow Alarm",
+	"info/Blue Alarm",
+	"serial"
+};
+
+#define DIVA_STATUS_FILE_BIT(__x__) (1U << (__x__))
+#define DIVA_STATUS_ALL_FILES       (DIVA_STATUS_FILE_BIT(DivaStatusFile_Max) - 1U)
+#define DIVA_STATUS_MAX_FILE_LENGTH (16U*1024U)
+#define DIVA_STATUS_MAX_VALUES ((int)DivaStateIfcState_Max > (int)DivaStateIfcConfig_Max ? \
+                                (int)DivaStateIfcState_Max : (int)DivaStateIfcConfig_Max)
+#define DIVA_STATUS_MAX_RETRY_INTERVAL 64 /*! \brief Max. seconds between attempts to restore lost watches */
 
 /*
 	LOCALS
 	*/
 struct _diva_status_ifc;
 static int diva_status_active(void);
-static int diva_status_get_controller_state(int controller, diva_status_ifc_state_t *state);
-static char* diva_status_read_file(unsigned int controller, const char* fileName);
-static void diva_status_create_wd(int* wd, int controller, const char* fileName, int isDir);
+static void diva_status_get_controller_state(struct _diva_status_ifc *controllerState, unsigned int files, diva_status_ifc_state_t *state);
+static const char* diva_status_read_file(struct _diva_status_ifc *controllerState, diva_status_file_t file);
+static void diva_status_close_files(struct _diva_status_ifc *controllerState);
+static int diva_status_create_wd(int* wd, int controller, const char* fileName, int isDir);
 static diva_status_interface_state_t diva_status_get_interface_state_from_idi_state (const diva_status_ifc_state_t* state);
 static diva_status_hardware_state_t diva_status_get_hw_state_from_idi_state (const diva_status_ifc_state_t* state);
 static int diva_status_map_CAPI2XDI(int capiController);
 static void diva_status_process_event(struct _diva_status_ifc *controllerState, int initialStateIndex, int newStateIndex);
+static void diva_status_update(struct _diva_status_ifc *controllerState);
 #ifdef CC_USE_INOTIFY
 static pcchar DIVA_DIVA_FS_PATH       = "/usr/lib/eicon/divas/registry/ifc";
 static void diva_status_cleanup_wd(int wd);
 static int divaFsWd  = -1; /*! \brief Diva fs state */
+static time_t retryTime; /*! \brief Time of next attempt to restore lost watches */
+static int retryInterval = 1;
 #endif
 
 #ifdef CC_AST_HAS_VERSION_1_6
@@ -95,12 +123,15 @@ typedef struct _diva_status_ifc {
 	int currentState;
 	int ifstateWd;
 	int infoWd;
+	unsigned int changedFiles; /*! \brief Files changed since last update */
+	int fd[DivaStatusFile_Max]; /*! \brief Open status files */
 	diva_status_changed_cb_proc_t   status_changed_notify_proc; /*! \brief Notify about interface state change */
 	diva_hwstatus_changed_cb_proc_t hw_status_changed_notify_proc; /*! \brief Notify about hardware state change */
 	time_t changeTime; /*! \brief Time interface state changed */
 	time_t unavailableChangeTime; /*! \brief Time interface state changed to unavailable */
 	time_t hwChangeTime; /*! \brief Time hardware state changed */
 	time_t unavailableHwChangeTime; /*! \brief Time hardware state changed to unavailable */
+	char buffer[DIVA_STATUS_MAX_FILE_LENGTH]; /*! \brief Contents of last read file */
 } diva_status_ifc_t;
 
 diva_status_interface_state_t diva_status_init_interface(int controller,
@@ -111,6 +142,7 @@ diva_status_interface_state_t diva_status_init_interface(int controller,
 	int idiController = diva_status_map_CAPI2XDI(controller);
 	diva_status_ifc_t* controllerState = idiController > 0 ? (ast_malloc(sizeof(*controllerState))) : 0;
 	diva_status_interface_state_t ret = DivaStatusInterfaceStateNotAvailable;
+	int i;
 
   if (controllerState != 0) {
 		controllerState->capiController = controller;
@@ -119,11 +151,15 @@ diva_status_interface_state_t diva_status_init_interface(int controller,
 		controllerState->hw_status_changed_notify_proc = hwfn;
 		controllerState->ifstateWd = -1;
 		controllerState->infoWd    = -1;
+		controllerState->changedFiles = 0;
+		for (i = 0; i < DivaStatusFile_Max; i++) {
+			controllerState->fd[i] = -1;
+		}
 		diva_status_create_wd(&controllerState->ifstateWd, idiController, DIVA_STATUS_FILE, 0);
 		diva_status_create_wd(&controllerState->infoWd, idiController, DIVA_INFO_FILE, 1);
 		controllerState->currentState = 0;
 		controllerState->changeTime = time(NULL);
-		diva_status_get_controller_state(idiController, &controllerState->state[controllerState->currentState]);
+		diva_status_get_controller_state(controllerState, DIVA_STATUS_ALL_FILES, &controllerState->state[controllerState->currentState]);
 		diva_q_add_tail(&controller_q, &controllerState->link);
 		ret = diva_status_get_interface_state_from_idi_state(&controllerState->state[controllerState->currentState]);
 		*hwState = diva_status_get_hw_state_from_idi_state(&controllerState->state[controllerState->currentState]);
@@ -147,6 +183,7 @@ void diva_status_cleanup_interface (int controller)
 			if (controllerState->infoWd >= 0)
 				inotify_rm_watch(inotifyFd, controllerState->infoWd);
 #endif
+			diva_status_close_files(controllerState);
 			ast_free (controllerState);
 			break;
 		}
@@ -171,31 +208,75 @@ int diva_status_get_waitable_object(void)
 	return inotifyFd;
 }
 
+/*
+	Read changed files and notify about state change
+	*/
+static void diva_status_update(diva_status_ifc_t *controllerState)
+{
+	int currentState = controllerState->currentState;
+	int newState = (currentState + 1) % 2;
+
+	controllerState->state[newState] = controllerState->state[currentState];
+	diva_status_get_controller_state(controllerState, controllerState->changedFiles, &controllerState->state[newState]);
+	controllerState->changedFiles = 0;
+	controllerState->currentState = newState;
+	diva_status_process_event(controllerState, currentState, newState);
+}
+
+#ifdef CC_USE_INOTIFY
+/*
+	Map name of file in info directory to status file
+	*/
+static unsigned int diva_status_info_file(const char* name)
+{
+	unsigned int i;
+
+	for (i = 0; i < DivaStatusFile_Max; i++) {
+		if ((strncmp(diva_status_files[i], "info/", 5) == 0) &&
+				(strcmp(&diva_status_files[i][5], name) == 0)) {
+			return (DIVA_STATUS_FILE_BIT(i));
+		}
+	}
+
+	return (0);
+}
+#endif
+
 void diva_status_process_events(void)
 {
 	diva_entity_link_t* link;
 
+#ifdef CC_USE_INOTIFY
 	/*
-		Polling
+		Restore lost watches. Files are read only if a watch
+		was lost or if the watched file changed.
 		*/
-	for (link = diva_q_get_head(&controller_q); link != 0; link = diva_q_get_next(link)) {
-		diva_status_ifc_t *controllerState = DIVAS_CONTAINING_RECORD(link, diva_status_ifc_t, link);
-		if ((controllerState->ifstateWd < 0) || (controllerState->infoWd < 0)) {
-			int currentState = controllerState->currentState;
-			diva_status_create_wd(&controllerState->ifstateWd, controllerState->idiController, DIVA_STATUS_FILE, 0);
-			diva_status_create_wd(&controllerState->infoWd, controllerState->idiController, DIVA_INFO_FILE, 1);
-			controllerState->currentState = (controllerState->currentState + 1) % 2;
-			diva_status_get_controller_state(controllerState->idiController, &controllerState->state[controllerState->currentState]);
-			diva_status_process_event(controllerState, currentState, controllerState->currentState);
+	if ((retryTime != 0) && (time(NULL) >= retryTime)) {
+		int missing = 0;
+
+		for (link = diva_q_get_head(&controller_q); link != 0; link = diva_q_get_next(link)) {
+			diva_status_ifc_t *controllerState = DIVAS_CONTAINING_RECORD(link, diva_status_ifc_t, link);
+
+			if ((controllerState->ifstateWd < 0) || (controllerState->infoWd < 0)) {
+				missing += diva_status_create_wd(&controllerState->ifstateWd, controllerState->idiController, DIVA_STATUS_FILE, 0);
+				missing += diva_status_create_wd(&controllerState->infoWd, controllerState->idiController, DIVA_INFO_FILE, 1);
+				controllerState->changedFiles = DIVA_STATUS_ALL_FILES;
+			}
+		}
+		if (missing != 0) {
+			retryInterval = MIN(retryInterval * 2, DIVA_STATUS_MAX_RETRY_INTERVAL);
+			retryTime = time(NULL) + retryInterval;
+		} else {
+			retryInterval = 1;
+			retryTime = 0;
 		}
 	}
 
 	/*
 		Events
 		*/
-#ifdef CC_USE_INOTIFY
 	if (inotifyFd >= 0 && divaFsWd >= 0) {
-		unsigned char buffer[1024];
+		unsigned char buffer[1024] __attribute__ ((aligned(__alignof__(struct inotify_event))));
 		int length;
 		int i;
 
@@ -211,11 +292,26 @@ void diva_status_process_events(void)
 				if (event->wd != divaFsWd) {
 					for (link = diva_q_get_head(&controller_q); link != 0; link = diva_q_get_next(link)) {
 						diva_status_ifc_t *controllerState = DIVAS_CONTAINING_RECORD(link, diva_status_ifc_t, link);
-						if ((controllerState->ifstateWd == event->wd) || (controllerState->infoWd == event->wd)) {
-							int currentState = controllerState->currentState;
-							controllerState->currentState = (controllerState->currentState + 1) % 2;
-							diva_status_get_controller_state(controllerState->idiController, &controllerState->state[controllerState->currentState]);
-							diva_status_process_event(controllerState, currentState, controllerState->currentState);
+
+						if (controllerState->ifstateWd == event->wd) {
+							controllerState->changedFiles |= DIVA_STATUS_FILE_BIT(DivaStatusFileIfcState);
+						} else if (controllerState->infoWd == event->wd) {
+							unsigned int files = (event->len != 0) ? diva_status_info_file(event->name) : 0;
+							int file;
+
+							if (files == 0) {
+								files = DIVA_STATUS_ALL_FILES;
+							}
+							if ((event->mask & (IN_DELETE|IN_MOVED_TO)) != 0) {
+								/* file replaced, reopen */
+								for (file = 0; file < DivaStatusFile_Max; file++) {
+									if (((files & DIVA_STATUS_FILE_BIT(file)) != 0) && (controllerState->fd[file] >= 0)) {
+										close(controllerState->fd[file]);
+										controllerState->fd[file] = -1;
+									}
+								}
+							}
+							controllerState->changedFiles |= files;
 						}
 					}
 				}
@@ -224,7 +320,25 @@ void diva_status_process_events(void)
 			}
 		}
 	}
+#else
+	/*
+		Polling
+		*/
+	for (link = diva_q_get_head(&controller_q); link != 0; link = diva_q_get_next(link)) {
+		diva_status_ifc_t *controllerState = DIVAS_CONTAINING_RECORD(link, diva_status_ifc_t, link);
+		/* no notification about replaced files */
+		diva_status_close_files(controllerState);
+		controllerState->changedFiles = DIVA_STATUS_ALL_FILES;
+	}
 #endif
+
+	for (link = diva_q_get_head(&controller_q); link != 0; link = diva_q_get_next(link)) {
+		diva_status_ifc_t *controllerState = DIVAS_CONTAINING_RECORD(link, diva_status_ifc_t, link);
+
+		if (controllerState->changedFiles != 0) {
+			diva_status_update(controllerState);
+		}
+	}
 }
 
 #ifdef CC_USE_INOTIFY
@@ -243,12 +357,16 @@ static void diva_status_cleanup_wd(int wd)
 			inotify_rm_watch(inotifyFd, controllerState->infoWd);
 		}
 		controllerState->infoWd = -1;
+		diva_status_close_files(controllerState);
 	}
 
 	if ((divaFsWd >= 0) && (wd != divaFsWd)) {
 		inotify_rm_watch(inotifyFd, divaFsWd);
 	}
 	divaFsWd = -1;
+
+	retryInterval = 1;
+	retryTime = time(NULL);
 }
 #endif
 
@@ -281,7 +399,12 @@ static void diva_status_process_event(diva_status_ifc_t *controllerState, int in
 	}
 }
 
-static void diva_status_create_wd(int* wd, int controller, const char* fileName, int isDir)
+/*!
+	\brief Create watch if not exists
+
+	\return zero if watch exists
+	*/
+static int diva_status_create_wd(int* wd, int controller, const char* fileName, int isDir)
 {
 #ifdef CC_USE_INOTIFY
 	if (inotifyFd < 0) {
@@ -293,10 +416,7 @@ static void diva_status_create_wd(int* wd, int controller, const char* fileName,
 		divaFsWd = inotify_add_watch (inotifyFd, DIVA_DIVA_FS_PATH, IN_DELETE_SELF | IN_UNMOUNT | IN_IGNORED);
 	}
 
-	if (*wd >= 0)
-		return;
-
-	if (inotifyFd >= 0 && divaFsWd >= 0) {
+	if (*wd < 0 && inotifyFd >= 0 && divaFsWd >= 0) {
 		int name_len = strlen(DIVA_STATUS_PATH) + strlen(fileName) + 32;
 		char name[name_len];
 
@@ -304,13 +424,17 @@ static void diva_status_create_wd(int* wd, int controller, const char* fileName,
 		name[name_len-1] = 0;
 
 		*wd = inotify_add_watch (inotifyFd, name,
-					 IN_CLOSE_WRITE | IN_DELETE_SELF | IN_IGNORED | ((isDir != 0) ? IN_DELETE : 0));
+					 IN_CLOSE_WRITE | IN_DELETE_SELF | IN_IGNORED | ((isDir != 0) ? (IN_DELETE | IN_MOVED_TO) : 0));
+	}
 
-		return;
+	if (*wd < 0 && retryTime == 0) {
+		retryTime = time(NULL) + retryInterval;
 	}
 #else
 	*wd = -1;
 #endif
+
+	return ((*wd >= 0) ? 0 : 1);
 }
 
 /*!
@@ -323,191 +447,218 @@ static int diva_status_active(void)
 	return ((stat(DIVA_STATUS_PATH, &v) == 0 && S_ISDIR(v.st_mode) != 0) ? 0 : -1);
 }
 
-static char* diva_status_read_file(unsigned int controller, const char* fileName)
+static void diva_status_close_files(diva_status_ifc_t *controllerState)
 {
-	int name_len = strlen(DIVA_STATUS_PATH) + strlen(fileName) + 32;
-	char name[name_len];
-	struct stat v;
-	int fd;
-	int length;
-	char *data, *p;
+	int i;
 
-	snprintf(name, name_len, "%s/adapter%u/%s", DIVA_STATUS_PATH, controller, fileName);
-	name[name_len-1] = 0;
+	for (i = 0; i < DivaStatusFile_Max; i++) {
+		if (controllerState->fd[i] >= 0) {
+			close(controllerState->fd[i]);
+			controllerState->fd[i] = -1;
+		}
+	}
+}
 
-	fd = open(name, O_RDONLY);
-	if (fd < 0)
-		return 0;
+/*!
+	\brief Read first line of status file to the buffer of the controller,
+	the file is kept open for next read
+	*/
+static const char* diva_status_read_file(diva_status_ifc_t *controllerState, diva_status_file_t file)
+{
+	char *data = controllerState->buffer;
+	ssize_t length;
+	char *p;
 
-	if (fstat(fd, &v) != 0 || v.st_size == 0) {
-    close(fd);
-    return 0;
-  }
+	if (controllerState->fd[file] < 0) {
+		int name_len = strlen(DIVA_STATUS_PATH) + strlen(diva_status_files[file]) + 32;
+		char name[name_len];
 
-	length = MIN(v.st_size, 16U*1024U);
+		snprintf(name, name_len, "%s/adapter%u/%s", DIVA_STATUS_PATH, controllerState->idiController, diva_status_files[file]);
+		name[name_len-1] = 0;
 
-	data = ast_malloc(length+1);
-	if (data == 0) {
-		close (fd);
-		return 0;
+		controllerState->fd[file] = open(name, O_RDONLY);
+		if (controllerState->fd[file] < 0)
+			return 0;
 	}
 
-	if (read(fd, data, length) != length) {
-		ast_free(data);
-		close(fd);
-		return (0);
+	length = pread(controllerState->fd[file], data, DIVA_STATUS_MAX_FILE_LENGTH - 1, 0);
+	if (length <= 0) {
+		close(controllerState->fd[file]);
+		controllerState->fd[file] = -1;
+		return 0;
 	}
-
-	close (fd);
-
 	data[length] = 0;
 
-	while (((p = strchr(data, '\n')) != 0) || ((p = strchr(data, '\r')))) {
-		*p = 0;
-	}
+	for (p = data; (*p != 0) && (*p != '\n') && (*p != '\r'); p++)
+		;
+	*p = 0;
 
 	return (data);
 }
 
-static int diva_status_get_controller_state(int controller, diva_status_ifc_state_t *state)
-{
-	char *data, *p;
-	int i, pri, bri;
-	const char* v;
-
-	memset (state, 0x00, sizeof(*state));
-	state->ifcType    = DivaStatusIfcNotPri;
-	state->hwState    = DivaStatusHwStateUnknown;
-	state->ifcL1State = DivaStatusIfcL2DoNotApply;
-	state->ifcL2State = DivaStatusIfcL2DoNotApply;
-	state->ifcL1VisualState = DivaStatusIfcL2DoNotApply;
-	state->ifcL2VisualState = DivaStatusIfcL2DoNotApply;
-
-	if (diva_status_active() != 0)
-		return -1;
-
-	if ((data = diva_status_read_file(controller, DIVA_CONFIG_FILE)) == 0)
-		return -1;
-
-	for (i = 0, pri = 0, bri = 0, p = data, v = strsep(&p, ",");
-			 v != 0 && i < DivaStateIfcConfig_Max;
-			 v = strsep(&p, ","), i++) {
-		if (v[0] == '\'' && v[strlen(v)-1] != '\'') {
-			const char *tmp;
-			do {
-				if ((p != 0) && (*p != 0))
-					p[-1] = ',';
-				tmp = strsep (&p, ",");
-			} while ((tmp != 0) && (tmp[strlen(tmp)-1] != '\''));
-		}
-
-		switch ((diva_state_ifc_config_parameters_t)i) {
-			case DivaStateIfcConfig_TYPE:
-				pri += (strcmp ("PRI", v) == 0);
-				bri += (strcmp ("BRI", v) == 0);
-				break;
+/*!
+	\brief Split line at commas outside of quoted values
 
-			case DivaStateIfcConfig_PRI:
-				pri += (strcmp ("'YES'", v) == 0);
-				bri += (strcmp ("'NO'", v) == 0);
-				break;
+	\return number of values
+	*/
+static int diva_status_split(char *data, char **values, int maxValues)
+{
+	char *p, *start = data;
+	int nr = 0, quoted = 0;
+
+	for (p = data; nr < maxValues; p++) {
+		if (*p == '\'') {
+			if (p == start) {
+				quoted = (p[1] != ',') && (p[1] != 0);
+			} else if ((p[1] == ',') || (p[1] == 0)) {
+				quoted = 0;
+			}
+		} else if (((*p == ',') && (quoted == 0)) || (*p == 0)) {
+			int end = (*p == 0);
 
-			default:
+			*p = 0;
+			values[nr++] = start;
+			start = p + 1;
+			if (end != 0)
 				break;
 		}
 	}
-	ast_free(data);
 
-	state->ifcType = (pri == 2) ? DivaStatusIfcPri : DivaStatusIfcNotPri;
-	if (bri == 2) {
-		state->ifcType = DivaStatusIfcBri;
+	return (nr);
+}
+
+/*!
+	\brief Update state from the files in 'files'
+	*/
+static void diva_status_get_controller_state(diva_status_ifc_t *controllerState, unsigned int files, diva_status_ifc_state_t *state)
+{
+	char *values[DIVA_STATUS_MAX_VALUES];
+	const char* data;
+	int i, nr;
+
+	if ((files & DIVA_STATUS_FILE_BIT(DivaStatusFileConfig)) != 0) {
+		/* interface type used to evaluate layer 1 and 2 state */
+		files |= DIVA_STATUS_FILE_BIT(DivaStatusFileIfcState);
 	}
 
-	if ((data = diva_status_read_file(controller, DIVA_STATUS_FILE)) == 0)
-		return (-1);
+	if ((files & DIVA_STATUS_FILE_BIT(DivaStatusFileConfig)) != 0) {
+		int pri = 0, bri = 0;
 
-	for (i = 0, p = data, v = strsep (&p, ","); v != 0 && i < (int)DivaStateIfcState_Max; v = strsep (&p, ","), i++) {
-		if (v[0] == '\'' && v[strlen(v)-1] != '\'') {
-			const char *tmp;
-			do {
-				if ((p != 0) && (*p != 0))
-					p[-1] = ',';
-				tmp = strsep (&p, ",");
-			} while ((tmp != 0) && (tmp[strlen(tmp)-1] != '\''));
-		}
+		if ((data = diva_status_read_file(controllerState, DivaStatusFileConfig)) != 0) {
+			nr = diva_status_split((char*)data, values, DivaStateIfcConfig_Max);
+			for (i = 0; i < nr; i++) {
+				const char* v = values[i];
 
-		switch ((diva_state_ifcstate_parameters_t)i) {
-			case DivaStateIfcState_LAYER1_STATE:
-				state->ifcL1VisualState = (strcmp ("'Activated'", v) == 0) ? DivaStatusIfcL1OK : DivaStatusIfcL1Error;
-				if (state->ifcType == DivaStatusIfcPri) {
-					state->ifcL1State = state->ifcL1VisualState;
-				}
-				break;
+				switch ((diva_state_ifc_config_parameters_t)i) {
+					case DivaStateIfcConfig_TYPE:
+						pri += (strcmp ("PRI", v) == 0);
+						bri += (strcmp ("BRI", v) == 0);
+						break;
 
-			case DivaStateIfcState_LAYER2_STATE:
-				state->ifcL2VisualState = (strcmp ("'Layer2 UP'", v) == 0) ? DivaStatusIfcL2OK : DivaStatusIfcL2Error;
-				if (state->ifcType == DivaStatusIfcPri) {
-					state->ifcL2State = state->ifcL2VisualState;
-				}
-				break;
+					case DivaStateIfcConfig_PRI:
+						pri += (strcmp ("'YES'", v) == 0);
+						bri += (strcmp ("'NO'", v) == 0);
+						break;
 
-			case DivaStateIfcState_D1_X_FRAMES:
-				state->ifcTxDStatistics.Frames = (unsigned int)atol(v);
-				break;
-			case DivaStateIfcState_D1_X_BYTES:
-				state->ifcTxDStatistics.Bytes = (unsigned int)atol(v);
-				break;
-			case DivaStateIfcState_D1_X_ERRORS:
-				state->ifcTxDStatistics.Errors = (unsigned int)atol(v);
-				break;
-			case DivaStateIfcState_D1_R_FRAMES:
-				state->ifcRxDStatistics.Frames = (unsigned int)atol(v);
-				break;
-			case DivaStateIfcState_D1_R_BYTES:
-				state->ifcRxDStatistics.Bytes = (unsigned int)atol(v);
-				break;
-			case DivaStateIfcState_D1_R_ERRORS:
-				state->ifcRxDStatistics.Errors = (unsigned int)atol(v);
-				break;
+					default:
+						break;
+				}
+			}
+		}
 
-			case DivaStateIfcState_MAX_TEMPERATURE:
-				state->maxTemperature = (unsigned int)atoi(v);
-				break;
-			case DivaStateIfcState_TEMPERATURE:
-				state->currentTemperature = (unsigned int)atoi(v);
-				break;
+		state->ifcType = (pri == 2) ? DivaStatusIfcPri : DivaStatusIfcNotPri;
+		if (bri == 2) {
+			state->ifcType = DivaStatusIfcBri;
+		}
+	}
 
-			case DivaStateIfcState_HARDWARE_STATE:
-				if (strcmp("'Active'", v) == 0)
-					state->hwState = DivaStateHwStateActive;
-				else if (strcmp("'Inactive'", v) == 0)
-					state->hwState = DivaStateHwStateInactive;
-				break;
+	if ((files & DIVA_STATUS_FILE_BIT(DivaStatusFileIfcState)) != 0) {
+		state->hwState    = DivaStatusHwStateUnknown;
+		state->ifcL1State = DivaStatusIfcL2DoNotApply;
+		state->ifcL2State = DivaStatusIfcL2DoNotApply;
+		state->ifcL1VisualState = DivaStatusIfcL2DoNotApply;
+		state->ifcL2VisualState = DivaStatusIfcL2DoNotApply;
+		memset (&state->ifcTxDStatistics, 0x00, sizeof(state->ifcTxDStatistics));
+		memset (&state->ifcRxDStatistics, 0x00, sizeof(state->ifcRxDStatistics));
+		state->maxTemperature     = 0;
+		state->currentTemperature = 0;
+
+		if ((data = diva_status_read_file(controllerState, DivaStatusFileIfcState)) != 0) {
+			nr = diva_status_split((char*)data, values, DivaStateIfcState_Max);
+			for (i = 0; i < nr; i++) {
+				const char* v = values[i];
+
+				switch ((diva_state_ifcstate_parameters_t)i) {
+					case DivaStateIfcState_LAYER1_STATE:
+						state->ifcL1VisualState = (strcmp ("'Activated'", v) == 0) ? DivaStatusIfcL1OK : DivaStatusIfcL1Error;
+						if (state->ifcType == DivaStatusIfcPri) {
+							state->ifcL1State = state->ifcL1VisualState;
+						}
+						break;
 
-			default:
-				break;
+					case DivaStateIfcState_LAYER2_STATE:
+						state->ifcL2VisualState = (strcmp ("'Layer2 UP'", v) == 0) ? DivaStatusIfcL2OK : DivaStatusIfcL2Error;
+						if (state->ifcType == DivaStatusIfcPri) {
+							state->ifcL2State = state->ifcL2VisualState;
+						}
+						break;
+
+					case DivaStateIfcState_D1_X_FRAMES:
+						state->ifcTxDStatistics.Frames = (unsigned int)atol(v);
+						break;
+					case DivaStateIfcState_D1_X_BYTES:
+						state->ifcTxDStatistics.Bytes = (unsigned int)atol(v);
+						break;
+					case DivaStateIfcState_D1_X_ERRORS:
+						state->ifcTxDStatistics.Errors = (unsigned int)atol(v);
+						break;
+					case DivaStateIfcState_D1_R_FRAMES:
+						state->ifcRxDStatistics.Frames = (unsigned int)atol(v);
+						break;
+					case DivaStateIfcState_D1_R_BYTES:
+						state->ifcRxDStatistics.Bytes = (unsigned int)atol(v);
+						break;
+					case DivaStateIfcState_D1_R_ERRORS:
+						state->ifcRxDStatistics.Errors = (unsigned int)atol(v);
+						break;
+
+					case DivaStateIfcState_MAX_TEMPERATURE:
+						state->maxTemperature = (unsigned int)atoi(v);
+						break;
+					case DivaStateIfcState_TEMPERATURE:
+						state->currentTemperature = (unsigned int)atoi(v);
+						break;
+
+					case DivaStateIfcState_HARDWARE_STATE:
+						if (strcmp("'Active'", v) == 0)
+							state->hwState = DivaStateHwStateActive;
+						else if (strcmp("'Inactive'", v) == 0)
+							state->hwState = DivaStateHwStateInactive;
+						break;
+
+					default:
+						break;
+				}
+			}
 		}
 	}
-	ast_free (data);
 
-	if ((data = diva_status_read_file(controller, DIVA_READ_ALARM_FILE)) != 0) {
-		state->ifcAlarms.Red = strcmp("TRUE", data) == 0;
-		ast_free(data);
+	if ((files & DIVA_STATUS_FILE_BIT(DivaStatusFileRedAlarm)) != 0) {
+		data = diva_status_read_file(controllerState, DivaStatusFileRedAlarm);
+		state->ifcAlarms.Red = (data != 0) && (strcmp("TRUE", data) == 0);
 	}
-	if ((data = diva_status_read_file(controller, DIVA_YELLOW_ALARM_FILE)) != 0) {
-		state->ifcAlarms.Yellow = strcmp("TRUE", data) == 0;
-		ast_free(data);
+	if ((files & DIVA_STATUS_FILE_BIT(DivaStatusFileYellowAlarm)) != 0) {
+		data = diva_status_read_file(controllerState, DivaStatusFileYellowAlarm);
+		state->ifcAlarms.Yellow = (data != 0) && (strcmp("TRUE", data) == 0);
 	}
-	if ((data = diva_status_read_file(controller, DIVA_BLUE_ALARM_FILE)) != 0) {
-		state->ifcAlarms.Blue = strcmp("TRUE", data) == 0;
-		ast_free(data);
+	if ((files & DIVA_STATUS_FILE_BIT(DivaStatusFileBlueAlarm)) != 0) {
+		data = diva_status_read_file(controllerState, DivaStatusFileBlueAlarm);
+		state->ifcAlarms.Blue = (data != 0) && (strcmp("TRUE", data) == 0);
 	}
-	if ((data = diva_status_read_file(controller, DIVA_SERIAL_FILE)) != 0) {
-		state->serialNumber = (unsigned int)(atol(data)) & 0x00ffffff;
-		ast_free(data);
+	if ((files & DIVA_STATUS_FILE_BIT(DivaStatusFileSerial)) != 0) {
+		data = diva_status_read_file(controllerState, DivaStatusFileSerial);
+		state->serialNumber = (data != 0) ? ((unsigned int)(atol(data)) & 0x00ffffff) : 0;
 	}
-
-	return (0);
 }
 
 /*
@@ -515,27 +666,17 @@ static int diva_status_get_controller_state(int controller, diva_status_ifc_stat
 	*/
 diva_status_interface_state_t diva_status_get_interface_state(int controller)
 {
-	diva_status_ifc_state_t state;
-	int ret;
-
-	ret = diva_status_get_controller_state(controller, &state);
+	diva_entity_link_t* link;
 
-	if ((ret != 0) ||
-			(state.ifcType != DivaStatusIfcPri) ||
-			(state.ifcL1State == DivaStatusIfcL2DoNotApply) ||
-			(state.hwState    == DivaStatusHwStateUnknown)) {
-		return (DivaStatusInterfaceStateNotAvailable);
-	}
+	for (link = diva_q_get_head(&controller_q); link != 0; link = diva_q_get_next(link)) {
+		diva_status_ifc_t *controllerState = DIVAS_CONTAINING_RECORD(link, diva_status_ifc_t, link);
 
-	if ((state.ifcAlarms.Red    == 0) &&
-			(state.ifcAlarms.Yellow == 0) &&
-			(state.ifcAlarms.Blue   == 0) &&
-			(state.hwState == DivaStateHwStateActive) &&
-			(state.ifcL1State == DivaStatusIfcL1OK)) {
-		return DivaStatusInterfaceStateOK;
+		if (controllerState->capiController == controller) {
+			return (diva_status_get_interface_state_from_idi_state(&controllerState->state[controllerState->currentState]));
+		}
 	}
 
-	return DivaStatusInterfaceStateERROR;
+	return (DivaStatusInterfaceStateNotAvailable);
 }
 
 static diva_status_interface_state_t diva_status_get_interface_state_from_idi_state(const diva_status_ifc_state_t* state)
@@ -25,6 +25,7 @@
  */
 
 #include <stdio.h>
+#include <time.h>
 #include "chan_capi_platform.h"
 #include "chan_capi20.h"
 #include "chan_capi.h"
@@ -35,15 +36,48 @@
 #include "diva_streaming_messages.h"
 #include "diva_streaming_vector.h"
 #include "diva_streaming_manager.h"
+#include "diva_segment_alloc_ifc.h"
+#include "diva_streaming_loopback.h"
 #include "chan_capi_divastreaming_utils.h"
 
 /*
 	LOCALS
 	*/
 static int diva_streaming_disabled;
+/*
+	Protects the list of new streams and the stream entry of interfaces,
+	held by the device thread during one wakeup cycle.
+	Stream access is protected by the lock of the stream entry.
+	*/
 AST_MUTEX_DEFINE_STATIC(stream_write_lock);
 
 static diva_entity_queue_t diva_streaming_new; /* protected by stream_write_lock, new streams */
+static diva_entity_queue_t diva_streaming_cancelled; /* protected by stream_write_lock, streams with cancelled create request */
+static diva_entity_queue_t active_streams; /* accessed by device thread only */
+static diva_entity_queue_t retired_streams; /* accessed by device thread only */
+/*
+	Protects the list of streams with data written since the last wakeup
+	and flush_pending of the stream entries
+	*/
+AST_MUTEX_DEFINE_STATIC(stream_ready_lock);
+static diva_entity_queue_t diva_streaming_ready;
+
+static void divaStreamingSchedule(diva_stream_scheduling_entry_t* pE);
+
+/*
+	Stream pool, protected by stream_write_lock.
+	The segment alloc is shared by all streams (DIVA_SHARED_SEGMENT_ALLOC)
+	and keeps segments of released streams mapped. The pool maps the
+	segments for the configured streams at load time, so the first calls
+	do not wait for the driver. Released stream entries are kept for
+	reuse, the owner of an entry is changed with the lock of the entry
+	held and checked by writers.
+	*/
+static struct _diva_segment_alloc* stream_segment_alloc;
+static diva_entity_queue_t stream_entry_pool;
+static unsigned int stream_entries_in_pool;
+static unsigned int streams_in_use;
+static int stream_pool_size = -1; /* streams per controller, -1 amount of B-channels */
 
 int capi_DivaStreamingSupported (unsigned controller)
 {
@@ -108,27 +142,43 @@ static int divaStreamingMessageRx (void* user_context, dword message, dword leng
 						if (pE->i->virtualBridgePeer != 0) {
 							if (pE->i->bridgePeer != 0) {
 								struct capi_pvt* bridgePeer = pE->i->bridgePeer;
-								if (bridgePeer->NCCI != 0 && bridgePeer->diva_stream_entry != 0 &&
-										bridgePeer->diva_stream_entry->diva_stream_state == DivaStreamActive &&
-										bridgePeer->diva_stream_entry->diva_stream->get_tx_in_use (bridgePeer->diva_stream_entry->diva_stream) < 512 &&
-										bridgePeer->diva_stream_entry->diva_stream->get_tx_free (bridgePeer->diva_stream_entry->diva_stream) >
-																																																2*CAPI_MAX_B3_BLOCK_SIZE+128) {
-									dword i = 0, k = 0, b3len;
-									byte b3buf[CAPI_MAX_B3_BLOCK_SIZE];
-									b3len = diva_streaming_read_vector_data(vind, vind_nr, &i, &k, b3buf, CAPI_MAX_B3_BLOCK_SIZE);
-									bridgePeer->diva_stream_entry->diva_stream->write (bridgePeer->diva_stream_entry->diva_stream,
-																																		 8U << 8 | DIVA_STREAM_MESSAGE_TX_IDI_REQUEST,
-																																		 b3buf, b3len);
-									bridgePeer->diva_stream_entry->diva_stream->flush_stream(bridgePeer->diva_stream_entry->diva_stream);
+								diva_stream_scheduling_entry_t* pPeerE = bridgePeer->diva_stream_entry;
+
+								if (pPeerE != 0) {
+									cc_mutex_lock(&pPeerE->lock);
+								}
+								if (bridgePeer->NCCI != 0 && pPeerE != 0 &&
+										pPeerE->diva_stream_state == DivaStreamActive &&
+										pPeerE->diva_stream->get_tx_in_use (pPeerE->diva_stream) < 512 &&
+										pPeerE->diva_stream->get_tx_free (pPeerE->diva_stream) > 2*CAPI_MAX_B3_BLOCK_SIZE+128) {
+									diva_streaming_vector_t vtx[sizeof(vind)/sizeof(vind[0])];
+									dword b3len = 0;
+									int vtx_nr;
+
+									/*
+										Gather the received data directly into the stream of the peer
+										*/
+									for (vtx_nr = 0; vtx_nr < vind_nr && b3len < CAPI_MAX_B3_BLOCK_SIZE; vtx_nr++) {
+										vtx[vtx_nr].data   = vind[vtx_nr].data;
+										vtx[vtx_nr].length = MIN(vind[vtx_nr].length, CAPI_MAX_B3_BLOCK_SIZE - b3len);
+										b3len += vtx[vtx_nr].length;
+									}
+									pPeerE->diva_stream->write_vector (pPeerE->diva_stream,
+																										 8U << 8 | DIVA_STREAM_MESSAGE_TX_IDI_REQUEST,
+																										 vtx, vtx_nr);
+									divaStreamingSchedule (pPeerE);
 								} else {
-									if (bridgePeer->NCCI != 0 && bridgePeer->diva_stream_entry != 0 &&
-										bridgePeer->diva_stream_entry->diva_stream_state == DivaStreamActive) {
+									if (bridgePeer->NCCI != 0 && pPeerE != 0 &&
+										pPeerE->diva_stream_state == DivaStreamActive) {
 										DBG_ERR(("%s PLCI %04x discarded bridge packet free: %u in use: %u",
 															pE->i->name, pE->i->PLCI & 0xffffU, 
-										bridgePeer->diva_stream_entry->diva_stream->get_tx_free (bridgePeer->diva_stream_entry->diva_stream),
-										bridgePeer->diva_stream_entry->diva_stream->get_tx_in_use (bridgePeer->diva_stream_entry->diva_stream)))
+										pPeerE->diva_stream->get_tx_free (pPeerE->diva_stream),
+										pPeerE->diva_stream->get_tx_in_use (pPeerE->diva_stream)))
 									}
 								}
+								if (pPeerE != 0) {
+									cc_mutex_unlock(&pPeerE->lock);
+								}
 							}
 						} else {
 							capidev_handle_data_b3_indication_vector (pE->i, vind, vind_nr);
@@ -137,8 +187,9 @@ static int divaStreamingMessageRx (void* user_context, dword message, dword leng
 				} else {
 					dword i = 0, k = 0;
 					word data_length;
-					byte ind_data_buffer[2048+512];
-					data_length = (word)diva_streaming_read_vector_data (vind, vind_nr, &i, &k, ind_data_buffer, sizeof(ind_data_buffer));
+
+					/* length only, data is not used */
+					data_length = (word)diva_streaming_read_vector_data (vind, vind_nr, &i, &k, 0, 2048+512);
 
 					DBG_TRC(("Ind: %02x length:%u", Ind, data_length))
 				}
@@ -191,6 +242,153 @@ static int divaStreamingMessageRx (void* user_context, dword message, dword leng
   return (0);
 }
 
+static diva_stream_scheduling_entry_t* divaStreamingEntryAlloc(void)
+{
+	diva_stream_scheduling_entry_t* pE = ast_malloc (sizeof(*pE));
+
+	if (pE != 0) {
+		memset (pE, 0x00, sizeof(*pE));
+		cc_mutex_init(&pE->lock);
+	}
+
+	return (pE);
+}
+
+/*
+ * Get stream entry from pool, called with stream_write_lock held.
+ * Writers of the previous call may still hold the entry, they find
+ * that the owner changed once they get the lock of the entry.
+ */
+static diva_stream_scheduling_entry_t* divaStreamingEntryGet(void)
+{
+	diva_entity_link_t* link = diva_q_get_head (&stream_entry_pool);
+	diva_stream_scheduling_entry_t* pE;
+
+	if (link != 0) {
+		diva_q_remove (&stream_entry_pool, link);
+		stream_entries_in_pool--;
+		pE = DIVAS_CONTAINING_RECORD(link, diva_stream_scheduling_entry_t, link);
+	} else {
+		pE = divaStreamingEntryAlloc ();
+	}
+
+	return (pE);
+}
+
+/*
+ * Return stream entry to pool, called with stream_write_lock held.
+ * Entries are freed only after the device thread was stopped.
+ */
+static void divaStreamingEntryPut(diva_stream_scheduling_entry_t* pE)
+{
+	cc_mutex_lock(&pE->lock);
+	pE->i = 0;
+	cc_mutex_unlock(&pE->lock);
+	diva_q_add_tail (&stream_entry_pool, &pE->link);
+	stream_entries_in_pool++;
+}
+
+/*
+ * Streams per controller pre-allocated at load time
+ */
+void capi_DivaStreamingSetPoolSize(int streams)
+{
+	stream_pool_size = streams;
+}
+
+int capi_DivaStreamingGetPoolSize(int nbchannels)
+{
+	return ((stream_pool_size < 0) ? nbchannels : stream_pool_size);
+}
+
+/*
+ * Create the segment alloc used by all streams and map the segments
+ * for 'streams' streams, so stream setup does not need to access the driver
+ */
+void capi_DivaStreamingPoolInit(unsigned int streams)
+{
+	diva_segment_alloc_access_t* segment_access;
+	struct {
+		void* addr;
+		dword lo;
+		dword hi;
+	} *segments = 0;
+	unsigned int n, nr_segments = 0;
+
+	if (diva_streaming_disabled)
+		return;
+
+	cc_mutex_lock(&stream_write_lock);
+
+	if (stream_segment_alloc == 0) {
+		if (diva_create_segment_alloc (NULL, &stream_segment_alloc) != 0) {
+			stream_segment_alloc = 0;
+			cc_mutex_unlock(&stream_write_lock);
+			cc_log(LOG_WARNING, "Diva streaming: failed to create segment pool\n");
+			return;
+		}
+	}
+	segment_access = diva_get_segment_alloc_ifc (stream_segment_alloc);
+
+	if ((streams != 0) &&
+			((segments = ast_malloc (streams * DIVA_STREAM_POOL_SEGMENTS * sizeof(*segments))) != 0)) {
+		for (nr_segments = 0; nr_segments < streams * DIVA_STREAM_POOL_SEGMENTS; nr_segments++) {
+			segments[nr_segments].addr = segment_access->segment_alloc (stream_segment_alloc,
+																																	&segments[nr_segments].lo,
+																																	&segments[nr_segments].hi);
+			if (segments[nr_segments].addr == 0)
+				break;
+		}
+		for (n = 0; n < nr_segments; n++) {
+			segment_access->segment_free (stream_segment_alloc, segments[n].addr, segments[n].lo, segments[n].hi);
+		}
+		ast_free (segments);
+	}
+
+	while (stream_entries_in_pool < streams) {
+		diva_stream_scheduling_entry_t* pE = divaStreamingEntryAlloc ();
+
+		if (pE == 0)
+			break;
+		divaStreamingEntryPut (pE);
+	}
+
+	cc_mutex_unlock(&stream_write_lock);
+
+	cc_verbose(3, 0, VERBOSE_PREFIX_3 "Diva streaming: %u segments for %u streams mapped\n",
+		nr_segments, nr_segments / DIVA_STREAM_POOL_SEGMENTS);
+}
+
+/*
+ * Release stream pool, called after the device thread was stopped
+ */
+void capi_DivaStreamingPoolCleanup(void)
+{
+	diva_entity_link_t* link;
+
+	cc_mutex_lock(&stream_write_lock);
+
+	while ((link = diva_q_get_head (&stream_entry_pool)) != 0) {
+		diva_stream_scheduling_entry_t* pE = DIVAS_CONTAINING_RECORD(link, diva_stream_scheduling_entry_t, link);
+
+		diva_q_remove (&stream_entry_pool, link);
+		cc_mutex_destroy(&pE->lock);
+		ast_free (pE);
+	}
+	stream_entries_in_pool = 0;
+
+	if (stream_segment_alloc != 0) {
+		if (streams_in_use == 0) {
+			diva_get_segment_alloc_ifc (stream_segment_alloc)->release (&stream_segment_alloc);
+			stream_segment_alloc = 0;
+		} else {
+			cc_log(LOG_WARNING, "Diva streaming: %u streams still in use\n", streams_in_use);
+		}
+	}
+
+	cc_mutex_unlock(&stream_write_lock);
+}
+
 /*
  * Create Diva stream
  *
@@ -205,16 +403,22 @@ void capi_DivaStreamingOn(struct capi_pvt *i, byte streamCommand, _cword message
 	if (diva_streaming_disabled)
 		return;
 
-	pE = ast_malloc (sizeof(*pE));
-	if (pE == 0)
-		return;
-
 	snprintf (trace_ident, sizeof(trace_ident), "C%02x", (byte)i->PLCI);
 	trace_ident[sizeof(trace_ident)-1] = 0;
 
 	cc_mutex_lock(&stream_write_lock);
 
-	ret = diva_stream_create (&pE->diva_stream, NULL, 255, divaStreamingMessageRx, pE, trace_ident);
+	pE = divaStreamingEntryGet ();
+	if (pE == 0) {
+		cc_mutex_unlock(&stream_write_lock);
+		return;
+	}
+
+	/*
+		Without segment pool stream uses own segment alloc
+		*/
+	ret = diva_stream_create_with_user_segment_alloc (&pE->diva_stream, NULL, 255,
+																										divaStreamingMessageRx, pE, trace_ident, stream_segment_alloc);
 
 	if (ret == 0) {
 		static byte addie[] = { 0x2d /* UID */, 0x01, 0x00, 0x04 /* BC */, 0x04, 0x0, 0x0, 0x0, 0x00 /* 0x20 DMA polling */, 0 /* END */};
@@ -239,19 +443,24 @@ void capi_DivaStreamingOn(struct capi_pvt *i, byte streamCommand, _cword message
 		error = capi_sendf (NULL, 0, CAPI_MANUFACTURER_REQ, effectivePLCI, messageNumber,
 												"dws", _DI_MANU_ID, _DI_STREAM_CTRL, description);
 		if (error == 0) {
+			cc_mutex_lock(&pE->lock);
 			pE->diva_stream_state = DivaStreamCreated;
 			pE->PLCI              = i->PLCI;
 			pE->i                 = i;
-			i->diva_stream_entry  = pE;
+			cc_mutex_unlock(&pE->lock);
+			cc_atomic_store(&i->diva_stream_entry, pE);
 			memcpy (pE->vname, i->vname, MIN(sizeof(pE->vname), sizeof(i->vname)));
 			pE->vname[sizeof(pE->vname)-1] = 0;
 			pE->rx_flow_control = 0;
 			pE->tx_flow_control = 0;
 			diva_q_add_tail (&diva_streaming_new, &pE->link);
+			streams_in_use++;
 		} else {
 			pE->diva_stream->release (pE->diva_stream);
-			ast_free (pE);
+			divaStreamingEntryPut (pE);
 		}
+	} else {
+		divaStreamingEntryPut (pE);
 	}
 
 	cc_mutex_unlock(&stream_write_lock);
@@ -315,7 +524,8 @@ void capi_DivaStreamingRemove(struct capi_pvt *i)
 	cc_mutex_lock(&stream_write_lock);
 	pE = i->diva_stream_entry;
 	if (pE != 0) {
-		i->diva_stream_entry = 0;
+		cc_atomic_store(&i->diva_stream_entry, NULL);
+		cc_mutex_lock(&pE->lock);
 		pE->i = 0;
 		if (pE->diva_stream_state == DivaStreamCreated) {
 
@@ -332,11 +542,16 @@ void capi_DivaStreamingRemove(struct capi_pvt *i)
 			}
 			pE->diva_stream_state = DivaStreamCancelSent;
 			pE->cancel_start = time(NULL) + 5;
+			if (pE->cancel_queued == 0) {
+				diva_q_add_tail (&diva_streaming_cancelled, &pE->cancel_link);
+				pE->cancel_queued = 1;
+			}
 			DBG_LOG(("stream cancelled [%p]", pE->diva_stream))
 		} else if (pE->diva_stream_state == DivaStreamActive) {
 			pE->diva_stream->release_stream(pE->diva_stream);
 			pE->diva_stream_state = DivaStreamDisconnectSent;
 		}
+		cc_mutex_unlock(&pE->lock);
 	}
 	cc_mutex_unlock(&stream_write_lock);
 
@@ -347,22 +562,53 @@ void capi_DivaStreamingRemove(struct capi_pvt *i)
 		error = capi_sendf(NULL, 0, CAPI_DATA_B3_REQ, i->NCCI, get_capi_MessageNumber(),
 											"dwww", data, sizeof(data), 0, 1U << 4);
 		if (likely(error == 0)) {
-			cc_mutex_lock(&i->lock);
-			i->B3count++;
-			cc_mutex_unlock(&i->lock);
+			cc_atomic_add(&i->B3count, 1);
 		}
 	}
 }
 
 /*
-	This is only one used to access streaming scheduling list routine.
-	This ensures list can be accessed w/o anly locks
+ * Queue stream for flush by the device thread, called with lock of the entry held
+ */
+static void divaStreamingSchedule(diva_stream_scheduling_entry_t* pE)
+{
+	cc_mutex_lock(&stream_ready_lock);
+	if (pE->flush_pending == 0) {
+		pE->flush_pending = 1;
+		diva_q_add_tail (&diva_streaming_ready, &pE->ready_link);
+	}
+	cc_mutex_unlock(&stream_ready_lock);
+}
 
-	To ensure exclusive access scheduling queue is static function variable
+/*
+ * Move stream without diva_stream to retired streams, called by device thread
+ * with stream_write_lock and lock of the entry held
+ */
+static void divaStreamingRetire(diva_stream_scheduling_entry_t* pE, time_t current_time)
+{
+	diva_q_remove (&active_streams, &pE->link);
+	if (pE->cancel_queued != 0) {
+		diva_q_remove (&diva_streaming_cancelled, &pE->cancel_link);
+		pE->cancel_queued = 0;
+	}
+	if (pE->i != 0) {
+		cc_atomic_store(&pE->i->diva_stream_entry, NULL);
+		pE->i = 0;
+	}
+	pE->retire_time = current_time + DIVA_STREAM_RETIRE_TIME;
+	diva_q_add_tail (&retired_streams, &pE->link);
+	streams_in_use--;
+}
+
+/*
+	This is only one used to access streaming scheduling list routine.
+	Called by the device thread after every loop, services only streams
+	where the remote side wrote to the rx ring or data was written to
+	the tx ring.
 	*/
 void divaStreamingWakeup (void)
 {
-	static diva_entity_queue_t active_streams;
+	static time_t cancel_check_time;
 	diva_entity_link_t* link;
 	time_t current_time = time (NULL);
 
@@ -372,45 +618,137 @@ void divaStreamingWakeup (void)
 		diva_q_remove (&diva_streaming_new, &pE->link);
 		diva_q_add_tail (&active_streams, &pE->link);
 	}
-	cc_mutex_unlock(&stream_write_lock);
 
+	/*
+		The adapter does not notify the host about updates of the rx ring,
+		compare rx counter w/o lock, diva_stream is changed by device thread only
+		*/
 	for (link = diva_q_get_head (&active_streams); likely(link != 0);) {
 		diva_entity_link_t* next = diva_q_get_next(link);
 		diva_stream_scheduling_entry_t* pE = DIVAS_CONTAINING_RECORD(link, diva_stream_scheduling_entry_t, link);
 
-		cc_mutex_lock(&stream_write_lock);
-		pE->diva_stream->wakeup (pE->diva_stream);
-		if (unlikely(pE->diva_stream_state == DivaStreamCancelSent && pE->cancel_start < current_time)) {
-			DBG_LOG(("stream reclaimed [%p]", pE->diva_stream))
-			pE->diva_stream->release (pE->diva_stream);
-			pE->diva_stream_state = DivaStreamDisconnected;
-			pE->diva_stream = 0;
+		if (unlikely(pE->diva_stream->rx_pending (pE->diva_stream) != 0)) {
+			cc_mutex_lock(&pE->lock);
+			pE->diva_stream->wakeup (pE->diva_stream);
+			if (unlikely(pE->diva_stream == 0)) {
+				divaStreamingRetire (pE, current_time);
+			}
+			cc_mutex_unlock(&pE->lock);
 		}
 
-		if (unlikely(pE->diva_stream == 0)) {
-			diva_q_remove (&active_streams, &pE->link);
-			if (pE->i != 0) {
-				pE->i->diva_stream_entry = 0;
+		link = next;
+	}
+
+	/*
+		Reclaim streams where create request was cancelled
+		and remote side did not respond
+		*/
+	if (unlikely(cancel_check_time != current_time)) {
+		cancel_check_time = current_time;
+
+		for (link = diva_q_get_head (&diva_streaming_cancelled); link != 0;) {
+			diva_entity_link_t* next = diva_q_get_next(link);
+			diva_stream_scheduling_entry_t* pE = DIVAS_CONTAINING_RECORD(link, diva_stream_scheduling_entry_t, cancel_link);
+
+			cc_mutex_lock(&pE->lock);
+			if (pE->diva_stream_state != DivaStreamCancelSent) {
+				diva_q_remove (&diva_streaming_cancelled, &pE->cancel_link);
+				pE->cancel_queued = 0;
+			} else if (pE->cancel_start < current_time) {
+				DBG_LOG(("stream reclaimed [%p]", pE->diva_stream))
+				pE->diva_stream->release (pE->diva_stream);
+				pE->diva_stream_state = DivaStreamDisconnected;
+				pE->diva_stream = 0;
+				divaStreamingRetire (pE, current_time);
 			}
-			ast_free (pE);
+			cc_mutex_unlock(&pE->lock);
+
+			link = next;
 		}
-		cc_mutex_unlock(&stream_write_lock);
+	}
 
-		link = next;
+	while ((link = diva_q_get_head (&retired_streams)) != 0) {
+		diva_stream_scheduling_entry_t* pE = DIVAS_CONTAINING_RECORD(link, diva_stream_scheduling_entry_t, link);
+
+		if (pE->retire_time > current_time)
+			break;
+		diva_q_remove (&retired_streams, &pE->link);
+		divaStreamingEntryPut (pE);
+	}
+	cc_mutex_unlock(&stream_write_lock);
+
+	/*
+		One update of the remote side for all data written
+		to the stream since the last wakeup
+		*/
+	for (;;) {
+		diva_stream_scheduling_entry_t* pE;
+
+		cc_mutex_lock(&stream_ready_lock);
+		if ((link = diva_q_get_head (&diva_streaming_ready)) != 0) {
+			diva_q_remove (&diva_streaming_ready, link);
+		}
+		cc_mutex_unlock(&stream_ready_lock);
+		if (link == 0)
+			break;
+
+		pE = DIVAS_CONTAINING_RECORD(link, diva_stream_scheduling_entry_t, ready_link);
+		cc_mutex_lock(&pE->lock);
+		cc_mutex_lock(&stream_ready_lock);
+		pE->flush_pending = 0;
+		cc_mutex_unlock(&stream_ready_lock);
+		if (pE->diva_stream != 0) {
+			pE->diva_stream->flush_stream(pE->diva_stream);
+		}
+		cc_mutex_unlock(&pE->lock);
 	}
 }
 
+/*
+ * Write data to the stream of the interface, sent to the adapter
+ * by the next wakeup. Returns -1 if the interface has no stream.
+ * The entry is loaded without stream_write_lock, it may have been
+ * removed from the interface and given to another call meanwhile,
+ * so the owner is checked with the lock of the entry held.
+ */
+int capi_DivaStreamingWrite(struct capi_pvt* i, const void* data, int length, int* ready)
+{
+	diva_stream_scheduling_entry_t* pE = cc_atomic_load(&i->diva_stream_entry);
+	int written = 0;
+
+	if (pE == 0)
+		return (-1);
+
+	cc_mutex_lock(&pE->lock);
+	if (unlikely(pE->i != i)) {
+		cc_mutex_unlock(&pE->lock);
+		return (-1);
+	}
+	*ready = (pE->diva_stream_state == DivaStreamActive);
+	if ((*ready != 0) &&
+			(pE->diva_stream->get_tx_free (pE->diva_stream) > 2*CAPI_MAX_B3_BLOCK_SIZE+128)) {
+		written = pE->diva_stream->write (pE->diva_stream, 8U << 8 | DIVA_STREAM_MESSAGE_TX_IDI_REQUEST, data, length);
+		divaStreamingSchedule (pE);
+	}
+	cc_mutex_unlock(&pE->lock);
+
+	return (written);
+}
+
 unsigned int capi_DivaStreamingGetStreamInUse(const struct capi_pvt* i)
 {
+	diva_stream_scheduling_entry_t* pE;
 	unsigned int ret = 0;
 
-	capi_DivaStreamLock();
-	if ((i != NULL) && (i->diva_stream_entry != NULL) &&
-			(i->diva_stream_entry->diva_stream_state == DivaStreamActive) &&
-			(i->diva_stream_entry->diva_stream != NULL)) {
-		ret = i->diva_stream_entry->diva_stream->get_tx_in_use (i->diva_stream_entry->diva_stream);
+	if ((i == NULL) || ((pE = cc_atomic_load(&i->diva_stream_entry)) == NULL))
+		return (0);
+
+	cc_mutex_lock(&pE->lock);
+	if ((pE->i == i) &&
+			(pE->diva_stream_state == DivaStreamActive) && (pE->diva_stream != NULL)) {
+		ret = pE->diva_stream->get_tx_in_use (pE->diva_stream);
 	}
-	capi_DivaStreamUnLock();
+	cc_mutex_unlock(&pE->lock);
 
 	return (ret);
 }
@@ -429,3 +767,158 @@ void capi_DivaStreamingDisable (void) {
 	diva_streaming_disabled = 1;
 }
 
+/*
+ * Software loopback load test
+ */
+typedef struct _diva_stream_loopback_test {
+	diva_stream_t* diva_stream;
+	struct _diva_streaming_loopback* loopback;
+	int active;
+	unsigned int rx_frames;
+	unsigned int rx_errors;
+	unsigned char tx_pattern;
+	unsigned char rx_pattern;
+} diva_stream_loopback_test_t;
+
+static int divaStreamingLoopbackRx(void* user_context, dword message, dword length, const diva_streaming_vector_t* v, dword nr_v)
+{
+	diva_stream_loopback_test_t* pT = (diva_stream_loopback_test_t*)user_context;
+
+	if ((message & 0xff) == 0xff) {
+		switch ((byte)(message >> 8)) {
+			case DIVA_STREAM_MESSAGE_INIT:
+				pT->active = 1;
+				break;
+			case DIVA_STREAM_MESSAGE_RELEASE_ACK:
+			case DIVA_STREAM_MESSAGE_INIT_ERROR:
+				pT->diva_stream = 0;
+				break;
+		}
+	} else {
+		dword i, k;
+
+		for (i = 0; i < nr_v; i++) {
+			const byte* data = v[i].data;
+
+			for (k = 0; k < v[i].length; k++) {
+				if (data[k] != pT->rx_pattern++)
+					pT->rx_errors++;
+			}
+		}
+		pT->rx_frames++;
+	}
+
+	return (0);
+}
+
+/*
+ * Run 'streams' streams against the software loopback emulation of the
+ * adapter and send 'frames' voice frames on every stream. Every frame
+ * is looped back and verified. Reports the cost per frame.
+ */
+void capi_DivaStreamingLoopbackTest(int fd, int streams, int frames)
+{
+	struct _diva_segment_alloc* segment_alloc = 0;
+	diva_stream_loopback_test_t* tests;
+	diva_streaming_loopback_stat_t stat;
+	unsigned long long tx_frames = 0, rx_frames = 0, rx_errors = 0, dropped = 0, ns;
+	struct timespec start, end;
+	byte frame[CAPI_MAX_B3_BLOCK_SIZE];
+	int n, f, created = 0;
+
+	tests = ast_malloc(streams * sizeof(*tests));
+	if (tests == NULL) {
+		return;
+	}
+	memset(tests, 0, streams * sizeof(*tests));
+
+	if (diva_create_memory_segment_alloc(&segment_alloc) != 0) {
+		ast_cli(fd, "failed to create memory segment alloc\n");
+		ast_free(tests);
+		return;
+	}
+
+	for (n = 0; n < streams; n++, created++) {
+		diva_stream_loopback_test_t* pT = &tests[n];
+		char trace_ident[16];
+
+		snprintf(trace_ident, sizeof(trace_ident), "L%03d", n);
+		if (diva_stream_create_with_user_segment_alloc(&pT->diva_stream, NULL, 255,
+				divaStreamingLoopbackRx, pT, trace_ident, segment_alloc) != 0) {
+			break;
+		}
+		if (diva_streaming_loopback_create(&pT->loopback, segment_alloc,
+				pT->diva_stream->description(pT->diva_stream, 0, 0)) != 0) {
+			pT->diva_stream->release(pT->diva_stream);
+			pT->diva_stream = 0;
+			break;
+		}
+		pT->diva_stream->wakeup(pT->diva_stream);
+	}
+	if (created != streams) {
+		ast_cli(fd, "failed to create stream %d\n", created);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (f = 0; f < frames; f++) {
+		for (n = 0; n < created; n++) {
+			diva_stream_loopback_test_t* pT = &tests[n];
+			int k;
+
+			if ((pT->active == 0) ||
+					(pT->diva_stream->get_tx_free(pT->diva_stream) <= 2*CAPI_MAX_B3_BLOCK_SIZE+128)) {
+				continue;
+			}
+			for (k = 0; k < CAPI_MAX_B3_BLOCK_SIZE; k++) {
+				frame[k] = pT->tx_pattern++;
+			}
+			if (pT->diva_stream->write(pT->diva_stream, 8U << 8 | DIVA_STREAM_MESSAGE_TX_IDI_REQUEST,
+					frame, sizeof(frame)) == sizeof(frame)) {
+				tx_frames++;
+			} else {
+				pT->tx_pattern -= sizeof(frame);
+			}
+			pT->diva_stream->flush_stream(pT->diva_stream);
+		}
+		for (n = 0; n < created; n++) {
+			diva_streaming_loopback_process(tests[n].loopback);
+		}
+		for (n = 0; n < created; n++) {
+			if (tests[n].diva_stream != 0) {
+				tests[n].diva_stream->wakeup(tests[n].diva_stream);
+			}
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (unsigned long long)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+		end.tv_nsec - start.tv_nsec;
+
+	for (n = 0; n < created; n++) {
+		diva_stream_loopback_test_t* pT = &tests[n];
+
+		rx_frames += pT->rx_frames;
+		rx_errors += pT->rx_errors;
+		diva_streaming_loopback_get_stat(pT->loopback, &stat);
+		dropped += stat.rx_dropped;
+
+		if (pT->diva_stream != 0) {
+			pT->diva_stream->release_stream(pT->diva_stream);
+			diva_streaming_loopback_process(pT->loopback);
+			pT->diva_stream->wakeup(pT->diva_stream);
+			if (pT->diva_stream != 0) {
+				pT->diva_stream->release(pT->diva_stream);
+			}
+		}
+		diva_streaming_loopback_destroy(pT->loopback);
+	}
+
+	diva_get_segment_alloc_ifc(segment_alloc)->release(&segment_alloc);
+	ast_free(tests);
+
+	ast_cli(fd, "%d streams, %llu frames sent, %llu frames received, %llu errors, %llu dropped\n",
+		created, tx_frames, rx_frames, rx_errors, dropped);
+	ast_cli(fd, "%llu ms, %llu ns per frame\n", ns / 1000000ULL,
+		(tx_frames != 0) ? (ns / tx_frames) : 0);
+}
@@ -8,9 +8,15 @@ extern void capi_DivaStreamingRemoveInfo(struct capi_pvt *i);
 extern void capi_DivaStreamingRemove(struct capi_pvt *i);
 extern void divaStreamingWakeup(void);
 extern unsigned int capi_DivaStreamingGetStreamInUse(const struct capi_pvt* i);
+extern int capi_DivaStreamingWrite(struct capi_pvt* i, const void* data, int length, int* ready);
 extern void capi_DivaStreamLock(void);
 extern void capi_DivaStreamUnLock (void);
 extern void capi_DivaStreamingDisable (void);
+extern void capi_DivaStreamingSetPoolSize(int streams);
+extern int capi_DivaStreamingGetPoolSize(int nbchannels);
+extern void capi_DivaStreamingPoolInit(unsigned int streams);
+extern void capi_DivaStreamingPoolCleanup(void);
+extern void capi_DivaStreamingLoopbackTest(int fd, int streams, int frames);
 
 typedef enum _diva_stream_state {
   DivaStreamCreated        = 0,
@@ -24,13 +30,31 @@ typedef struct _diva_stream_scheduling_entry {
 	diva_entity_link_t  link;
 	struct _diva_stream *diva_stream;
 	diva_stream_state_t diva_stream_state;
-	struct capi_pvt      *i;
+	struct capi_pvt      *i; /* owner, changed with lock held */
 	int									rx_flow_control;
 	int									tx_flow_control;
 	char vname[CAPI_MAX_STRING]; /* Cached from capi_pvt */
 	dword               PLCI; /* Cached from capi_pvt */
 	time_t              cancel_start;
+	ast_mutex_t         lock; /* protects stream access */
+	int                 flush_pending; /* queued for flush, protected by stream_ready_lock */
+	time_t              retire_time;
+	diva_entity_link_t  ready_link; /* data written since last flush */
+	diva_entity_link_t  cancel_link; /* create request cancelled */
+	int                 cancel_queued;
 } diva_stream_scheduling_entry_t;
 
+/*
+	Removed entries are released after this time (seconds). Writers
+	which found the entry before removal may still lock it, they
+	check the owner of the entry with the lock held.
+	*/
+#define DIVA_STREAM_RETIRE_TIME 2
+
+/*
+	Segments used by one stream (one tx and one rx segment)
+	*/
+#define DIVA_STREAM_POOL_SEGMENTS 2
+
 #endif
 
@@ -40,6 +40,7 @@ typedef struct _diva_segment_alloc_access {
 } diva_segment_alloc_access_t;
 
 int diva_create_segment_alloc  (void* os_context, struct _diva_segment_alloc** segment_alloc);
+int diva_create_memory_segment_alloc (struct _diva_segment_alloc** segment_alloc);
 int diva_destroy_segment_alloc (struct _diva_segment_alloc** segment_alloc);
 diva_segment_alloc_access_t* diva_get_segment_alloc_ifc (struct _diva_segment_alloc* segment_alloc);
 
@@ -34,6 +34,7 @@ struct _diva_streaming_idi_host_ifc_w;
 struct _diva_streaming_idi_host_ifc_w_access;
 struct _diva_streaming_idi_host_ifc_r;
 struct _diva_streaming_idi_host_ifc_r_access;
+struct _diva_streaming_vector;
 
 
 typedef struct _diva_streaming_idi_host_ifc_w_access {
@@ -41,6 +42,8 @@ typedef struct _diva_streaming_idi_host_ifc_w_access {
 	diva_streaming_idi_result_t (*release_stream)(struct _diva_streaming_idi_host_ifc_w* ifc);
 	int (*write_message)(struct _diva_streaming_idi_host_ifc_w* ifc,
 											 dword info, const void* data, dword data_length);
+	int (*write_message_vector)(struct _diva_streaming_idi_host_ifc_w* ifc,
+											 dword info, const struct _diva_streaming_vector* v, dword nr_v);
 	int (*ack)(struct _diva_streaming_idi_host_ifc_w* ifc, dword length);
 	int (*ack_rx)(struct _diva_streaming_idi_host_ifc_w* ifc, dword length, int flush_ack);
 	int (*write)(struct _diva_streaming_idi_host_ifc_w* ifc, const void* data, dword data_length);
@@ -66,6 +69,7 @@ typedef struct _diva_streaming_idi_host_ifc_r_access {
 	int (*release)(struct _diva_streaming_idi_host_ifc_r* ifc);
 	int (*wakeup)(struct _diva_streaming_idi_host_ifc_r* ifc);
 	byte (*description)(struct _diva_streaming_idi_host_ifc_r* ifc, byte* dst, byte max_length);
+	int (*pending)(const struct _diva_streaming_idi_host_ifc_r* ifc);
 } diva_streaming_idi_host_ifc_r_access_t;
 
 int diva_streaming_idi_host_rx_ifc_create (struct _diva_streaming_idi_host_ifc_r** ifc,
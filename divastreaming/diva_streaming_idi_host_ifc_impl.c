@@ -42,6 +42,10 @@ static int write_message (struct _diva_streaming_idi_host_ifc_w* ifc,
 													dword info,
 													const void* data,
 													dword data_length);
+static int write_message_vector (struct _diva_streaming_idi_host_ifc_w* ifc,
+																 dword info,
+																 const diva_streaming_vector_t* v,
+																 dword nr_v);
 static byte description (diva_streaming_idi_host_ifc_w_t* ifc, byte* dst, byte max_length);
 static int init (struct _diva_streaming_idi_host_ifc_w* ifc, dword version, dword counter, dword info);
 static diva_streaming_idi_result_t sync_req (struct _diva_streaming_idi_host_ifc_w* ifc, dword ident);
@@ -123,6 +127,7 @@ int diva_streaming_idi_host_ifc_create (struct _diva_streaming_idi_host_ifc_w**
 	ifc_w->access.release = diva_streaming_idi_host_ifc_cleanup;
 	ifc_w->access.release_stream = release_stream;
 	ifc_w->access.write_message = write_message;
+	ifc_w->access.write_message_vector = write_message_vector;
 	ifc_w->access.ack = ack_data;
 	ifc_w->access.ack_rx = ack_rx_data;
 	ifc_w->access.write = write_data;
@@ -220,11 +225,34 @@ static int write_message (struct _diva_streaming_idi_host_ifc_w* ifc,
 													dword info,
 													const void* data,
 													dword data_length) {
+	diva_streaming_vector_t v;
+
+	v.data   = data;
+	v.length = data_length;
+
+	return (write_message_vector (ifc, info, &v, data_length != 0 ? 1 : 0));
+}
+
+/*
+	Write message with data gathered from vector, data is copied
+	directly to the stream segments
+	*/
+static int write_message_vector (struct _diva_streaming_idi_host_ifc_w* ifc,
+																 dword info,
+																 const diva_streaming_vector_t* v,
+																 dword nr_v) {
+	dword data_length = 0;
 	dword idi_header_length = ((info & 0xff) == DIVA_STREAM_MESSAGE_TX_IDI_REQUEST && (info & DIVA_STREAMING_IDI_SYSTEM_MESSAGE) == 0) ? (sizeof(diva_spi_msg_hdr_t)+1) : 0;
-	dword length = data_length + idi_header_length + 2 * sizeof(dword); /* data length + message length + info */
-	dword required_length = (length + 31) & ~31;
+	dword length, required_length;
 	byte tmp[sizeof(dword)+1];
 	byte Req = 0;
+	dword n;
+
+	for (n = 0; n < nr_v; n++) {
+		data_length += v[n].length;
+	}
+	length = data_length + idi_header_length + 2 * sizeof(dword); /* data length + message length + info */
+	required_length = (length + 31) & ~31;
 
 	if (required_length > get_free (ifc)) {
 		return (0);
@@ -261,7 +289,9 @@ static int write_message (struct _diva_streaming_idi_host_ifc_w* ifc,
 		write_buffer (ifc, hdr, idi_header_length);
 	}
 
-	write_buffer (ifc, data, data_length); /* Write data */
+	for (n = 0; n < nr_v; n++) {
+		write_buffer (ifc, v[n].data, v[n].length); /* Write data */
+	}
 
 	align_write_buffer (ifc, required_length - length); /* Move to next message */
 
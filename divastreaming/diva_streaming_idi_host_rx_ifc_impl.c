@@ -49,6 +49,7 @@ static int diva_streaming_idi_host_rx_process_message (struct _diva_streaming_id
 																											 const diva_streaming_vector_t* v, dword nr_v);
 static byte description (diva_streaming_idi_host_ifc_r_t* ifc, byte* dst, byte max_length);
 static int diva_streaming_idi_host_rx_ifc_rx (struct _diva_streaming_idi_host_ifc_r* ifc);
+static int diva_streaming_idi_host_rx_ifc_pending (const struct _diva_streaming_idi_host_ifc_r* ifc);
 static int diva_streaming_idi_host_rx_ifc_cleanup (struct _diva_streaming_idi_host_ifc_r* ifc);
 
 int diva_streaming_idi_host_rx_ifc_create (struct _diva_streaming_idi_host_ifc_r** ifc,
@@ -122,6 +123,7 @@ int diva_streaming_idi_host_rx_ifc_create (struct _diva_streaming_idi_host_ifc_r
 	ifc_r->access.release     = diva_streaming_idi_host_rx_ifc_cleanup;
 	ifc_r->access.wakeup      = diva_streaming_idi_host_rx_ifc_rx;
 	ifc_r->access.description = description;
+	ifc_r->access.pending     = diva_streaming_idi_host_rx_ifc_pending;
 
 	*ifc = ifc_r;
 
@@ -186,6 +188,13 @@ static int diva_streaming_idi_host_rx_ifc_rx (struct _diva_streaming_idi_host_if
 	return (ret);
 }
 
+/*
+ * Remote side wrote data since last wakeup
+ */
+static int diva_streaming_idi_host_rx_ifc_pending (const struct _diva_streaming_idi_host_ifc_r* ifc) {
+	return (ifc->remote_counter[0] != ifc->local_counter);
+}
+
 static void update_buffer (struct _diva_streaming_idi_host_ifc_r* ifc) {
 	if (ifc->current_free == 0) {
 		ifc->current_segment++;
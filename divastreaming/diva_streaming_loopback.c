@@ -0,0 +1,343 @@
+/*
+ *
+  Software loopback emulation of the remote side of a Diva stream
+
+ *
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+ *
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY OF ANY KIND WHATSOEVER INCLUDING ANY
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+ *
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+/*
+	The emulation takes the role of the adapter: it reads the messages
+	written by the host to the tx ring, answers system messages, loops
+	data requests back as data indications to the host rx ring and
+	acknowledges consumed tx data. It works on any segment alloc which
+	is able to map the segment addresses, this allows to exercise the
+	streaming transport without hardware.
+	*/
+#include "platform.h"
+#include "pc.h"
+#include "diva_streaming_result.h"
+#include "diva_streaming_vector.h"
+#include "diva_streaming_messages.h"
+#include "diva_streaming_manager.h"
+#include "diva_segment_alloc_ifc.h"
+#include "spi_descriptor.h"
+#include "diva_streaming_loopback.h"
+
+#define DIVA_STREAMING_LOOPBACK_MAX_SEGMENTS 8
+#define DIVA_STREAMING_LOOPBACK_VERSION      1
+#define DIVA_STREAMING_LOOPBACK_MAX_DATA     (2048+512)
+
+typedef struct _diva_streaming_loopback_ring {
+	byte* segments[DIVA_STREAMING_LOOPBACK_MAX_SEGMENTS];
+	dword segment_length[DIVA_STREAMING_LOOPBACK_MAX_SEGMENTS];
+	dword nr_segments;
+	dword segment;  /**< current segment */
+	dword position; /**< position in current segment */
+	dword length;   /**< overall length of all segments */
+} diva_streaming_loopback_ring_t;
+
+typedef struct _diva_streaming_loopback {
+	diva_streaming_loopback_ring_t tx; /**< written by host */
+	diva_streaming_loopback_ring_t rx; /**< read by host */
+
+	volatile int32* tx_counter; /**< updated by host, located at end of first tx segment */
+	volatile int32* rx_counter; /**< updated by remote, located at begin of first rx segment */
+	int32 tx_consumed;
+	int32 rx_written;
+	dword rx_in_use;  /**< written to rx ring and not acknowledged by host */
+	dword tx_ack;     /**< consumed tx data not acknowledged to host */
+	byte  tx_ack_sequence;
+	int   released;
+
+	diva_streaming_loopback_stat_t stat;
+
+	byte data[DIVA_STREAMING_LOOPBACK_MAX_DATA];
+} diva_streaming_loopback_t;
+
+/*
+ * LOCALS
+ */
+static void ring_advance (diva_streaming_loopback_ring_t* ring, dword length);
+static void ring_read (diva_streaming_loopback_ring_t* ring, byte* dst, dword length);
+static void ring_write (diva_streaming_loopback_ring_t* ring, const byte* src, dword length);
+static int rx_message (diva_streaming_loopback_t* pI, byte Id, byte Ind, const byte* data, dword data_length);
+static void rx_ack (diva_streaming_loopback_t* pI, dword length);
+static void tx_acknowledge (diva_streaming_loopback_t* pI);
+
+int diva_streaming_loopback_create (struct _diva_streaming_loopback** loopback,
+																		struct _diva_segment_alloc* segment_alloc,
+																		const byte* description) {
+	diva_segment_alloc_access_t* segment_access = diva_get_segment_alloc_ifc (segment_alloc);
+	diva_streaming_loopback_t* pI;
+	const byte* tx_description = &description[4];
+	dword nr_segments = tx_description[0];
+	byte init[9];
+	dword i;
+
+	if (nr_segments == 0 || nr_segments > DIVA_STREAMING_LOOPBACK_MAX_SEGMENTS) {
+		DBG_ERR(("loopback: wrong number of segments %u", nr_segments))
+		return (-1);
+	}
+
+	pI = diva_os_malloc (0, sizeof(*pI));
+	if (pI == 0)
+		return (-1);
+
+	memset (pI, 0x00, sizeof(*pI));
+
+	/*
+		Tx description: number of segments, lo, hi, length of every segment.
+		Rx description follows: lo, hi of every segment.
+		*/
+	pI->tx.nr_segments = nr_segments;
+	pI->rx.nr_segments = nr_segments;
+
+	for (i = 0; i < nr_segments; i++) {
+		dword tx_lo     = READ_DWORD(&tx_description[1 + i*sizeof(dword)]);
+		dword tx_hi     = READ_DWORD(&tx_description[1 + (nr_segments + i)*sizeof(dword)]);
+		dword tx_length = READ_DWORD(&tx_description[1 + (2*nr_segments + i)*sizeof(dword)]);
+		dword rx_lo     = READ_DWORD(&tx_description[1 + (3*nr_segments + i)*sizeof(dword)]);
+		dword rx_hi     = READ_DWORD(&tx_description[1 + (4*nr_segments + i)*sizeof(dword)]);
+
+		pI->tx.segments[i] = segment_access->map_address (segment_alloc, tx_lo, tx_hi, 1);
+		pI->tx.segment_length[i] = tx_length;
+		pI->rx.segments[i] = segment_access->map_address (segment_alloc, rx_lo, rx_hi, 1);
+		pI->rx.segment_length[i] = segment_access->get_segment_length (segment_alloc);
+
+		if (pI->tx.segments[i] == 0 || pI->rx.segments[i] == 0) {
+			DBG_ERR(("loopback: failed to map segment %u", i))
+			diva_os_free (0, pI);
+			return (-1);
+		}
+	}
+
+	/*
+		Tx counter is located at end of first tx segment, rx counter
+		at begin of first rx segment
+		*/
+	pI->tx.segment_length[0] -= sizeof(dword);
+	pI->tx_counter = (volatile int32*)(pI->tx.segments[0] + pI->tx.segment_length[0]);
+	pI->rx_counter = (volatile int32*)pI->rx.segments[0];
+	pI->rx.segments[0]       += sizeof(dword);
+	pI->rx.segment_length[0] -= sizeof(dword);
+
+	for (i = 0; i < nr_segments; i++) {
+		pI->tx.length += pI->tx.segment_length[i];
+		pI->rx.length += pI->rx.segment_length[i];
+	}
+
+	init[0] = DIVA_STREAMING_LOOPBACK_VERSION;
+	WRITE_DWORD(&init[1], 0); /* counter, not used */
+	WRITE_DWORD(&init[5], DIVA_STREAMING_MANAGER_TX_COUNTER_IN_TX_PAGE);
+	rx_message (pI, 0xff, DIVA_STREAMING_IDI_TX_INIT_MSG, init, sizeof(init));
+	pI->rx_counter[0] = pI->rx_written;
+
+	*loopback = pI;
+
+	return (0);
+}
+
+void diva_streaming_loopback_destroy (struct _diva_streaming_loopback* pI) {
+	if (pI != 0) {
+		diva_os_free (0, pI);
+	}
+}
+
+int diva_streaming_loopback_process (struct _diva_streaming_loopback* pI) {
+	int32 available;
+	int count = 0;
+
+	if (pI->released != 0)
+		return (-1);
+
+	available = pI->tx_counter[0] - pI->tx_consumed;
+
+	while (available > 0 && pI->released == 0) {
+		byte tmp[2*sizeof(dword)];
+		dword message_length, info, required_length, data_length;
+
+		ring_read (&pI->tx, tmp, 2*sizeof(dword));
+		message_length  = READ_DWORD(&tmp[0]); /* without length dword */
+		info            = READ_DWORD(&tmp[4]);
+		required_length = (message_length + sizeof(dword) + 31) & ~31;
+		data_length     = message_length - sizeof(dword);
+
+		if (message_length < sizeof(dword) || required_length > (dword)available) {
+			DBG_ERR(("loopback: wrong message length %u available %d", message_length, available))
+			pI->released = 1;
+			return (-1);
+		}
+
+		if ((info & DIVA_STREAMING_IDI_SYSTEM_MESSAGE) != 0) {
+			switch ((byte)info) {
+				case DIVA_STREAMING_IDI_RX_ACK_MSG:
+					rx_ack (pI, (info >> 8) & 0xffff);
+					break;
+
+				case DIVA_STREAMING_IDI_SYNC_REQ:
+					if (data_length >= sizeof(dword)) {
+						ring_read (&pI->tx, tmp, sizeof(dword));
+						data_length -= sizeof(dword);
+						rx_message (pI, 0xff, DIVA_STREAMING_IDI_TX_SYNC_ACK, tmp, sizeof(dword));
+					}
+					break;
+
+				case DIVA_STREAMING_IDI_RELEASE:
+					tmp[0] = 0;
+					tmp[1] = 0;
+					rx_message (pI, 0xff, DIVA_STREAMING_IDI_RELEASE_ACK, tmp, 2);
+					pI->released = 1;
+					break;
+
+				default:
+					break;
+			}
+		} else if ((byte)info == DIVA_STREAMING_IDI_TX_REQUEST && data_length >= sizeof(diva_spi_msg_hdr_t)+1) {
+			diva_spi_msg_hdr_t* hdr = (diva_spi_msg_hdr_t*)tmp;
+			dword to_copy;
+
+			rx_ack (pI, (info >> 8) & 0xffff);
+
+			ring_read (&pI->tx, tmp, sizeof(diva_spi_msg_hdr_t)+1); /* IDI header */
+			data_length -= sizeof(diva_spi_msg_hdr_t)+1;
+			to_copy = MIN(data_length, sizeof(pI->data));
+			ring_read (&pI->tx, pI->data, to_copy);
+			data_length -= to_copy;
+
+			pI->stat.tx_data++;
+			if ((hdr->Ind & 0x0f) == 8 /* N_DATA */) {
+				if (rx_message (pI, 0, hdr->Ind, pI->data, to_copy) == 0) {
+					pI->stat.rx_data++;
+				} else {
+					pI->stat.rx_dropped++;
+				}
+			}
+		}
+
+		ring_read (&pI->tx, 0, data_length);
+		ring_read (&pI->tx, 0, required_length - message_length - sizeof(dword));
+
+		pI->tx_consumed += required_length;
+		pI->tx_ack      += required_length;
+		available       -= required_length;
+		pI->stat.tx_messages++;
+		count++;
+	}
+
+	tx_acknowledge (pI);
+
+	pI->rx_counter[0] = pI->rx_written;
+
+	return (count);
+}
+
+void diva_streaming_loopback_get_stat (const struct _diva_streaming_loopback* pI, diva_streaming_loopback_stat_t* stat) {
+	*stat = pI->stat;
+}
+
+static void ring_advance (diva_streaming_loopback_ring_t* ring, dword length) {
+	ring->position += length;
+	if (ring->position >= ring->segment_length[ring->segment]) {
+		ring->segment++;
+		if (ring->segment >= ring->nr_segments) {
+			ring->segment = 0;
+		}
+		ring->position = 0;
+	}
+}
+
+static void ring_read (diva_streaming_loopback_ring_t* ring, byte* dst, dword length) {
+	while (length != 0) {
+		dword to_copy = MIN(ring->segment_length[ring->segment] - ring->position, length);
+
+		if (dst != 0) {
+			memcpy (dst, ring->segments[ring->segment] + ring->position, to_copy);
+			dst += to_copy;
+		}
+		length -= to_copy;
+		ring_advance (ring, to_copy);
+	}
+}
+
+static void ring_write (diva_streaming_loopback_ring_t* ring, const byte* src, dword length) {
+	while (length != 0) {
+		dword to_copy = MIN(ring->segment_length[ring->segment] - ring->position, length);
+
+		if (src != 0) {
+			memcpy (ring->segments[ring->segment] + ring->position, src, to_copy);
+			src += to_copy;
+		} else {
+			memset (ring->segments[ring->segment] + ring->position, 0x00, to_copy);
+		}
+		length -= to_copy;
+		ring_advance (ring, to_copy);
+	}
+}
+
+/*
+	Write message to host rx ring, the header is located in one segment
+	because messages and segments are aligned to dword
+	*/
+static int rx_message (diva_streaming_loopback_t* pI, byte Id, byte Ind, const byte* data, dword data_length) {
+	dword length = data_length + sizeof(dword) + sizeof(word);
+	dword message_length = (length + sizeof(dword) - 1) & ~(sizeof(dword) - 1);
+	byte hdr[sizeof(dword)+sizeof(word)];
+
+	if (message_length > pI->rx.length - pI->rx_in_use)
+		return (-1);
+
+	hdr[0] = (byte)length;
+	hdr[1] = (byte)(length >> 8);
+	hdr[2] = Id;
+	hdr[3] = Ind;
+	hdr[4] = 0;
+	hdr[5] = 0;
+
+	ring_write (&pI->rx, hdr, sizeof(hdr));
+	ring_write (&pI->rx, data, data_length);
+	ring_write (&pI->rx, 0, message_length - length);
+
+	pI->rx_written += message_length;
+	pI->rx_in_use  += message_length;
+	pI->stat.rx_messages++;
+
+	return (0);
+}
+
+static void rx_ack (diva_streaming_loopback_t* pI, dword length) {
+	pI->rx_in_use -= MIN(length, pI->rx_in_use);
+}
+
+/*
+	Acknowledge consumed tx data, the acknowledge is limited to one word
+	per message. Not sent acknowledges are sent by next call.
+	*/
+static void tx_acknowledge (diva_streaming_loopback_t* pI) {
+	while (pI->tx_ack != 0) {
+		dword ack = MIN(pI->tx_ack, 0xffff);
+		byte data[3];
+
+		data[0] = (byte)ack;
+		data[1] = (byte)(ack >> 8);
+		data[2] = pI->tx_ack_sequence;
+
+		if (rx_message (pI, 0xff, DIVA_STREAMING_IDI_TX_ACK_MSG, data, sizeof(data)) != 0)
+			break;
+
+		pI->tx_ack_sequence++;
+		pI->tx_ack -= ack;
+	}
+}
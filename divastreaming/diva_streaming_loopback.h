@@ -0,0 +1,56 @@
+/*
+ *
+  Software loopback emulation of the remote side of a Diva stream
+
+ *
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+ *
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY OF ANY KIND WHATSOEVER INCLUDING ANY
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  See the GNU General Public License for more details.
+ *
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+#ifndef __DIVA_STREAMING_LOOPBACK_H__
+#define __DIVA_STREAMING_LOOPBACK_H__
+
+struct _diva_segment_alloc;
+struct _diva_streaming_loopback;
+
+/*
+	Statistics of the emulated remote side
+	*/
+typedef struct _diva_streaming_loopback_stat {
+	dword tx_messages; /**< messages consumed from host tx ring */
+	dword tx_data;     /**< data requests consumed */
+	dword rx_messages; /**< messages written to host rx ring */
+	dword rx_data;     /**< data indications looped back */
+	dword rx_dropped;  /**< data indications dropped, host rx ring full */
+} diva_streaming_loopback_stat_t;
+
+/*
+	Attach to the stream described by 'description' (as returned by the
+	description function of the stream). Segments are located using
+	map_address of the segment alloc, normally a memory segment alloc.
+	*/
+int diva_streaming_loopback_create (struct _diva_streaming_loopback** loopback,
+																		struct _diva_segment_alloc* segment_alloc,
+																		const byte* description);
+void diva_streaming_loopback_destroy (struct _diva_streaming_loopback* loopback);
+
+/*
+	Consume messages written by host, loop back data requests as data
+	indications and acknowledge consumed data.
+	Returns amount of processed messages or -1 if the stream was released.
+	*/
+int diva_streaming_loopback_process (struct _diva_streaming_loopback* loopback);
+void diva_streaming_loopback_get_stat (const struct _diva_streaming_loopback* loopback, diva_streaming_loopback_stat_t* stat);
+
+#endif
@@ -56,7 +56,9 @@ static int message_input_proc (void* user_context, dword message, dword length,
 static diva_streaming_idi_result_t diva_stream_manager_release (struct _diva_stream* ifc);
 static diva_streaming_idi_result_t diva_stream_manager_release_stream (struct _diva_stream* ifc);
 static diva_streaming_idi_result_t diva_stream_manager_write (struct _diva_stream* ifc, dword message, const void* data, dword length);
+static diva_streaming_idi_result_t diva_stream_manager_write_vector (struct _diva_stream* ifc, dword message, const diva_streaming_vector_t* v, dword nr_v);
 static diva_streaming_idi_result_t diva_stream_manager_wakeup (struct _diva_stream* ifc);
+static int diva_stream_manager_rx_pending (const struct _diva_stream* ifc);
 static const byte* diva_stream_manager_description (struct _diva_stream* ifc, const byte* addie, byte addielen);
 static diva_streaming_idi_result_t diva_stream_manager_sync_req (struct _diva_stream* ifc, dword ident);
 static diva_streaming_idi_result_t diva_stream_flush (struct _diva_stream* ifc);
@@ -119,7 +121,9 @@ diva_streaming_idi_result_t diva_stream_create_with_user_segment_alloc (struct _
 					pI->ifc.release     = diva_stream_manager_release;
 					pI->ifc.release_stream     = diva_stream_manager_release_stream;
 					pI->ifc.write       = diva_stream_manager_write;
+					pI->ifc.write_vector = diva_stream_manager_write_vector;
 					pI->ifc.wakeup      = diva_stream_manager_wakeup;
+					pI->ifc.rx_pending  = diva_stream_manager_rx_pending;
 					pI->ifc.description = diva_stream_manager_description;
 					pI->ifc.sync        = diva_stream_manager_sync_req;
 					pI->ifc.flush_stream = diva_stream_flush;
@@ -187,12 +191,24 @@ static diva_streaming_idi_result_t diva_stream_manager_write (struct _diva_strea
 	return (pI->tx_ifc->write_message (pI->tx, message, data, length));
 }
 
+static diva_streaming_idi_result_t diva_stream_manager_write_vector (struct _diva_stream* ifc, dword message, const diva_streaming_vector_t* v, dword nr_v) {
+	diva_stream_manager_t* pI = DIVAS_CONTAINING_RECORD(ifc, diva_stream_manager_t, ifc);
+
+	return (pI->tx_ifc->write_message_vector (pI->tx, message, v, nr_v));
+}
+
 static diva_streaming_idi_result_t diva_stream_manager_wakeup (struct _diva_stream* ifc) {
 	diva_stream_manager_t* pI = DIVAS_CONTAINING_RECORD(ifc, diva_stream_manager_t, ifc);
 
 	return (pI->rx_ifc->wakeup (pI->rx));
 }
 
+static int diva_stream_manager_rx_pending (const struct _diva_stream* ifc) {
+	const diva_stream_manager_t* pI = DIVAS_CONTAINING_RECORD(ifc, const diva_stream_manager_t, ifc);
+
+	return (pI->rx_ifc->pending (pI->rx));
+}
+
 const byte* diva_stream_manager_description (struct _diva_stream* ifc, const byte* addie, byte addielen) {
 	diva_stream_manager_t* pI = DIVAS_CONTAINING_RECORD(ifc, diva_stream_manager_t, ifc);
 	byte length = 4, len_tx, len_rx;
@@ -32,7 +32,9 @@ typedef struct _diva_stream {
 	diva_streaming_idi_result_t (*release)(struct _diva_stream* ifc); /**< destroy stream */
 	diva_streaming_idi_result_t (*release_stream)(struct _diva_stream* ifc); /**< destroy stream */
 	diva_streaming_idi_result_t (*write)(struct _diva_stream* ifc, dword message, const void* data, dword length); /**< write data to stream */
+	diva_streaming_idi_result_t (*write_vector)(struct _diva_stream* ifc, dword message, const struct _diva_streaming_vector* v, dword nr_v); /**< write data gathered from vector to stream */
 	diva_streaming_idi_result_t (*wakeup)(struct _diva_stream* ifc);
+	int (*rx_pending)(const struct _diva_stream* ifc); /**< wakeup has messages to process */
 	const byte* (*description)(struct _diva_stream* ifc, const byte* addie, byte addielength);
 	diva_streaming_idi_result_t (*sync)(struct _diva_stream* ifc, dword ident);
 	diva_streaming_idi_result_t (*flush_stream)(struct _diva_stream* ifc);
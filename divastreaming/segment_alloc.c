@@ -43,6 +43,7 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <stdlib.h>
 #endif
 
 typedef struct _diva_map_entry {
@@ -69,6 +70,7 @@ typedef struct _diva_segment_alloc {
 #if !defined(DIVA_USERMODE)
 	IDI_SYNC_REQ syncReq;
 #endif
+	dword memory_lo; /* last address assigned by memory segment alloc */
 } diva_segment_alloc_t;
 
 /*
@@ -103,6 +105,28 @@ static diva_segment_alloc_access_t ifc_ref = {
 	resource_removed
 };
 
+/*
+	Memory segment alloc, segments are plain host memory and
+	addresses are assigned by the allocator. Used by the loopback
+	emulation of the remote side, not shared.
+	*/
+static void  memory_release_proc(struct _diva_segment_alloc**);
+static void* memory_segment_alloc_proc(struct _diva_segment_alloc*, dword* lo, dword* hi);
+static void* memory_map_address (struct _diva_segment_alloc* ifc, dword lo, dword hi, int map_host);
+static void* memory_umap_address (struct _diva_segment_alloc* ifc, dword lo, dword hi, void* local);
+static int   memory_write_address (struct _diva_segment_alloc* ifc, dword lo, dword hi, dword data);
+
+static diva_segment_alloc_access_t memory_ifc_ref = {
+	memory_release_proc,
+	memory_segment_alloc_proc,
+	segment_free_proc,
+	get_segment_length_proc,
+	memory_map_address,
+	memory_umap_address,
+	memory_write_address,
+	resource_removed
+};
+
 #if defined(DIVA_SHARED_SEGMENT_ALLOC)
 static struct _diva_segment_alloc* shared_segment_alloc;
 static int shared_segment_alloc_count;
@@ -437,4 +461,114 @@ diva_segment_alloc_access_t* diva_get_segment_alloc_ifc (struct _diva_segment_al
 	return ((segment_alloc != 0) ? &segment_alloc->ifc : 0);
 }
 
+int diva_create_memory_segment_alloc (struct _diva_segment_alloc** segment_alloc)
+{
+	diva_segment_alloc_t* pI = diva_os_malloc(0, sizeof(*pI));
+
+	if (pI == 0)
+		return (-1);
+
+	memset (pI, 0x00, sizeof(*pI));
+
+	pI->ifc = memory_ifc_ref;
+#if defined(DIVA_USERMODE) && defined(LINUX)
+	pI->fd     = -1;
+	pI->fd_mem = -1;
+	pI->fd_xdi = -1;
+#endif
+
+	diva_q_init (&pI->free_q);
+	diva_q_init (&pI->busy_q);
+
+	*segment_alloc = pI;
+
+	DBG_TRC(("created memory segment alloc [%p]", pI))
+
+	return (0);
+}
 
+static void memory_release_proc(struct _diva_segment_alloc** segment_alloc) {
+	diva_segment_alloc_t* pI = (segment_alloc != 0) ? *segment_alloc : 0;
+	diva_entity_link_t* link;
+
+	if (pI == 0)
+		return;
+
+	DBG_TRC(("destroy memory segment alloc [%p]", pI))
+
+	while ((link = diva_q_get_head (&pI->busy_q)) != 0) {
+		diva_q_remove (&pI->busy_q, link);
+		diva_q_add_tail (&pI->free_q, link);
+	}
+
+	while ((link = diva_q_get_head (&pI->free_q)) != 0) {
+		diva_map_entry_t* pE = DIVAS_CONTAINING_RECORD(link, diva_map_entry_t, link);
+
+		diva_q_remove (&pI->free_q, link);
+		free (pE->mem);
+		diva_os_free (0, pE);
+	}
+
+	diva_os_free (0, pI);
+
+	*segment_alloc = 0;
+}
+
+static void* memory_segment_alloc_proc(struct _diva_segment_alloc* pI, dword* lo, dword* hi) {
+	diva_entity_link_t* link = diva_q_get_head(&pI->free_q);
+	diva_map_entry_t* pE;
+
+	if (link != 0) {
+		pE = DIVAS_CONTAINING_RECORD(link, diva_map_entry_t, link);
+		diva_q_remove (&pI->free_q, link);
+	} else {
+		pE = diva_os_malloc (0, sizeof(*pE));
+		if (pE == 0)
+			return (0);
+		memset (pE, 0x00, sizeof(*pE));
+		if (posix_memalign (&pE->mem, 4*1024, 4*1024) != 0) {
+			diva_os_free (0, pE);
+			return (0);
+		}
+		pI->memory_lo += 4*1024;
+		pE->dma_lo = pI->memory_lo;
+		pE->dma_hi = 0;
+	}
+
+	memset (pE->mem, 0x00, 4*1024);
+	diva_q_add_tail (&pI->busy_q, &pE->link);
+
+	*lo = pE->dma_lo;
+	*hi = pE->dma_hi;
+
+	return (pE->mem);
+}
+
+static void* memory_map_address (struct _diva_segment_alloc* pI, dword lo, dword hi, int map_host) {
+	diva_entity_link_t* link;
+
+	for (link = diva_q_get_head(&pI->busy_q); link != 0; link = diva_q_get_next(link)) {
+		diva_map_entry_t* pE = DIVAS_CONTAINING_RECORD(link, diva_map_entry_t, link);
+
+		if (pE->dma_lo == (lo & ~(4*1024-1)) && pE->dma_hi == hi) {
+			return ((byte*)pE->mem + (lo & (4*1024-1)));
+		}
+	}
+
+	return (0);
+}
+
+static void* memory_umap_address (struct _diva_segment_alloc* ifc, dword lo, dword hi, void* local) {
+	return (0);
+}
+
+static int memory_write_address (struct _diva_segment_alloc* ifc, dword lo, dword hi, dword data) {
+	volatile dword* p = memory_map_address (ifc, lo, hi, 1);
+
+	if (p == 0)
+		return (-1);
+
+	*p = data;
+
+	return (0);
+}
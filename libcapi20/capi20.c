@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <assert.h>
+#include <sys/mman.h>
 #define _LINUX_LIST_H
 #include <linux/capi.h>
  
@@ -48,6 +49,15 @@
 
 #define SEND_BUFSIZ		(128+2048)
 
+/* receive buffer arena */
+#define RECV_CACHELINE		64
+#define RECV_HUGEPAGE_SIZE	(2*1024*1024)
+#define RECV_OVERFLOW_BUFSIZ	4096
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS		MAP_ANON
+#endif
+
 static char capidevname[] = "/dev/capi20";
 static char capidevnamenew[] = "/dev/isdn/capi20";
 
@@ -61,6 +71,7 @@ static unsigned short int port;
 static char hostname[1024];
 static int tracelevel;
 static char *tracefile;
+static unsigned recv_arena_flags;
 
 /* REMOTE-CAPI commands */
  
@@ -419,8 +430,82 @@ struct applinfo {
 	struct recvbuffer *firstfree;
 	struct recvbuffer *lastfree;
 	unsigned char *bufferstart;
+	size_t    arenasize;      /* 0 if allocated by malloc */
+	unsigned char *overflowbuf; /* signalling messages bigger than recvbuffersize */
 };
 
+static inline size_t align_size(size_t size, size_t align)
+{
+	return ((size + align - 1) / align) * align;
+}
+
+static void init_buffers(struct applinfo *ap, unsigned nbufs, size_t recvbuffersize)
+{
+	unsigned i;
+
+	ap->maxbufs = nbufs;
+	ap->recvbuffersize = recvbuffersize;
+	ap->firstfree = ap->buffers;
+	for (i = 0; i < ap->maxbufs; i++) {
+		ap->buffers[i].next = &ap->buffers[i+1];
+		ap->buffers[i].used = 0;
+		ap->buffers[i].ncci = 0;
+		ap->buffers[i].buf = ap->bufferstart+(recvbuffersize*i);
+	}
+	ap->lastfree = &ap->buffers[ap->maxbufs-1];
+	ap->lastfree->next = 0;
+}
+
+/*
+ * Place descriptors and data buffers in one cache line aligned,
+ * optionally huge page backed, region. Data buffers are sized to
+ * MaxSizeB3; signalling messages which do not fit are received
+ * into the overflow buffer (the kernel keeps the message queued
+ * on EMSGSIZE).
+ */
+static struct applinfo *alloc_buffers_arena(
+	unsigned nbufs,
+	unsigned MaxSizeB3)
+{
+	struct applinfo *ap;
+	size_t recvbuffersize = align_size(128 + MaxSizeB3, RECV_CACHELINE);
+	size_t descsize = align_size(sizeof(struct applinfo) +
+		sizeof(struct recvbuffer) * nbufs, RECV_CACHELINE);
+	size_t size = descsize + recvbuffersize * nbufs + RECV_OVERFLOW_BUFSIZ;
+	void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	if (recv_arena_flags & CAPI20EXT_RECV_ARENA_HUGEPAGES) {
+		size_t hugesize = align_size(size, RECV_HUGEPAGE_SIZE);
+		p = mmap(0, hugesize, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+			size = hugesize;
+	}
+#endif
+	if (p == MAP_FAILED) {
+		size = align_size(size, getpagesize());
+		p = mmap(0, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return 0;
+#ifdef MADV_HUGEPAGE
+		if (recv_arena_flags & CAPI20EXT_RECV_ARENA_HUGEPAGES)
+			(void)madvise(p, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	/* anonymous mappings are zero filled */
+	ap = (struct applinfo *)p;
+	ap->arenasize = size;
+	ap->buffers = (struct recvbuffer *)(ap+1);
+	ap->bufferstart = (unsigned char *)p + descsize;
+	ap->overflowbuf = ap->bufferstart + recvbuffersize * nbufs;
+	init_buffers(ap, nbufs, recvbuffersize);
+
+	return ap;
+}
+
 static struct applinfo *alloc_buffers(
 	unsigned MaxB3Connection,
 	unsigned MaxB3Blks,
@@ -429,9 +514,13 @@ static struct applinfo *alloc_buffers(
 	struct applinfo *ap;
 	unsigned nbufs = 2 + MaxB3Connection * (MaxB3Blks + 1);
 	size_t recvbuffersize = 128 + MaxSizeB3;
-	unsigned i;
 	size_t size;
 
+	if ((recv_arena_flags & CAPI20EXT_RECV_ARENA) && (!remote_capi)) {
+		if ((ap = alloc_buffers_arena(nbufs, MaxSizeB3)) != 0)
+			return ap;
+	}
+
 	if (recvbuffersize < 2048)
 		recvbuffersize = 2048;
 
@@ -444,25 +533,18 @@ static struct applinfo *alloc_buffers(
 		return 0;
 
 	memset(ap, 0, size);
-	ap->maxbufs = nbufs;
-	ap->recvbuffersize = recvbuffersize;
 	ap->buffers = (struct recvbuffer *)(ap+1);
-	ap->firstfree = ap->buffers;
 	ap->bufferstart = (unsigned char *)(ap->buffers+nbufs);
-	for (i = 0; i < ap->maxbufs; i++) {
-		ap->buffers[i].next = &ap->buffers[i+1];
-		ap->buffers[i].used = 0;
-		ap->buffers[i].ncci = 0;
-		ap->buffers[i].buf = ap->bufferstart+(recvbuffersize*i);
-	}
-	ap->lastfree = &ap->buffers[ap->maxbufs-1];
-	ap->lastfree->next = 0;
+	init_buffers(ap, nbufs, recvbuffersize);
 	return ap;
 }
 
 static void free_buffers(struct applinfo *ap)
 {
-	free(ap);
+	if (ap && ap->arenasize)
+		munmap(ap, ap->arenasize);
+	else
+		free(ap);
 }
 
 static struct applinfo *applinfo[MAX_APPL];
@@ -877,6 +959,26 @@ capi20_get_message (unsigned ApplID, unsigned char **Buf)
 
 	return_buffer(ApplID, offset);
 
+	if ((rc < 0) && (errno == EMSGSIZE) && (applinfo[ApplID]->overflowbuf)) {
+		/* signalling message bigger than the arena data buffers */
+		*Buf = rcvbuf = applinfo[ApplID]->overflowbuf;
+		rc = read(fd, rcvbuf, RECV_OVERFLOW_BUFSIZ);
+		if ((rc > 0) && (!((CAPIMSG_COMMAND(rcvbuf) == CAPI_DATA_B3) &&
+		    (CAPIMSG_SUBCOMMAND(rcvbuf) == CAPI_IND)))) {
+			write_capi_trace(0, rcvbuf, rc, 0);
+			CAPIMSG_SETAPPID(rcvbuf, ApplID);
+			if ((CAPIMSG_COMMAND(rcvbuf) == CAPI_DISCONNECT) &&
+			    (CAPIMSG_SUBCOMMAND(rcvbuf) == CAPI_IND)) {
+				cleanup_buffers_for_plci(ApplID, CAPIMSG_U32(rcvbuf, 8));
+			}
+			return CapiNoError;
+		}
+		if (rc > 0) {
+			errno = EMSGSIZE;
+			rc = -1;
+		}
+	}
+
 	if (rc == 0)
 		return CapiReceiveQueueEmpty;
 
@@ -1133,6 +1235,12 @@ int capi20ext_ncci_opencount(unsigned applid, unsigned ncci)
 	return ioctl(applid2fd(applid), CAPI_NCCI_OPENCOUNT, &ncci);
 }
 
+int capi20ext_set_recv_arena(unsigned flags)
+{
+	recv_arena_flags = flags;
+	return 0;
+}
+
 static void initlib(void) __attribute__((constructor));
 static void exitlib(void) __attribute__((destructor));
 
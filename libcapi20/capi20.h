@@ -65,6 +65,18 @@ char *capi20ext_get_raw_devname(
 
 int capi20ext_ncci_opencount(unsigned applid, unsigned ncci);
 
+/*
+ * Receive buffer allocation for applications registered after this call.
+ * CAPI20EXT_RECV_ARENA places the receive buffers in one cache line
+ * aligned mapping sized to MaxBDataLen, CAPI20EXT_RECV_ARENA_HUGEPAGES
+ * additionally tries to back it with huge pages.
+ */
+#define CAPI20EXT_HAS_RECV_ARENA       1
+#define CAPI20EXT_RECV_ARENA           0x01
+#define CAPI20EXT_RECV_ARENA_HUGEPAGES 0x02
+
+int capi20ext_set_recv_arena(unsigned flags);
+
 /* end extentions functions (no standard functions) */
 
 #ifdef __cplusplus